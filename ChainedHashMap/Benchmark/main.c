@@ -0,0 +1,152 @@
+//
+//  main.c
+//  Benchmark
+//
+//  Created by Thomas Mailund on 19/10/2026.
+//  Copyright © 2026 Thomas Mailund. All rights reserved.
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "hash_map.h"
+#include "hash_join.h"
+
+static double now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static uint64_t next_random(uint64_t *state)
+{
+    uint64_t z = (*state += 0x9e3779b97f4a7c15);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111eb;
+    return z ^ (z >> 31);
+}
+
+static uint32_t hash(void *key)
+{
+    uint64_t x = *(uint64_t *)key;
+    x ^= x >> 33; x *= 0xff51afd7ed558ccd;
+    x ^= x >> 33; x *= 0xc4ceb9fe1a85ec53;
+    return (uint32_t)(x ^ (x >> 33));
+}
+
+static bool cmp(void *a, void *b)
+{
+    return *(uint64_t *)a == *(uint64_t *)b;
+}
+
+static void nop(void *x)
+{
+}
+
+// TPC-H style tables. ORDERS has 1.5M rows per scale factor, and its
+// keys are sparse: 8 out of every 32 numbers. Each order has 1 to 7
+// LINEITEM rows, 4 on average.
+struct tables {
+    struct join_tuple *orders;
+    size_t no_orders;
+    struct join_tuple *lineitem;
+    size_t no_lineitem;
+    struct join_tuple *late;     // lineitems received after the commit date
+    size_t no_late;
+};
+
+static void generate(struct tables *tables, double scale_factor)
+{
+    uint64_t state = 1;
+    tables->no_orders = (size_t)(1500000 * scale_factor);
+    tables->orders = malloc(tables->no_orders * sizeof(struct join_tuple));
+    tables->lineitem = malloc(7 * tables->no_orders * sizeof(struct join_tuple));
+    tables->late = malloc(7 * tables->no_orders * sizeof(struct join_tuple));
+    tables->no_lineitem = tables->no_late = 0;
+    for (size_t i = 0; i < tables->no_orders; ++i) {
+        uint64_t orderkey = (i / 8) * 32 + (i % 8) + 1;
+        tables->orders[i].key = orderkey;
+        tables->orders[i].payload = i;
+        int no_items = 1 + next_random(&state) % 7;
+        for (int j = 0; j < no_items; ++j) {
+            struct join_tuple item = { orderkey, tables->no_lineitem };
+            tables->lineitem[tables->no_lineitem++] = item;
+            if (next_random(&state) % 2)
+                tables->late[tables->no_late++] = item;
+        }
+    }
+    // Shuffle LINEITEM so the probes do not follow the orders
+    for (size_t i = tables->no_lineitem - 1; i > 0; --i) {
+        size_t j = next_random(&state) % (i + 1);
+        struct join_tuple tmp = tables->lineitem[i];
+        tables->lineitem[i] = tables->lineitem[j];
+        tables->lineitem[j] = tmp;
+    }
+}
+
+// What we did before: one chained map over all of ORDERS, probed with
+// every LINEITEM row.
+static size_t unpartitioned_join(struct tables *tables)
+{
+    struct hash_map *table = new_map(1024, hash, cmp, nop, nop);
+    for (size_t i = 0; i < tables->no_orders; ++i) {
+        map(table, &tables->orders[i].key, &tables->orders[i]);
+    }
+    size_t no_matches = 0;
+    for (size_t i = 0; i < tables->no_lineitem; ++i) {
+        if (lookup(table, &tables->lineitem[i].key)) no_matches++;
+    }
+    delete_map(table);
+    return no_matches;
+}
+
+// ORDERS join LINEITEM on the order key, and, as in TPC-H Q4, the
+// ORDERS with at least one late LINEITEM (a semi join with the late
+// items as the build side).
+int main(int argc, const char *argv[])
+{
+    double scale_factor = 1.0;
+    if (argc > 1) scale_factor = atof(argv[1]);
+
+    struct tables tables;
+    generate(&tables, scale_factor);
+    printf("SF %.2f: %zu orders, %zu lineitems, %zu late\n",
+           scale_factor, tables.no_orders, tables.no_lineitem, tables.no_late);
+
+    double begin = now();
+    size_t no_matches = unpartitioned_join(&tables);
+    double elapsed = now() - begin;
+    printf("one chained map:  %7.2f Mtuples/s (%zu matches)\n",
+           (tables.no_orders + tables.no_lineitem) / elapsed * 1e-6, no_matches);
+
+    for (int no_threads = 1; no_threads <= 64; no_threads *= 2) {
+        begin = now();
+        struct join_result *result =
+        hash_join(INNER_JOIN, tables.orders, tables.no_orders,
+                  tables.lineitem, tables.no_lineitem, no_threads);
+        double inner_elapsed = now() - begin;
+        size_t no_inner = result->n;
+        delete_join_result(result);
+
+        begin = now();
+        result = hash_join(SEMI_JOIN, tables.late, tables.no_late,
+                           tables.orders, tables.no_orders, no_threads);
+        double semi_elapsed = now() - begin;
+        size_t no_semi = result->n;
+        delete_join_result(result);
+
+        printf("%2d threads: inner %7.2f Mtuples/s (%zu matches), "
+               "semi %7.2f Mtuples/s (%zu orders)\n",
+               no_threads,
+               (tables.no_orders + tables.no_lineitem) / inner_elapsed * 1e-6,
+               no_inner,
+               (tables.no_late + tables.no_orders) / semi_elapsed * 1e-6,
+               no_semi);
+    }
+
+    free(tables.orders);
+    free(tables.lineitem);
+    free(tables.late);
+    return EXIT_SUCCESS;
+}
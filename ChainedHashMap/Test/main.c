@@ -10,7 +10,13 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <assert.h>
+#include <stdatomic.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
 #include "hash_map.h"
+#include "hash_join.h"
+#include "durable_map.h"
 
 
 struct tag_key {
@@ -53,6 +59,79 @@ static void val_destroy(void *void_key)
     key->val_deleted = true;
 }
 
+static void count_entry(void *key, void *val, void *data)
+{
+    assert(key == val);
+    atomic_fetch_add((_Atomic int *)data, 1);
+}
+
+#define NO_DURABLE_THREADS 4
+#define NO_DURABLE_KEYS 4000
+
+// Key i maps to "i" followed by version copies of "+"
+static uint32_t durable_string(char *buffer, int i, int version)
+{
+    int len = sprintf(buffer, "%d", i);
+    for (int j = 0; j < version; ++j) buffer[len++] = '+';
+    return (uint32_t)len;
+}
+
+struct durable_thread {
+    struct durable_map *map;
+    int thread;
+};
+
+// Each thread writes its share of the keys, then deletes every third
+static void *durable_updater(void *arg)
+{
+    struct durable_thread *data = (struct durable_thread *)arg;
+    char key[32], val[32];
+    for (int i = data->thread; i < NO_DURABLE_KEYS; i += NO_DURABLE_THREADS) {
+        assert(durable_map_key(data->map, key, durable_string(key, i, 0),
+                               val, durable_string(val, i, 1)));
+    }
+    for (int i = data->thread; i < NO_DURABLE_KEYS; i += NO_DURABLE_THREADS) {
+        if (i % 3 == 0)
+            assert(durable_delete_key(data->map, key, durable_string(key, i, 0)));
+    }
+    return 0;
+}
+
+static void check_durable(struct durable_map *map, int version)
+{
+    char key[32], val[32], found_val[32];
+    for (int i = 0; i < NO_DURABLE_KEYS; ++i) {
+        uint32_t key_len = durable_string(key, i, 0);
+        uint32_t val_len;
+        bool found = durable_lookup(map, key, key_len,
+                                    found_val, sizeof(found_val), &val_len);
+        assert(found == (i % 3 != 0));
+        assert(durable_contains_key(map, key, key_len) == found);
+        if (!found) continue;
+        int expected = (i % 5 == 0) ? version : 1;
+        assert(val_len == durable_string(val, i, expected));
+        assert(memcmp(found_val, val, val_len) == 0);
+    }
+}
+
+// Updates the values of every fifth key
+static void update_durable(struct durable_map *map, int version)
+{
+    char key[32], val[32];
+    for (int i = 0; i < NO_DURABLE_KEYS; i += 5) {
+        if (i % 3 == 0) continue;
+        assert(durable_map_key(map, key, durable_string(key, i, 0),
+                               val, durable_string(val, i, version)));
+    }
+}
+
+static bool file_exists(const char *dir, const char *name)
+{
+    char path[256];
+    sprintf(path, "%s/%s", dir, name);
+    return access(path, F_OK) == 0;
+}
+
 int main(int argc, const char *argv[])
 {
     
@@ -128,6 +207,177 @@ int main(int argc, const char *argv[])
     }
     
     delete_map(table);
+    
+    // Building from arrays. Each key appears twice.
+    int no_array = 100000;
+    struct tag_key *array_keys = malloc(2 * no_array * sizeof(struct tag_key));
+    void **array_key_ptrs = malloc(2 * no_array * sizeof(void *));
+    for (enum duplicate_keys duplicates = UNIQUE_KEYS;
+         duplicates <= KEEP_LAST_KEY; ++duplicates) {
+        // With unique keys we only give the table the first half
+        int n = duplicates == UNIQUE_KEYS ? no_array : 2 * no_array;
+        for (int i = 0; i < 2 * no_array; ++i) {
+            init_tag_key(&array_keys[i], i % no_array);
+            array_key_ptrs[i] = &array_keys[i];
+        }
+        table = new_map_from_arrays(n, array_key_ptrs, array_key_ptrs,
+                                    duplicates, 4, id_hash,
+                                    compare_values, key_destroy, val_destroy);
+        assert(table->used == no_array);
+        for (int i = 0; i < no_array; ++i) {
+            int kept = duplicates == KEEP_LAST_KEY ? i + no_array : i;
+            int dropped = duplicates == KEEP_LAST_KEY ? i : i + no_array;
+            assert(lookup(table, &array_keys[i]) == &array_keys[kept]);
+            assert(array_keys[kept].key_deleted == false);
+            assert(array_keys[dropped].key_deleted == (duplicates != UNIQUE_KEYS));
+        }
+        delete_map(table);
+    }
+    free(array_keys);
+    free(array_key_ptrs);
+    
+    // Hash joins. Every build key appears twice, and half the probe
+    // keys are in the build relation. The build relation is large
+    // enough that we partition in two passes.
+    int no_build = 400000, no_probe = 600000;
+    struct join_tuple *build = malloc(no_build * sizeof(struct join_tuple));
+    struct join_tuple *probe = malloc(no_probe * sizeof(struct join_tuple));
+    for (int i = 0; i < no_build; ++i) {
+        build[i].key = i % (no_build / 2);
+        build[i].payload = i;
+    }
+    for (int i = 0; i < no_probe; ++i) {
+        probe[i].key = i % no_build;
+        probe[i].payload = i;
+    }
+    int no_hits = 0;
+    for (int i = 0; i < no_probe; ++i) {
+        if (probe[i].key < no_build / 2) no_hits++;
+    }
+    for (int no_threads = 1; no_threads <= 4; no_threads *= 3) {
+        struct join_result *result =
+        hash_join(INNER_JOIN, build, no_build, probe, no_probe, no_threads);
+        assert(result->n == 2 * no_hits);
+        int *seen = calloc(no_probe, sizeof(int));
+        for (size_t i = 0; i < result->n; ++i) {
+            struct join_match *match = &result->matches[i];
+            assert(build[match->build_payload].key == match->key);
+            assert(probe[match->probe_payload].key == match->key);
+            seen[match->probe_payload]++;
+        }
+        for (int i = 0; i < no_probe; ++i) {
+            assert(seen[i] == (probe[i].key < no_build / 2 ? 2 : 0));
+        }
+        free(seen);
+        delete_join_result(result);
+        
+        result = hash_join(SEMI_JOIN, build, no_build, probe, no_probe, no_threads);
+        assert(result->n == no_hits);
+        for (size_t i = 0; i < result->n; ++i) {
+            assert(result->tuples[i].key < no_build / 2);
+            assert(probe[result->tuples[i].payload].key == result->tuples[i].key);
+        }
+        delete_join_result(result);
+    }
+    // A small join that needs no partitioning
+    struct join_result *result = hash_join(INNER_JOIN, build, 10, probe, 10, 1);
+    assert(result->n == 10);
+    delete_join_result(result);
+    free(build);
+    free(probe);
+    
+    // Iteration
+    int no_iter = 10000;
+    struct tag_key *iter_keys = malloc(no_iter * sizeof(struct tag_key));
+    table = new_map(2, id_hash, compare_values, key_destroy, val_destroy);
+    for (int i = 0; i < no_iter; ++i) {
+        init_tag_key(&iter_keys[i], i);
+        map(table, &iter_keys[i], &iter_keys[i]);
+    }
+    int no_iterated = 0;
+    struct cursor cursor;
+    init_cursor(&cursor);
+    void *key, *val;
+    while (next_entry(table, &cursor, &key, &val)) {
+        assert(key == val);
+        ((struct tag_key *)key)->key_deleted = true;
+        no_iterated++;
+    }
+    assert(no_iterated == no_iter);
+    for (int i = 0; i < no_iter; ++i) {
+        assert(iter_keys[i].key_deleted == true);
+        iter_keys[i].key_deleted = false;
+    }
+    _Atomic int no_visited = 0;
+    for_each(table, count_entry, &no_visited);
+    assert(no_visited == no_iter);
+    for (int no_threads = 1; no_threads <= 8; no_threads *= 2) {
+        no_visited = 0;
+        for_each_parallel(table, count_entry, &no_visited, no_threads);
+        assert(no_visited == no_iter);
+    }
+    delete_map(table);
+    free(iter_keys);
+    
+    // Durable maps. The map must come back the same when we open it
+    // again, after we replay the log, after a checkpoint, and after a
+    // crash left half a record at the end of the log.
+    char dir[] = "/tmp/durable_mapXXXXXX";
+    assert(mkdtemp(dir));
+    struct durable_map *durable = open_durable_map(dir, 0);
+    assert(durable);
+    pthread_t threads[NO_DURABLE_THREADS];
+    struct durable_thread durable_data[NO_DURABLE_THREADS];
+    for (int i = 0; i < NO_DURABLE_THREADS; ++i) {
+        durable_data[i].map = durable;
+        durable_data[i].thread = i;
+        pthread_create(&threads[i], 0, durable_updater, &durable_data[i]);
+    }
+    for (int i = 0; i < NO_DURABLE_THREADS; ++i) {
+        pthread_join(threads[i], 0);
+    }
+    check_durable(durable, 1);
+    close_durable_map(durable);
+    
+    durable = open_durable_map(dir, 0);
+    check_durable(durable, 1);
+    assert(durable_checkpoint(durable));
+    assert(file_exists(dir, "checkpoint"));
+    assert(!file_exists(dir, "log.0"));
+    assert(file_exists(dir, "log.1"));
+    update_durable(durable, 2);
+    close_durable_map(durable);
+    
+    durable = open_durable_map(dir, 0);
+    check_durable(durable, 2);
+    update_durable(durable, 3);
+    close_durable_map(durable);
+    char log_path[256];
+    sprintf(log_path, "%s/log.1", dir);
+    FILE *log_file = fopen(log_path, "ab");
+    fwrite("torn record", 1, 11, log_file);
+    fclose(log_file);
+    
+    // The checkpoint thread takes over from here
+    durable = open_durable_map(dir, 1);
+    check_durable(durable, 3);
+    update_durable(durable, 4);
+    while (file_exists(dir, "log.1"))
+        usleep(1000);
+    check_durable(durable, 4);
+    close_durable_map(durable);
+    durable = open_durable_map(dir, 0);
+    check_durable(durable, 4);
+    close_durable_map(durable);
+    
+    for (int g = 0; g < 8; ++g) {
+        sprintf(log_path, "%s/log.%d", dir, g);
+        unlink(log_path);
+    }
+    sprintf(log_path, "%s/checkpoint", dir);
+    unlink(log_path);
+    rmdir(dir);
+    
     printf("SUCCESS\n");
     
     return EXIT_SUCCESS;
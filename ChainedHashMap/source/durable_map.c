@@ -0,0 +1,589 @@
+//
+//  durable_map.c
+//  ChainedHashMap
+//
+//  Created by Thomas Mailund on 19/10/2026.
+//  Copyright © 2026 Thomas Mailund. All rights reserved.
+//
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "durable_map.h"
+
+#define CHECKPOINT_MAGIC "DURMAP01"
+#define INITIAL_BUFFER_SIZE (1 << 16)
+
+enum record_type {
+    PUT = 1,
+    DELETE = 2
+};
+
+// The header of a record in the log or the checkpoint. The key and
+// value bytes follow it. The checksum covers the rest of the header
+// and the bytes, so we can tell when a record was only partly written.
+struct record {
+    uint32_t checksum;
+    uint32_t type;
+    uint32_t key_len;
+    uint32_t val_len;
+};
+
+struct checkpoint_header {
+    char magic[8];
+    uint64_t generation;
+    uint64_t no_records;
+};
+
+// Keys and values in the table. The bytes follow the struct in the
+// same allocation, except in the keys we search with.
+struct bytes {
+    uint32_t len;
+    const uint8_t *data;
+};
+
+#pragma mark keys and checksums
+
+// The finaliser from MurmurHash3
+static uint64_t mix(uint64_t x)
+{
+    x ^= x >> 33;
+    x *= 0xff51afd7ed558ccd;
+    x ^= x >> 33;
+    x *= 0xc4ceb9fe1a85ec53;
+    x ^= x >> 33;
+    return x;
+}
+
+static uint64_t hash_words(uint64_t h, const void *data, uint32_t len)
+{
+    const uint8_t *bytes = (const uint8_t *)data;
+    uint64_t w;
+    uint32_t i = 0;
+    for (; i + 8 <= len; i += 8) {
+        memcpy(&w, bytes + i, 8);
+        h = mix(h ^ w);
+    }
+    w = 0;
+    if (i < len) memcpy(&w, bytes + i, len - i);
+    return mix(mix(h ^ w) ^ len);
+}
+
+static uint32_t hash_bytes(void *key)
+{
+    struct bytes *bytes = (struct bytes *)key;
+    return (uint32_t)hash_words(0, bytes->data, bytes->len);
+}
+
+static bool bytes_equal(void *a, void *b)
+{
+    struct bytes *x = (struct bytes *)a, *y = (struct bytes *)b;
+    return x->len == y->len && memcmp(x->data, y->data, x->len) == 0;
+}
+
+static struct bytes *new_bytes(const void *data, uint32_t len)
+{
+    struct bytes *bytes = (struct bytes *)malloc(sizeof(struct bytes) + len);
+    uint8_t *copy = (uint8_t *)(bytes + 1);
+    memcpy(copy, data, len);
+    bytes->len = len;
+    bytes->data = copy;
+    return bytes;
+}
+
+static uint32_t checksum(const struct record *record,
+                         const void *key, const void *val)
+{
+    uint64_t h = hash_words(0, &record->type,
+                            sizeof(struct record) - sizeof(record->checksum));
+    h = hash_words(h, key, record->key_len);
+    h = hash_words(h, val, record->val_len);
+    return (uint32_t)h;
+}
+
+#pragma mark files
+
+static char *file_path(struct durable_map *m, const char *name, uint64_t generation)
+{
+    size_t len = strlen(m->dir) + strlen(name) + 32;
+    char *path = (char *)malloc(len);
+    if (generation == UINT64_MAX)
+        snprintf(path, len, "%s/%s", m->dir, name);
+    else
+        snprintf(path, len, "%s/%s.%llu", m->dir, name,
+                 (unsigned long long)generation);
+    return path;
+}
+
+static bool write_all(int fd, const void *data, size_t len)
+{
+    const uint8_t *bytes = (const uint8_t *)data;
+    while (len > 0) {
+        ssize_t written = write(fd, bytes, len);
+        if (written < 0 && errno == EINTR) continue;
+        if (written <= 0) return false;
+        bytes += written;
+        len -= written;
+    }
+    return true;
+}
+
+// New and renamed files are only durable once their directory is synced
+static bool sync_dir(struct durable_map *m)
+{
+    int fd = open(m->dir, O_RDONLY);
+    if (fd < 0) return false;
+    bool ok = fsync(fd) == 0;
+    close(fd);
+    return ok;
+}
+
+// Maps a whole file for reading it front to back. Empty files are
+// fine; we just get no bytes.
+static bool map_file(const char *path, const uint8_t **data, size_t *bytes)
+{
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) return false;
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        close(fd);
+        return false;
+    }
+    *bytes = st.st_size;
+    *data = 0;
+    if (*bytes > 0) {
+        void *mapped = mmap(0, *bytes, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (mapped == MAP_FAILED) {
+            close(fd);
+            return false;
+        }
+        madvise(mapped, *bytes, MADV_SEQUENTIAL);
+        *data = (const uint8_t *)mapped;
+    }
+    close(fd);
+    return true;
+}
+
+#pragma mark recovery
+
+static void apply(struct durable_map *m, uint32_t type,
+                  const void *key, uint32_t key_len,
+                  const void *val, uint32_t val_len)
+{
+    if (type == PUT) {
+        map(m->table, new_bytes(key, key_len), new_bytes(val, val_len));
+    } else {
+        struct bytes probe = { key_len, (const uint8_t *)key };
+        delete_key(m->table, &probe);
+    }
+}
+
+// Applies the records in data until we run out of bytes or records,
+// or meet a record that is not whole. Returns the number of bytes in
+// the records we applied.
+static size_t replay(struct durable_map *m,
+                     const uint8_t *data, size_t bytes, uint64_t *no_records)
+{
+    size_t offset = 0;
+    uint64_t n = 0;
+    while (n < *no_records && bytes - offset >= sizeof(struct record)) {
+        struct record record;
+        memcpy(&record, data + offset, sizeof(record));
+        const uint8_t *key = data + offset + sizeof(record);
+        size_t left = bytes - offset - sizeof(record);
+        if ((record.type != PUT && record.type != DELETE) ||
+            record.key_len > left || record.val_len > left - record.key_len)
+            break;
+        const uint8_t *val = key + record.key_len;
+        if (checksum(&record, key, val) != record.checksum)
+            break;
+        apply(m, record.type, key, record.key_len, val, record.val_len);
+        offset += sizeof(record) + record.key_len + record.val_len;
+        n++;
+    }
+    *no_records = n;
+    return offset;
+}
+
+// Loads the checkpoint, if there is one, and gives us the generation
+// of the first log after it.
+static bool read_checkpoint(struct durable_map *m, uint64_t *generation)
+{
+    char *path = file_path(m, "checkpoint", UINT64_MAX);
+    const uint8_t *data;
+    size_t bytes;
+    bool exists = map_file(path, &data, &bytes);
+    int error = errno;
+    free(path);
+
+    *generation = 0;
+    if (!exists) {
+        m->table = new_map(1024, hash_bytes, bytes_equal, free, free);
+        return error == ENOENT;
+    }
+
+    struct checkpoint_header header;
+    bool ok = bytes >= sizeof(header);
+    if (ok) {
+        memcpy(&header, data, sizeof(header));
+        ok = memcmp(header.magic, CHECKPOINT_MAGIC, sizeof(header.magic)) == 0;
+    }
+    if (ok) {
+        // Make room for all the keys up front
+        uint32_t size = 1024;
+        while (size / 2 < header.no_records && size < (1u << 31)) size *= 2;
+        m->table = new_map(size, hash_bytes, bytes_equal, free, free);
+        uint64_t no_records = header.no_records;
+        size_t used = replay(m, data + sizeof(header), bytes - sizeof(header),
+                             &no_records);
+        // We synced the checkpoint before we gave it its name, so
+        // it must be whole.
+        ok = no_records == header.no_records &&
+             used == bytes - sizeof(header);
+        *generation = header.generation;
+    }
+    if (bytes > 0) munmap((void *)data, bytes);
+    return ok;
+}
+
+// Replays the logs after the checkpoint and opens the last one for
+// appending. A crash can leave a partial record at the end of the
+// last log; we cut it off.
+static bool replay_logs(struct durable_map *m, uint64_t generation)
+{
+    // Logs the checkpoint covers, if we crashed before removing them
+    for (uint64_t g = generation; g-- > 0; ) {
+        char *path = file_path(m, "log", g);
+        bool removed = unlink(path) == 0;
+        free(path);
+        if (!removed) break;
+    }
+
+    size_t valid = 0;
+    bool found = false;
+    for (uint64_t g = generation; ; ++g) {
+        char *path = file_path(m, "log", g);
+        const uint8_t *data;
+        size_t bytes;
+        bool exists = map_file(path, &data, &bytes);
+        free(path);
+        if (!exists) break;
+        uint64_t no_records = UINT64_MAX;
+        valid = replay(m, data, bytes, &no_records);
+        if (bytes > 0) munmap((void *)data, bytes);
+        generation = g;
+        found = true;
+    }
+
+    char *path = file_path(m, "log", generation);
+    m->log_fd = open(path, O_WRONLY | O_CREAT | O_APPEND, 0600);
+    free(path);
+    m->generation = generation;
+    if (m->log_fd < 0) return false;
+    if (found) return ftruncate(m->log_fd, valid) == 0;
+    return sync_dir(m);
+}
+
+#pragma mark logging
+
+static void append_record(struct durable_map *m, uint32_t type,
+                          const void *key, uint32_t key_len,
+                          const void *val, uint32_t val_len)
+{
+    struct record record = { 0, type, key_len, val_len };
+    record.checksum = checksum(&record, key, val);
+
+    size_t bytes = sizeof(record) + key_len + val_len;
+    if (m->buffer_used + bytes > m->buffer_size) {
+        while (m->buffer_used + bytes > m->buffer_size) m->buffer_size *= 2;
+        m->buffer = (uint8_t *)realloc(m->buffer, m->buffer_size);
+    }
+    uint8_t *out = m->buffer + m->buffer_used;
+    memcpy(out, &record, sizeof(record));
+    memcpy(out + sizeof(record), key, key_len);
+    memcpy(out + sizeof(record) + key_len, val, val_len);
+    m->buffer_used += bytes;
+    m->appended++;
+    m->log_bytes += bytes;
+}
+
+// Waits until the log is on disk up to record number seq. The first
+// thread to get here writes and syncs the buffer for all the records
+// appended so far, while the others wait for it. Records appended in
+// the meantime go to the spare buffer and the next sync. If a later
+// sync fails, records that were already synced are still on disk, so
+// we compare seq with what we synced rather than look at the failure.
+// Called with the lock held.
+static bool commit(struct durable_map *m, uint64_t seq)
+{
+    while (m->synced < seq && !m->failed) {
+        if (m->syncing) {
+            pthread_cond_wait(&m->synced_cond, &m->lock);
+            continue;
+        }
+
+        m->syncing = true;
+        uint8_t *buffer = m->buffer;
+        size_t used = m->buffer_used, size = m->buffer_size;
+        uint64_t upto = m->appended;
+        int fd = m->log_fd;
+        m->buffer = m->spare;
+        m->buffer_size = m->spare_size;
+        m->buffer_used = 0;
+
+        pthread_mutex_unlock(&m->lock);
+        bool ok = write_all(fd, buffer, used) && fsync(fd) == 0;
+        pthread_mutex_lock(&m->lock);
+
+        m->spare = buffer;
+        m->spare_size = size;
+        if (ok) m->synced = upto;
+        else m->failed = true;
+        m->syncing = false;
+        pthread_cond_broadcast(&m->synced_cond);
+    }
+    return m->synced >= seq;
+}
+
+bool durable_map_key(struct durable_map *m,
+                     const void *key, uint32_t key_len,
+                     const void *val, uint32_t val_len)
+{
+    pthread_mutex_lock(&m->lock);
+    if (m->failed) {
+        pthread_mutex_unlock(&m->lock);
+        return false;
+    }
+    // Updating the table in log order keeps it the same as a replay
+    append_record(m, PUT, key, key_len, val, val_len);
+    apply(m, PUT, key, key_len, val, val_len);
+    bool ok = commit(m, m->appended);
+    pthread_mutex_unlock(&m->lock);
+    return ok;
+}
+
+bool durable_delete_key(struct durable_map *m,
+                        const void *key, uint32_t key_len)
+{
+    pthread_mutex_lock(&m->lock);
+    if (m->failed) {
+        pthread_mutex_unlock(&m->lock);
+        return false;
+    }
+    append_record(m, DELETE, key, key_len, "", 0);
+    apply(m, DELETE, key, key_len, "", 0);
+    bool ok = commit(m, m->appended);
+    pthread_mutex_unlock(&m->lock);
+    return ok;
+}
+
+// We copy the value while we hold the lock, since an update in
+// another thread frees the old value.
+bool durable_lookup(struct durable_map *m,
+                    const void *key, uint32_t key_len,
+                    void *val, uint32_t val_size, uint32_t *val_len)
+{
+    struct bytes probe = { key_len, (const uint8_t *)key };
+    pthread_mutex_lock(&m->lock);
+    struct bytes *found = (struct bytes *)lookup(m->table, &probe);
+    if (found) {
+        memcpy(val, found->data, found->len < val_size ? found->len : val_size);
+        if (val_len) *val_len = found->len;
+    }
+    pthread_mutex_unlock(&m->lock);
+    return found != 0;
+}
+
+bool durable_contains_key(struct durable_map *m,
+                          const void *key, uint32_t key_len)
+{
+    struct bytes probe = { key_len, (const uint8_t *)key };
+    pthread_mutex_lock(&m->lock);
+    bool found = lookup(m->table, &probe) != 0;
+    pthread_mutex_unlock(&m->lock);
+    return found;
+}
+
+#pragma mark checkpoints
+
+struct checkpoint_writer {
+    FILE *file;
+    uint64_t no_records;
+    bool ok;
+};
+
+static void write_entry(void *key, void *val, void *data)
+{
+    struct checkpoint_writer *writer = (struct checkpoint_writer *)data;
+    struct bytes *k = (struct bytes *)key, *v = (struct bytes *)val;
+    struct record record = { 0, PUT, k->len, v->len };
+    record.checksum = checksum(&record, k->data, v->data);
+    writer->ok = writer->ok &&
+        fwrite(&record, sizeof(record), 1, writer->file) == 1 &&
+        fwrite(k->data, 1, k->len, writer->file) == k->len &&
+        fwrite(v->data, 1, v->len, writer->file) == v->len;
+    writer->no_records++;
+}
+
+// Writes the table to a new checkpoint file and starts the next log.
+// We hold the lock while we write the table, but we sync the file and
+// remove the old log after we let go of it.
+bool durable_checkpoint(struct durable_map *m)
+{
+    pthread_mutex_lock(&m->checkpoint_lock);
+    pthread_mutex_lock(&m->lock);
+
+    // Everything appended so far must be in the old log, and nobody
+    // may be writing to it, before we switch to the new one.
+    while (!m->failed && (m->syncing || m->synced < m->appended)) {
+        if (m->syncing) pthread_cond_wait(&m->synced_cond, &m->lock);
+        else commit(m, m->appended);
+    }
+
+    char *tmp_path = file_path(m, "checkpoint.tmp", UINT64_MAX);
+    char *log_path = file_path(m, "log", m->generation + 1);
+    struct checkpoint_writer writer = { fopen(tmp_path, "wb"), 0, !m->failed };
+    int log_fd = -1;
+    if (writer.file) {
+        setvbuf(writer.file, 0, _IOFBF, 1 << 20);
+        struct checkpoint_header header;
+        memset(&header, 0, sizeof(header));
+        memcpy(header.magic, CHECKPOINT_MAGIC, sizeof(header.magic));
+        header.generation = m->generation + 1;
+        writer.ok = writer.ok && fwrite(&header, sizeof(header), 1, writer.file) == 1;
+        for_each(m->table, write_entry, &writer);
+        header.no_records = writer.no_records;
+        writer.ok = writer.ok && fseek(writer.file, 0, SEEK_SET) == 0 &&
+                    fwrite(&header, sizeof(header), 1, writer.file) == 1 &&
+                    fflush(writer.file) == 0;
+        if (writer.ok)
+            log_fd = open(log_path, O_WRONLY | O_CREAT | O_TRUNC | O_APPEND, 0600);
+    }
+
+    // New records go to the new log, which must survive a crash once
+    // we have synced a record to it.
+    int old_fd = m->log_fd;
+    uint64_t old_generation = m->generation;
+    bool ok = writer.ok && log_fd >= 0 && sync_dir(m);
+    bool switched = ok;
+    if (ok) {
+        m->log_fd = log_fd;
+        m->generation++;
+        m->log_bytes = 0;
+    } else if (log_fd >= 0) {
+        close(log_fd);
+        unlink(log_path);
+    }
+    pthread_mutex_unlock(&m->lock);
+
+    if (writer.file) {
+        ok = ok && fsync(fileno(writer.file)) == 0;
+        if (fclose(writer.file) != 0) ok = false;
+    }
+    if (ok) {
+        char *path = file_path(m, "checkpoint", UINT64_MAX);
+        ok = rename(tmp_path, path) == 0 && sync_dir(m);
+        free(path);
+    }
+    if (switched) close(old_fd);
+    if (ok) {
+        // The checkpoint covers the old log now
+        char *old_path = file_path(m, "log", old_generation);
+        unlink(old_path);
+        free(old_path);
+    } else {
+        // If we switched logs, the old log stays, and we replay it
+        // before the new one.
+        unlink(tmp_path);
+    }
+
+    free(tmp_path);
+    free(log_path);
+    pthread_mutex_unlock(&m->checkpoint_lock);
+    return ok;
+}
+
+static void *run_checkpointer(void *arg)
+{
+    struct durable_map *m = (struct durable_map *)arg;
+    pthread_mutex_lock(&m->lock);
+    while (!m->stop) {
+        struct timespec deadline;
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        uint64_t ns = deadline.tv_nsec + (uint64_t)m->checkpoint_ms * 1000000;
+        deadline.tv_sec += ns / 1000000000;
+        deadline.tv_nsec = ns % 1000000000;
+        pthread_cond_timedwait(&m->wake_checkpointer, &m->lock, &deadline);
+        if (m->stop || m->log_bytes == 0) continue;
+
+        pthread_mutex_unlock(&m->lock);
+        durable_checkpoint(m);
+        pthread_mutex_lock(&m->lock);
+    }
+    pthread_mutex_unlock(&m->lock);
+    return 0;
+}
+
+#pragma mark opening and closing
+
+static void free_durable_map(struct durable_map *m)
+{
+    if (m->log_fd >= 0) close(m->log_fd);
+    if (m->table) delete_map(m->table);
+    pthread_mutex_destroy(&m->lock);
+    pthread_mutex_destroy(&m->checkpoint_lock);
+    pthread_cond_destroy(&m->synced_cond);
+    pthread_cond_destroy(&m->wake_checkpointer);
+    free(m->buffer);
+    free(m->spare);
+    free(m->dir);
+    free(m);
+}
+
+struct durable_map *open_durable_map(const char *dir, uint32_t checkpoint_ms)
+{
+    if (mkdir(dir, 0700) != 0 && errno != EEXIST)
+        return 0;
+
+    struct durable_map *m = (struct durable_map *)calloc(1, sizeof(struct durable_map));
+    m->dir = strdup(dir);
+    m->log_fd = -1;
+    pthread_mutex_init(&m->lock, 0);
+    pthread_mutex_init(&m->checkpoint_lock, 0);
+    pthread_cond_init(&m->synced_cond, 0);
+    pthread_cond_init(&m->wake_checkpointer, 0);
+    m->buffer_size = m->spare_size = INITIAL_BUFFER_SIZE;
+    m->buffer = (uint8_t *)malloc(m->buffer_size);
+    m->spare = (uint8_t *)malloc(m->spare_size);
+
+    uint64_t generation;
+    if (!read_checkpoint(m, &generation) || !replay_logs(m, generation)) {
+        free_durable_map(m);
+        return 0;
+    }
+
+    m->checkpoint_ms = checkpoint_ms;
+    if (checkpoint_ms > 0) {
+        pthread_create(&m->checkpointer, 0, run_checkpointer, m);
+        m->has_checkpointer = true;
+    }
+    return m;
+}
+
+void close_durable_map(struct durable_map *m)
+{
+    if (m->has_checkpointer) {
+        pthread_mutex_lock(&m->lock);
+        m->stop = true;
+        pthread_cond_signal(&m->wake_checkpointer);
+        pthread_mutex_unlock(&m->lock);
+        pthread_join(m->checkpointer, 0);
+    }
+    free_durable_map(m);
+}
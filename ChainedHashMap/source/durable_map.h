@@ -0,0 +1,91 @@
+//
+//  durable_map.h
+//  ChainedHashMap
+//
+//  Created by Thomas Mailund on 19/10/2026.
+//  Copyright © 2026 Thomas Mailund. All rights reserved.
+//
+
+#ifndef durable_map_h
+#define durable_map_h
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <pthread.h>
+#include "hash_map.h"
+
+// A chained hash map of byte-string keys and values that survives
+// crashes. Every update is applied to the map and appended to a log
+// buffer, and it returns once its log record is on disk. Threads that
+// update at the same time share a single write and fsync of the log
+// (group commit).
+//
+// A background thread checkpoints the map now and then: it writes
+// all the keys and values to a checkpoint file, starts a new log, and
+// removes the old one. When we open the map again, we read the last
+// checkpoint and replay the logs written after it. A record that was
+// only partly written when we crashed is dropped.
+//
+// The files live in their own directory: "checkpoint" and
+// "log.<generation>", where the checkpoint covers all logs with a
+// smaller generation.
+
+struct durable_map {
+    struct hash_map *table;
+    char *dir;
+
+    // Protects the table and everything below
+    pthread_mutex_t lock;
+
+    // The log. Records go to the buffer, and the thread that syncs
+    // the log swaps in the spare buffer while it writes.
+    int log_fd;
+    uint64_t generation;
+    uint8_t *buffer, *spare;
+    size_t buffer_used, buffer_size, spare_size;
+    uint64_t appended, synced; // records
+    bool syncing;
+    bool failed;               // a write to the log failed
+    pthread_cond_t synced_cond;
+    uint64_t log_bytes;        // since the last checkpoint
+
+    // Checkpoints. Only one runs at a time.
+    pthread_mutex_t checkpoint_lock;
+    pthread_t checkpointer;
+    pthread_cond_t wake_checkpointer;
+    uint32_t checkpoint_ms;
+    bool stop;
+    bool has_checkpointer;
+};
+
+// Opens the map in dir, creating the directory if it does not exist.
+// The map checkpoints every checkpoint_ms milliseconds if the log has
+// grown since the last checkpoint; with 0 it only checkpoints when
+// you call durable_checkpoint(). Returns null if we cannot read or
+// create the files.
+struct durable_map *
+open_durable_map    (const char *dir, uint32_t checkpoint_ms);
+// Waits for the checkpoint thread and closes the files. All updates
+// are already on disk, so we do not checkpoint here.
+void  close_durable_map(struct durable_map *map);
+
+// Updates are applied to the map before their records are on disk,
+// so lookups can see updates that are not durable yet. Return false
+// if we could not write the log. The update is then in the map but
+// might not be on disk, and all later updates fail as well.
+bool  durable_map_key   (struct durable_map *map,
+                         const void *key, uint32_t key_len,
+                         const void *val, uint32_t val_len);
+bool  durable_delete_key(struct durable_map *map,
+                         const void *key, uint32_t key_len);
+// Copies up to val_size bytes of the key's value to val and sets
+// val_len to the value's full length, so you can try again with a
+// larger buffer. Returns false if the key is not in the map.
+bool  durable_lookup    (struct durable_map *map,
+                         const void *key, uint32_t key_len,
+                         void *val, uint32_t val_size, uint32_t *val_len);
+bool  durable_contains_key(struct durable_map *map,
+                           const void *key, uint32_t key_len);
+bool  durable_checkpoint(struct durable_map *map);
+
+#endif /* durable_map_h */
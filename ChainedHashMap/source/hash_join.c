@@ -0,0 +1,410 @@
+//
+//  hash_join.c
+//  ChainedHashMap
+//
+//  Created by Thomas Mailund on 19/10/2026.
+//  Copyright © 2026 Thomas Mailund. All rights reserved.
+//
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include "hash_join.h"
+
+// We want a build partition and its table to fit in this.
+#define CACHE_SIZE (256 * 1024)
+// About what a build tuple takes up in a partition's table: the
+// tuple, its link, its share of the buckets and its duplicate index.
+#define BUILD_TUPLE_SIZE 96
+// We write to at most 2^MAX_PASS_BITS partitions at a time, so the
+// places we write to stay in the cache and the TLB.
+#define MAX_PASS_BITS 7
+
+// murmur3's 64-bit finaliser
+static uint64_t mix(uint64_t x)
+{
+    x ^= x >> 33; x *= 0xff51afd7ed558ccd;
+    x ^= x >> 33; x *= 0xc4ceb9fe1a85ec53;
+    return x ^ (x >> 33);
+}
+
+// We partition on the high bits of the hash and the tables use the
+// low bits.
+static uint32_t key_hash(void *key)
+{
+    return (uint32_t)mix(*(uint64_t *)key);
+}
+
+static bool key_cmp(void *a, void *b)
+{
+    return *(uint64_t *)a == *(uint64_t *)b;
+}
+
+static void no_destructor(void *x)
+{
+}
+
+// The next pass_bits bits after the first bits_done bits of the hash.
+static uint32_t radix(uint64_t key, int bits_done, int pass_bits)
+{
+    return (uint32_t)((mix(key) << bits_done) >> (64 - pass_bits));
+}
+
+#pragma mark partitioning
+
+struct relation {
+    const struct join_tuple *input;
+    size_t n;
+    struct join_tuple *buffers[2];
+    int current;                     // the buffer we last wrote to
+    const struct join_tuple *tuples; // the partitioned tuples
+    size_t *bounds;                  // no_partitions + 1
+};
+
+// Output from one thread
+struct output {
+    void *results;
+    size_t n, size;
+} __attribute__((aligned(64)));
+
+struct join {
+    enum join_type type;
+    int no_threads;
+    struct relation relations[2]; // build and probe
+
+    uint32_t no_partitions;       // so far
+    int bits_done, pass_bits;
+    size_t *counts[2];            // first pass, no_threads x fan-out
+    _Atomic uint32_t next_task;
+
+    struct output *outputs;
+};
+
+struct join_thread {
+    struct join *join;
+    int thread;
+};
+
+static void run_join_threads(struct join *join, void *(*f)(void *))
+{
+    pthread_t threads[join->no_threads];
+    struct join_thread args[join->no_threads];
+    atomic_store(&join->next_task, 0);
+    for (int i = 0; i < join->no_threads; ++i) {
+        args[i].join = join;
+        args[i].thread = i;
+        pthread_create(&threads[i], 0, f, &args[i]);
+    }
+    for (int i = 0; i < join->no_threads; ++i) {
+        pthread_join(threads[i], 0);
+    }
+}
+
+static void slice(size_t n, int no_threads, int thread,
+                  size_t *begin, size_t *end)
+{
+    *begin = n / no_threads * thread;
+    *end = (thread == no_threads - 1) ? n : *begin + n / no_threads;
+}
+
+// The first pass splits the inputs between the threads. Each thread
+// counts how many of its tuples go to each partition, and once we know
+// where the partitions start, writes its tuples there.
+static void *count_first_pass(void *arg)
+{
+    struct join_thread *t = (struct join_thread *)arg;
+    struct join *join = t->join;
+    uint32_t fan_out = 1 << join->pass_bits;
+    for (int r = 0; r < 2; ++r) {
+        struct relation *relation = &join->relations[r];
+        size_t *counts = join->counts[r] + t->thread * fan_out;
+        size_t begin, end;
+        slice(relation->n, join->no_threads, t->thread, &begin, &end);
+        for (size_t i = begin; i < end; ++i)
+            counts[radix(relation->input[i].key, 0, join->pass_bits)]++;
+    }
+    return 0;
+}
+
+static void *scatter_first_pass(void *arg)
+{
+    struct join_thread *t = (struct join_thread *)arg;
+    struct join *join = t->join;
+    uint32_t fan_out = 1 << join->pass_bits;
+    for (int r = 0; r < 2; ++r) {
+        struct relation *relation = &join->relations[r];
+        size_t *offsets = join->counts[r] + t->thread * fan_out;
+        struct join_tuple *out = relation->buffers[0];
+        size_t begin, end;
+        slice(relation->n, join->no_threads, t->thread, &begin, &end);
+        for (size_t i = begin; i < end; ++i) {
+            const struct join_tuple *tuple = &relation->input[i];
+            out[offsets[radix(tuple->key, 0, join->pass_bits)]++] = *tuple;
+        }
+    }
+    return 0;
+}
+
+static void first_pass(struct join *join)
+{
+    int no_threads = join->no_threads;
+    uint32_t fan_out = 1 << join->pass_bits;
+    for (int r = 0; r < 2; ++r)
+        join->counts[r] = (size_t *)calloc(no_threads * fan_out, sizeof(size_t));
+
+    run_join_threads(join, count_first_pass);
+
+    // Partition d starts where partitions before it end, and within a
+    // partition the threads write in thread order.
+    for (int r = 0; r < 2; ++r) {
+        struct relation *relation = &join->relations[r];
+        relation->bounds = (size_t *)malloc((fan_out + 1) * sizeof(size_t));
+        size_t offset = 0;
+        for (uint32_t d = 0; d < fan_out; ++d) {
+            relation->bounds[d] = offset;
+            for (int t = 0; t < no_threads; ++t) {
+                size_t count = join->counts[r][t * fan_out + d];
+                join->counts[r][t * fan_out + d] = offset;
+                offset += count;
+            }
+        }
+        relation->bounds[fan_out] = offset;
+    }
+
+    run_join_threads(join, scatter_first_pass);
+
+    for (int r = 0; r < 2; ++r) {
+        struct relation *relation = &join->relations[r];
+        relation->current = 0;
+        relation->tuples = relation->buffers[0];
+        free(join->counts[r]);
+    }
+    join->no_partitions = fan_out;
+}
+
+// Later passes split each partition from the last pass on its own,
+// so the threads take whole partitions at a time.
+static void split_partition(struct join *join, struct relation *relation,
+                            uint32_t q, size_t *new_bounds)
+{
+    uint32_t fan_out = 1 << join->pass_bits;
+    const struct join_tuple *in = relation->buffers[relation->current];
+    struct join_tuple *out = relation->buffers[1 - relation->current];
+    size_t begin = relation->bounds[q], end = relation->bounds[q + 1];
+
+    size_t offsets[fan_out];
+    memset(offsets, 0, sizeof(offsets));
+    for (size_t i = begin; i < end; ++i)
+        offsets[radix(in[i].key, join->bits_done, join->pass_bits)]++;
+    size_t offset = begin;
+    for (uint32_t d = 0; d < fan_out; ++d) {
+        size_t count = offsets[d];
+        new_bounds[q * fan_out + d] = offsets[d] = offset;
+        offset += count;
+    }
+    for (size_t i = begin; i < end; ++i)
+        out[offsets[radix(in[i].key, join->bits_done, join->pass_bits)]++] = in[i];
+}
+
+static void *later_pass(void *arg)
+{
+    struct join_thread *t = (struct join_thread *)arg;
+    struct join *join = t->join;
+    uint32_t no_tasks = 2 * join->no_partitions;
+    uint32_t task;
+    while ((task = atomic_fetch_add(&join->next_task, 1)) < no_tasks) {
+        struct relation *relation = &join->relations[task % 2];
+        split_partition(join, relation, task / 2, join->counts[task % 2]);
+    }
+    return 0;
+}
+
+static void next_pass(struct join *join)
+{
+    uint32_t no_partitions = join->no_partitions << join->pass_bits;
+    for (int r = 0; r < 2; ++r) {
+        join->counts[r] = (size_t *)malloc((no_partitions + 1) * sizeof(size_t));
+        join->counts[r][no_partitions] = join->relations[r].n;
+    }
+
+    run_join_threads(join, later_pass);
+
+    for (int r = 0; r < 2; ++r) {
+        struct relation *relation = &join->relations[r];
+        relation->current = 1 - relation->current;
+        relation->tuples = relation->buffers[relation->current];
+        free(relation->bounds);
+        relation->bounds = join->counts[r];
+    }
+    join->no_partitions = no_partitions;
+}
+
+#pragma mark joining
+
+static void *output_slot(struct output *output, size_t result_size)
+{
+    if (output->n == output->size) {
+        output->size = output->size ? 2 * output->size : 1024;
+        output->results = realloc(output->results, output->size * result_size);
+    }
+    return (char *)output->results + output->n++ * result_size;
+}
+
+static void join_partition(struct join *join, uint32_t p,
+                           struct output *output,
+                           uint32_t **next, size_t *next_size)
+{
+    struct relation *build_relation = &join->relations[0];
+    struct relation *probe_relation = &join->relations[1];
+    const struct join_tuple *build = build_relation->tuples + build_relation->bounds[p];
+    size_t no_build = build_relation->bounds[p + 1] - build_relation->bounds[p];
+    const struct join_tuple *probe = probe_relation->tuples + probe_relation->bounds[p];
+    size_t no_probe = probe_relation->bounds[p + 1] - probe_relation->bounds[p];
+    if (no_build == 0 || no_probe == 0) return;
+
+    // The table maps a key to the last build tuple with that key, and
+    // next links each tuple to the one before it with the same key.
+    // We store indices plus one, so zero means there are no more.
+    if (*next_size < no_build) {
+        *next_size = no_build;
+        *next = (uint32_t *)realloc(*next, no_build * sizeof(uint32_t));
+    }
+    uint32_t size = 2;
+    while (size / 2 < no_build) size *= 2;
+    struct hash_map *table =
+    new_map(size, key_hash, key_cmp, no_destructor, no_destructor);
+    for (size_t i = 0; i < no_build; ++i) {
+        void *key = (void *)&build[i].key;
+        (*next)[i] = (uint32_t)(uintptr_t)lookup(table, key);
+        map(table, key, (void *)(uintptr_t)(i + 1));
+    }
+
+    for (size_t i = 0; i < no_probe; ++i) {
+        uint32_t j = (uint32_t)(uintptr_t)lookup(table, (void *)&probe[i].key);
+        if (!j) continue;
+        if (join->type == SEMI_JOIN) {
+            struct join_tuple *tuple =
+            (struct join_tuple *)output_slot(output, sizeof(struct join_tuple));
+            *tuple = probe[i];
+            continue;
+        }
+        for (; j; j = (*next)[j - 1]) {
+            struct join_match *match =
+            (struct join_match *)output_slot(output, sizeof(struct join_match));
+            match->key = probe[i].key;
+            match->build_payload = build[j - 1].payload;
+            match->probe_payload = probe[i].payload;
+        }
+    }
+
+    delete_map(table);
+}
+
+static void *join_partitions(void *arg)
+{
+    struct join_thread *t = (struct join_thread *)arg;
+    struct join *join = t->join;
+    uint32_t *next = 0;
+    size_t next_size = 0;
+    uint32_t p;
+    while ((p = atomic_fetch_add(&join->next_task, 1)) < join->no_partitions) {
+        join_partition(join, p, &join->outputs[t->thread], &next, &next_size);
+    }
+    free(next);
+    return 0;
+}
+
+struct join_result *hash_join(enum join_type type,
+                              const struct join_tuple *build, size_t no_build,
+                              const struct join_tuple *probe, size_t no_probe,
+                              int no_threads)
+{
+    struct join join;
+    join.type = type;
+    join.no_threads = no_threads < 1 ? 1 : no_threads;
+
+    const struct join_tuple *inputs[2] = { build, probe };
+    size_t sizes[2] = { no_build, no_probe };
+    for (int r = 0; r < 2; ++r) {
+        struct relation *relation = &join.relations[r];
+        relation->input = inputs[r];
+        relation->n = sizes[r];
+        relation->buffers[0] = relation->buffers[1] = 0;
+        relation->tuples = inputs[r];
+        relation->bounds = (size_t *)malloc(2 * sizeof(size_t));
+        relation->bounds[0] = 0;
+        relation->bounds[1] = sizes[r];
+    }
+    join.no_partitions = 1;
+
+    // Enough bits that the build partitions fit in the cache, and
+    // enough partitions that the threads have something to share.
+    int bits = 0;
+    while (((size_t)CACHE_SIZE << bits) < no_build * BUILD_TUPLE_SIZE)
+        bits++;
+    while (join.no_threads > 1 && (1 << bits) < 4 * join.no_threads)
+        bits++;
+
+    if (bits > 0) {
+        for (int r = 0; r < 2; ++r) {
+            struct relation *relation = &join.relations[r];
+            free(relation->bounds);
+            relation->buffers[0] =
+            (struct join_tuple *)malloc(relation->n * sizeof(struct join_tuple));
+            if (bits > MAX_PASS_BITS)
+                relation->buffers[1] =
+                (struct join_tuple *)malloc(relation->n * sizeof(struct join_tuple));
+        }
+        join.bits_done = 0;
+        join.pass_bits = bits < MAX_PASS_BITS ? bits : MAX_PASS_BITS;
+        first_pass(&join);
+        join.bits_done = join.pass_bits;
+        while (join.bits_done < bits) {
+            int left = bits - join.bits_done;
+            join.pass_bits = left < MAX_PASS_BITS ? left : MAX_PASS_BITS;
+            next_pass(&join);
+            join.bits_done += join.pass_bits;
+        }
+    }
+
+    size_t outputs_size = join.no_threads * sizeof(struct output);
+    join.outputs = (struct output *)aligned_alloc(64, outputs_size);
+    memset(join.outputs, 0, outputs_size);
+    run_join_threads(&join, join_partitions);
+
+    // Collect the results from the threads
+    size_t result_size = (type == SEMI_JOIN) ?
+        sizeof(struct join_tuple) : sizeof(struct join_match);
+    struct join_result *result = (struct join_result *)malloc(sizeof(struct join_result));
+    result->type = type;
+    result->n = 0;
+    for (int t = 0; t < join.no_threads; ++t)
+        result->n += join.outputs[t].n;
+    char *results = (char *)malloc(result->n * result_size + 1);
+    size_t offset = 0;
+    for (int t = 0; t < join.no_threads; ++t) {
+        memcpy(results + offset, join.outputs[t].results,
+               join.outputs[t].n * result_size);
+        offset += join.outputs[t].n * result_size;
+        free(join.outputs[t].results);
+    }
+    result->matches = (type == INNER_JOIN) ? (struct join_match *)results : 0;
+    result->tuples = (type == SEMI_JOIN) ? (struct join_tuple *)results : 0;
+
+    free(join.outputs);
+    for (int r = 0; r < 2; ++r) {
+        free(join.relations[r].buffers[0]);
+        free(join.relations[r].buffers[1]);
+        free(join.relations[r].bounds);
+    }
+
+    return result;
+}
+
+void delete_join_result(struct join_result *result)
+{
+    free(result->matches);
+    free(result->tuples);
+    free(result);
+}
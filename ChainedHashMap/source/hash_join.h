@@ -0,0 +1,54 @@
+//
+//  hash_join.h
+//  ChainedHashMap
+//
+//  Created by Thomas Mailund on 19/10/2026.
+//  Copyright © 2026 Thomas Mailund. All rights reserved.
+//
+
+#ifndef hash_join_h
+#define hash_join_h
+
+#include <stdint.h>
+#include <stddef.h>
+#include "hash_map.h"
+
+// Radix-partitioned hash join. We partition both inputs on the high
+// bits of a hash of the key, in as many passes as it takes to make
+// the partitions of the build side fit in the cache, and then join
+// each pair of partitions with a small chained hash map. Partitions
+// are joined in parallel.
+
+struct join_tuple {
+    uint64_t key;
+    uint64_t payload;
+};
+
+struct join_match {
+    uint64_t key;
+    uint64_t build_payload;
+    uint64_t probe_payload;
+};
+
+enum join_type {
+    INNER_JOIN, // all pairs of build and probe tuples with the same key
+    SEMI_JOIN   // the probe tuples with at least one build tuple
+};
+
+struct join_result {
+    enum join_type type;
+    size_t n;
+    struct join_match *matches; // for inner joins
+    struct join_tuple *tuples;  // for semi joins
+};
+
+// The order of the results depends on the partitioning, not on the
+// order of the inputs.
+struct join_result *
+hash_join         (enum join_type type,
+                   const struct join_tuple *build, size_t no_build,
+                   const struct join_tuple *probe, size_t no_probe,
+                   int no_threads);
+void delete_join_result(struct join_result *result);
+
+#endif /* hash_join_h */
@@ -15,6 +15,15 @@
 typedef uint32_t (*hash_func)(void *);
 typedef void (*destructor_func)(void *);
 typedef bool (*compare_func)(void *, void *);
+typedef void (*for_each_func)(void *key, void *val, void *data);
+
+// How the constructors from arrays handle keys that appear more
+// than once.
+enum duplicate_keys {
+    UNIQUE_KEYS,    // there are none; we do not check
+    KEEP_FIRST_KEY, // later copies are destroyed
+    KEEP_LAST_KEY   // earlier copies are destroyed, as with map()
+};
 
 struct hash_map {
     struct linked_list *table;
@@ -33,6 +42,16 @@ new_map           (uint32_t size, // Must be a power of two!
                    compare_func key_cmp,
                    destructor_func key_destructor,
                    destructor_func val_destructor);
+// Builds a map of keys[i] to vals[i] for i < n, large enough that it
+// does not resize. no_threads threads fill the buckets.
+struct hash_map *
+new_map_from_arrays(uint32_t n, void **keys, void **vals,
+                    enum duplicate_keys duplicates,
+                    int no_threads,
+                    hash_func hash,
+                    compare_func key_cmp,
+                    destructor_func key_destructor,
+                    destructor_func val_destructor);
 void  delete_map  (struct hash_map *table);
 
 void  map          (struct hash_map *table,
@@ -41,4 +60,19 @@ void *lookup       (struct hash_map *table, void *key);
 bool  contains_key (struct hash_map *table, void *key);
 void  delete_key   (struct hash_map *table, void *key);
 
+// Iteration. The table must not change while you iterate over it,
+// and f must not change it either.
+struct cursor {
+    uint32_t index;
+    struct linked_list *link;
+};
+void  init_cursor  (struct cursor *cursor);
+bool  next_entry   (struct hash_map *table, struct cursor *cursor,
+                    void **key, void **val);
+void  for_each     (struct hash_map *table, for_each_func f, void *data);
+// Splits the buckets into no_threads ranges and calls f from
+// no_threads threads at the same time.
+void  for_each_parallel(struct hash_map *table,
+                        for_each_func f, void *data, int no_threads);
+
 #endif /* hash_map_h */
@@ -8,6 +8,7 @@
 
 #include "hash_set.h"
 #include <stdlib.h>
+#include <pthread.h>
 
 #pragma mark linked lists
 struct linked_list {
@@ -141,6 +142,177 @@ struct hash_set *new_set(uint32_t size,
     return table;
 }
 
+#pragma mark building from arrays
+
+// We build a table from an array in three passes. First, each thread
+// hashes its slice of the keys and counts how many go to each
+// thread's range of buckets. Then the threads write the key indices
+// to an array ordered by range, keeping the order of the keys within
+// a range, and finally each thread links the keys in its own range.
+// Threads only touch their own buckets, so they never conflict.
+struct build {
+    struct hash_set *table;
+    void **keys;
+    uint32_t n;
+    enum duplicate_keys duplicates;
+    int no_threads;
+    
+    uint32_t *hash_keys;              // indexed like the keys
+    uint32_t *offsets;                // no_threads x no_threads
+    uint32_t *range_start;            // no_threads + 1
+    uint32_t *order;                  // key indices ordered by range
+    uint32_t *no_inserted;            // per thread
+};
+
+struct build_thread {
+    struct build *build;
+    int thread;
+};
+
+// The first index in range r when we split size indices into
+// no_threads ranges.
+static uint32_t range_begin(uint32_t size, int no_threads, int r)
+{
+    return (uint32_t)(((uint64_t)size * r + no_threads - 1) / no_threads);
+}
+
+static int bucket_range(struct build *b, uint32_t hash_key)
+{
+    uint32_t size = b->table->size;
+    return (int)((uint64_t)(hash_key & (size - 1)) * b->no_threads / size);
+}
+
+static void *hash_array_keys(void *arg)
+{
+    struct build_thread *t = (struct build_thread *)arg;
+    struct build *b = t->build;
+    uint32_t *counts = b->offsets + t->thread * b->no_threads;
+    
+    uint32_t end = range_begin(b->n, b->no_threads, t->thread + 1);
+    for (uint32_t i = range_begin(b->n, b->no_threads, t->thread); i < end; ++i) {
+        b->hash_keys[i] = b->table->hash(b->keys[i]);
+        counts[bucket_range(b, b->hash_keys[i])]++;
+    }
+    return 0;
+}
+
+static void *order_array_keys(void *arg)
+{
+    struct build_thread *t = (struct build_thread *)arg;
+    struct build *b = t->build;
+    uint32_t *offsets = b->offsets + t->thread * b->no_threads;
+    
+    uint32_t end = range_begin(b->n, b->no_threads, t->thread + 1);
+    for (uint32_t i = range_begin(b->n, b->no_threads, t->thread); i < end; ++i) {
+        b->order[offsets[bucket_range(b, b->hash_keys[i])]++] = i;
+    }
+    return 0;
+}
+
+static void *link_range(void *arg)
+{
+    struct build_thread *t = (struct build_thread *)arg;
+    struct build *b = t->build;
+    struct hash_set *table = b->table;
+    uint32_t mask = table->size - 1;
+    
+    uint32_t no_inserted = 0;
+    uint32_t end = b->range_start[t->thread + 1];
+    for (uint32_t j = b->range_start[t->thread]; j < end; ++j) {
+        uint32_t i = b->order[j];
+        struct linked_list *list = &table->table[b->hash_keys[i] & mask];
+        if (b->duplicates != UNIQUE_KEYS) {
+            struct linked_list *link =
+                get_previous_link(list, b->hash_keys[i], b->keys[i], table->cmp);
+            if (link) {
+                link = link->next;
+                if (b->duplicates == KEEP_FIRST_KEY) {
+                    if (table->destructor) table->destructor(b->keys[i]);
+                } else {
+                    if (table->destructor) table->destructor(link->key);
+                    link->key = b->keys[i];
+                }
+                continue;
+            }
+        }
+        struct linked_list *new_link = (struct linked_list*)malloc(sizeof(struct linked_list));
+        new_link->hash_key = b->hash_keys[i];
+        new_link->key = b->keys[i];
+        new_link->next = list->next;
+        list->next = new_link;
+        no_inserted++;
+    }
+    b->no_inserted[t->thread] = no_inserted;
+    return 0;
+}
+
+static void run_build_threads(struct build *b, void *(*f)(void *))
+{
+    pthread_t threads[b->no_threads];
+    struct build_thread args[b->no_threads];
+    for (int i = 0; i < b->no_threads; ++i) {
+        args[i].build = b;
+        args[i].thread = i;
+        pthread_create(&threads[i], 0, f, &args[i]);
+    }
+    for (int i = 0; i < b->no_threads; ++i) {
+        pthread_join(threads[i], 0);
+    }
+}
+
+struct hash_set *new_set_from_array(uint32_t n, void **keys,
+                                    enum duplicate_keys duplicates,
+                                    int no_threads,
+                                    hash_func hash,
+                                    compare_func cmp,
+                                    destructor_func destructor)
+{
+    // Make room for all the keys, so we never resize while we fill
+    uint32_t size = 2;
+    while (size / 2 < n) size *= 2;
+    struct hash_set *table = new_set(size, hash, cmp, destructor);
+    
+    struct build b;
+    b.table = table;
+    b.keys = keys;
+    b.n = n;
+    b.duplicates = duplicates;
+    b.no_threads = no_threads < 1 ? 1 : no_threads;
+    b.hash_keys = (uint32_t *)malloc(n * sizeof(uint32_t));
+    b.offsets = (uint32_t *)calloc(b.no_threads * b.no_threads, sizeof(uint32_t));
+    b.range_start = (uint32_t *)malloc((b.no_threads + 1) * sizeof(uint32_t));
+    b.order = (uint32_t *)malloc(n * sizeof(uint32_t));
+    b.no_inserted = (uint32_t *)malloc(b.no_threads * sizeof(uint32_t));
+    
+    run_build_threads(&b, hash_array_keys);
+    
+    // Turn the counts into offsets. Range r starts where all the
+    // ranges before it end.
+    uint32_t offset = 0;
+    for (int r = 0; r < b.no_threads; ++r) {
+        b.range_start[r] = offset;
+        for (int t = 0; t < b.no_threads; ++t) {
+            uint32_t count = b.offsets[t * b.no_threads + r];
+            b.offsets[t * b.no_threads + r] = offset;
+            offset += count;
+        }
+    }
+    b.range_start[b.no_threads] = offset;
+    
+    run_build_threads(&b, order_array_keys);
+    run_build_threads(&b, link_range);
+    for (int t = 0; t < b.no_threads; ++t)
+        table->used += b.no_inserted[t];
+    
+    free(b.hash_keys);
+    free(b.offsets);
+    free(b.range_start);
+    free(b.order);
+    free(b.no_inserted);
+    
+    return table;
+}
+
 void delete_set(struct hash_set *table)
 {
     for (int i = 0; i < table->size; ++i) {
@@ -201,3 +373,69 @@ void delete_key(struct hash_set *table, void *key)
         resize(table, table->size / 2);
 }
 
+#pragma mark iteration
+
+void init_cursor(struct cursor *cursor)
+{
+    cursor->index = 0;
+    cursor->link = 0;
+}
+
+bool next_key(struct hash_set *table, struct cursor *cursor, void **key)
+{
+    while (!cursor->link) {
+        if (cursor->index == table->size) return false;
+        cursor->link = table->table[cursor->index++].next;
+    }
+    *key = cursor->link->key;
+    cursor->link = cursor->link->next;
+    return true;
+}
+
+static void for_each_in_range(struct hash_set *table,
+                              uint32_t begin, uint32_t end,
+                              for_each_func f, void *data)
+{
+    for (uint32_t i = begin; i < end; ++i) {
+        for (struct linked_list *link = table->table[i].next; link; link = link->next)
+            f(link->key, data);
+    }
+}
+
+void for_each(struct hash_set *table, for_each_func f, void *data)
+{
+    for_each_in_range(table, 0, table->size, f, data);
+}
+
+struct iteration_thread {
+    struct hash_set *table;
+    uint32_t begin, end;
+    for_each_func f;
+    void *data;
+};
+
+static void *iterate_range(void *arg)
+{
+    struct iteration_thread *t = (struct iteration_thread *)arg;
+    for_each_in_range(t->table, t->begin, t->end, t->f, t->data);
+    return 0;
+}
+
+void for_each_parallel(struct hash_set *table,
+                       for_each_func f, void *data, int no_threads)
+{
+    if (no_threads < 1) no_threads = 1;
+    pthread_t threads[no_threads];
+    struct iteration_thread args[no_threads];
+    for (int i = 0; i < no_threads; ++i) {
+        args[i].table = table;
+        args[i].begin = range_begin(table->size, no_threads, i);
+        args[i].end = range_begin(table->size, no_threads, i + 1);
+        args[i].f = f;
+        args[i].data = data;
+        pthread_create(&threads[i], 0, iterate_range, &args[i]);
+    }
+    for (int i = 0; i < no_threads; ++i) {
+        pthread_join(threads[i], 0);
+    }
+}
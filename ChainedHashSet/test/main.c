@@ -9,6 +9,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <assert.h>
+#include <stdatomic.h>
 #include "hash_set.h"
 
 
@@ -46,6 +47,11 @@ static void destroy(void *void_key)
     key->deleted = true;
 }
 
+static void count_key(void *key, void *data)
+{
+    atomic_fetch_add((_Atomic int *)data, 1);
+}
+
 int main(int argc, const char *argv[])
 {
     
@@ -106,6 +112,66 @@ int main(int argc, const char *argv[])
     }
     
     delete_set(table);
+    
+    // Building from arrays. Each key appears twice.
+    int no_array = 100000;
+    struct tag_key *array_keys = malloc(2 * no_array * sizeof(struct tag_key));
+    void **array_key_ptrs = malloc(2 * no_array * sizeof(void *));
+    for (enum duplicate_keys duplicates = UNIQUE_KEYS;
+         duplicates <= KEEP_LAST_KEY; ++duplicates) {
+        // With unique keys we only give the table the first half
+        int n = duplicates == UNIQUE_KEYS ? no_array : 2 * no_array;
+        for (int i = 0; i < 2 * no_array; ++i) {
+            init_tag_key(&array_keys[i], i % no_array);
+            array_key_ptrs[i] = &array_keys[i];
+        }
+        table = new_set_from_array(n, array_key_ptrs, duplicates, 4,
+                                   id_hash, compare_values, destroy);
+        assert(table->used == no_array);
+        for (int i = 0; i < no_array; ++i) {
+            int kept = duplicates == KEEP_LAST_KEY ? i + no_array : i;
+            int dropped = duplicates == KEEP_LAST_KEY ? i : i + no_array;
+            assert(contains_key(table, &array_keys[i]));
+            assert(array_keys[kept].deleted == false);
+            assert(array_keys[dropped].deleted == (duplicates != UNIQUE_KEYS));
+        }
+        delete_set(table);
+    }
+    free(array_keys);
+    free(array_key_ptrs);
+    
+    // Iteration
+    int no_iter = 10000;
+    struct tag_key *iter_keys = malloc(no_iter * sizeof(struct tag_key));
+    table = new_set(2, id_hash, compare_values, destroy);
+    for (int i = 0; i < no_iter; ++i) {
+        init_tag_key(&iter_keys[i], i);
+        insert_key(table, &iter_keys[i]);
+    }
+    int no_iterated = 0;
+    struct cursor cursor;
+    init_cursor(&cursor);
+    void *key;
+    while (next_key(table, &cursor, &key)) {
+        ((struct tag_key *)key)->deleted = true;
+        no_iterated++;
+    }
+    assert(no_iterated == no_iter);
+    for (int i = 0; i < no_iter; ++i) {
+        assert(iter_keys[i].deleted == true);
+        iter_keys[i].deleted = false;
+    }
+    _Atomic int no_visited = 0;
+    for_each(table, count_key, &no_visited);
+    assert(no_visited == no_iter);
+    for (int no_threads = 1; no_threads <= 8; no_threads *= 2) {
+        no_visited = 0;
+        for_each_parallel(table, count_key, &no_visited, no_threads);
+        assert(no_visited == no_iter);
+    }
+    delete_set(table);
+    free(iter_keys);
+    
     printf("SUCCESS\n");
     
     return EXIT_SUCCESS;
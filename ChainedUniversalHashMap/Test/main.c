@@ -10,6 +10,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <assert.h>
+#include <stdatomic.h>
 #include "hash_map.h"
 
 
@@ -42,6 +43,12 @@ static uint32_t id_hash(void *key)
     return ((struct tag_key*)key)->key;
 }
 
+static void key_bytes(void *key, const void **bytes, uint32_t *len)
+{
+    *bytes = &((struct tag_key*)key)->key;
+    *len = sizeof(uint32_t);
+}
+
 static void key_destroy(void *void_key)
 {
     struct tag_key *key = (struct tag_key*)void_key;
@@ -53,6 +60,12 @@ static void val_destroy(void *void_key)
     key->val_deleted = true;
 }
 
+static void count_entry(void *key, void *val, void *data)
+{
+    assert(key == val);
+    atomic_fetch_add((_Atomic int *)data, 1);
+}
+
 int main(int argc, const char *argv[])
 {
     
@@ -97,6 +110,14 @@ int main(int argc, const char *argv[])
         assert(lookup(table, &other_keys[i]) == &keys[i]);
         assert(lookup(table, &other_keys[i]) != &other_keys[i]);
     }
+    void *key_ptrs[no_elms], *vals[no_elms];
+    for (int i = 0; i < no_elms; ++i) {
+        key_ptrs[i] = &other_keys[i];
+    }
+    lookup_keys(table, key_ptrs, no_elms, vals);
+    for (int i = 0; i < no_elms; ++i) {
+        assert(vals[i] == &keys[i]);
+    }
     for (int i = 0; i < no_elms; ++i) {
         assert(!contains_key(table, &different_keys[i]));
     }
@@ -128,6 +149,113 @@ int main(int argc, const char *argv[])
     }
     
     delete_map(table);
+    
+    // Multiply-shift hashing
+    table = new_map_family(2, 1.0, UNIVERSAL_MULTIPLY_SHIFT,
+                           id_hash, compare_values, key_destroy, val_destroy);
+    for (int i = 0; i < no_elms; ++i) {
+        init_tag_key(&keys[i], keys[i].key);
+        map(table, &keys[i], &keys[i]);
+    }
+    for (int i = 0; i < no_elms; ++i) {
+        assert(lookup(table, &other_keys[i]) == &keys[i]);
+    }
+    for (int i = 0; i < no_elms; ++i) {
+        assert(!contains_key(table, &different_keys[i]));
+    }
+    for (int i = 0; i < no_elms; ++i) {
+        delete_key(table, &keys[i]);
+        assert(!contains_key(table, &keys[i]));
+        assert(keys[i].key_deleted == true);
+        assert(keys[i].val_deleted == true);
+    }
+    delete_map(table);
+    
+    // Hashing the key bytes, which needs a key_view
+    assert(!new_map_family(2, 1.0, UNIVERSAL_KEY_BYTES, 0,
+                           compare_values, key_destroy, val_destroy));
+    assert(!new_map_keyed(2, 1.0, 0, compare_values, key_destroy, val_destroy));
+    table = new_map_keyed(2, 1.0, key_bytes,
+                          compare_values, key_destroy, val_destroy);
+    for (int i = 0; i < no_elms; ++i) {
+        init_tag_key(&keys[i], keys[i].key);
+        map(table, &keys[i], &keys[i]);
+    }
+    for (int i = 0; i < no_elms; ++i) {
+        assert(lookup(table, &other_keys[i]) == &keys[i]);
+    }
+    for (int i = 0; i < no_elms; ++i) {
+        assert(!contains_key(table, &different_keys[i]));
+    }
+    for (int i = 0; i < no_elms; ++i) {
+        delete_key(table, &keys[i]);
+        assert(!contains_key(table, &keys[i]));
+        assert(keys[i].key_deleted == true);
+        assert(keys[i].val_deleted == true);
+    }
+    delete_map(table);
+    
+    // Building from arrays. Each key appears twice.
+    int no_array = 100000;
+    struct tag_key *array_keys = malloc(2 * no_array * sizeof(struct tag_key));
+    void **array_key_ptrs = malloc(2 * no_array * sizeof(void *));
+    for (enum duplicate_keys duplicates = UNIQUE_KEYS;
+         duplicates <= KEEP_LAST_KEY; ++duplicates) {
+        // With unique keys we only give the table the first half
+        int n = duplicates == UNIQUE_KEYS ? no_array : 2 * no_array;
+        for (int i = 0; i < 2 * no_array; ++i) {
+            init_tag_key(&array_keys[i], i % no_array);
+            array_key_ptrs[i] = &array_keys[i];
+        }
+        table = new_map_from_arrays(n, array_key_ptrs, array_key_ptrs,
+                                    duplicates, 4, 1.0, id_hash,
+                                    compare_values, key_destroy, val_destroy);
+        assert(table->used == no_array);
+        for (int i = 0; i < no_array; ++i) {
+            int kept = duplicates == KEEP_LAST_KEY ? i + no_array : i;
+            int dropped = duplicates == KEEP_LAST_KEY ? i : i + no_array;
+            assert(lookup(table, &array_keys[i]) == &array_keys[kept]);
+            assert(array_keys[kept].key_deleted == false);
+            assert(array_keys[dropped].key_deleted == (duplicates != UNIQUE_KEYS));
+        }
+        delete_map(table);
+    }
+    free(array_keys);
+    free(array_key_ptrs);
+    
+    // Iteration
+    int no_iter = 10000;
+    struct tag_key *iter_keys = malloc(no_iter * sizeof(struct tag_key));
+    table = new_map(2, 1.0, id_hash, compare_values, key_destroy, val_destroy);
+    for (int i = 0; i < no_iter; ++i) {
+        init_tag_key(&iter_keys[i], i);
+        map(table, &iter_keys[i], &iter_keys[i]);
+    }
+    int no_iterated = 0;
+    struct cursor cursor;
+    init_cursor(&cursor);
+    void *key, *val;
+    while (next_entry(table, &cursor, &key, &val)) {
+        assert(key == val);
+        ((struct tag_key *)key)->key_deleted = true;
+        no_iterated++;
+    }
+    assert(no_iterated == no_iter);
+    for (int i = 0; i < no_iter; ++i) {
+        assert(iter_keys[i].key_deleted == true);
+        iter_keys[i].key_deleted = false;
+    }
+    _Atomic int no_visited = 0;
+    for_each(table, count_entry, &no_visited);
+    assert(no_visited == no_iter);
+    for (int no_threads = 1; no_threads <= 8; no_threads *= 2) {
+        no_visited = 0;
+        for_each_parallel(table, count_entry, &no_visited, no_threads);
+        assert(no_visited == no_iter);
+    }
+    delete_map(table);
+    free(iter_keys);
+    
     printf("SUCCESS\n");
     
     return EXIT_SUCCESS;
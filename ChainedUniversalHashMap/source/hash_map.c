@@ -7,7 +7,10 @@
 //
 
 #include "hash_map.h"
+#include "tabulation.h"
 #include <stdlib.h>
+#include <pthread.h>
+#include <string.h>
 
 #pragma mark linked lists
 struct linked_list {
@@ -100,30 +103,96 @@ bool list_contains_key(struct linked_list *list,
 
 #pragma mark universal hashing
 
-void tabulation_sample(uint32_t *start, uint32_t *end)
+// multiply-add-shift: the high 32 bits of a*x + b, for random 64-bit
+// a (odd) and b. It needs no table and a single multiplication.
+static uint32_t mulshift(uint32_t x, uint64_t a, uint64_t b)
 {
-    while (start != end)
-        *(start++) = rand();
+    return (uint32_t)((a * x + b) >> 32);
 }
 
-// tabulation hashing, r=4, q=32
-static uint32_t tabhash(uint32_t x, uint8_t *T)
+static uint32_t uhash(struct hash_map *table, uint32_t hash_key)
 {
-    const int r = 4;
-    const uint32_t no_cols = 1 << r;
-    const uint32_t mask = (1 << r) - 1;
-    
-    uint32_t *T_ = (uint32_t*)T;
-    uint32_t y = T_[0 * no_cols + (x & mask)]; x >>= r;
-    y ^= T_[1 * no_cols + (x & mask)]; x >>= r;
-    y ^= T_[2 * no_cols + (x & mask)]; x >>= r;
-    y ^= T_[3 * no_cols + (x & mask)]; x >>= r;
-    y ^= T_[4 * no_cols + (x & mask)]; x >>= r;
-    y ^= T_[5 * no_cols + (x & mask)]; x >>= r;
-    y ^= T_[6 * no_cols + (x & mask)]; x >>= r;
-    y ^= T_[7 * no_cols + (x & mask)];
-    
-    return y;
+    if (table->family == UNIVERSAL_MULTIPLY_SHIFT)
+        return mulshift(hash_key, table->a, table->b);
+    if (table->family == UNIVERSAL_KEY_BYTES)
+        return hash_key;
+    return tabhash_32_r8(hash_key, (const uint32_t *)table->T);
+}
+
+static void uhash_n(struct hash_map *table,
+                    const uint32_t *x, uint32_t *y, uint32_t n)
+{
+    if (table->family == UNIVERSAL_MULTIPLY_SHIFT) {
+        for (uint32_t i = 0; i < n; ++i)
+            y[i] = mulshift(x[i], table->a, table->b);
+    } else if (table->family == UNIVERSAL_KEY_BYTES) {
+        memcpy(y, x, n * sizeof(uint32_t));
+    } else {
+        tabhash_32_r8_n(x, y, n, (const uint32_t *)table->T);
+    }
+}
+
+// Multilinear hashing of the raw key bytes, taken as 32-bit words w_i:
+// the high 32 bits of m_0 + len * m_1 + sum_i m_{i+2} w_i (mod 2^64)
+// for random 64-bit coefficients m. We draw coefficients as longer
+// keys need them.
+static void grow_coefficients(struct hash_map *table, uint32_t n)
+{
+    uint32_t no_coefs = table->no_coefs ? table->no_coefs : 16;
+    while (no_coefs < n) no_coefs *= 2;
+    table->coefs = (uint64_t *)realloc(table->coefs, no_coefs * sizeof(uint64_t));
+    for (uint32_t i = table->no_coefs; i < no_coefs; ++i)
+        table->coefs[i] = tabulation_random(&table->rng_state);
+    table->no_coefs = no_coefs;
+}
+
+static uint32_t multilinear(struct hash_map *table,
+                            const uint8_t *bytes, uint32_t len)
+{
+    uint32_t no_words = (len + 3) / 4;
+    if (no_words + 2 > table->no_coefs)
+        grow_coefficients(table, no_words + 2);
+    
+    const uint64_t *m = table->coefs;
+    uint64_t h = m[0] + m[1] * len;
+    uint32_t i = 0, w;
+    for (; i < len / 4; ++i) {
+        memcpy(&w, bytes + 4 * i, 4);
+        h += m[i + 2] * w;
+    }
+    if (len % 4) {
+        w = 0;
+        memcpy(&w, bytes + 4 * i, len % 4);
+        h += m[i + 2] * w;
+    }
+    return (uint32_t)(h >> 32);
+}
+
+// The hash key we store for a key. For the key-bytes family this is
+// already a universal hash, so uhash() leaves it alone.
+static uint32_t key_hash(struct hash_map *table, void *key)
+{
+    if (table->family == UNIVERSAL_KEY_BYTES) {
+        const void *bytes; uint32_t len;
+        table->key_view(key, &bytes, &len);
+        return multilinear(table, (const uint8_t *)bytes, len);
+    }
+    return table->hash(key);
+}
+
+// Samples a new function from the table's family.
+static void sample_hash_function(struct hash_map *table)
+{
+    if (table->family == UNIVERSAL_MULTIPLY_SHIFT) {
+        table->a = tabulation_random(&table->rng_state) | 1;
+        table->b = tabulation_random(&table->rng_state);
+    } else if (table->family == UNIVERSAL_KEY_BYTES) {
+        for (uint32_t i = 0; i < table->no_coefs; ++i)
+            table->coefs[i] = tabulation_random(&table->rng_state);
+    } else {
+        tabulation_sample(&table->rng_state,
+                          (uint32_t*)table->T, (uint32_t*)table->T_end);
+    }
 }
 
 
@@ -135,6 +204,48 @@ static void insert_key_hashed(struct hash_map *table,
                               uint32_t uhash_key,
                               void *key, void *val);
 
+// Number of keys we hash at a time when we work on batches of keys.
+#define HASH_BATCH 256
+
+static void insert_links(struct hash_map *table,
+                         struct linked_list **batch,
+                         uint32_t *hash_keys, uint32_t n)
+{
+    uint32_t uhash_keys[HASH_BATCH];
+    uhash_n(table, hash_keys, uhash_keys, n);
+    for (uint32_t i = 0; i < n; ++i) {
+        insert_key_hashed(table, hash_keys[i], uhash_keys[i],
+                          batch[i]->key, batch[i]->val);
+    }
+}
+
+// Insert the links from the old bins in the table. We compute the
+// new hash keys a batch at a time so tabulation hashing can vectorise them.
+static void move_links(struct hash_map *table,
+                       struct linked_list *old_bins, uint32_t old_size)
+{
+    struct linked_list *batch[HASH_BATCH];
+    uint32_t hash_keys[HASH_BATCH];
+    uint32_t n = 0;
+    
+    for (uint32_t i = 0; i < old_size; ++i) {
+        struct linked_list *list = &old_bins[i];
+        while ( (list = list->next) ) {
+            batch[n] = list;
+            // With the key-bytes family the hash key depends on the
+            // function we just sampled.
+            hash_keys[n++] = (table->family == UNIVERSAL_KEY_BYTES) ?
+                key_hash(table, list->key) : list->hash_key;
+            if (n == HASH_BATCH) {
+                insert_links(table, batch, hash_keys, n);
+                n = 0;
+            }
+        }
+    }
+    if (n > 0)
+        insert_links(table, batch, hash_keys, n);
+}
+
 static void resize(struct hash_map *table, uint32_t new_size)
 {
     if (new_size == 0) return;
@@ -149,20 +260,14 @@ static void resize(struct hash_map *table, uint32_t new_size)
     table->used = 0;
     
     // Update hash function
-    tabulation_sample((uint32_t*)table->T, (uint32_t*)table->T_end);
+    sample_hash_function(table);
     
     // Update rehash limit
     table->probe_limit = table->rehash_factor * new_size;
     table->operations_since_rehash = 0;
     
     // Copy keys
-    for (int i = 0; i < old_size; ++i) {
-        struct linked_list *list = &old_bins[i];
-        while ( (list = list->next) ) {
-            uint32_t new_uhash_key = tabhash(list->hash_key, table->T);
-            insert_key_hashed(table, list->hash_key, new_uhash_key, list->key, list->val);
-        }
-    }
+    move_links(table, old_bins, old_size);
     
     // Delete old table
     for (int i = 0; i < old_size; ++i) {
@@ -187,19 +292,13 @@ static void rehash(struct hash_map *table)
     table->used = 0;
     
     // Update hash function
-    tabulation_sample((uint32_t*)table->T, (uint32_t*)table->T_end);
+    sample_hash_function(table);
     
     // Update rehash limit
     table->operations_since_rehash = 0;
     
     // Copy keys
-    for (int i = 0; i < old_size; ++i) {
-        struct linked_list *list = &old_bins[i];
-        while ( (list = list->next) ) {
-            uint32_t new_uhash_key = tabhash(list->hash_key, table->T);
-            insert_key_hashed(table, list->hash_key, new_uhash_key, list->key, list->val);
-        }
-    }
+    move_links(table, old_bins, old_size);
     
     // Delete old table
     for (int i = 0; i < old_size; ++i) {
@@ -209,12 +308,14 @@ static void rehash(struct hash_map *table)
     free(old_bins);
 }
 
-struct hash_map *new_map(uint32_t size,
-                         float rehash_factor,
-                         hash_func hash,
-                         compare_func key_cmp,
-                         destructor_func key_destructor,
-                         destructor_func val_destructor)
+static struct hash_map *new_table(uint32_t size,
+                                  float rehash_factor,
+                                  enum universal_family family,
+                                  hash_func hash,
+                                  key_view_func key_view,
+                                  compare_func key_cmp,
+                                  destructor_func key_destructor,
+                                  destructor_func val_destructor)
 {
     struct hash_map *table = (struct hash_map *)malloc(sizeof(struct hash_map));
     
@@ -229,17 +330,27 @@ struct hash_map *new_map(uint32_t size,
     table->key_destructor = key_destructor;
     table->val_destructor = val_destructor;
     
-    // setting up tabulation hashing table
-    int p = 32;
-    int r = 4;
-    int q = 32;
-    int no_cols = (1 << r);
-    int t = p / r;
-    int bytes = t * no_cols * q / 8;
-    table->T = malloc(bytes);
-    table->T_end = table->T + bytes;
-    tabulation_sample((uint32_t*)table->T,
-                      (uint32_t*)table->T_end);
+    // setting up the hash function. Only tabulation hashing
+    // needs a table.
+    table->family = family;
+    table->T = table->T_end = 0;
+    table->coefs = 0;
+    table->no_coefs = 0;
+    table->key_view = key_view;
+    if (family == UNIVERSAL_TABULATION) {
+        int p = 32;
+        int r = 8;
+        int q = 32;
+        int no_cols = (1 << r);
+        int t = p / r;
+        int bytes = t * no_cols * q / 8;
+        table->T = malloc(bytes);
+        table->T_end = table->T + bytes;
+    }
+    // We only use rand() to seed the table's own generator, so
+    // srand() still makes the tables reproducible.
+    table->rng_state = ((uint64_t)rand() << 32) ^ (uint64_t)rand();
+    sample_hash_function(table);
     
     table->rehash_factor = rehash_factor;
     table->probe_limit = rehash_factor * size;
@@ -248,6 +359,230 @@ struct hash_map *new_map(uint32_t size,
     return table;
 }
 
+// UNIVERSAL_KEY_BYTES tables need a key_view, so they only come
+// from new_map_keyed.
+struct hash_map *new_map_family(uint32_t size,
+                                float rehash_factor,
+                                enum universal_family family,
+                                hash_func hash,
+                                compare_func key_cmp,
+                                destructor_func key_destructor,
+                                destructor_func val_destructor)
+{
+    if (family == UNIVERSAL_KEY_BYTES) return 0;
+    return new_table(size, rehash_factor, family, hash, 0,
+                     key_cmp, key_destructor, val_destructor);
+}
+
+struct hash_map *new_map(uint32_t size,
+                         float rehash_factor,
+                         hash_func hash,
+                         compare_func key_cmp,
+                         destructor_func key_destructor,
+                         destructor_func val_destructor)
+{
+    return new_map_family(size, rehash_factor, UNIVERSAL_TABULATION,
+                          hash, key_cmp, key_destructor, val_destructor);
+}
+
+struct hash_map *new_map_keyed(uint32_t size,
+                               float rehash_factor,
+                               key_view_func key_view,
+                               compare_func key_cmp,
+                               destructor_func key_destructor,
+                               destructor_func val_destructor)
+{
+    if (!key_view) return 0;
+    return new_table(size, rehash_factor, UNIVERSAL_KEY_BYTES, 0, key_view,
+                     key_cmp, key_destructor, val_destructor);
+}
+
+#pragma mark building from arrays
+
+// We build a table from arrays in three passes. First, each thread
+// hashes its slice of the keys and counts how many go to each
+// thread's range of buckets. Then the threads write the key indices
+// to an array ordered by range, keeping the order of the keys within
+// a range, and finally each thread links the keys in its own range.
+// Threads only touch their own buckets, so they never conflict.
+struct build {
+    struct hash_map *table;
+    void **keys, **vals;
+    uint32_t n;
+    enum duplicate_keys duplicates;
+    int no_threads;
+    
+    uint32_t *hash_keys, *uhash_keys; // indexed like the keys
+    uint32_t *offsets;                // no_threads x no_threads
+    uint32_t *range_start;            // no_threads + 1
+    uint32_t *order;                  // key indices ordered by range
+    uint32_t *no_inserted;            // per thread
+};
+
+struct build_thread {
+    struct build *build;
+    int thread;
+};
+
+// The first index in range r when we split size indices into
+// no_threads ranges.
+static uint32_t range_begin(uint32_t size, int no_threads, int r)
+{
+    return (uint32_t)(((uint64_t)size * r + no_threads - 1) / no_threads);
+}
+
+static int bucket_range(struct build *b, uint32_t uhash_key)
+{
+    uint32_t size = b->table->size;
+    return (int)((uint64_t)(uhash_key & (size - 1)) * b->no_threads / size);
+}
+
+static void *hash_array_keys(void *arg)
+{
+    struct build_thread *t = (struct build_thread *)arg;
+    struct build *b = t->build;
+    uint32_t *counts = b->offsets + t->thread * b->no_threads;
+    
+    uint32_t begin = range_begin(b->n, b->no_threads, t->thread);
+    uint32_t end = range_begin(b->n, b->no_threads, t->thread + 1);
+    for (uint32_t i = begin; i < end; i += HASH_BATCH) {
+        uint32_t m = (end - i < HASH_BATCH) ? end - i : HASH_BATCH;
+        for (uint32_t j = 0; j < m; ++j)
+            b->hash_keys[i + j] = key_hash(b->table, b->keys[i + j]);
+        uhash_n(b->table, b->hash_keys + i, b->uhash_keys + i, m);
+        for (uint32_t j = 0; j < m; ++j)
+            counts[bucket_range(b, b->uhash_keys[i + j])]++;
+    }
+    return 0;
+}
+
+static void *order_array_keys(void *arg)
+{
+    struct build_thread *t = (struct build_thread *)arg;
+    struct build *b = t->build;
+    uint32_t *offsets = b->offsets + t->thread * b->no_threads;
+    
+    uint32_t end = range_begin(b->n, b->no_threads, t->thread + 1);
+    for (uint32_t i = range_begin(b->n, b->no_threads, t->thread); i < end; ++i) {
+        b->order[offsets[bucket_range(b, b->uhash_keys[i])]++] = i;
+    }
+    return 0;
+}
+
+static void *link_range(void *arg)
+{
+    struct build_thread *t = (struct build_thread *)arg;
+    struct build *b = t->build;
+    struct hash_map *table = b->table;
+    uint32_t mask = table->size - 1;
+    
+    uint32_t no_inserted = 0;
+    uint32_t end = b->range_start[t->thread + 1];
+    for (uint32_t j = b->range_start[t->thread]; j < end; ++j) {
+        uint32_t i = b->order[j];
+        struct linked_list *list = &table->table[b->uhash_keys[i] & mask];
+        if (b->duplicates != UNIQUE_KEYS) {
+            struct linked_list *link =
+                get_previous_link(list, b->hash_keys[i], b->keys[i], table->key_cmp);
+            if (link) {
+                link = link->next;
+                if (b->duplicates == KEEP_FIRST_KEY) {
+                    table->key_destructor(b->keys[i]);
+                    table->val_destructor(b->vals[i]);
+                } else {
+                    table->key_destructor(link->key);
+                    table->val_destructor(link->val);
+                    link->key = b->keys[i];
+                    link->val = b->vals[i];
+                }
+                continue;
+            }
+        }
+        struct linked_list *new_link = (struct linked_list*)malloc(sizeof(struct linked_list));
+        new_link->hash_key = b->hash_keys[i];
+        new_link->key = b->keys[i];
+        new_link->val = b->vals[i];
+        new_link->next = list->next;
+        list->next = new_link;
+        no_inserted++;
+    }
+    b->no_inserted[t->thread] = no_inserted;
+    return 0;
+}
+
+static void run_build_threads(struct build *b, void *(*f)(void *))
+{
+    pthread_t threads[b->no_threads];
+    struct build_thread args[b->no_threads];
+    for (int i = 0; i < b->no_threads; ++i) {
+        args[i].build = b;
+        args[i].thread = i;
+        pthread_create(&threads[i], 0, f, &args[i]);
+    }
+    for (int i = 0; i < b->no_threads; ++i) {
+        pthread_join(threads[i], 0);
+    }
+}
+
+struct hash_map *new_map_from_arrays(uint32_t n, void **keys, void **vals,
+                                     enum duplicate_keys duplicates,
+                                     int no_threads,
+                                     float rehash_factor,
+                                     hash_func hash,
+                                     compare_func key_cmp,
+                                     destructor_func key_destructor,
+                                     destructor_func val_destructor)
+{
+    // Make room for all the keys, so we never resize while we fill
+    uint32_t size = 2;
+    while (size / 2 < n) size *= 2;
+    struct hash_map *table =
+    new_map(size, rehash_factor, hash, key_cmp, key_destructor, val_destructor);
+    
+    struct build b;
+    b.table = table;
+    b.keys = keys;
+    b.vals = vals;
+    b.n = n;
+    b.duplicates = duplicates;
+    b.no_threads = no_threads < 1 ? 1 : no_threads;
+    b.hash_keys = (uint32_t *)malloc(n * sizeof(uint32_t));
+    b.uhash_keys = (uint32_t *)malloc(n * sizeof(uint32_t));
+    b.offsets = (uint32_t *)calloc(b.no_threads * b.no_threads, sizeof(uint32_t));
+    b.range_start = (uint32_t *)malloc((b.no_threads + 1) * sizeof(uint32_t));
+    b.order = (uint32_t *)malloc(n * sizeof(uint32_t));
+    b.no_inserted = (uint32_t *)malloc(b.no_threads * sizeof(uint32_t));
+    
+    run_build_threads(&b, hash_array_keys);
+    
+    // Turn the counts into offsets. Range r starts where all the
+    // ranges before it end.
+    uint32_t offset = 0;
+    for (int r = 0; r < b.no_threads; ++r) {
+        b.range_start[r] = offset;
+        for (int t = 0; t < b.no_threads; ++t) {
+            uint32_t count = b.offsets[t * b.no_threads + r];
+            b.offsets[t * b.no_threads + r] = offset;
+            offset += count;
+        }
+    }
+    b.range_start[b.no_threads] = offset;
+    
+    run_build_threads(&b, order_array_keys);
+    run_build_threads(&b, link_range);
+    for (int t = 0; t < b.no_threads; ++t)
+        table->used += b.no_inserted[t];
+    
+    free(b.hash_keys);
+    free(b.uhash_keys);
+    free(b.offsets);
+    free(b.range_start);
+    free(b.order);
+    free(b.no_inserted);
+    
+    return table;
+}
+
 void delete_map(struct hash_map *table)
 {
     for (int i = 0; i < table->size; ++i) {
@@ -256,6 +591,7 @@ void delete_map(struct hash_map *table)
     }
     free(table->table);
     free(table->T);
+    free(table->coefs);
     free(table);
 }
 
@@ -290,8 +626,8 @@ void map(struct hash_map *table, void *key, void *val)
         rehash(table);
     }
     
-    uint32_t hash_key = table->hash(key);
-    uint32_t uhash_key = tabhash(hash_key, table->T);
+    uint32_t hash_key = key_hash(table, key);
+    uint32_t uhash_key = uhash(table, hash_key);
     insert_key_hashed(table, hash_key, uhash_key,
                       key, val);
     if (table->used > table->size / 2)
@@ -305,8 +641,8 @@ bool contains_key(struct hash_map *table, void *key)
         rehash(table);
     }
     
-    uint32_t hash_key = table->hash(key);
-    uint32_t uhash_key = tabhash(hash_key, table->T);
+    uint32_t hash_key = key_hash(table, key);
+    uint32_t uhash_key = uhash(table, hash_key);
     uint32_t mask = table->size - 1;
     uint32_t index = uhash_key & mask;
     return list_contains_key(&table->table[index],
@@ -314,15 +650,11 @@ bool contains_key(struct hash_map *table, void *key)
                              table->key_cmp);
 }
 
-void *lookup(struct hash_map *table, void *key)
+static void *lookup_hashed(struct hash_map *table,
+                           uint32_t hash_key,
+                           uint32_t uhash_key,
+                           void *key)
 {
-    table->operations_since_rehash++;
-    if (table->operations_since_rehash > table->probe_limit) {
-        rehash(table);
-    }
-    
-    uint32_t hash_key = table->hash(key);
-    uint32_t uhash_key = tabhash(hash_key, table->T);
     uint32_t mask = table->size - 1;
     uint32_t index = uhash_key & mask;
     struct linked_list *link =
@@ -336,6 +668,41 @@ void *lookup(struct hash_map *table, void *key)
     }
 }
 
+void *lookup(struct hash_map *table, void *key)
+{
+    table->operations_since_rehash++;
+    if (table->operations_since_rehash > table->probe_limit) {
+        rehash(table);
+    }
+    
+    uint32_t hash_key = key_hash(table, key);
+    uint32_t uhash_key = uhash(table, hash_key);
+    return lookup_hashed(table, hash_key, uhash_key, key);
+}
+
+void lookup_keys(struct hash_map *table,
+                 void **keys, uint32_t n, void **vals)
+{
+    table->operations_since_rehash += n;
+    if (table->operations_since_rehash > table->probe_limit) {
+        rehash(table);
+    }
+    
+    uint32_t hash_keys[HASH_BATCH];
+    uint32_t uhash_keys[HASH_BATCH];
+    for (uint32_t offset = 0; offset < n; offset += HASH_BATCH) {
+        uint32_t m = (n - offset < HASH_BATCH) ? n - offset : HASH_BATCH;
+        for (uint32_t i = 0; i < m; ++i) {
+            hash_keys[i] = key_hash(table, keys[offset + i]);
+        }
+        uhash_n(table, hash_keys, uhash_keys, m);
+        for (uint32_t i = 0; i < m; ++i) {
+            vals[offset + i] = lookup_hashed(table, hash_keys[i], uhash_keys[i],
+                                             keys[offset + i]);
+        }
+    }
+}
+
 void delete_key(struct hash_map *table, void *key)
 {
     table->operations_since_rehash++;
@@ -343,8 +710,8 @@ void delete_key(struct hash_map *table, void *key)
         rehash(table);
     }
     
-    uint32_t hash_key = table->hash(key);
-    uint32_t uhash_key = tabhash(hash_key, table->T);
+    uint32_t hash_key = key_hash(table, key);
+    uint32_t uhash_key = uhash(table, hash_key);
     uint32_t mask = table->size - 1;
     uint32_t index = uhash_key & mask;
     
@@ -363,3 +730,70 @@ void delete_key(struct hash_map *table, void *key)
         resize(table, table->size / 2);
 }
 
+#pragma mark iteration
+
+void init_cursor(struct cursor *cursor)
+{
+    cursor->index = 0;
+    cursor->link = 0;
+}
+
+bool next_entry(struct hash_map *table, struct cursor *cursor, void **key, void **val)
+{
+    while (!cursor->link) {
+        if (cursor->index == table->size) return false;
+        cursor->link = table->table[cursor->index++].next;
+    }
+    *key = cursor->link->key;
+    *val = cursor->link->val;
+    cursor->link = cursor->link->next;
+    return true;
+}
+
+static void for_each_in_range(struct hash_map *table,
+                              uint32_t begin, uint32_t end,
+                              for_each_func f, void *data)
+{
+    for (uint32_t i = begin; i < end; ++i) {
+        for (struct linked_list *link = table->table[i].next; link; link = link->next)
+            f(link->key, link->val, data);
+    }
+}
+
+void for_each(struct hash_map *table, for_each_func f, void *data)
+{
+    for_each_in_range(table, 0, table->size, f, data);
+}
+
+struct iteration_thread {
+    struct hash_map *table;
+    uint32_t begin, end;
+    for_each_func f;
+    void *data;
+};
+
+static void *iterate_range(void *arg)
+{
+    struct iteration_thread *t = (struct iteration_thread *)arg;
+    for_each_in_range(t->table, t->begin, t->end, t->f, t->data);
+    return 0;
+}
+
+void for_each_parallel(struct hash_map *table,
+                       for_each_func f, void *data, int no_threads)
+{
+    if (no_threads < 1) no_threads = 1;
+    pthread_t threads[no_threads];
+    struct iteration_thread args[no_threads];
+    for (int i = 0; i < no_threads; ++i) {
+        args[i].table = table;
+        args[i].begin = range_begin(table->size, no_threads, i);
+        args[i].end = range_begin(table->size, no_threads, i + 1);
+        args[i].f = f;
+        args[i].data = data;
+        pthread_create(&threads[i], 0, iterate_range, &args[i]);
+    }
+    for (int i = 0; i < no_threads; ++i) {
+        pthread_join(threads[i], 0);
+    }
+}
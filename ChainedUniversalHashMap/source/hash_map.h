@@ -15,6 +15,24 @@
 typedef uint32_t (*hash_func)(void *);
 typedef void (*destructor_func)(void *);
 typedef bool (*compare_func)(void *, void *);
+typedef void (*for_each_func)(void *key, void *val, void *data);
+// Gives the table the bytes of a key, for hashing the key bytes
+// instead of a 32-bit pre-hash.
+typedef void (*key_view_func)(void *key, const void **bytes, uint32_t *len);
+
+enum universal_family {
+    UNIVERSAL_TABULATION,     // tabulation hashing, 4 KB table per hash table
+    UNIVERSAL_MULTIPLY_SHIFT, // multiply-add-shift, no table
+    UNIVERSAL_KEY_BYTES       // multilinear hashing of the key bytes
+};
+
+// How the constructors from arrays handle keys that appear more
+// than once.
+enum duplicate_keys {
+    UNIQUE_KEYS,    // there are none; we do not check
+    KEEP_FIRST_KEY, // later copies are destroyed
+    KEEP_LAST_KEY   // earlier copies are destroyed, as with map()
+};
 
 struct hash_map {
     struct linked_list *table;
@@ -26,8 +44,14 @@ struct hash_map {
     destructor_func key_destructor;
     destructor_func val_destructor;
     
-    // For tabulation hashing.
-    uint8_t *T, *T_end;
+    // The universal family and the current function from it.
+    enum universal_family family;
+    uint8_t *T, *T_end;  // tabulation hashing
+    uint64_t a, b;       // multiply-shift hashing
+    uint64_t *coefs;     // key-bytes hashing
+    uint32_t no_coefs;
+    key_view_func key_view;
+    uint64_t rng_state;
     
     float rehash_factor;
     unsigned int probe_limit;
@@ -42,12 +66,60 @@ new_map           (uint32_t size, // Must be a power of two!
                    compare_func key_cmp,
                    destructor_func key_destructor,
                    destructor_func val_destructor);
+// Returns 0 for UNIVERSAL_KEY_BYTES. Use new_map_keyed for that.
+struct hash_map *
+new_map_family    (uint32_t size, // Must be a power of two!
+                   float rehash_factor,
+                   enum universal_family family,
+                   hash_func hash,
+                   compare_func key_cmp,
+                   destructor_func key_destructor,
+                   destructor_func val_destructor);
+// Hashes the bytes of keys with multilinear hashing, so rehashing
+// also breaks up keys that would collide in a 32-bit pre-hash.
+// Returns 0 if key_view is 0.
+struct hash_map *
+new_map_keyed     (uint32_t size, // Must be a power of two!
+                   float rehash_factor,
+                   key_view_func key_view,
+                   compare_func key_cmp,
+                   destructor_func key_destructor,
+                   destructor_func val_destructor);
+// Builds a map of keys[i] to vals[i] for i < n, large enough that it
+// does not resize. no_threads threads fill the buckets.
+struct hash_map *
+new_map_from_arrays(uint32_t n, void **keys, void **vals,
+                    enum duplicate_keys duplicates,
+                    int no_threads,
+                    float rehash_factor,
+                    hash_func hash,
+                    compare_func key_cmp,
+                    destructor_func key_destructor,
+                    destructor_func val_destructor);
 void  delete_map  (struct hash_map *table);
 
 void  map          (struct hash_map *table,
                     void *key, void *val);
 void *lookup       (struct hash_map *table, void *key);
+// Looks up n keys at a time and puts the values in vals.
+void  lookup_keys  (struct hash_map *table,
+                    void **keys, uint32_t n, void **vals);
 bool  contains_key (struct hash_map *table, void *key);
 void  delete_key   (struct hash_map *table, void *key);
 
+// Iteration. The table must not change while you iterate over it,
+// and since lookups can rehash, you cannot look up keys either.
+struct cursor {
+    uint32_t index;
+    struct linked_list *link;
+};
+void  init_cursor  (struct cursor *cursor);
+bool  next_entry   (struct hash_map *table, struct cursor *cursor,
+                    void **key, void **val);
+void  for_each     (struct hash_map *table, for_each_func f, void *data);
+// Splits the buckets into no_threads ranges and calls f from
+// no_threads threads at the same time.
+void  for_each_parallel(struct hash_map *table,
+                        for_each_func f, void *data, int no_threads);
+
 #endif /* hash_map_h */
@@ -9,6 +9,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <assert.h>
+#include <stdatomic.h>
 #include "hash_set.h"
 
 
@@ -40,12 +41,23 @@ static uint32_t id_hash(void *key)
     return ((struct tag_key*)key)->key;
 }
 
+static void key_bytes(void *key, const void **bytes, uint32_t *len)
+{
+    *bytes = &((struct tag_key*)key)->key;
+    *len = sizeof(uint32_t);
+}
+
 static void destroy(void *void_key)
 {
     struct tag_key *key = (struct tag_key*)void_key;
     key->deleted = true;
 }
 
+static void count_key(void *key, void *data)
+{
+    atomic_fetch_add((_Atomic int *)data, 1);
+}
+
 int main(int argc, const char *argv[])
 {
     
@@ -78,6 +90,15 @@ int main(int argc, const char *argv[])
     for (int i = 0; i < no_elms; ++i) {
         assert(contains_key(table, &other_keys[i]));
     }
+    void *key_ptrs[no_elms];
+    bool results[no_elms];
+    for (int i = 0; i < no_elms; ++i) {
+        key_ptrs[i] = &other_keys[i];
+    }
+    contains_keys(table, key_ptrs, no_elms, results);
+    for (int i = 0; i < no_elms; ++i) {
+        assert(results[i]);
+    }
     for (int i = 0; i < no_elms; ++i) {
         assert(!contains_key(table, &different_keys[i]));
     }
@@ -106,6 +127,107 @@ int main(int argc, const char *argv[])
     }
     
     delete_set(table);
+    
+    // Multiply-shift hashing
+    table = new_set_family(2, 1.0, UNIVERSAL_MULTIPLY_SHIFT,
+                           id_hash, compare_values, destroy);
+    for (int i = 0; i < no_elms; ++i) {
+        init_tag_key(&keys[i], keys[i].key);
+        insert_key(table, &keys[i]);
+    }
+    for (int i = 0; i < no_elms; ++i) {
+        assert(contains_key(table, &other_keys[i]));
+    }
+    for (int i = 0; i < no_elms; ++i) {
+        assert(!contains_key(table, &different_keys[i]));
+    }
+    for (int i = 0; i < no_elms; ++i) {
+        delete_key(table, &keys[i]);
+        assert(!contains_key(table, &keys[i]));
+        assert(keys[i].deleted == true);
+    }
+    delete_set(table);
+    
+    // Hashing the key bytes, which needs a key_view
+    assert(!new_set_family(2, 1.0, UNIVERSAL_KEY_BYTES, 0, compare_values, destroy));
+    assert(!new_set_keyed(2, 1.0, 0, compare_values, destroy));
+    table = new_set_keyed(2, 1.0, key_bytes, compare_values, destroy);
+    for (int i = 0; i < no_elms; ++i) {
+        init_tag_key(&keys[i], keys[i].key);
+        insert_key(table, &keys[i]);
+    }
+    for (int i = 0; i < no_elms; ++i) {
+        assert(contains_key(table, &other_keys[i]));
+    }
+    for (int i = 0; i < no_elms; ++i) {
+        assert(!contains_key(table, &different_keys[i]));
+    }
+    for (int i = 0; i < no_elms; ++i) {
+        delete_key(table, &keys[i]);
+        assert(!contains_key(table, &keys[i]));
+        assert(keys[i].deleted == true);
+    }
+    delete_set(table);
+    
+    // Building from arrays. Each key appears twice.
+    int no_array = 100000;
+    struct tag_key *array_keys = malloc(2 * no_array * sizeof(struct tag_key));
+    void **array_key_ptrs = malloc(2 * no_array * sizeof(void *));
+    for (enum duplicate_keys duplicates = UNIQUE_KEYS;
+         duplicates <= KEEP_LAST_KEY; ++duplicates) {
+        // With unique keys we only give the table the first half
+        int n = duplicates == UNIQUE_KEYS ? no_array : 2 * no_array;
+        for (int i = 0; i < 2 * no_array; ++i) {
+            init_tag_key(&array_keys[i], i % no_array);
+            array_key_ptrs[i] = &array_keys[i];
+        }
+        table = new_set_from_array(n, array_key_ptrs, duplicates, 4, 1.0,
+                                   id_hash, compare_values, destroy);
+        assert(table->used == no_array);
+        for (int i = 0; i < no_array; ++i) {
+            int kept = duplicates == KEEP_LAST_KEY ? i + no_array : i;
+            int dropped = duplicates == KEEP_LAST_KEY ? i : i + no_array;
+            assert(contains_key(table, &array_keys[i]));
+            assert(array_keys[kept].deleted == false);
+            assert(array_keys[dropped].deleted == (duplicates != UNIQUE_KEYS));
+        }
+        delete_set(table);
+    }
+    free(array_keys);
+    free(array_key_ptrs);
+    
+    // Iteration
+    int no_iter = 10000;
+    struct tag_key *iter_keys = malloc(no_iter * sizeof(struct tag_key));
+    table = new_set(2, 1.0, id_hash, compare_values, destroy);
+    for (int i = 0; i < no_iter; ++i) {
+        init_tag_key(&iter_keys[i], i);
+        insert_key(table, &iter_keys[i]);
+    }
+    int no_iterated = 0;
+    struct cursor cursor;
+    init_cursor(&cursor);
+    void *key;
+    while (next_key(table, &cursor, &key)) {
+        ((struct tag_key *)key)->deleted = true;
+        no_iterated++;
+    }
+    assert(no_iterated == no_iter);
+    for (int i = 0; i < no_iter; ++i) {
+        assert(iter_keys[i].deleted == true);
+        iter_keys[i].deleted = false;
+    }
+    _Atomic int no_visited = 0;
+    for_each(table, count_key, &no_visited);
+    assert(no_visited == no_iter);
+    for (int no_threads = 1; no_threads <= 8; no_threads *= 2) {
+        no_visited = 0;
+        for_each_parallel(table, count_key, &no_visited, no_threads);
+        assert(no_visited == no_iter);
+    }
+    delete_set(table);
+    free(iter_keys);
+    
     printf("SUCCESS\n");
     
     return EXIT_SUCCESS;
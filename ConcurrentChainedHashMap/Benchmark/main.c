@@ -0,0 +1,118 @@
+//
+//  main.c
+//  Benchmark
+//
+//  Created by Thomas Mailund on 19/10/2026.
+//  Copyright © 2026 Thomas Mailund. All rights reserved.
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <pthread.h>
+#include "hash_map.h"
+
+static double now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static uint32_t hash(void *key)
+{
+    uint32_t x = *(uint32_t *)key;
+    x ^= x >> 16; x *= 0x45d9f3b;
+    x ^= x >> 16; x *= 0x45d9f3b;
+    return x ^ (x >> 16);
+}
+
+static bool cmp(void *a, void *b)
+{
+    return *(uint32_t *)a == *(uint32_t *)b;
+}
+
+static void nop(void *x)
+{
+}
+
+#define NO_KEYS (1 << 20)
+static uint32_t keys[NO_KEYS];
+
+struct thread_data {
+    struct hash_map *table;
+    uint64_t rng_state;
+    int no_ops;
+    int read_percent;
+};
+
+static uint64_t next_random(uint64_t *state)
+{
+    uint64_t z = (*state += 0x9e3779b97f4a7c15);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111eb;
+    return z ^ (z >> 31);
+}
+
+static void *worker(void *arg)
+{
+    struct thread_data *data = (struct thread_data *)arg;
+    for (int i = 0; i < data->no_ops; ++i) {
+        uint64_t r = next_random(&data->rng_state);
+        uint32_t *key = &keys[r % NO_KEYS];
+        int op = (r >> 32) % 100;
+        if (op < data->read_percent) {
+            lookup(data->table, key);
+        } else if (op % 2 == 0) {
+            map(data->table, key, key);
+        } else {
+            delete_key(data->table, key);
+        }
+    }
+    return 0;
+}
+
+// Runs a mixed workload with 1 to 64 threads. The total amount of
+// work is the same for each thread count, so on a machine with
+// enough cores the time should drop as we add threads.
+int main(int argc, const char *argv[])
+{
+    int total_ops = 1 << 23;
+    int read_percent = 90;
+    if (argc > 1) read_percent = atoi(argv[1]);
+
+    for (int i = 0; i < NO_KEYS; ++i) {
+        keys[i] = i;
+    }
+
+    printf("%d%% lookups, the rest split between map and delete_key\n",
+           read_percent);
+    for (int no_threads = 1; no_threads <= 64; no_threads *= 2) {
+        struct hash_map *table = new_map(1024, hash, cmp, nop, nop);
+        // Fill the table halfway so lookups hit half the time
+        for (int i = 0; i < NO_KEYS; i += 2) {
+            map(table, &keys[i], &keys[i]);
+        }
+
+        pthread_t threads[no_threads];
+        struct thread_data data[no_threads];
+        double begin = now();
+        for (int i = 0; i < no_threads; ++i) {
+            data[i].table = table;
+            data[i].rng_state = i + 1;
+            data[i].no_ops = total_ops / no_threads;
+            data[i].read_percent = read_percent;
+            pthread_create(&threads[i], 0, worker, &data[i]);
+        }
+        for (int i = 0; i < no_threads; ++i) {
+            pthread_join(threads[i], 0);
+        }
+        double elapsed = now() - begin;
+
+        printf("%2d threads: %7.2f Mops/s\n",
+               no_threads, total_ops / elapsed * 1e-6);
+        delete_map(table);
+    }
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,206 @@
+//
+//  main.c
+//  Test
+//
+//  Created by Thomas Mailund on 19/10/2026.
+//  Copyright © 2026 Thomas Mailund. All rights reserved.
+//
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <pthread.h>
+#include "hash_map.h"
+
+
+struct tag_key {
+    bool key_deleted;
+    bool val_deleted;
+    uint32_t key;
+};
+
+static void init_tag_key(struct tag_key *tag_key, uint32_t key)
+{
+    tag_key->key = key;
+    tag_key->val_deleted = tag_key->key_deleted = false;
+}
+
+static uint32_t random_key()
+{
+    return (uint32_t)random();
+}
+
+static bool compare_values(void *a, void *b)
+{
+    uint32_t key_a = ((struct tag_key*)a)->key;
+    uint32_t key_b = ((struct tag_key*)b)->key;
+    return key_a == key_b;
+}
+
+static uint32_t id_hash(void *key)
+{
+    return ((struct tag_key*)key)->key;
+}
+
+static void key_destroy(void *void_key)
+{
+    struct tag_key *key = (struct tag_key*)void_key;
+    key->key_deleted = true;
+}
+static void val_destroy(void *void_key)
+{
+    struct tag_key *key = (struct tag_key*)void_key;
+    key->val_deleted = true;
+}
+
+
+#define NO_THREADS 8
+#define KEYS_PER_THREAD 2000
+
+struct thread_data {
+    struct hash_map *table;
+    struct tag_key *keys;
+    int thread;
+};
+
+// Each writer owns a range of keys; it inserts them, replaces half of
+// them, and deletes the other half, while it also reads the keys of
+// the other threads.
+static void *writer(void *arg)
+{
+    struct thread_data *data = (struct thread_data *)arg;
+    struct tag_key *keys = data->keys + data->thread * KEYS_PER_THREAD;
+    struct tag_key *vals = keys + NO_THREADS * KEYS_PER_THREAD;
+    struct tag_key *other = data->keys + ((data->thread + 1) % NO_THREADS) * KEYS_PER_THREAD;
+
+    for (int i = 0; i < KEYS_PER_THREAD; ++i) {
+        map(data->table, &keys[i], &keys[i]);
+        assert(lookup(data->table, &keys[i]) == &keys[i]);
+        void *val = lookup(data->table, &other[i]);
+        assert(val == 0 || val == &other[i] || val == &other[i + NO_THREADS * KEYS_PER_THREAD]);
+    }
+    for (int i = 0; i < KEYS_PER_THREAD; ++i) {
+        if (i % 2 == 0) {
+            map(data->table, &vals[i], &vals[i]);
+            assert(lookup(data->table, &keys[i]) == &vals[i]);
+        } else {
+            delete_key(data->table, &keys[i]);
+            assert(!contains_key(data->table, &keys[i]));
+        }
+    }
+    return 0;
+}
+
+static void concurrent_test()
+{
+    int no_keys = NO_THREADS * KEYS_PER_THREAD;
+    // the first half are the keys, the second half replace them
+    struct tag_key *keys = malloc(2 * no_keys * sizeof(struct tag_key));
+    for (int i = 0; i < no_keys; ++i) {
+        init_tag_key(&keys[i], i);
+        init_tag_key(&keys[i + no_keys], i);
+    }
+
+    struct hash_map *table = new_map(2, id_hash, compare_values, key_destroy, val_destroy);
+
+    pthread_t threads[NO_THREADS];
+    struct thread_data data[NO_THREADS];
+    for (int i = 0; i < NO_THREADS; ++i) {
+        data[i].table = table;
+        data[i].keys = keys;
+        data[i].thread = i;
+        pthread_create(&threads[i], 0, writer, &data[i]);
+    }
+    for (int i = 0; i < NO_THREADS; ++i) {
+        pthread_join(threads[i], 0);
+    }
+
+    for (int i = 0; i < no_keys; ++i) {
+        int j = i % KEYS_PER_THREAD;
+        if (j % 2 == 0) {
+            assert(lookup(table, &keys[i]) == &keys[i + no_keys]);
+        } else {
+            assert(!contains_key(table, &keys[i]));
+        }
+    }
+
+    delete_map(table);
+    for (int i = 0; i < no_keys; ++i) {
+        assert(keys[i].key_deleted == true);
+        assert(keys[i].val_deleted == true);
+        bool replaced = (i % KEYS_PER_THREAD) % 2 == 0;
+        assert(keys[i + no_keys].key_deleted == replaced);
+        assert(keys[i + no_keys].val_deleted == replaced);
+    }
+    free(keys);
+}
+
+int main(int argc, const char *argv[])
+{
+    
+    int no_elms = 100;
+    struct tag_key keys[no_elms];
+    for (int i = 0; i < no_elms; ++i) {
+        init_tag_key(&keys[i], random_key());
+    }
+    struct tag_key other_keys[no_elms];
+    for (int i = 0; i < no_elms; ++i) {
+        init_tag_key(&other_keys[i], keys[i].key);
+    }
+    struct tag_key different_keys[no_elms];
+    for (int i = 0; i < no_elms; ++i) {
+        init_tag_key(&different_keys[i], random_key());
+    }
+    
+    struct hash_map *table = new_map(2, id_hash, compare_values, key_destroy, val_destroy);
+    
+    for (int i = 0; i < no_elms; ++i) {
+        map(table, &keys[i], &keys[i]);
+        assert(keys[i].key_deleted == false);
+    }
+    for (int i = 0; i < no_elms; ++i) {
+        assert(contains_key(table, &keys[i]));
+        assert(lookup(table, &keys[i]) == &keys[i]);
+        assert(keys[i].key_deleted == false);
+        assert(keys[i].val_deleted == false);
+    }
+    for (int i = 0; i < no_elms; ++i) {
+        assert(contains_key(table, &other_keys[i]));
+        assert(lookup(table, &other_keys[i]) == &keys[i]);
+    }
+    for (int i = 0; i < no_elms; ++i) {
+        assert(!contains_key(table, &different_keys[i]));
+    }
+    for (int i = 0; i < no_elms; ++i) {
+        map(table, &other_keys[i], &other_keys[i]);
+    }
+    // The replaced keys are destroyed once no reader can see them,
+    // which might not be yet, but the new ones must still be alive.
+    for (int i = 0; i < no_elms; ++i) {
+        assert(lookup(table, &other_keys[i]) == &other_keys[i]);
+        assert(other_keys[i].key_deleted == false);
+        assert(other_keys[i].val_deleted == false);
+    }
+    for (int i = 0; i < no_elms; ++i) {
+        delete_key(table, &other_keys[i]);
+    }
+    for (int i = 0; i < no_elms; ++i) {
+        assert(!contains_key(table, &keys[i]));
+        assert(!contains_key(table, &other_keys[i]));
+    }
+    
+    delete_map(table);
+    for (int i = 0; i < no_elms; ++i) {
+        assert(keys[i].key_deleted == true);
+        assert(keys[i].val_deleted == true);
+        assert(other_keys[i].key_deleted == true);
+        assert(other_keys[i].val_deleted == true);
+    }
+    
+    concurrent_test();
+    
+    printf("SUCCESS\n");
+    
+    return EXIT_SUCCESS;
+}
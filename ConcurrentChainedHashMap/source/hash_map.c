@@ -0,0 +1,495 @@
+//
+//  hash_map.c
+//  ConcurrentChainedHashMap
+//
+//  Created by Thomas Mailund on 19/10/2026.
+//  Copyright © 2026 Thomas Mailund. All rights reserved.
+//
+
+#include "hash_map.h"
+#include <stdlib.h>
+
+#pragma mark epochs
+
+// Epoch-based reclamation. Readers announce the epoch they run in
+// while they look at the table. A link that is removed in epoch e
+// can be freed once the global epoch reaches e + 2, because then no
+// reader can still be looking at it. All threads share the epoch.
+
+struct epoch_record {
+    // (epoch << 1) | 1 while the thread reads the table, 0 otherwise
+    _Atomic uint64_t state;
+    atomic_bool in_use;
+    struct epoch_record *next;
+};
+
+static _Atomic uint64_t global_epoch = 1;
+static _Atomic(struct epoch_record *) records;
+static pthread_key_t record_key;
+static pthread_once_t record_key_once = PTHREAD_ONCE_INIT;
+static _Thread_local struct epoch_record *thread_record;
+
+// Called when a thread exits, so another thread can take the record.
+static void release_record(void *record)
+{
+    atomic_store(&((struct epoch_record *)record)->in_use, false);
+}
+
+static void make_record_key(void)
+{
+    pthread_key_create(&record_key, release_record);
+}
+
+static struct epoch_record *get_record(void)
+{
+    if (thread_record) return thread_record;
+
+    struct epoch_record *record = atomic_load(&records);
+    for (; record; record = record->next) {
+        bool free_record = false;
+        if (atomic_compare_exchange_strong(&record->in_use, &free_record, true))
+            break;
+    }
+    if (!record) {
+        record = (struct epoch_record *)malloc(sizeof(struct epoch_record));
+        atomic_init(&record->state, 0);
+        atomic_init(&record->in_use, true);
+        record->next = atomic_load(&records);
+        while (!atomic_compare_exchange_weak(&records, &record->next, record))
+            ;
+    }
+
+    pthread_once(&record_key_once, make_record_key);
+    pthread_setspecific(record_key, record);
+    thread_record = record;
+    return record;
+}
+
+static struct epoch_record *epoch_enter(void)
+{
+    struct epoch_record *record = get_record();
+    uint64_t epoch = atomic_load(&global_epoch);
+    atomic_store(&record->state, (epoch << 1) | 1);
+    atomic_thread_fence(memory_order_seq_cst);
+    return record;
+}
+
+static void epoch_exit(struct epoch_record *record)
+{
+    atomic_store_explicit(&record->state, 0, memory_order_release);
+}
+
+// Moves the global epoch forward if all readers have seen the
+// current one. Returns the global epoch.
+static uint64_t try_advance(void)
+{
+    uint64_t epoch = atomic_load(&global_epoch);
+    for (struct epoch_record *record = atomic_load(&records);
+         record; record = record->next) {
+        uint64_t state = atomic_load(&record->state);
+        if ((state & 1) && (state >> 1) != epoch)
+            return epoch;
+    }
+    atomic_compare_exchange_strong(&global_epoch, &epoch, epoch + 1);
+    return atomic_load(&global_epoch);
+}
+
+
+#pragma mark linked lists
+
+struct linked_list {
+    uint32_t hash_key;
+    void *key; void *val;
+    _Atomic(struct linked_list *) next;
+
+    // For reclamation
+    struct linked_list *retired_next;
+    uint64_t retired_epoch;
+};
+
+static struct linked_list *new_link(uint32_t hash_key, void *key, void *val,
+                                    struct linked_list *next)
+{
+    struct linked_list *link =
+    (struct linked_list *)malloc(sizeof(struct linked_list));
+    link->hash_key = hash_key;
+    link->key = key;
+    link->val = val;
+    atomic_init(&link->next, next);
+    return link;
+}
+
+static struct linked_list *
+find_link(_Atomic(struct linked_list *) *head,
+          uint32_t hash_key, void *key,
+          compare_func cmp)
+{
+    struct linked_list *link =
+    atomic_load_explicit(head, memory_order_acquire);
+    for (; link; link = atomic_load_explicit(&link->next, memory_order_acquire)) {
+        if (link->hash_key == hash_key && cmp(link->key, key))
+            return link;
+    }
+    return 0;
+}
+
+// Only writers call this, with the stripe lock held, so nobody
+// changes the list under us.
+static _Atomic(struct linked_list *) *
+get_previous_link(_Atomic(struct linked_list *) *head,
+                  uint32_t hash_key, void *key,
+                  compare_func cmp)
+{
+    _Atomic(struct linked_list *) *prev = head;
+    struct linked_list *link;
+    while ( (link = atomic_load_explicit(prev, memory_order_relaxed)) ) {
+        if (link->hash_key == hash_key && cmp(link->key, key))
+            return prev;
+        prev = &link->next;
+    }
+    return 0;
+}
+
+
+#pragma mark buckets
+
+struct buckets {
+    uint32_t size;
+    // For reclamation
+    struct buckets *retired_next;
+    uint64_t retired_epoch;
+    _Atomic(struct linked_list *) heads[];
+};
+
+static struct buckets *new_buckets(uint32_t size)
+{
+    // Using `calloc` sets all the list heads to null
+    struct buckets *buckets =
+    (struct buckets *)calloc(1, sizeof(struct buckets) +
+                             size * sizeof(struct linked_list *));
+    buckets->size = size;
+    return buckets;
+}
+
+static void delete_buckets(struct buckets *buckets)
+{
+    for (uint32_t i = 0; i < buckets->size; ++i) {
+        struct linked_list *link = atomic_load(&buckets->heads[i]);
+        while (link) {
+            struct linked_list *next = atomic_load(&link->next);
+            free(link);
+            link = next;
+        }
+    }
+    free(buckets);
+}
+
+
+#pragma mark hash map
+
+// How many links we let a stripe collect before we try to free them
+#define LIMBO_LIMIT 64
+
+static void reclaim_links(struct hash_map *table, struct stripe *stripe)
+{
+    uint64_t epoch = try_advance();
+    struct linked_list **prev = &stripe->limbo;
+    while (*prev) {
+        struct linked_list *link = *prev;
+        if (link->retired_epoch + 2 <= epoch) {
+            *prev = link->retired_next;
+            table->key_destructor(link->key);
+            table->val_destructor(link->val);
+            free(link);
+            stripe->no_limbo--;
+        } else {
+            prev = &link->retired_next;
+        }
+    }
+}
+
+// Call with the stripe lock held and after the link is unreachable.
+static void retire_link(struct hash_map *table, struct stripe *stripe,
+                        struct linked_list *link)
+{
+    link->retired_epoch = atomic_load(&global_epoch);
+    link->retired_next = stripe->limbo;
+    stripe->limbo = link;
+    if (++stripe->no_limbo % LIMBO_LIMIT == 0)
+        reclaim_links(table, stripe);
+}
+
+static void reclaim_buckets(struct hash_map *table)
+{
+    if (pthread_mutex_trylock(&table->reclaim_lock) != 0)
+        return; // someone else is on it
+
+    uint64_t epoch = try_advance();
+    struct buckets *buckets = atomic_load(&table->retired);
+    struct buckets *keep = 0;
+    while (buckets) {
+        struct buckets *next = buckets->retired_next;
+        if (buckets->retired_epoch + 2 <= epoch) {
+            delete_buckets(buckets);
+        } else {
+            buckets->retired_next = keep;
+            keep = buckets;
+        }
+        buckets = next;
+    }
+    atomic_store(&table->retired, keep);
+
+    pthread_mutex_unlock(&table->reclaim_lock);
+}
+
+static struct stripe *get_stripe(struct hash_map *table,
+                                 struct buckets *buckets,
+                                 uint32_t hash_key)
+{
+    uint32_t index = hash_key & (buckets->size - 1);
+    return &table->stripes[index & (NO_STRIPES - 1)];
+}
+
+// Locks the stripe the key belongs to in the current buckets.
+static struct stripe *lock_stripe(struct hash_map *table, uint32_t hash_key,
+                                  struct buckets **buckets)
+{
+    for (;;) {
+        struct buckets *current = atomic_load(&table->table);
+        struct stripe *stripe = get_stripe(table, current, hash_key);
+        pthread_mutex_lock(&stripe->lock);
+        // A resize needs all the locks, so if the buckets have not
+        // changed now, they will not change until we unlock.
+        if (atomic_load(&table->table) == current) {
+            *buckets = current;
+            return stripe;
+        }
+        pthread_mutex_unlock(&stripe->lock);
+    }
+}
+
+static uint32_t count_keys(struct hash_map *table)
+{
+    uint32_t used = 0;
+    for (int i = 0; i < NO_STRIPES; ++i) {
+        used += atomic_load_explicit(&table->stripes[i].used,
+                                     memory_order_relaxed);
+    }
+    return used;
+}
+
+static void resize(struct hash_map *table, uint32_t old_size, uint32_t new_size)
+{
+    if (new_size == 0) return;
+
+    for (int i = 0; i < NO_STRIPES; ++i) {
+        pthread_mutex_lock(&table->stripes[i].lock);
+    }
+
+    // Someone else might have resized while we waited for the locks
+    struct buckets *old_buckets = atomic_load(&table->table);
+    if (old_buckets->size != old_size) {
+        for (int i = 0; i < NO_STRIPES; ++i) {
+            pthread_mutex_unlock(&table->stripes[i].lock);
+        }
+        return;
+    }
+
+    // Copy the links to the new buckets. Readers might still be
+    // running through the old lists, so we cannot move the links.
+    struct buckets *buckets = new_buckets(new_size);
+    uint32_t used[NO_STRIPES] = { 0 };
+    for (uint32_t i = 0; i < old_size; ++i) {
+        struct linked_list *link = atomic_load(&old_buckets->heads[i]);
+        for (; link; link = atomic_load(&link->next)) {
+            uint32_t index = link->hash_key & (new_size - 1);
+            struct linked_list *head = atomic_load(&buckets->heads[index]);
+            atomic_store_explicit(&buckets->heads[index],
+                                  new_link(link->hash_key, link->key, link->val, head),
+                                  memory_order_relaxed);
+            used[index & (NO_STRIPES - 1)]++;
+        }
+    }
+    for (int i = 0; i < NO_STRIPES; ++i) {
+        atomic_store_explicit(&table->stripes[i].used, used[i],
+                              memory_order_relaxed);
+    }
+
+    // Publish the new buckets
+    atomic_store(&table->table, buckets);
+    for (int i = 0; i < NO_STRIPES; ++i) {
+        pthread_mutex_unlock(&table->stripes[i].lock);
+    }
+
+    // and get rid of the old when no reader can see them
+    pthread_mutex_lock(&table->reclaim_lock);
+    old_buckets->retired_epoch = atomic_load(&global_epoch);
+    old_buckets->retired_next = atomic_load(&table->retired);
+    atomic_store(&table->retired, old_buckets);
+    pthread_mutex_unlock(&table->reclaim_lock);
+}
+
+struct hash_map *new_map(uint32_t size,
+                         hash_func hash,
+                         compare_func key_cmp,
+                         destructor_func key_destructor,
+                         destructor_func val_destructor)
+{
+    struct hash_map *table =
+    (struct hash_map *)aligned_alloc(_Alignof(struct hash_map),
+                                     sizeof(struct hash_map));
+
+    atomic_init(&table->table, new_buckets(size));
+    for (int i = 0; i < NO_STRIPES; ++i) {
+        struct stripe *stripe = &table->stripes[i];
+        pthread_mutex_init(&stripe->lock, 0);
+        atomic_init(&stripe->used, 0);
+        stripe->limbo = 0;
+        stripe->no_limbo = 0;
+    }
+    pthread_mutex_init(&table->reclaim_lock, 0);
+    atomic_init(&table->retired, 0);
+
+    table->hash = hash;
+    table->key_cmp = key_cmp;
+    table->key_destructor = key_destructor;
+    table->val_destructor = val_destructor;
+
+    return table;
+}
+
+void delete_map(struct hash_map *table)
+{
+    struct buckets *buckets = atomic_load(&table->table);
+    for (uint32_t i = 0; i < buckets->size; ++i) {
+        struct linked_list *link = atomic_load(&buckets->heads[i]);
+        for (; link; link = atomic_load(&link->next)) {
+            table->key_destructor(link->key);
+            table->val_destructor(link->val);
+        }
+    }
+    delete_buckets(buckets);
+
+    // Nobody is reading any longer, so we can free everything
+    for (int i = 0; i < NO_STRIPES; ++i) {
+        struct stripe *stripe = &table->stripes[i];
+        while (stripe->limbo) {
+            struct linked_list *link = stripe->limbo;
+            stripe->limbo = link->retired_next;
+            table->key_destructor(link->key);
+            table->val_destructor(link->val);
+            free(link);
+        }
+        pthread_mutex_destroy(&stripe->lock);
+    }
+    buckets = atomic_load(&table->retired);
+    while (buckets) {
+        struct buckets *next = buckets->retired_next;
+        delete_buckets(buckets);
+        buckets = next;
+    }
+    pthread_mutex_destroy(&table->reclaim_lock);
+
+    free(table);
+}
+
+void map(struct hash_map *table, void *key, void *val)
+{
+    uint32_t hash_key = table->hash(key);
+    // We look at the buckets before we hold a lock
+    struct epoch_record *record = epoch_enter();
+    struct buckets *buckets;
+    struct stripe *stripe = lock_stripe(table, hash_key, &buckets);
+
+    _Atomic(struct linked_list *) *head =
+    &buckets->heads[hash_key & (buckets->size - 1)];
+    _Atomic(struct linked_list *) *prev =
+    get_previous_link(head, hash_key, key, table->key_cmp);
+
+    uint32_t used = 0;
+    if (prev) {
+        // Readers might be looking at the old link, so we replace it
+        // rather than update it.
+        struct linked_list *link = atomic_load_explicit(prev, memory_order_relaxed);
+        struct linked_list *next = atomic_load_explicit(&link->next, memory_order_relaxed);
+        atomic_store_explicit(prev, new_link(hash_key, key, val, next),
+                              memory_order_release);
+        retire_link(table, stripe, link);
+    } else {
+        struct linked_list *first = atomic_load_explicit(head, memory_order_relaxed);
+        atomic_store_explicit(head, new_link(hash_key, key, val, first),
+                              memory_order_release);
+        used = atomic_load_explicit(&stripe->used, memory_order_relaxed) + 1;
+        atomic_store_explicit(&stripe->used, used, memory_order_relaxed);
+    }
+
+    uint32_t size = buckets->size;
+    pthread_mutex_unlock(&stripe->lock);
+    epoch_exit(record);
+
+    // We only count all the keys when this stripe looks full.
+    if (used && (uint64_t)used * NO_STRIPES > size / 2 &&
+        count_keys(table) > size / 2)
+        resize(table, size, size * 2);
+
+    if (atomic_load_explicit(&table->retired, memory_order_relaxed))
+        reclaim_buckets(table);
+}
+
+bool contains_key(struct hash_map *table, void *key)
+{
+    uint32_t hash_key = table->hash(key);
+    struct epoch_record *record = epoch_enter();
+    struct buckets *buckets = atomic_load_explicit(&table->table, memory_order_acquire);
+    struct linked_list *link =
+    find_link(&buckets->heads[hash_key & (buckets->size - 1)],
+              hash_key, key, table->key_cmp);
+    epoch_exit(record);
+    return link != 0;
+}
+
+void *lookup(struct hash_map *table, void *key)
+{
+    uint32_t hash_key = table->hash(key);
+    struct epoch_record *record = epoch_enter();
+    struct buckets *buckets = atomic_load_explicit(&table->table, memory_order_acquire);
+    struct linked_list *link =
+    find_link(&buckets->heads[hash_key & (buckets->size - 1)],
+              hash_key, key, table->key_cmp);
+    void *val = link ? link->val : 0;
+    epoch_exit(record);
+    return val;
+}
+
+void delete_key(struct hash_map *table, void *key)
+{
+    uint32_t hash_key = table->hash(key);
+    // We look at the buckets before we hold a lock
+    struct epoch_record *record = epoch_enter();
+    struct buckets *buckets;
+    struct stripe *stripe = lock_stripe(table, hash_key, &buckets);
+
+    _Atomic(struct linked_list *) *head =
+    &buckets->heads[hash_key & (buckets->size - 1)];
+    _Atomic(struct linked_list *) *prev =
+    get_previous_link(head, hash_key, key, table->key_cmp);
+
+    bool deleted = false;
+    uint32_t used = atomic_load_explicit(&stripe->used, memory_order_relaxed);
+    if (prev) {
+        struct linked_list *link = atomic_load_explicit(prev, memory_order_relaxed);
+        struct linked_list *next = atomic_load_explicit(&link->next, memory_order_relaxed);
+        atomic_store_explicit(prev, next, memory_order_release);
+        retire_link(table, stripe, link);
+        atomic_store_explicit(&stripe->used, --used, memory_order_relaxed);
+        deleted = true;
+    }
+
+    uint32_t size = buckets->size;
+    pthread_mutex_unlock(&stripe->lock);
+    epoch_exit(record);
+
+    if (deleted && (uint64_t)used * NO_STRIPES < size / 8 &&
+        count_keys(table) < size / 8)
+        resize(table, size, size / 2);
+}
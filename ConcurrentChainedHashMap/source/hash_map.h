@@ -0,0 +1,67 @@
+//
+//  hash_map.h
+//  ConcurrentChainedHashMap
+//
+//  Created by Thomas Mailund on 19/10/2026.
+//  Copyright © 2026 Thomas Mailund. All rights reserved.
+//
+
+#ifndef hash_map_h
+#define hash_map_h
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <pthread.h>
+
+typedef uint32_t (*hash_func)(void *);
+typedef void (*destructor_func)(void *);
+typedef bool (*compare_func)(void *, void *);
+
+// Writers lock one of NO_STRIPES stripes of buckets. Must be a power
+// of two.
+#define NO_STRIPES 256
+
+struct stripe {
+    pthread_mutex_t lock;
+    _Atomic uint32_t used;
+    // links we have removed but that readers might still see
+    struct linked_list *limbo;
+    uint32_t no_limbo;
+} __attribute__((aligned(64)));
+
+struct hash_map {
+    _Atomic(struct buckets *) table;
+    struct stripe stripes[NO_STRIPES];
+
+    // old bucket arrays that readers might still see
+    pthread_mutex_t reclaim_lock;
+    _Atomic(struct buckets *) retired;
+
+    hash_func hash;
+    compare_func key_cmp;
+    destructor_func key_destructor;
+    destructor_func val_destructor;
+};
+
+// All operations except new_map and delete_map can be called from
+// any number of threads at the same time. Lookups never take locks.
+//
+// Replaced and deleted keys and values are destroyed once no thread
+// can see them any longer, but a value you got from lookup can be
+// destroyed if another thread deletes or replaces its key.
+struct hash_map *
+new_map           (uint32_t size, // Must be a power of two!
+                   hash_func hash,
+                   compare_func key_cmp,
+                   destructor_func key_destructor,
+                   destructor_func val_destructor);
+void  delete_map  (struct hash_map *table);
+
+void  map          (struct hash_map *table,
+                    void *key, void *val);
+void *lookup       (struct hash_map *table, void *key);
+bool  contains_key (struct hash_map *table, void *key);
+void  delete_key   (struct hash_map *table, void *key);
+
+#endif /* hash_map_h */
@@ -0,0 +1,103 @@
+//
+//  main.c
+//  Benchmark
+//
+//  Created by Thomas Mailund on 19/10/2026.
+//  Copyright © 2026 Thomas Mailund. All rights reserved.
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <math.h>
+#include <pthread.h>
+#include "hash_map.h"
+
+static double now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static uint64_t next_random(uint64_t *state)
+{
+    uint64_t z = (*state += 0x9e3779b97f4a7c15);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111eb;
+    return z ^ (z >> 31);
+}
+
+struct thread_data {
+    struct hash_map *table;
+    const uint64_t *keys;
+    int no_ops;
+    bool buffered;
+};
+
+static void *incrementer(void *arg)
+{
+    struct thread_data *data = (struct thread_data *)arg;
+    if (data->buffered) {
+        struct increment_buffer *buffer = new_increment_buffer(data->table, 1024);
+        for (int i = 0; i < data->no_ops; ++i) {
+            buffered_increment(buffer, data->keys[i], 1);
+        }
+        delete_increment_buffer(buffer);
+    } else {
+        for (int i = 0; i < data->no_ops; ++i) {
+            increment(data->table, data->keys[i], 1);
+        }
+    }
+    return 0;
+}
+
+static double run(const uint64_t *keys, int total_ops,
+                  int no_threads, bool buffered)
+{
+    struct hash_map *table = new_map(1024);
+    pthread_t threads[no_threads];
+    struct thread_data data[no_threads];
+    int per_thread = total_ops / no_threads;
+    double begin = now();
+    for (int i = 0; i < no_threads; ++i) {
+        data[i].table = table;
+        data[i].keys = keys + i * per_thread;
+        data[i].no_ops = per_thread;
+        data[i].buffered = buffered;
+        pthread_create(&threads[i], 0, incrementer, &data[i]);
+    }
+    for (int i = 0; i < no_threads; ++i) {
+        pthread_join(threads[i], 0);
+    }
+    double elapsed = now() - begin;
+    delete_map(table);
+    return total_ops / elapsed * 1e-6;
+}
+
+// Counts keys drawn from a Zipf-like distribution over a million keys,
+// so a few hot keys get most of the increments, with and without
+// thread-local buffers.
+int main(int argc, const char *argv[])
+{
+    int total_ops = 1 << 24;
+    if (argc > 1) total_ops = atoi(argv[1]);
+
+    uint64_t state = 1;
+    uint64_t *keys = malloc(total_ops * sizeof(uint64_t));
+    for (int i = 0; i < total_ops; ++i) {
+        double u = (next_random(&state) >> 11) * 0x1.0p-53;
+        keys[i] = (uint64_t)pow(1e6, u) + 1; // key k has weight 1/k
+    }
+
+    for (int no_threads = 1; no_threads <= 64; no_threads *= 2) {
+        printf("%2d threads: %7.2f Mincrements/s direct, "
+               "%7.2f Mincrements/s buffered\n",
+               no_threads,
+               run(keys, total_ops, no_threads, false),
+               run(keys, total_ops, no_threads, true));
+    }
+
+    free(keys);
+    return EXIT_SUCCESS;
+}
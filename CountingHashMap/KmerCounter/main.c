@@ -0,0 +1,101 @@
+//
+//  main.c
+//  KmerCounter
+//
+//  Created by Thomas Mailund on 19/10/2026.
+//  Copyright © 2026 Thomas Mailund. All rights reserved.
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "hash_map.h"
+#include "kmers.h"
+
+// Counts the k-mers in a FASTA or FASTQ file:
+//
+//     kmers [-k k] [-t threads] [-f] [-o output] [-b] file
+//
+// -f counts forward k-mers instead of canonical k-mers, and -o writes
+// the sorted counts to a file. With -b, we count the file with 1, 2,
+// 4, ... up to the given number of threads and report the k-mers per
+// second for each.
+
+static double now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static void usage(const char *name)
+{
+    fprintf(stderr, "Usage: %s [-k k] [-t threads] [-f] [-o output] [-b] file\n", name);
+    exit(EXIT_FAILURE);
+}
+
+static struct hash_map *count(const char *path, int k, bool canonical,
+                              int no_threads, uint64_t *no_kmers,
+                              double *seconds)
+{
+    struct hash_map *table = new_map(1 << 16);
+    double begin = now();
+    if (!count_kmers_in_file(table, path, k, canonical, no_threads, no_kmers)) {
+        perror(path);
+        exit(EXIT_FAILURE);
+    }
+    *seconds = now() - begin;
+    return table;
+}
+
+static void count_distinct(uint64_t kmer, uint64_t count, void *data)
+{
+    (*(uint64_t *)data)++;
+}
+
+int main(int argc, char *argv[])
+{
+    int k = 21, no_threads = 1;
+    bool canonical = true, benchmark = false;
+    const char *output = 0;
+    int opt;
+    while ((opt = getopt(argc, argv, "k:t:fo:b")) != -1) {
+        switch (opt) {
+            case 'k': k = atoi(optarg); break;
+            case 't': no_threads = atoi(optarg); break;
+            case 'f': canonical = false; break;
+            case 'o': output = optarg; break;
+            case 'b': benchmark = true; break;
+            default: usage(argv[0]);
+        }
+    }
+    if (optind != argc - 1 || k < 1 || k > MAX_K || no_threads < 1)
+        usage(argv[0]);
+    const char *path = argv[optind];
+
+    uint64_t no_kmers;
+    double seconds;
+    if (benchmark) {
+        for (int threads = 1; threads <= no_threads; threads *= 2) {
+            delete_map(count(path, k, canonical, threads, &no_kmers, &seconds));
+            printf("%2d threads: %7.2f M k-mers/s\n",
+                   threads, no_kmers / seconds * 1e-6);
+        }
+        return EXIT_SUCCESS;
+    }
+
+    struct hash_map *table = count(path, k, canonical, no_threads, &no_kmers, &seconds);
+    uint64_t distinct = 0;
+    for_each(table, count_distinct, &distinct);
+    fprintf(stderr, "%llu %d-mers, %llu distinct, %.3f s, %.2f M k-mers/s\n",
+            (unsigned long long)no_kmers, k, (unsigned long long)distinct,
+            seconds, no_kmers / seconds * 1e-6);
+    if (output && !write_kmer_counts(table, k, output)) {
+        perror(output);
+        return EXIT_FAILURE;
+    }
+    delete_map(table);
+    return EXIT_SUCCESS;
+}
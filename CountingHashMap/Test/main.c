@@ -0,0 +1,293 @@
+//
+//  main.c
+//  Test
+//
+//  Created by Thomas Mailund on 19/10/2026.
+//  Copyright © 2026 Thomas Mailund. All rights reserved.
+//
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <pthread.h>
+#include <unistd.h>
+#include "hash_map.h"
+#include "kmers.h"
+
+static uint64_t random_key()
+{
+    return ((uint64_t)random() << 32) ^ (uint64_t)random();
+}
+
+#define NO_THREADS 8
+#define NO_KEYS 20000
+
+struct thread_data {
+    struct hash_map *table;
+    int thread;
+    bool buffered;
+};
+
+// All threads count all keys, key k by k + 1, so the threads fight
+// over the same bins while the table resizes.
+static void *incrementer(void *arg)
+{
+    struct thread_data *data = (struct thread_data *)arg;
+    struct increment_buffer *buffer = 0;
+    if (data->buffered) buffer = new_increment_buffer(data->table, 64);
+    for (uint64_t i = 0; i < NO_KEYS; ++i) {
+        uint64_t key = (i + data->thread * NO_KEYS / NO_THREADS) % NO_KEYS;
+        if (buffer) {
+            buffered_increment(buffer, key, key + 1);
+        } else {
+            increment(data->table, key, key + 1);
+            assert(lookup(data->table, key) >= key + 1);
+        }
+    }
+    if (buffer) delete_increment_buffer(buffer);
+    return 0;
+}
+
+static void concurrent_test(bool buffered)
+{
+    struct hash_map *table = new_map(2);
+
+    pthread_t threads[NO_THREADS];
+    struct thread_data data[NO_THREADS];
+    for (int i = 0; i < NO_THREADS; ++i) {
+        data[i].table = table;
+        data[i].thread = i;
+        data[i].buffered = buffered;
+        pthread_create(&threads[i], 0, incrementer, &data[i]);
+    }
+    for (int i = 0; i < NO_THREADS; ++i) {
+        pthread_join(threads[i], 0);
+    }
+
+    // No increment may get lost, or counted twice, when we resize
+    for (uint64_t key = 0; key < NO_KEYS; ++key) {
+        assert(lookup(table, key) == NO_THREADS * (key + 1));
+    }
+    assert(!contains_key(table, NO_KEYS));
+
+    delete_map(table);
+}
+
+struct sum {
+    uint64_t no_keys;
+    uint64_t total;
+};
+
+static void sum_counts(uint64_t key, uint64_t count, void *data)
+{
+    struct sum *sum = (struct sum *)data;
+    sum->no_keys++;
+    sum->total += count;
+}
+
+#pragma mark k-mers
+
+static int cmp_kmers(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+    return (x > y) - (x < y);
+}
+
+// Adds all the k-mers in a sequence to kmers, the slow way
+static int reference_kmers(const char *seq, int len, int k, bool canonical,
+                           uint64_t *kmers)
+{
+    int n = 0;
+    for (int i = 0; i + k <= len; ++i) {
+        uint64_t kmer;
+        if (!encode_kmer(seq + i, k, &kmer)) continue;
+        kmers[n++] = canonical ? canonical_kmer(kmer, k) : kmer;
+    }
+    return n;
+}
+
+// Random sequences, mostly ACGT, but with lower case and Ns, written
+// as FASTA with 60 bases per line or as FASTQ.
+#define NO_RECORDS 200
+#define MAX_SEQ 400
+
+static size_t random_sequences(char *data, bool fastq, int k, bool canonical,
+                               uint64_t *kmers, int *no_kmers)
+{
+    size_t size = 0;
+    char seq[MAX_SEQ];
+    *no_kmers = 0;
+    for (int r = 0; r < NO_RECORDS; ++r) {
+        int len = random() % MAX_SEQ;
+        for (int i = 0; i < len; ++i) {
+            seq[i] = "ACGTACGTACGTacgtN"[random() % 17];
+        }
+        *no_kmers += reference_kmers(seq, len, k, canonical, kmers + *no_kmers);
+        if (fastq) {
+            size += sprintf(data + size, "@read%d\n%.*s\n+\n", r, len, seq);
+            // Quality lines can start with '@' or '+'
+            for (int i = 0; i < len; ++i) {
+                data[size++] = "@+!#AJ"[random() % 6];
+            }
+            data[size++] = '\n';
+        } else {
+            size += sprintf(data + size, ">sequence %d\n", r);
+            for (int i = 0; i < len; i += 60) {
+                int line = len - i < 60 ? len - i : 60;
+                size += sprintf(data + size, "%.*s\n", line, seq + i);
+            }
+        }
+    }
+    qsort(kmers, *no_kmers, sizeof(uint64_t), cmp_kmers);
+    return size;
+}
+
+static void kmer_counting_test(bool fastq, int k, bool canonical)
+{
+    char *data = malloc(NO_RECORDS * (2 * MAX_SEQ + 32));
+    uint64_t *expected = malloc(NO_RECORDS * MAX_SEQ * sizeof(uint64_t));
+    int no_expected;
+    size_t size = random_sequences(data, fastq, k, canonical, expected, &no_expected);
+
+    char path[] = "/tmp/kmersXXXXXX";
+    close(mkstemp(path));
+    for (int no_threads = 1; no_threads <= 7; no_threads += 3) {
+        struct hash_map *table = new_map(16);
+        assert(count_kmers(table, data, size, k, canonical, no_threads) == no_expected);
+        assert(write_kmer_counts(table, k, path));
+        delete_map(table);
+
+        // The counts come back sorted
+        int file_k; uint64_t n, *kmers, *counts;
+        assert(read_kmer_counts(path, &file_k, &n, &kmers, &counts));
+        assert(file_k == k);
+        int j = 0;
+        for (uint64_t i = 0; i < n; ++i) {
+            assert(i == 0 || kmers[i - 1] < kmers[i]);
+            for (uint64_t c = 0; c < counts[i]; ++c) {
+                assert(expected[j++] == kmers[i]);
+            }
+        }
+        assert(j == no_expected);
+        free(kmers);
+        free(counts);
+    }
+    unlink(path);
+    free(data);
+    free(expected);
+}
+
+static void kmer_test()
+{
+    char bases[MAX_K];
+    uint64_t kmer;
+    assert(encode_kmer("ACGT", 4, &kmer) && kmer == 0x1b);
+    assert(!encode_kmer("ACNT", 4, &kmer));
+    assert(encode_kmer("AACG", 4, &kmer));
+    decode_kmer(reverse_complement(kmer, 4), 4, bases);
+    assert(memcmp(bases, "CGTT", 4) == 0);
+    assert(canonical_kmer(kmer, 4) == kmer);
+
+    for (int k = 1; k <= MAX_K; ++k) {
+        for (int i = 0; i < 100; ++i) {
+            uint64_t x = random_key();
+            if (k < 32) x &= (UINT64_C(1) << (2 * k)) - 1;
+            decode_kmer(x, k, bases);
+            assert(encode_kmer(bases, k, &kmer) && kmer == x);
+            assert(reverse_complement(reverse_complement(x, k), k) == x);
+            // The reverse complement, the slow way
+            char rc[MAX_K];
+            for (int j = 0; j < k; ++j) {
+                switch (bases[k - 1 - j]) {
+                    case 'A': rc[j] = 'T'; break;
+                    case 'C': rc[j] = 'G'; break;
+                    case 'G': rc[j] = 'C'; break;
+                    case 'T': rc[j] = 'A'; break;
+                }
+            }
+            assert(encode_kmer(rc, k, &kmer) && kmer == reverse_complement(x, k));
+        }
+    }
+
+    kmer_counting_test(false, 5, true);
+    kmer_counting_test(false, 21, true);
+    kmer_counting_test(false, 32, false);
+    kmer_counting_test(true, 7, true);
+    kmer_counting_test(true, 31, false);
+}
+
+int main(int argc, const char *argv[])
+{
+    int no_elms = 1000;
+    uint64_t keys[no_elms];
+    for (int i = 0; i < no_elms; ++i) {
+        keys[i] = random_key();
+    }
+    uint64_t different_keys[no_elms];
+    for (int i = 0; i < no_elms; ++i) {
+        different_keys[i] = random_key();
+    }
+
+    struct hash_map *table = new_map(2);
+    for (int i = 0; i < no_elms; ++i) {
+        increment(table, keys[i], 1);
+    }
+    for (int i = 0; i < no_elms; ++i) {
+        assert(contains_key(table, keys[i]));
+        assert(lookup(table, keys[i]) == 1);
+        increment(table, keys[i], i);
+    }
+    for (int i = 0; i < no_elms; ++i) {
+        assert(lookup(table, keys[i]) == i + 1);
+    }
+    for (int i = 0; i < no_elms; ++i) {
+        assert(!contains_key(table, different_keys[i]));
+        assert(lookup(table, different_keys[i]) == 0);
+    }
+
+    // The keys we use as markers in the bins
+    assert(!contains_key(table, 0));
+    assert(!contains_key(table, UINT64_MAX));
+    increment(table, 0, 2);
+    increment(table, UINT64_MAX, 3);
+    increment(table, 0, 2);
+    assert(contains_key(table, 0));
+    assert(contains_key(table, UINT64_MAX));
+    assert(lookup(table, 0) == 4);
+    assert(lookup(table, UINT64_MAX) == 3);
+
+    struct sum sum = { 0, 0 };
+    for_each(table, sum_counts, &sum);
+    assert(sum.no_keys == no_elms + 2);
+    assert(sum.total == (uint64_t)no_elms * (no_elms + 1) / 2 + 7);
+
+    delete_map(table);
+
+    // Buffered increments only reach the map when we flush
+    table = new_map(2);
+    struct increment_buffer *buffer = new_increment_buffer(table, 16);
+    buffered_increment(buffer, 42, 1);
+    buffered_increment(buffer, 42, 1);
+    assert(!contains_key(table, 42));
+    flush_increments(buffer);
+    assert(lookup(table, 42) == 2);
+    for (int i = 0; i < no_elms; ++i) {
+        buffered_increment(buffer, keys[i], 1);
+    }
+    delete_increment_buffer(buffer);
+    for (int i = 0; i < no_elms; ++i) {
+        assert(lookup(table, keys[i]) == 1);
+    }
+    delete_map(table);
+
+    concurrent_test(false);
+    concurrent_test(true);
+
+    kmer_test();
+
+    printf("SUCCESS\n");
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,398 @@
+//
+//  hash_map.c
+//  CountingHashMap
+//
+//  Created by Thomas Mailund on 19/10/2026.
+//  Copyright © 2026 Thomas Mailund. All rights reserved.
+//
+
+#include <stdlib.h>
+#include <stddef.h>
+#include <string.h>
+#include <sched.h>
+#include "hash_map.h"
+
+// Markers in the key bins. Users can still count these two keys; we
+// keep track of them in the map itself.
+#define EMPTY 0
+#define MOVED UINT64_MAX
+
+// Set in a count when its key has moved to the next bins
+#define FROZEN (UINT64_C(1) << 63)
+
+// Number of bins a thread moves at a time when we resize
+#define CHUNK_SIZE 1024
+
+// Each thread counts keys in one of these counters, so the threads
+// do not all fight over the same cache line. Must be a power of two.
+#define NO_COUNTERS 64
+
+struct counter {
+    _Atomic uint32_t value;
+} __attribute__((aligned(64)));
+
+// Key and count share a cache line, so an increment only touches one.
+// The bins are 16 bytes, at a multiple of 16 from the cache-aligned
+// start of struct bins, so no bin straddles two cache lines.
+struct bin {
+    _Atomic uint64_t key;
+    _Atomic uint64_t count;
+} __attribute__((aligned(16)));
+
+struct bins {
+    uint32_t size;
+    struct counter used[NO_COUNTERS];
+
+    // For resizing
+    _Atomic(struct bins *) next;
+    _Atomic uint32_t next_chunk;
+    _Atomic uint32_t chunks_done;
+    // The bins we moved away from. Threads might still look at them,
+    // so we only free them with the map.
+    struct bins *older;
+
+    struct bin bins[];
+};
+
+// The finaliser from MurmurHash3
+static uint64_t mix(uint64_t x)
+{
+    x ^= x >> 33;
+    x *= 0xff51afd7ed558ccd;
+    x ^= x >> 33;
+    x *= 0xc4ceb9fe1a85ec53;
+    x ^= x >> 33;
+    return x;
+}
+
+static uint32_t
+p(uint32_t k, uint32_t i, uint32_t m)
+{
+    return (k + i) & (m - 1);
+}
+
+static struct bins *new_bins(uint32_t size)
+{
+    size_t bytes = offsetof(struct bins, bins) + size * sizeof(struct bin);
+    bytes = (bytes + _Alignof(struct bins) - 1) & ~(_Alignof(struct bins) - 1);
+    struct bins *bins =
+    (struct bins *)aligned_alloc(_Alignof(struct bins), bytes);
+    // All bins EMPTY with count zero, and all counters zero
+    memset(bins, 0, bytes);
+    bins->size = size;
+    return bins;
+}
+
+#pragma mark counting keys
+
+static _Atomic uint32_t next_counter;
+static _Thread_local int32_t thread_counter = -1;
+
+static struct counter *get_counter(struct bins *bins)
+{
+    if (thread_counter < 0) {
+        thread_counter = atomic_fetch_add(&next_counter, 1) & (NO_COUNTERS - 1);
+    }
+    return &bins->used[thread_counter];
+}
+
+static uint32_t count_keys(struct bins *bins)
+{
+    uint32_t used = 0;
+    for (int i = 0; i < NO_COUNTERS; ++i) {
+        used += atomic_load_explicit(&bins->used[i].value, memory_order_relaxed);
+    }
+    return used;
+}
+
+// Counts a new key and tells us if it is time to resize.
+static bool add_key(struct bins *bins)
+{
+    uint32_t used =
+    atomic_fetch_add_explicit(&get_counter(bins)->value, 1,
+                              memory_order_relaxed) + 1;
+    if (bins->size > NO_COUNTERS * CHUNK_SIZE && used % 16 != 0)
+        return false;
+    if ((uint64_t)used * NO_COUNTERS <= bins->size / 2)
+        return false;
+    return count_keys(bins) > bins->size / 2;
+}
+
+#pragma mark resizing
+
+// Only called when we move keys into bins nobody else increments in
+// yet, and the keys are unique, so we do not need to check for them.
+static void move_key(struct bins *bins, uint64_t key, uint64_t count)
+{
+    uint32_t hash_key = (uint32_t)mix(key);
+    for (uint32_t i = 0; ; ++i) {
+        uint64_t expected = EMPTY;
+        struct bin *bin = &bins->bins[p(hash_key, i, bins->size)];
+        if (atomic_compare_exchange_strong(&bin->key, &expected, key)) {
+            atomic_store(&bin->count, count);
+            atomic_fetch_add_explicit(&get_counter(bins)->value, 1,
+                                      memory_order_relaxed);
+            return;
+        }
+    }
+}
+
+static void move_chunk(struct bins *bins, struct bins *next, uint32_t chunk)
+{
+    uint32_t begin = chunk * CHUNK_SIZE;
+    uint32_t end = begin + CHUNK_SIZE;
+    if (end > bins->size) end = bins->size;
+    for (uint32_t i = begin; i < end; ++i) {
+        struct bin *bin = &bins->bins[i];
+        uint64_t key = EMPTY;
+        if (atomic_compare_exchange_strong(&bin->key, &key, MOVED))
+            continue;
+        // The bin has a key. Once we freeze the count, increments
+        // go to the next bins instead, so the count we get here is
+        // the last one this bin will have.
+        uint64_t count = atomic_fetch_or(&bin->count, FROZEN);
+        move_key(next, key, count & ~FROZEN);
+    }
+}
+
+// Moves chunks until there are no more, then waits for the other
+// threads to finish theirs. Returns the new bins.
+static struct bins *help_resize(struct hash_map *table, struct bins *bins)
+{
+    struct bins *next = atomic_load(&bins->next);
+    uint32_t no_chunks = (bins->size + CHUNK_SIZE - 1) / CHUNK_SIZE;
+    uint32_t chunk;
+    while ((chunk = atomic_fetch_add(&bins->next_chunk, 1)) < no_chunks) {
+        move_chunk(bins, next, chunk);
+        atomic_fetch_add(&bins->chunks_done, 1);
+    }
+    while (atomic_load(&bins->chunks_done) < no_chunks) {
+        sched_yield();
+    }
+
+    struct bins *expected = bins;
+    atomic_compare_exchange_strong(&table->table, &expected, next);
+    return next;
+}
+
+static struct bins *resize(struct hash_map *table, struct bins *bins)
+{
+    struct bins *next = atomic_load(&bins->next);
+    if (!next) {
+        struct bins *new_next = new_bins(2 * bins->size);
+        new_next->older = bins;
+        if (!atomic_compare_exchange_strong(&bins->next, &next, new_next))
+            free(new_next); // someone beat us to it
+    }
+    return help_resize(table, bins);
+}
+
+#pragma mark map
+
+struct hash_map *new_map(uint32_t size)
+{
+    struct hash_map *table =
+    (struct hash_map *)malloc(sizeof(struct hash_map));
+    atomic_init(&table->table, new_bins(size));
+    atomic_init(&table->has_empty_key, false);
+    atomic_init(&table->has_moved_key, false);
+    atomic_init(&table->empty_key_count, 0);
+    atomic_init(&table->moved_key_count, 0);
+    return table;
+}
+
+void delete_map(struct hash_map *table)
+{
+    struct bins *bins = atomic_load(&table->table);
+    while (bins) {
+        struct bins *older = bins->older;
+        free(bins);
+        bins = older;
+    }
+    free(table);
+}
+
+enum increment_result {
+    INCREMENTED,
+    NEW_KEY,
+    MUST_RESIZE
+};
+
+static enum increment_result
+increment_bins(struct bins *bins, uint64_t key, uint64_t delta)
+{
+    uint32_t hash_key = (uint32_t)mix(key);
+    for (uint32_t i = 0; i < bins->size; ++i) {
+        struct bin *bin = &bins->bins[p(hash_key, i, bins->size)];
+        uint64_t bin_key = atomic_load(&bin->key);
+        bool claimed = false;
+        if (bin_key == EMPTY) {
+            claimed = atomic_compare_exchange_strong(&bin->key, &bin_key, key);
+            // if someone else got the bin first, bin_key now holds
+            // what they put there
+            if (claimed) bin_key = key;
+        }
+        if (bin_key == MOVED) return MUST_RESIZE;
+        if (bin_key == key) {
+            uint64_t old = atomic_fetch_add(&bin->count, delta);
+            // If the count was frozen, the bins are being moved and
+            // the delta must go to the next bins.
+            if (old & FROZEN) return MUST_RESIZE;
+            return claimed ? NEW_KEY : INCREMENTED;
+        }
+    }
+    return MUST_RESIZE; // the table is full
+}
+
+void increment(struct hash_map *table, uint64_t key, uint64_t delta)
+{
+    if (key == EMPTY) {
+        atomic_fetch_add(&table->empty_key_count, delta);
+        atomic_store(&table->has_empty_key, true);
+        return;
+    }
+    if (key == MOVED) {
+        atomic_fetch_add(&table->moved_key_count, delta);
+        atomic_store(&table->has_moved_key, true);
+        return;
+    }
+
+    struct bins *bins = atomic_load(&table->table);
+    for (;;) {
+        switch (increment_bins(bins, key, delta)) {
+            case NEW_KEY:
+                if (add_key(bins)) resize(table, bins);
+                return;
+            case INCREMENTED:
+                return;
+            case MUST_RESIZE:
+                bins = resize(table, bins);
+                break;
+        }
+    }
+}
+
+// Finds the key's bin, or returns null if the key is not there.
+static struct bin *find_bin(struct hash_map *table, uint64_t key)
+{
+    struct bins *bins = atomic_load(&table->table);
+    uint32_t hash_key = (uint32_t)mix(key);
+    for (uint32_t i = 0; i < bins->size; ++i) {
+        struct bin *bin = &bins->bins[p(hash_key, i, bins->size)];
+        uint64_t bin_key = atomic_load(&bin->key);
+        if (bin_key == EMPTY) return 0;
+        if (bin_key == key && !(atomic_load(&bin->count) & FROZEN))
+            return bin;
+        if (bin_key == MOVED || bin_key == key) {
+            // The key might be in the new bins, but only once all
+            // keys are moved.
+            bins = help_resize(table, bins);
+            i = -1;
+        }
+    }
+    return 0;
+}
+
+uint64_t lookup(struct hash_map *table, uint64_t key)
+{
+    if (key == EMPTY)
+        return atomic_load(&table->empty_key_count);
+    if (key == MOVED)
+        return atomic_load(&table->moved_key_count);
+
+    for (;;) {
+        struct bin *bin = find_bin(table, key);
+        if (!bin) return 0;
+        uint64_t count = atomic_load(&bin->count);
+        // Increments can still land on a frozen count, so we must
+        // get it from the next bins instead.
+        if (!(count & FROZEN)) return count;
+    }
+}
+
+bool contains_key(struct hash_map *table, uint64_t key)
+{
+    if (key == EMPTY)
+        return atomic_load(&table->has_empty_key);
+    if (key == MOVED)
+        return atomic_load(&table->has_moved_key);
+
+    return find_bin(table, key) != 0;
+}
+
+void for_each(struct hash_map *table, for_each_func f, void *data)
+{
+    if (atomic_load(&table->has_empty_key))
+        f(EMPTY, atomic_load(&table->empty_key_count), data);
+    if (atomic_load(&table->has_moved_key))
+        f(MOVED, atomic_load(&table->moved_key_count), data);
+
+    struct bins *bins = atomic_load(&table->table);
+    for (uint32_t i = 0; i < bins->size; ++i) {
+        uint64_t key = atomic_load_explicit(&bins->bins[i].key,
+                                            memory_order_relaxed);
+        if (key != EMPTY && key != MOVED)
+            f(key, atomic_load_explicit(&bins->bins[i].count,
+                                        memory_order_relaxed), data);
+    }
+}
+
+#pragma mark buffered increments
+
+struct increment_buffer *
+new_increment_buffer(struct hash_map *table, uint32_t size)
+{
+    struct increment_buffer *buffer =
+    (struct increment_buffer *)malloc(sizeof(struct increment_buffer));
+    buffer->table = table;
+    buffer->size = size;
+    buffer->used = 0;
+    buffer->keys = (uint64_t *)malloc(size * sizeof(uint64_t));
+    buffer->deltas = (uint64_t *)calloc(size, sizeof(uint64_t));
+    return buffer;
+}
+
+void delete_increment_buffer(struct increment_buffer *buffer)
+{
+    flush_increments(buffer);
+    free(buffer->keys);
+    free(buffer->deltas);
+    free(buffer);
+}
+
+void buffered_increment(struct increment_buffer *buffer,
+                        uint64_t key, uint64_t delta)
+{
+    // A zero delta marks an empty bin, so we cannot buffer it.
+    if (delta == 0) {
+        increment(buffer->table, key, delta);
+        return;
+    }
+
+    uint32_t hash_key = (uint32_t)mix(key);
+    for (uint32_t i = 0; ; ++i) {
+        uint32_t index = p(hash_key, i, buffer->size);
+        if (buffer->deltas[index] == 0) {
+            buffer->keys[index] = key;
+            buffer->deltas[index] = delta;
+            if (++buffer->used > buffer->size / 2)
+                flush_increments(buffer);
+            return;
+        }
+        if (buffer->keys[index] == key) {
+            buffer->deltas[index] += delta;
+            return;
+        }
+    }
+}
+
+void flush_increments(struct increment_buffer *buffer)
+{
+    for (uint32_t i = 0; i < buffer->size; ++i) {
+        if (buffer->deltas[i]) {
+            increment(buffer->table, buffer->keys[i], buffer->deltas[i]);
+            buffer->deltas[i] = 0;
+        }
+    }
+    buffer->used = 0;
+}
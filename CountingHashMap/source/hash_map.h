@@ -0,0 +1,68 @@
+//
+//  hash_map.h
+//  CountingHashMap
+//
+//  Created by Thomas Mailund on 19/10/2026.
+//  Copyright © 2026 Thomas Mailund. All rights reserved.
+//
+
+#ifndef hash_map_h
+#define hash_map_h
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+
+// Linear probing map from 64-bit keys to 64-bit counts that any number
+// of threads can increment at the same time. Keys and counts live
+// directly in the bins. Threads claim bins for new keys with
+// compare-and-swap and add to counts with fetch-and-add, so they never
+// take a lock.
+//
+// When the table gets full, the threads move the keys to a larger
+// table together, as in LockFreeHashSet. A count is frozen when its key
+// is moved, and an increment that finds its count frozen is done again
+// in the new table. Counts must stay below 2^63.
+
+struct hash_map {
+    _Atomic(struct bins *) table;
+    // The two keys we use as markers in the bins
+    atomic_bool has_empty_key, has_moved_key;
+    _Atomic uint64_t empty_key_count, moved_key_count;
+};
+
+typedef void (*for_each_func)(uint64_t key, uint64_t count, void *data);
+
+struct hash_map *
+new_map          (uint32_t size); // Must be a power of two!
+void  delete_map (struct hash_map *table);
+
+// Adds delta to the key's count. Keys we have not seen count zero.
+void     increment   (struct hash_map *table, uint64_t key, uint64_t delta);
+uint64_t lookup      (struct hash_map *table, uint64_t key);
+bool     contains_key(struct hash_map *table, uint64_t key);
+
+// Calls f on all keys. No thread may increment while we do.
+void  for_each   (struct hash_map *table, for_each_func f, void *data);
+
+// A thread can collect its increments in a small local table and add
+// them to the map in batches. Hot keys then only touch the shared
+// bins once per batch. Each thread needs its own buffer, and the
+// counts in the map are only up to date once the buffer is flushed.
+struct increment_buffer {
+    struct hash_map *table;
+    uint32_t size, used;
+    uint64_t *keys;
+    uint64_t *deltas; // zero for empty bins
+};
+
+struct increment_buffer *
+new_increment_buffer   (struct hash_map *table,
+                        uint32_t size); // Must be a power of two!
+// Flushes the buffer before it deletes it.
+void delete_increment_buffer(struct increment_buffer *buffer);
+void buffered_increment(struct increment_buffer *buffer,
+                        uint64_t key, uint64_t delta);
+void flush_increments  (struct increment_buffer *buffer);
+
+#endif /* hash_map_h */
@@ -0,0 +1,389 @@
+//
+//  kmers.c
+//  CountingHashMap
+//
+//  Created by Thomas Mailund on 19/10/2026.
+//  Copyright © 2026 Thomas Mailund. All rights reserved.
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "kmers.h"
+
+// Size of the threads' increment buffers
+#define BUFFER_SIZE 4096
+
+static const int8_t base_codes[256] = {
+    [0 ... 255] = -1,
+    ['A'] = 0, ['C'] = 1, ['G'] = 2, ['T'] = 3,
+    ['a'] = 0, ['c'] = 1, ['g'] = 2, ['t'] = 3,
+};
+
+static uint64_t kmer_mask(int k)
+{
+    return k == 32 ? UINT64_MAX : (UINT64_C(1) << (2 * k)) - 1;
+}
+
+#pragma mark k-mers
+
+bool encode_kmer(const char *bases, int k, uint64_t *kmer)
+{
+    uint64_t x = 0;
+    for (int i = 0; i < k; ++i) {
+        int code = base_codes[(uint8_t)bases[i]];
+        if (code < 0) return false;
+        x = (x << 2) | code;
+    }
+    *kmer = x;
+    return true;
+}
+
+void decode_kmer(uint64_t kmer, int k, char *bases)
+{
+    for (int i = k - 1; i >= 0; --i) {
+        bases[i] = "ACGT"[kmer & 3];
+        kmer >>= 2;
+    }
+}
+
+uint64_t reverse_complement(uint64_t kmer, int k)
+{
+    // Complementing is flipping the bits, and then we reverse the
+    // order of the two-bit bases.
+    uint64_t x = ~kmer;
+    x = ((x >> 2) & 0x3333333333333333) | ((x & 0x3333333333333333) << 2);
+    x = ((x >> 4) & 0x0f0f0f0f0f0f0f0f) | ((x & 0x0f0f0f0f0f0f0f0f) << 4);
+    x = ((x >> 8) & 0x00ff00ff00ff00ff) | ((x & 0x00ff00ff00ff00ff) << 8);
+    x = ((x >> 16) & 0x0000ffff0000ffff) | ((x & 0x0000ffff0000ffff) << 16);
+    x = (x >> 32) | (x << 32);
+    return x >> (64 - 2 * k);
+}
+
+uint64_t canonical_kmer(uint64_t kmer, int k)
+{
+    uint64_t rc = reverse_complement(kmer, k);
+    return kmer < rc ? kmer : rc;
+}
+
+#pragma mark counting
+
+struct kmer_thread {
+    struct hash_map *table;
+    const char *data;
+    size_t size;
+    size_t begin, end; // the slice
+    int k;
+    bool canonical;
+    uint64_t no_kmers;
+};
+
+// A k-mer we are sliding along a sequence
+struct sliding_kmer {
+    uint64_t forward, reverse, mask;
+    int shift;  // of the first base in the reverse k-mer
+    int filled; // bases since the last break, up to k
+};
+
+static void start_kmer(struct sliding_kmer *kmer, int k)
+{
+    kmer->forward = kmer->reverse = 0;
+    kmer->mask = kmer_mask(k);
+    kmer->shift = 2 * (k - 1);
+    kmer->filled = 0;
+}
+
+static void add_base(struct sliding_kmer *kmer, int code, int k)
+{
+    kmer->forward = ((kmer->forward << 2) | code) & kmer->mask;
+    kmer->reverse = (kmer->reverse >> 2) | ((uint64_t)(3 - code) << kmer->shift);
+    if (kmer->filled < k) kmer->filled++;
+}
+
+static void count_kmer(struct kmer_thread *t, struct increment_buffer *buffer,
+                       struct sliding_kmer *kmer)
+{
+    uint64_t x = kmer->forward;
+    if (t->canonical && kmer->reverse < x) x = kmer->reverse;
+    buffered_increment(buffer, x, 1);
+    t->no_kmers++;
+}
+
+static size_t next_line(const char *data, size_t size, size_t pos)
+{
+    const char *newline = memchr(data + pos, '\n', size - pos);
+    return newline ? (size_t)(newline - data) + 1 : size;
+}
+
+// FASTA sequences can span lines, and so can k-mers. We count the
+// k-mers whose first base is in the slice, so we read on past the end
+// of the slice until we have seen the k-mers that start before it.
+static void count_fasta(struct kmer_thread *t, struct increment_buffer *buffer)
+{
+    const char *data = t->data;
+    size_t size = t->size, end = t->end;
+    int k = t->k;
+
+    // If we start in a header, we skip the rest of it
+    size_t pos = t->begin;
+    size_t line = pos;
+    while (line > 0 && data[line - 1] != '\n') line--;
+    if (data[line] == '>') pos = next_line(data, size, pos);
+
+    struct sliding_kmer kmer;
+    start_kmer(&kmer, k);
+    int past_end = 0;
+    while (pos < size) {
+        char c = data[pos];
+        if (c == '\n' || c == '\r') {
+            pos++;
+            continue;
+        }
+        if (c == '>') {
+            if (pos >= end) break;
+            kmer.filled = 0;
+            pos = next_line(data, size, pos);
+            continue;
+        }
+        int code = base_codes[(uint8_t)c];
+        if (pos >= end) {
+            // After k bases past the end, k-mers start in the next
+            // slice, and after a break, so do all the rest.
+            if (code < 0 || kmer.filled == 0 || ++past_end == k) break;
+        }
+        if (code < 0) {
+            kmer.filled = 0;
+        } else {
+            add_base(&kmer, code, k);
+            if (kmer.filled == k) count_kmer(t, buffer, &kmer);
+        }
+        pos++;
+    }
+}
+
+// A line is the start of a FASTQ record if it starts with '@' and the
+// line after its sequence starts with '+'. A quality line can also
+// start with '@', but then the line two below is a sequence.
+static bool is_record_start(const char *data, size_t size, size_t pos)
+{
+    if (pos >= size || data[pos] != '@') return false;
+    size_t plus = next_line(data, size, next_line(data, size, pos));
+    return plus < size && data[plus] == '+';
+}
+
+// FASTQ records have their sequence on a single line. We count the
+// records whose header starts in the slice.
+static void count_fastq(struct kmer_thread *t, struct increment_buffer *buffer)
+{
+    const char *data = t->data;
+    size_t size = t->size, end = t->end;
+    int k = t->k;
+
+    size_t pos = t->begin;
+    if (pos > 0 && data[pos - 1] != '\n') pos = next_line(data, size, pos);
+    while (pos < end && !is_record_start(data, size, pos))
+        pos = next_line(data, size, pos);
+
+    struct sliding_kmer kmer;
+    while (pos < end) {
+        size_t seq = next_line(data, size, pos);
+        size_t plus = next_line(data, size, seq);
+        start_kmer(&kmer, k);
+        for (size_t i = seq; i < plus; ++i) {
+            int code = base_codes[(uint8_t)data[i]];
+            if (code < 0) {
+                kmer.filled = 0;
+            } else {
+                add_base(&kmer, code, k);
+                if (kmer.filled == k) count_kmer(t, buffer, &kmer);
+            }
+        }
+        pos = next_line(data, size, next_line(data, size, plus));
+    }
+}
+
+static void *count_slice(void *arg)
+{
+    struct kmer_thread *t = (struct kmer_thread *)arg;
+    struct increment_buffer *buffer = new_increment_buffer(t->table, BUFFER_SIZE);
+    t->no_kmers = 0;
+    if (t->data[0] == '@') {
+        count_fastq(t, buffer);
+    } else {
+        count_fasta(t, buffer);
+    }
+    delete_increment_buffer(buffer);
+    return 0;
+}
+
+uint64_t count_kmers(struct hash_map *table, const char *data, size_t size,
+                     int k, bool canonical, int no_threads)
+{
+    if (size == 0) return 0;
+
+    pthread_t threads[no_threads];
+    struct kmer_thread args[no_threads];
+    for (int i = 0; i < no_threads; ++i) {
+        args[i].table = table;
+        args[i].data = data;
+        args[i].size = size;
+        args[i].begin = size / no_threads * i;
+        args[i].end = (i == no_threads - 1) ? size : size / no_threads * (i + 1);
+        args[i].k = k;
+        args[i].canonical = canonical;
+    }
+    for (int i = 1; i < no_threads; ++i) {
+        pthread_create(&threads[i], 0, count_slice, &args[i]);
+    }
+    count_slice(&args[0]);
+    uint64_t no_kmers = args[0].no_kmers;
+    for (int i = 1; i < no_threads; ++i) {
+        pthread_join(threads[i], 0);
+        no_kmers += args[i].no_kmers;
+    }
+    return no_kmers;
+}
+
+bool count_kmers_in_file(struct hash_map *table, const char *path,
+                         int k, bool canonical, int no_threads,
+                         uint64_t *no_kmers)
+{
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) return false;
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        close(fd);
+        return false;
+    }
+    *no_kmers = 0;
+    if (st.st_size == 0) {
+        close(fd);
+        return true;
+    }
+
+    void *data = mmap(0, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) return false;
+    madvise(data, st.st_size, MADV_SEQUENTIAL);
+    *no_kmers = count_kmers(table, (const char *)data, st.st_size,
+                            k, canonical, no_threads);
+    munmap(data, st.st_size);
+    return true;
+}
+
+#pragma mark sorted counts
+
+struct kmer_file_header {
+    char magic[8];
+    uint32_t k;
+    uint32_t unused;
+    uint64_t no_kmers;
+};
+
+static const char MAGIC[8] = "KMERCNTS";
+
+struct kmer_counts {
+    uint64_t *kmers, *counts;
+    uint64_t n, size;
+};
+
+static void collect_kmer(uint64_t kmer, uint64_t count, void *data)
+{
+    struct kmer_counts *counts = (struct kmer_counts *)data;
+    if (counts->n == counts->size) {
+        counts->size = counts->size ? 2 * counts->size : 1024;
+        counts->kmers = (uint64_t *)realloc(counts->kmers, counts->size * sizeof(uint64_t));
+        counts->counts = (uint64_t *)realloc(counts->counts, counts->size * sizeof(uint64_t));
+    }
+    counts->kmers[counts->n] = kmer;
+    counts->counts[counts->n] = count;
+    counts->n++;
+}
+
+// Radix sort on the bytes the k-mers use, least significant first.
+static void sort_kmers(struct kmer_counts *counts, int k)
+{
+    uint64_t n = counts->n;
+    uint64_t *kmers = counts->kmers, *vals = counts->counts;
+    uint64_t *tmp_kmers = (uint64_t *)malloc(n * sizeof(uint64_t));
+    uint64_t *tmp_vals = (uint64_t *)malloc(n * sizeof(uint64_t));
+    int no_passes = (2 * k + 7) / 8;
+    for (int pass = 0; pass < no_passes; ++pass) {
+        int shift = 8 * pass;
+        uint64_t offsets[257] = { 0 };
+        for (uint64_t i = 0; i < n; ++i) {
+            offsets[((kmers[i] >> shift) & 0xff) + 1]++;
+        }
+        for (int b = 0; b < 256; ++b) {
+            offsets[b + 1] += offsets[b];
+        }
+        for (uint64_t i = 0; i < n; ++i) {
+            uint64_t j = offsets[(kmers[i] >> shift) & 0xff]++;
+            tmp_kmers[j] = kmers[i];
+            tmp_vals[j] = vals[i];
+        }
+        uint64_t *swap = kmers; kmers = tmp_kmers; tmp_kmers = swap;
+        swap = vals; vals = tmp_vals; tmp_vals = swap;
+    }
+    counts->kmers = kmers;
+    counts->counts = vals;
+    free(tmp_kmers);
+    free(tmp_vals);
+}
+
+bool write_kmer_counts(struct hash_map *table, int k, const char *path)
+{
+    struct kmer_counts counts = { 0, 0, 0, 0 };
+    for_each(table, collect_kmer, &counts);
+    sort_kmers(&counts, k);
+
+    struct kmer_file_header header;
+    memcpy(header.magic, MAGIC, sizeof(MAGIC));
+    header.k = k;
+    header.unused = 0;
+    header.no_kmers = counts.n;
+
+    bool ok = false;
+    FILE *file = fopen(path, "wb");
+    if (file) {
+        ok = fwrite(&header, sizeof(header), 1, file) == 1 &&
+        fwrite(counts.kmers, sizeof(uint64_t), counts.n, file) == counts.n &&
+        fwrite(counts.counts, sizeof(uint64_t), counts.n, file) == counts.n;
+        ok = (fclose(file) == 0) && ok;
+    }
+    free(counts.kmers);
+    free(counts.counts);
+    return ok;
+}
+
+bool read_kmer_counts(const char *path, int *k, uint64_t *n,
+                      uint64_t **kmers, uint64_t **counts)
+{
+    FILE *file = fopen(path, "rb");
+    if (!file) return false;
+    struct kmer_file_header header;
+    if (fread(&header, sizeof(header), 1, file) != 1 ||
+        memcmp(header.magic, MAGIC, sizeof(MAGIC)) != 0 ||
+        header.k < 1 || header.k > MAX_K) {
+        fclose(file);
+        return false;
+    }
+    *k = header.k;
+    *n = header.no_kmers;
+    *kmers = (uint64_t *)malloc(*n * sizeof(uint64_t));
+    *counts = (uint64_t *)malloc(*n * sizeof(uint64_t));
+    bool ok = *kmers && *counts &&
+    fread(*kmers, sizeof(uint64_t), *n, file) == *n &&
+    fread(*counts, sizeof(uint64_t), *n, file) == *n;
+    fclose(file);
+    if (!ok) {
+        free(*kmers);
+        free(*counts);
+    }
+    return ok;
+}
@@ -0,0 +1,58 @@
+//
+//  kmers.h
+//  CountingHashMap
+//
+//  Created by Thomas Mailund on 19/10/2026.
+//  Copyright © 2026 Thomas Mailund. All rights reserved.
+//
+
+#ifndef kmers_h
+#define kmers_h
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include "hash_map.h"
+
+// Counting k-mers in FASTA and FASTQ files with a counting map.
+//
+// A k-mer is k <= 32 bases packed two bits per base, A, C, G, T as 0
+// to 3, with the first base in the highest bits. We slide the k-mer
+// along the sequence one base at a time, and we update its reverse
+// complement the same way, so getting the canonical k-mer, the
+// smaller of the two, costs no more than a comparison. Any other
+// character than ACGT, upper or lower case, breaks the sequence.
+//
+// The input is split into one slice per thread. Each thread counts
+// the k-mers that start in its slice, through its own increment
+// buffer, so hot k-mers do not have the threads fighting over bins.
+
+#define MAX_K 32
+
+// Returns false if there is a base that is not ACGT.
+bool     encode_kmer(const char *bases, int k, uint64_t *kmer);
+void     decode_kmer(uint64_t kmer, int k, char *bases); // no '\0'
+uint64_t reverse_complement(uint64_t kmer, int k);
+uint64_t canonical_kmer(uint64_t kmer, int k);
+
+// Counts the k-mers in FASTA or FASTQ data, depending on whether the
+// first character is '>' or '@'. If canonical is true, we count a
+// k-mer and its reverse complement as the same. Returns the number of
+// k-mers we counted.
+uint64_t count_kmers(struct hash_map *table, const char *data, size_t size,
+                     int k, bool canonical, int no_threads);
+// Maps the file into memory and counts its k-mers. Returns false if
+// we could not read it.
+bool count_kmers_in_file(struct hash_map *table, const char *path,
+                         int k, bool canonical, int no_threads,
+                         uint64_t *no_kmers);
+
+// Writes the k-mers and their counts to a binary file, sorted by
+// k-mer: a header with k and the number of k-mers, then the k-mers,
+// then their counts, all as 64-bit numbers in host byte order.
+bool write_kmer_counts(struct hash_map *table, int k, const char *path);
+// Reads a file from write_kmer_counts(). The caller frees the arrays.
+bool read_kmer_counts(const char *path, int *k, uint64_t *n,
+                      uint64_t **kmers, uint64_t **counts);
+
+#endif /* kmers_h */
@@ -0,0 +1,144 @@
+//
+//  main.c
+//  Test
+//
+//  Created by Thomas Mailund on 19/10/2026.
+//  Copyright © 2026 Thomas Mailund. All rights reserved.
+//
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <unistd.h>
+#include "hash_map.h"
+
+#define NO_KEYS 50000
+
+// Keys are URL-like strings, and values are the decimal strings of
+// 3 * i, padded to a length that depends on i.
+static uint32_t key_string(char *buffer, int i)
+{
+    return (uint32_t)sprintf(buffer, "https://example.com/pages/%d/index.html", i);
+}
+
+static uint32_t val_string(char *buffer, int i)
+{
+    return (uint32_t)sprintf(buffer, "%0*d", 1 + i % 40, 3 * i);
+}
+
+static void map_key(struct hash_map *table, int i)
+{
+    char key[64], val[64];
+    uint32_t key_len = key_string(key, i);
+    uint32_t val_len = val_string(val, i);
+    assert(map(table, key, key_len, val, val_len));
+}
+
+static bool has_key(struct hash_map *table, int i)
+{
+    char key[64], val[64], found[MAX_ENTRY_BYTES];
+    uint32_t key_len = key_string(key, i);
+    uint32_t val_len = val_string(val, i);
+    uint32_t found_len;
+    if (!lookup(table, key, key_len, found, &found_len)) return false;
+    assert(found_len == val_len);
+    assert(memcmp(found, val, val_len) == 0);
+    return true;
+}
+
+int main(int argc, const char *argv[])
+{
+    char path[] = "/tmp/disk_mapXXXXXX";
+    close(mkstemp(path));
+
+    // The cache is much smaller than the map, so pages go back and
+    // forth between the cache and the file.
+    struct hash_map *table = open_map(path, 16);
+    assert(table);
+    for (int i = 0; i < NO_KEYS; ++i) {
+        map_key(table, i);
+    }
+    assert(no_keys(table) == NO_KEYS);
+    assert(table->page_writes > 0);
+    for (int i = 0; i < NO_KEYS; ++i) {
+        assert(has_key(table, i));
+    }
+    assert(!has_key(table, NO_KEYS));
+
+    for (int i = 0; i < NO_KEYS; i += 2) {
+        char key[64];
+        assert(delete_key(table, key, key_string(key, i)));
+    }
+    assert(!delete_key(table, "", 0));
+    assert(no_keys(table) == NO_KEYS / 2);
+    for (int i = 0; i < NO_KEYS; ++i) {
+        assert(has_key(table, i) == (i % 2 == 1));
+    }
+
+    // Replacing values, with the same and with other lengths
+    char found[MAX_ENTRY_BYTES]; uint32_t found_len;
+    assert(map(table, "a", 1, "xyz", 3));
+    assert(map(table, "a", 1, "abc", 3));
+    assert(lookup(table, "a", 1, found, &found_len));
+    assert(found_len == 3 && memcmp(found, "abc", 3) == 0);
+    assert(map(table, "a", 1, "", 0));
+    assert(lookup(table, "a", 1, found, &found_len) && found_len == 0);
+    assert(delete_key(table, "a", 1));
+
+    // Too large
+    static char large[MAX_ENTRY_BYTES + 1];
+    assert(!map(table, large, MAX_ENTRY_BYTES, "", 1));
+    assert(map(table, large, MAX_ENTRY_BYTES, "", 0));
+    assert(delete_key(table, large, MAX_ENTRY_BYTES));
+    assert(close_map(table));
+
+    // The map is still there when we open it again
+    table = open_map(path, 64);
+    assert(table);
+    assert(no_keys(table) == NO_KEYS / 2);
+    for (int i = 0; i < NO_KEYS; ++i) {
+        assert(has_key(table, i) == (i % 2 == 1));
+    }
+
+    // Looking up keys in batches
+    int batch_size = 1000;
+    char (*batch_keys)[64] = malloc(batch_size * sizeof(*batch_keys));
+    const void **keys = malloc(batch_size * sizeof(void *));
+    uint32_t *key_lens = malloc(batch_size * sizeof(uint32_t));
+    bool *batch_found = malloc(batch_size * sizeof(bool));
+    for (int i = 0; i < batch_size; ++i) {
+        key_lens[i] = key_string(batch_keys[i], 7 * i);
+        keys[i] = batch_keys[i];
+    }
+    contains_keys(table, batch_size, keys, key_lens, batch_found);
+    for (int i = 0; i < batch_size; ++i) {
+        assert(batch_found[i] == ((7 * i) % 2 == 1));
+    }
+    free(batch_keys);
+    free(keys);
+    free(key_lens);
+    free(batch_found);
+
+    // Adding the deleted keys back reuses their space
+    for (int i = 0; i < NO_KEYS; i += 2) {
+        map_key(table, i);
+    }
+    assert(no_keys(table) == NO_KEYS);
+    for (int i = 0; i < NO_KEYS; ++i) {
+        assert(has_key(table, i));
+    }
+    assert(close_map(table));
+
+    // A file that is not a map
+    FILE *file = fopen(path, "w");
+    fprintf(file, "not a hash map");
+    fclose(file);
+    assert(!open_map(path, 16));
+    unlink(path);
+
+    printf("SUCCESS\n");
+
+    return EXIT_SUCCESS;
+}
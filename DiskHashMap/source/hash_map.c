@@ -0,0 +1,835 @@
+//
+//  hash_map.c
+//  DiskHashMap
+//
+//  Created by Thomas Mailund on 19/10/2026.
+//  Copyright © 2026 Thomas Mailund. All rights reserved.
+//
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/uio.h>
+#include "hash_strings.h"
+#include "hash_map.h"
+
+#define MAGIC "DSKHMAP1"
+#define PAGE_BYTES 4096
+#define MAX_DEPTH 30      // the directory has at most 2^MAX_DEPTH entries
+#define NO_PAGE 0         // page 0 is the file header, so no bucket uses it
+#define NO_CACHED UINT32_MAX
+#define MAX_IOVECS 64
+
+struct file_header {
+    char magic[8];
+    uint32_t page_bytes;
+    uint32_t global_depth;
+    uint64_t no_keys;
+    uint64_t no_pages;
+    // The directory, followed by the list of free pages
+    uint64_t dir_page, dir_pages;
+    uint64_t no_free;
+};
+
+// A bucket page is this header, then the slots, which grow from the
+// front, and the bytes of keys and values, which grow from the back.
+struct page_header {
+    uint64_t overflow;     // the next page in the bucket, or NO_PAGE
+    uint32_t local_depth;  // bits of the hash the bucket's keys share
+    uint16_t no_entries;
+    uint16_t data_start;
+    uint16_t live_bytes;   // bytes of keys and values still in use
+    uint16_t unused[3];
+};
+
+struct slot {
+    uint8_t fingerprint;
+    uint8_t unused;
+    uint16_t offset;       // key bytes, then value bytes
+    uint16_t key_len;
+    uint16_t val_len;
+};
+
+struct cached_page {
+    uint64_t page_no;
+    uint32_t prev, next;   // LRU list, most recently used first
+    uint32_t chain;        // next page in the same index bucket
+    bool dirty;
+};
+
+static uint32_t bucket_hash(const void *key, uint32_t key_len)
+{
+    return jenkins_hash(0, (char *)key, (int)key_len);
+}
+
+// A different function than for buckets, so keys in the same bucket
+// still get different fingerprints.
+static uint8_t fingerprint(const void *key, uint32_t key_len)
+{
+    return (uint8_t)one_at_a_time_hash(0, (char *)key, (int)key_len);
+}
+
+static uint64_t dir_size(struct hash_map *table)
+{
+    return (uint64_t)1 << table->header->global_depth;
+}
+
+static uint64_t bucket_page(struct hash_map *table, uint32_t hash_key)
+{
+    return table->directory[hash_key & (dir_size(table) - 1)];
+}
+
+#pragma mark pages
+
+static struct page_header *page_header(uint8_t *page)
+{
+    return (struct page_header *)page;
+}
+
+static struct slot *page_slots(uint8_t *page)
+{
+    return (struct slot *)(page + sizeof(struct page_header));
+}
+
+static void init_page(uint8_t *page, uint32_t local_depth)
+{
+    struct page_header *header = page_header(page);
+    memset(header, 0, sizeof(*header));
+    header->overflow = NO_PAGE;
+    header->local_depth = local_depth;
+    header->data_start = PAGE_BYTES;
+}
+
+// Bytes between the slots and the keys and values
+static uint32_t gap_bytes(uint8_t *page)
+{
+    struct page_header *header = page_header(page);
+    return header->data_start - sizeof(struct page_header) -
+           header->no_entries * sizeof(struct slot);
+}
+
+// Moves the keys and values to the back of the page, so the space
+// deleted entries held is in the gap again.
+static void compact_page(uint8_t *page)
+{
+    uint8_t copy[PAGE_BYTES];
+    memcpy(copy, page, PAGE_BYTES);
+    struct page_header *header = page_header(page);
+    struct slot *slots = page_slots(page);
+    uint32_t data_start = PAGE_BYTES;
+    for (uint32_t i = 0; i < header->no_entries; ++i) {
+        uint32_t len = slots[i].key_len + slots[i].val_len;
+        data_start -= len;
+        memcpy(page + data_start, copy + slots[i].offset, len);
+        slots[i].offset = data_start;
+    }
+    header->data_start = data_start;
+}
+
+static bool make_room(uint8_t *page, uint32_t bytes)
+{
+    bytes += sizeof(struct slot);
+    if (gap_bytes(page) >= bytes) return true;
+    struct page_header *header = page_header(page);
+    uint32_t free_bytes = PAGE_BYTES - sizeof(struct page_header) -
+                          header->no_entries * sizeof(struct slot) -
+                          header->live_bytes;
+    if (free_bytes < bytes) return false;
+    compact_page(page);
+    return true;
+}
+
+// The page must have room (see make_room)
+static void put_entry(uint8_t *page, uint8_t fingerprint,
+                      const void *key, uint32_t key_len,
+                      const void *val, uint32_t val_len)
+{
+    struct page_header *header = page_header(page);
+    struct slot *slot = &page_slots(page)[header->no_entries++];
+    header->data_start -= key_len + val_len;
+    header->live_bytes += key_len + val_len;
+    slot->fingerprint = fingerprint;
+    slot->unused = 0;
+    slot->offset = header->data_start;
+    slot->key_len = key_len;
+    slot->val_len = val_len;
+    memcpy(page + slot->offset, key, key_len);
+    memcpy(page + slot->offset + key_len, val, val_len);
+}
+
+// The bytes stay in the page until we compact it
+static void remove_slot(uint8_t *page, uint32_t index)
+{
+    struct page_header *header = page_header(page);
+    struct slot *slots = page_slots(page);
+    header->live_bytes -= slots[index].key_len + slots[index].val_len;
+    slots[index] = slots[--header->no_entries];
+}
+
+static int find_slot(uint8_t *page, uint8_t fingerprint,
+                     const void *key, uint32_t key_len)
+{
+    struct page_header *header = page_header(page);
+    struct slot *slots = page_slots(page);
+    for (uint32_t i = 0; i < header->no_entries; ++i) {
+        if (slots[i].fingerprint == fingerprint &&
+            slots[i].key_len == key_len &&
+            memcmp(page + slots[i].offset, key, key_len) == 0)
+            return (int)i;
+    }
+    return -1;
+}
+
+#pragma mark page cache
+
+static bool write_all(int fd, const void *bytes, size_t len, uint64_t offset)
+{
+    while (len > 0) {
+        ssize_t written = pwrite(fd, bytes, len, offset);
+        if (written < 0 && errno == EINTR) continue;
+        // Writing nothing is an error too, or we would never finish
+        if (written <= 0) return false;
+        bytes = (const uint8_t *)bytes + written;
+        len -= written;
+        offset += written;
+    }
+    return true;
+}
+
+static uint8_t *cache_data(struct hash_map *table, uint32_t index)
+{
+    return table->cache_data + (uint64_t)index * PAGE_BYTES;
+}
+
+static uint32_t index_bucket(struct hash_map *table, uint64_t page_no)
+{
+    return (uint32_t)((page_no * 0x9e3779b97f4a7c15) >> 32) & table->index_mask;
+}
+
+static uint32_t find_cached(struct hash_map *table, uint64_t page_no)
+{
+    uint32_t i = table->cache_index[index_bucket(table, page_no)];
+    while (i != NO_CACHED && table->cache[i].page_no != page_no)
+        i = table->cache[i].chain;
+    return i;
+}
+
+static void remove_from_index(struct hash_map *table, uint32_t index)
+{
+    uint32_t *link = &table->cache_index[index_bucket(table, table->cache[index].page_no)];
+    while (*link != index)
+        link = &table->cache[*link].chain;
+    *link = table->cache[index].chain;
+}
+
+static void lru_remove(struct hash_map *table, uint32_t index)
+{
+    struct cached_page *page = &table->cache[index];
+    if (page->prev != NO_CACHED) table->cache[page->prev].next = page->next;
+    else table->lru_head = page->next;
+    if (page->next != NO_CACHED) table->cache[page->next].prev = page->prev;
+    else table->lru_tail = page->prev;
+}
+
+static void lru_push_front(struct hash_map *table, uint32_t index)
+{
+    struct cached_page *page = &table->cache[index];
+    page->prev = NO_CACHED;
+    page->next = table->lru_head;
+    if (table->lru_head != NO_CACHED) table->cache[table->lru_head].prev = index;
+    else table->lru_tail = index;
+    table->lru_head = index;
+}
+
+static void write_back(struct hash_map *table, uint32_t index)
+{
+    struct cached_page *page = &table->cache[index];
+    if (!write_all(table->fd, cache_data(table, index), PAGE_BYTES,
+                   page->page_no * PAGE_BYTES))
+        table->failed = true;
+    table->page_writes++;
+    page->dirty = false;
+}
+
+static void read_page(struct hash_map *table, uint64_t page_no, uint8_t *data)
+{
+    size_t done = 0;
+    while (done < PAGE_BYTES) {
+        ssize_t bytes = pread(table->fd, data + done, PAGE_BYTES - done,
+                              page_no * PAGE_BYTES + done);
+        if (bytes < 0 && errno == EINTR) continue;
+        if (bytes < 0) table->failed = true;
+        if (bytes <= 0) break;
+        done += bytes;
+    }
+    // Pages past the end of the file are all zeros
+    memset(data + done, 0, PAGE_BYTES - done);
+    table->page_reads++;
+}
+
+// Returns the page's bytes in the cache. They stay valid until the
+// next call, which can evict the page, so we work on one page at a
+// time. With fresh, we are about to overwrite the page, so we do not
+// read it.
+static uint8_t *get_page(struct hash_map *table, uint64_t page_no, bool fresh)
+{
+    uint32_t index = find_cached(table, page_no);
+    if (index != NO_CACHED) {
+        lru_remove(table, index);
+        lru_push_front(table, index);
+        return cache_data(table, index);
+    }
+
+    if (table->cache_used < table->cache_size) {
+        index = table->cache_used++;
+    } else {
+        index = table->lru_tail;
+        if (table->cache[index].dirty) write_back(table, index);
+        remove_from_index(table, index);
+        lru_remove(table, index);
+    }
+    struct cached_page *page = &table->cache[index];
+    page->page_no = page_no;
+    page->dirty = false;
+    uint32_t bucket = index_bucket(table, page_no);
+    page->chain = table->cache_index[bucket];
+    table->cache_index[bucket] = index;
+    lru_push_front(table, index);
+
+    uint8_t *data = cache_data(table, index);
+    if (fresh) memset(data, 0, PAGE_BYTES);
+    else read_page(table, page_no, data);
+    return data;
+}
+
+static void dirty_page(struct hash_map *table, uint8_t *data)
+{
+    table->cache[(data - table->cache_data) / PAGE_BYTES].dirty = true;
+}
+
+struct dirty_entry {
+    uint64_t page_no;
+    uint32_t index;
+};
+
+static int compare_dirty(const void *a, const void *b)
+{
+    uint64_t x = ((const struct dirty_entry *)a)->page_no;
+    uint64_t y = ((const struct dirty_entry *)b)->page_no;
+    return (x > y) - (x < y);
+}
+
+// Writes the changed pages in file order, with one pwritev() for
+// each run of pages that follow each other.
+static void flush_pages(struct hash_map *table)
+{
+    struct dirty_entry *dirty =
+    (struct dirty_entry *)malloc(table->cache_used * sizeof(struct dirty_entry));
+    uint32_t no_dirty = 0;
+    for (uint32_t i = 0; i < table->cache_used; ++i) {
+        if (!table->cache[i].dirty) continue;
+        dirty[no_dirty].page_no = table->cache[i].page_no;
+        dirty[no_dirty++].index = i;
+    }
+    qsort(dirty, no_dirty, sizeof(struct dirty_entry), compare_dirty);
+
+    struct iovec iov[MAX_IOVECS];
+    for (uint32_t i = 0; i < no_dirty; ) {
+        uint32_t n = 0;
+        while (i + n < no_dirty && n < MAX_IOVECS &&
+               dirty[i + n].page_no == dirty[i].page_no + n) {
+            iov[n].iov_base = cache_data(table, dirty[i + n].index);
+            iov[n].iov_len = PAGE_BYTES;
+            ++n;
+        }
+        ssize_t written = pwritev(table->fd, iov, n, dirty[i].page_no * PAGE_BYTES);
+        if (written != (ssize_t)n * PAGE_BYTES) {
+            // Finish the run a page at a time
+            for (uint32_t j = 0; j < n; ++j) {
+                if (!write_all(table->fd, iov[j].iov_base, PAGE_BYTES,
+                               dirty[i + j].page_no * PAGE_BYTES))
+                    table->failed = true;
+            }
+        }
+        for (uint32_t j = 0; j < n; ++j) {
+            table->cache[dirty[i + j].index].dirty = false;
+        }
+        table->page_writes += n;
+        i += n;
+    }
+    free(dirty);
+}
+
+#pragma mark file
+
+static uint64_t alloc_page(struct hash_map *table)
+{
+    if (table->header->no_free > 0)
+        return table->free_pages[--table->header->no_free];
+    return table->header->no_pages++;
+}
+
+static void free_page(struct hash_map *table, uint64_t page_no)
+{
+    if (table->header->no_free == table->free_size) {
+        table->free_size = table->free_size ? 2 * table->free_size : 64;
+        table->free_pages =
+        (uint64_t *)realloc(table->free_pages, table->free_size * sizeof(uint64_t));
+    }
+    table->free_pages[table->header->no_free++] = page_no;
+}
+
+static uint64_t pages_for(uint64_t bytes)
+{
+    return (bytes + PAGE_BYTES - 1) / PAGE_BYTES;
+}
+
+bool sync_map(struct hash_map *table)
+{
+    struct file_header *header = table->header;
+    flush_pages(table);
+
+    // The directory and free list go in a region of pages. When they
+    // outgrow it, we move them to a larger region at the end of the
+    // file and free the old one.
+    uint64_t dir_bytes = dir_size(table) * sizeof(uint64_t);
+    uint64_t needed = pages_for(dir_bytes + header->no_free * sizeof(uint64_t));
+    if (needed > header->dir_pages) {
+        for (uint64_t i = 0; i < header->dir_pages; ++i) {
+            free_page(table, header->dir_page + i);
+        }
+        needed = pages_for(dir_bytes + header->no_free * sizeof(uint64_t));
+        header->dir_page = header->no_pages;
+        header->dir_pages = 2 * needed;
+        header->no_pages += header->dir_pages;
+    }
+    bool ok = !table->failed &&
+    write_all(table->fd, table->directory, dir_bytes,
+              header->dir_page * PAGE_BYTES) &&
+    write_all(table->fd, table->free_pages, header->no_free * sizeof(uint64_t),
+              header->dir_page * PAGE_BYTES + dir_bytes) &&
+    write_all(table->fd, header, sizeof(*header), 0) &&
+    fsync(table->fd) == 0;
+    if (!ok) table->failed = true;
+    return ok;
+}
+
+static bool read_all(int fd, void *bytes, size_t len, uint64_t offset)
+{
+    while (len > 0) {
+        ssize_t read = pread(fd, bytes, len, offset);
+        if (read < 0 && errno == EINTR) continue;
+        if (read <= 0) return false;
+        bytes = (uint8_t *)bytes + read;
+        len -= read;
+        offset += read;
+    }
+    return true;
+}
+
+static bool read_directory(struct hash_map *table)
+{
+    struct file_header *header = table->header;
+    if (!read_all(table->fd, header, sizeof(*header), 0) ||
+        memcmp(header->magic, MAGIC, sizeof(header->magic)) != 0 ||
+        header->page_bytes != PAGE_BYTES ||
+        header->global_depth > MAX_DEPTH ||
+        header->dir_page + header->dir_pages > header->no_pages)
+        return false;
+    uint64_t dir_bytes = dir_size(table) * sizeof(uint64_t);
+    if (dir_bytes + header->no_free * sizeof(uint64_t) >
+        header->dir_pages * PAGE_BYTES)
+        return false;
+
+    table->directory = (uint64_t *)malloc(dir_bytes);
+    table->free_size = header->no_free;
+    table->free_pages = (uint64_t *)malloc(table->free_size * sizeof(uint64_t));
+    if (!read_all(table->fd, table->directory, dir_bytes,
+                  header->dir_page * PAGE_BYTES) ||
+        !read_all(table->fd, table->free_pages, header->no_free * sizeof(uint64_t),
+                  header->dir_page * PAGE_BYTES + dir_bytes))
+        return false;
+    for (uint64_t i = 0; i < dir_size(table); ++i) {
+        if (table->directory[i] == NO_PAGE || table->directory[i] >= header->no_pages)
+            return false;
+    }
+    return true;
+}
+
+static void free_map(struct hash_map *table)
+{
+    close(table->fd);
+    free(table->header);
+    free(table->directory);
+    free(table->free_pages);
+    free(table->cache);
+    free(table->cache_data);
+    free(table->cache_index);
+    free(table);
+}
+
+struct hash_map *open_map(const char *path, uint32_t cache_pages)
+{
+    int fd = open(path, O_RDWR | O_CREAT, 0644);
+    if (fd < 0) return 0;
+    off_t file_bytes = lseek(fd, 0, SEEK_END);
+    if (file_bytes < 0) {
+        close(fd);
+        return 0;
+    }
+
+    struct hash_map *table = (struct hash_map *)calloc(1, sizeof(struct hash_map));
+    table->fd = fd;
+    table->header = (struct file_header *)calloc(1, sizeof(struct file_header));
+
+    // Splitting a bucket needs a few pages at a time
+    if (cache_pages < 4) cache_pages = 4;
+    table->cache_size = cache_pages;
+    table->cache = (struct cached_page *)malloc(cache_pages * sizeof(struct cached_page));
+    if (posix_memalign((void **)&table->cache_data, PAGE_BYTES,
+                       (size_t)cache_pages * PAGE_BYTES) != 0) {
+        table->cache_data = 0;
+        free_map(table);
+        return 0;
+    }
+    uint32_t index_size = 1;
+    while (index_size < 2 * cache_pages) index_size *= 2;
+    table->index_mask = index_size - 1;
+    table->cache_index = (uint32_t *)malloc(index_size * sizeof(uint32_t));
+    for (uint32_t i = 0; i < index_size; ++i) {
+        table->cache_index[i] = NO_CACHED;
+    }
+    table->lru_head = table->lru_tail = NO_CACHED;
+
+    if (file_bytes > 0) {
+        if (!read_directory(table)) {
+            free_map(table);
+            return 0;
+        }
+        return table;
+    }
+
+    // A new map has a single, empty bucket
+    struct file_header *header = table->header;
+    memcpy(header->magic, MAGIC, sizeof(header->magic));
+    header->page_bytes = PAGE_BYTES;
+    header->no_pages = 1;
+    table->directory = (uint64_t *)malloc(sizeof(uint64_t));
+    table->directory[0] = alloc_page(table);
+    uint8_t *page = get_page(table, table->directory[0], true);
+    init_page(page, 0);
+    dirty_page(table, page);
+    if (!sync_map(table)) {
+        free_map(table);
+        return 0;
+    }
+    return table;
+}
+
+bool close_map(struct hash_map *table)
+{
+    bool ok = sync_map(table);
+    free_map(table);
+    return ok;
+}
+
+#pragma mark buckets
+
+struct split_entry {
+    uint32_t hash_key;
+    uint8_t fingerprint;
+    uint16_t key_len, val_len;
+    uint32_t offset; // into the split buffer
+};
+
+struct split {
+    struct split_entry *entries;
+    uint32_t no_entries, entries_size;
+    uint8_t *bytes;
+    uint64_t no_bytes, bytes_size;
+    uint64_t *pages; // the bucket's old pages
+    uint32_t no_pages, pages_size;
+};
+
+static void collect_entries(struct split *split, uint8_t *page)
+{
+    struct page_header *header = page_header(page);
+    struct slot *slots = page_slots(page);
+    for (uint32_t i = 0; i < header->no_entries; ++i) {
+        uint32_t len = slots[i].key_len + slots[i].val_len;
+        if (split->no_entries == split->entries_size) {
+            split->entries_size = split->entries_size ? 2 * split->entries_size : 64;
+            split->entries = (struct split_entry *)
+            realloc(split->entries, split->entries_size * sizeof(struct split_entry));
+        }
+        while (split->no_bytes + len > split->bytes_size) {
+            split->bytes_size = split->bytes_size ? 2 * split->bytes_size : PAGE_BYTES;
+            split->bytes = (uint8_t *)realloc(split->bytes, split->bytes_size);
+        }
+        struct split_entry *entry = &split->entries[split->no_entries++];
+        const uint8_t *key = page + slots[i].offset;
+        entry->hash_key = bucket_hash(key, slots[i].key_len);
+        entry->fingerprint = slots[i].fingerprint;
+        entry->key_len = slots[i].key_len;
+        entry->val_len = slots[i].val_len;
+        entry->offset = (uint32_t)split->no_bytes;
+        memcpy(split->bytes + split->no_bytes, key, len);
+        split->no_bytes += len;
+    }
+}
+
+static uint64_t next_page(struct hash_map *table, struct split *split,
+                          uint32_t *used_pages)
+{
+    if (*used_pages < split->no_pages)
+        return split->pages[(*used_pages)++];
+    return alloc_page(table);
+}
+
+// Writes the entries on one side of the split to a new chain of
+// pages that starts with first.
+static void write_chain(struct hash_map *table, struct split *split,
+                        uint64_t first, uint32_t depth, uint32_t side,
+                        uint32_t *used_pages)
+{
+    uint8_t *page = get_page(table, first, true);
+    init_page(page, depth);
+    dirty_page(table, page);
+    uint32_t bit = (uint32_t)1 << (depth - 1);
+    for (uint32_t i = 0; i < split->no_entries; ++i) {
+        struct split_entry *entry = &split->entries[i];
+        if (((entry->hash_key & bit) != 0) != side) continue;
+        if (!make_room(page, entry->key_len + entry->val_len)) {
+            uint64_t overflow = next_page(table, split, used_pages);
+            page_header(page)->overflow = overflow;
+            page = get_page(table, overflow, true);
+            init_page(page, depth);
+            dirty_page(table, page);
+        }
+        const uint8_t *bytes = split->bytes + entry->offset;
+        put_entry(page, entry->fingerprint, bytes, entry->key_len,
+                  bytes + entry->key_len, entry->val_len);
+    }
+}
+
+// Splits the bucket for hash_key in two on the next bit of the hash.
+// Returns false if that cannot help: the bucket's keys, and the key
+// we want to add, agree on all the bits we could split on.
+static bool split_bucket(struct hash_map *table, uint32_t hash_key)
+{
+    uint64_t primary = bucket_page(table, hash_key);
+    struct split split;
+    memset(&split, 0, sizeof(split));
+    uint32_t depth = 0;
+    for (uint64_t page_no = primary; page_no != NO_PAGE; ) {
+        uint8_t *page = get_page(table, page_no, false);
+        if (page_no == primary) depth = page_header(page)->local_depth;
+        if (split.no_pages == split.pages_size) {
+            split.pages_size = split.pages_size ? 2 * split.pages_size : 4;
+            split.pages = (uint64_t *)realloc(split.pages, split.pages_size * sizeof(uint64_t));
+        }
+        split.pages[split.no_pages++] = page_no;
+        collect_entries(&split, page);
+        page_no = page_header(page)->overflow;
+    }
+
+    uint32_t differ = 0;
+    for (uint32_t i = 0; i < split.no_entries; ++i) {
+        differ |= split.entries[i].hash_key ^ hash_key;
+    }
+    differ &= ((uint32_t)1 << MAX_DEPTH) - 1;
+    bool can_split = depth < MAX_DEPTH && (differ >> depth) != 0;
+    if (can_split) {
+        if (depth == table->header->global_depth) {
+            // Double the directory; the new half points to the same buckets
+            uint64_t size = dir_size(table);
+            table->directory =
+            (uint64_t *)realloc(table->directory, 2 * size * sizeof(uint64_t));
+            memcpy(table->directory + size, table->directory, size * sizeof(uint64_t));
+            table->header->global_depth++;
+        }
+
+        // The old pages are reused, and what is left is freed
+        uint32_t used_pages = 1;
+        uint64_t sibling = next_page(table, &split, &used_pages);
+        write_chain(table, &split, primary, depth + 1, 0, &used_pages);
+        write_chain(table, &split, sibling, depth + 1, 1, &used_pages);
+        for (uint32_t i = used_pages; i < split.no_pages; ++i) {
+            free_page(table, split.pages[i]);
+        }
+
+        // All directory entries that end in the bucket's bits and
+        // have the new bit set now point to the sibling
+        uint64_t bit = (uint64_t)1 << depth;
+        for (uint64_t i = (hash_key & (bit - 1)) | bit; i < dir_size(table); i += 2 * bit) {
+            table->directory[i] = sibling;
+        }
+    }
+
+    free(split.entries);
+    free(split.bytes);
+    free(split.pages);
+    return can_split;
+}
+
+// Finds the key's page and slot, and returns the page's bytes
+static uint8_t *find_entry(struct hash_map *table,
+                           uint32_t hash_key, uint8_t fingerprint,
+                           const void *key, uint32_t key_len, int *slot)
+{
+    uint64_t page_no = bucket_page(table, hash_key);
+    while (page_no != NO_PAGE) {
+        uint8_t *page = get_page(table, page_no, false);
+        *slot = find_slot(page, fingerprint, key, key_len);
+        if (*slot >= 0) return page;
+        page_no = page_header(page)->overflow;
+    }
+    return 0;
+}
+
+static void insert_entry(struct hash_map *table,
+                         uint32_t hash_key, uint8_t fingerprint,
+                         const void *key, uint32_t key_len,
+                         const void *val, uint32_t val_len)
+{
+    for (;;) {
+        uint64_t page_no = bucket_page(table, hash_key), last = NO_PAGE;
+        while (page_no != NO_PAGE) {
+            uint8_t *page = get_page(table, page_no, false);
+            if (make_room(page, key_len + val_len)) {
+                put_entry(page, fingerprint, key, key_len, val, val_len);
+                dirty_page(table, page);
+                return;
+            }
+            last = page_no;
+            page_no = page_header(page)->overflow;
+        }
+        if (split_bucket(table, hash_key)) continue;
+
+        // Splitting does not help, so the bucket gets another page
+        uint64_t overflow = alloc_page(table);
+        uint8_t *page = get_page(table, last, false);
+        uint32_t depth = page_header(page)->local_depth;
+        page_header(page)->overflow = overflow;
+        dirty_page(table, page);
+        page = get_page(table, overflow, true);
+        init_page(page, depth);
+        put_entry(page, fingerprint, key, key_len, val, val_len);
+        dirty_page(table, page);
+        return;
+    }
+}
+
+#pragma mark map
+
+bool map(struct hash_map *table,
+         const void *key, uint32_t key_len,
+         const void *val, uint32_t val_len)
+{
+    if ((uint64_t)key_len + val_len > MAX_ENTRY_BYTES) return false;
+    uint32_t hash_key = bucket_hash(key, key_len);
+    uint8_t fp = fingerprint(key, key_len);
+    int slot;
+    uint8_t *page = find_entry(table, hash_key, fp, key, key_len, &slot);
+    if (page) {
+        struct slot *old = &page_slots(page)[slot];
+        if (old->val_len == val_len) {
+            memcpy(page + old->offset + key_len, val, val_len);
+            dirty_page(table, page);
+            return !table->failed;
+        }
+        remove_slot(page, slot);
+        dirty_page(table, page);
+    } else {
+        table->header->no_keys++;
+    }
+    insert_entry(table, hash_key, fp, key, key_len, val, val_len);
+    return !table->failed;
+}
+
+bool lookup(struct hash_map *table,
+            const void *key, uint32_t key_len,
+            void *val, uint32_t *val_len)
+{
+    int slot;
+    uint8_t *page = find_entry(table, bucket_hash(key, key_len),
+                               fingerprint(key, key_len), key, key_len, &slot);
+    if (!page) return false;
+    struct slot *found = &page_slots(page)[slot];
+    memcpy(val, page + found->offset + key_len, found->val_len);
+    *val_len = found->val_len;
+    return true;
+}
+
+bool contains_key(struct hash_map *table,
+                  const void *key, uint32_t key_len)
+{
+    int slot;
+    return find_entry(table, bucket_hash(key, key_len),
+                      fingerprint(key, key_len), key, key_len, &slot) != 0;
+}
+
+struct batch_key {
+    uint64_t page_no;
+    uint32_t hash_key;
+    uint32_t index;
+};
+
+static int compare_batch_keys(const void *a, const void *b)
+{
+    uint64_t x = ((const struct batch_key *)a)->page_no;
+    uint64_t y = ((const struct batch_key *)b)->page_no;
+    return (x > y) - (x < y);
+}
+
+void contains_keys(struct hash_map *table, uint32_t n,
+                   const void **keys, const uint32_t *key_lens,
+                   bool *found)
+{
+    struct batch_key *batch = (struct batch_key *)malloc(n * sizeof(struct batch_key));
+    for (uint32_t i = 0; i < n; ++i) {
+        batch[i].hash_key = bucket_hash(keys[i], key_lens[i]);
+        batch[i].page_no = bucket_page(table, batch[i].hash_key);
+        batch[i].index = i;
+    }
+    qsort(batch, n, sizeof(struct batch_key), compare_batch_keys);
+
+#ifdef POSIX_FADV_WILLNEED
+    for (uint32_t i = 0; i < n; ++i) {
+        if ((i > 0 && batch[i].page_no == batch[i - 1].page_no) ||
+            find_cached(table, batch[i].page_no) != NO_CACHED)
+            continue;
+        posix_fadvise(table->fd, batch[i].page_no * PAGE_BYTES, PAGE_BYTES,
+                      POSIX_FADV_WILLNEED);
+    }
+#endif
+
+    int slot;
+    for (uint32_t i = 0; i < n; ++i) {
+        uint32_t k = batch[i].index;
+        found[k] = find_entry(table, batch[i].hash_key,
+                              fingerprint(keys[k], key_lens[k]),
+                              keys[k], key_lens[k], &slot) != 0;
+    }
+    free(batch);
+}
+
+bool delete_key(struct hash_map *table,
+                const void *key, uint32_t key_len)
+{
+    int slot;
+    uint8_t *page = find_entry(table, bucket_hash(key, key_len),
+                               fingerprint(key, key_len), key, key_len, &slot);
+    if (!page) return false;
+    remove_slot(page, slot);
+    dirty_page(table, page);
+    table->header->no_keys--;
+    return true;
+}
+
+uint64_t no_keys(struct hash_map *table)
+{
+    return table->header->no_keys;
+}
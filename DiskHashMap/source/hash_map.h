@@ -0,0 +1,89 @@
+//
+//  hash_map.h
+//  DiskHashMap
+//
+//  Created by Thomas Mailund on 19/10/2026.
+//  Copyright © 2026 Thomas Mailund. All rights reserved.
+//
+
+#ifndef hash_map_h
+#define hash_map_h
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// A map of byte-string keys and values that lives in a file, for key
+// sets that do not fit in memory. Keys go to buckets of 4 KB pages
+// with extendible hashing: a directory in memory maps the low bits of
+// a key's hash to its bucket, and when a bucket is full we split only
+// that bucket, doubling the directory when the bucket already uses
+// all its bits. Pages keep a one-byte fingerprint per key, so we only
+// compare the bytes of keys whose fingerprints match. Keys whose
+// hashes agree on all the bits we can split on go to overflow pages
+// chained after the bucket's page.
+//
+// We read and write pages with pread() and pwrite() through a small
+// cache of recently used pages. Changed pages are written when they
+// leave the cache, and sync_map() writes the rest, sorted so pages
+// that follow each other in the file go in a single pwritev().
+//
+// The file is only consistent after sync_map() or close_map(); if the
+// process dies between them, the file may be lost. Pages freed when
+// buckets split are reused, but deleting keys never shrinks the file.
+
+// Keys and values together can be at most this many bytes
+#define MAX_ENTRY_BYTES 1000
+
+struct file_header;
+struct cached_page;
+
+struct hash_map {
+    int fd;
+    struct file_header *header;
+    uint64_t *directory; // bucket pages
+    uint64_t *free_pages;
+    uint64_t free_size;
+
+    // The page cache
+    struct cached_page *cache;
+    uint8_t *cache_data;
+    uint32_t cache_size, cache_used;
+    uint32_t *cache_index, index_mask;
+    uint32_t lru_head, lru_tail;
+
+    bool failed;                      // a read or write failed
+    uint64_t page_reads, page_writes; // for benchmarks
+};
+
+// Opens the map in the file at path, creating it if it does not
+// exist. The cache holds cache_pages pages. Returns null if the file
+// exists but is not a map.
+struct hash_map *open_map(const char *path, uint32_t cache_pages);
+// Syncs and closes the map. Returns false if we could not write it.
+bool  close_map    (struct hash_map *table);
+// Writes all changed pages and the directory, and fsyncs the file.
+bool  sync_map     (struct hash_map *table);
+
+// Updates return false if the key and value are too large, or if
+// we could not read or write the file.
+bool  map          (struct hash_map *table,
+                    const void *key, uint32_t key_len,
+                    const void *val, uint32_t val_len);
+// Copies the key's value to val, which must have room for it.
+bool  lookup       (struct hash_map *table,
+                    const void *key, uint32_t key_len,
+                    void *val, uint32_t *val_len);
+bool  contains_key (struct hash_map *table,
+                    const void *key, uint32_t key_len);
+// Looks up n keys, sorted by bucket so we read each page once. We
+// tell the kernel about all the pages first, so it can read them in
+// parallel.
+void  contains_keys(struct hash_map *table, uint32_t n,
+                    const void **keys, const uint32_t *key_lens,
+                    bool *found);
+// Returns false if the key is not in the map.
+bool  delete_key   (struct hash_map *table,
+                    const void *key, uint32_t key_len);
+uint64_t no_keys   (struct hash_map *table);
+
+#endif /* hash_map_h */
@@ -0,0 +1,107 @@
+//
+//  main.c
+//  Test
+//
+//  Created by Thomas Mailund on 19/10/2026.
+//  Copyright © 2026 Thomas Mailund. All rights reserved.
+//
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <assert.h>
+#include "hash_strings.h"
+
+// Bob Jenkins' lookup2 hash, with the words put together from bytes,
+// so it does not depend on alignment or on the byte order. Like
+// jenkins_hash, it adds the number of bytes left after the words to
+// c, where lookup2 adds the key length. On a little-endian machine
+// jenkins_hash must give the same hashes.
+#define mix(a,b,c) \
+{ \
+a -= b; a -= c; a ^= (c>>13); \
+b -= c; b -= a; b ^= (a<<8); \
+c -= a; c -= b; c ^= (b>>13); \
+a -= b; a -= c; a ^= (c>>12); \
+b -= c; b -= a; b ^= (a<<16); \
+c -= a; c -= b; c ^= (b>>5); \
+a -= b; a -= c; a ^= (c>>3); \
+b -= c; b -= a; b ^= (a<<10); \
+c -= a; c -= b; c ^= (b>>15); \
+}
+
+static uint32_t word(const unsigned char *k)
+{
+    return k[0] + ((uint32_t)k[1] << 8) + ((uint32_t)k[2] << 16) + ((uint32_t)k[3] << 24);
+}
+
+static uint32_t lookup2(uint32_t state, const char *key, int len)
+{
+    const unsigned char *k = (const unsigned char *)key;
+    uint32_t a = 0x9e3779b9, b = 0x9e3779b9, c = state;
+    int left = len;
+    while (left >= 12) {
+        a += word(k);
+        b += word(k + 4);
+        c += word(k + 8);
+        mix(a, b, c);
+        k += 12;
+        left -= 12;
+    }
+    c += left;
+    switch (left) {
+        case 11: c += (uint32_t)k[10] << 24;
+        case 10: c += (uint32_t)k[9] << 16;
+        case 9 : c += (uint32_t)k[8] << 8;
+        case 8 : b += (uint32_t)k[7] << 24;
+        case 7 : b += (uint32_t)k[6] << 16;
+        case 6 : b += (uint32_t)k[5] << 8;
+        case 5 : b += k[4];
+        case 4 : a += (uint32_t)k[3] << 24;
+        case 3 : a += (uint32_t)k[2] << 16;
+        case 2 : a += (uint32_t)k[1] << 8;
+        case 1 : a += k[0];
+    }
+    mix(a, b, c);
+    return c;
+}
+
+static bool little_endian(void)
+{
+    uint32_t x = 1;
+    return *(unsigned char *)&x == 1;
+}
+
+int main(int argc, const char *argv[])
+{
+    const char *text =
+    "The quick brown fox jumps over the lazy dog, "
+    "and then it does it again.";
+    int text_len = (int)strlen(text);
+
+    // The hash of a key only depends on the key. We copy the key to
+    // the start of a buffer and fill the rest with different bytes.
+    char buffer[128];
+    for (int len = 0; len <= text_len; ++len) {
+        memset(buffer, 'x', sizeof(buffer));
+        memcpy(buffer, text, len);
+        uint32_t hash = jenkins_hash(0, buffer, len);
+        memset(buffer + len, 'y', sizeof(buffer) - len);
+        assert(jenkins_hash(0, buffer, len) == hash);
+
+        // Keys do not have to be aligned
+        memcpy(buffer + 1, text, len);
+        assert(jenkins_hash(0, buffer + 1, len) == hash);
+
+        if (little_endian()) {
+            assert(hash == lookup2(0, text, len));
+            assert(jenkins_hash(42, buffer + 1, len) == lookup2(42, text, len));
+        }
+    }
+
+    printf("SUCCESS\n");
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,357 @@
+//
+//  main.c
+//  WordFrequency
+//
+//  Created by Thomas Mailund on 19/10/2026.
+//  Copyright © 2026 Thomas Mailund. All rights reserved.
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <sys/resource.h>
+#include "hash_map.h"
+#include "hash_strings.h"
+
+// Counts the words in a text file with a map and each of the string
+// hash functions:
+//
+//     word_frequency [-h hash] [-w words] file
+//
+// It works with any of the maps that have the void-pointer interface,
+// ChainedHashMap, LinearProbeHashMap, ConcurrentChainedHashMap and
+// RCUHashMap, so build it with the source of the one you want to
+// measure, e.g.
+//
+//     cc -O2 -ILinearProbeHashMap/source -IHashFunctions/source
+//        LinearProbeHashMap/source/*.c HashFunctions/source/hash_strings.c
+//        HashFunctions/WordFrequency/main.c -lpthread -lm
+//
+// For ChainedUniversalHashMap and LinearProbeUniversalHashMap, where
+// the string hash is the pre-hash, add -DUNIVERSAL_MAP.
+//
+// A word is a run of letters, digits or non-ASCII bytes, so UTF-8
+// words stay whole. Words are case sensitive. Keys point into the
+// memory-mapped file, so we only copy a word's position when we see
+// it the first time.
+//
+// For each hash function we report words per second, the key
+// comparisons per word, the distinct words that share a full 32-bit
+// hash, the words that share a bin in a table with twice as many bins
+// as words, compared to what a random function would give, and the
+// peak memory. Each function runs in its own process, so the memory
+// we report is its own. -w prints the most frequent words.
+
+typedef uint32_t (*string_hash_func)(uint32_t state, char *input, int len);
+
+static struct {
+    const char *name;
+    string_hash_func hash;
+} hash_functions[] = {
+    { "jenkins", jenkins_hash },
+    { "one-at-a-time", one_at_a_time_hash },
+    { "rotating", rotating_hash },
+    { "additive", additive_hash },
+};
+#define NO_HASH_FUNCTIONS (sizeof(hash_functions) / sizeof(hash_functions[0]))
+
+static double now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static bool is_word_byte(uint8_t c)
+{
+    return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') ||
+    (c >= '0' && c <= '9') || c >= 0x80;
+}
+
+#pragma mark words
+
+struct word {
+    const char *bytes;
+    uint32_t len;
+    uint64_t count;
+};
+
+// Words live in blocks, so they do not move when we add more
+#define BLOCK_SIZE 4096
+
+struct word_block {
+    struct word words[BLOCK_SIZE];
+    uint32_t used;
+    struct word_block *next;
+};
+
+static string_hash_func string_hash;
+static uint64_t no_hash_calls, no_key_cmps;
+
+static uint32_t word_hash(void *key)
+{
+    struct word *word = (struct word *)key;
+    no_hash_calls++;
+    return string_hash(0, (char *)word->bytes, (int)word->len);
+}
+
+static bool word_cmp(void *a, void *b)
+{
+    struct word *x = (struct word *)a, *y = (struct word *)b;
+    no_key_cmps++;
+    return x->len == y->len && memcmp(x->bytes, y->bytes, x->len) == 0;
+}
+
+static void no_destructor(void *x)
+{
+}
+
+static struct word *new_word(struct word_block **blocks, const char *bytes, uint32_t len)
+{
+    if (!*blocks || (*blocks)->used == BLOCK_SIZE) {
+        struct word_block *block = (struct word_block *)malloc(sizeof(struct word_block));
+        block->used = 0;
+        block->next = *blocks;
+        *blocks = block;
+    }
+    struct word *word = &(*blocks)->words[(*blocks)->used++];
+    word->bytes = bytes;
+    word->len = len;
+    word->count = 0;
+    return word;
+}
+
+#pragma mark statistics
+
+// What we get back from the process that counts
+struct result {
+    uint64_t no_words, no_distinct;
+    double seconds;
+    uint64_t no_hash_calls, no_key_cmps;
+    uint64_t hash_collisions;      // distinct words that share a hash
+    uint64_t bin_collisions;       // and that share a bin
+    double expected_bin_collisions;
+};
+
+static int cmp_uint32(const void *a, const void *b)
+{
+    uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+    return (x > y) - (x < y);
+}
+
+static uint64_t no_repeats(uint32_t *values, uint64_t n)
+{
+    qsort(values, n, sizeof(uint32_t), cmp_uint32);
+    uint64_t repeats = 0;
+    for (uint64_t i = 1; i < n; ++i) {
+        repeats += values[i] == values[i - 1];
+    }
+    return repeats;
+}
+
+static void collisions(struct word_block *blocks, struct result *result)
+{
+    uint64_t n = result->no_distinct;
+    uint32_t *hashes = (uint32_t *)malloc(n * sizeof(uint32_t));
+    uint64_t i = 0;
+    for (struct word_block *block = blocks; block; block = block->next) {
+        for (uint32_t j = 0; j < block->used; ++j) {
+            struct word *word = &block->words[j];
+            hashes[i++] = string_hash(0, (char *)word->bytes, (int)word->len);
+        }
+    }
+    result->hash_collisions = no_repeats(hashes, n);
+
+    uint64_t m = 2;
+    while (m < 2 * n) m *= 2;
+    for (i = 0; i < n; ++i) {
+        hashes[i] &= (uint32_t)(m - 1);
+    }
+    result->bin_collisions = no_repeats(hashes, n);
+    // With a random function, the words occupy m(1 - e^(-n/m)) bins
+    result->expected_bin_collisions = n - m * (1.0 - exp(-(double)n / m));
+    free(hashes);
+}
+
+static int cmp_counts(const void *a, const void *b)
+{
+    const struct word *x = *(struct word *const *)a, *y = *(struct word *const *)b;
+    return (x->count < y->count) - (x->count > y->count);
+}
+
+static void print_top_words(struct word_block *blocks, uint64_t n, int no_top)
+{
+    struct word **words = (struct word **)malloc(n * sizeof(struct word *));
+    uint64_t i = 0;
+    for (struct word_block *block = blocks; block; block = block->next) {
+        for (uint32_t j = 0; j < block->used; ++j) {
+            words[i++] = &block->words[j];
+        }
+    }
+    qsort(words, n, sizeof(struct word *), cmp_counts);
+    for (i = 0; i < n && i < (uint64_t)no_top; ++i) {
+        printf("%10llu %.*s\n", (unsigned long long)words[i]->count,
+               (int)words[i]->len, words[i]->bytes);
+    }
+    printf("\n");
+    fflush(stdout);
+    free(words);
+}
+
+#pragma mark counting
+
+static void count_words(const char *text, size_t size, struct result *result,
+                        int no_top)
+{
+    no_hash_calls = no_key_cmps = 0;
+    struct word_block *blocks = 0;
+#ifdef UNIVERSAL_MAP
+    struct hash_map *table = new_map(1024, 1.0, word_hash, word_cmp,
+                                     no_destructor, no_destructor);
+#else
+    struct hash_map *table = new_map(1024, word_hash, word_cmp,
+                                     no_destructor, no_destructor);
+#endif
+
+    uint64_t no_words = 0, no_distinct = 0;
+    double begin = now();
+    size_t i = 0;
+    while (i < size) {
+        while (i < size && !is_word_byte(text[i])) i++;
+        size_t start = i;
+        while (i < size && is_word_byte(text[i])) i++;
+        if (i == start) break;
+
+        struct word key = { text + start, (uint32_t)(i - start), 0 };
+        struct word *word = (struct word *)lookup(table, &key);
+        if (!word) {
+            word = new_word(&blocks, key.bytes, key.len);
+            map(table, word, word);
+            no_distinct++;
+        }
+        word->count++;
+        no_words++;
+    }
+    result->seconds = now() - begin;
+    result->no_words = no_words;
+    result->no_distinct = no_distinct;
+    result->no_hash_calls = no_hash_calls;
+    result->no_key_cmps = no_key_cmps;
+
+    collisions(blocks, result);
+    if (no_top > 0) print_top_words(blocks, no_distinct, no_top);
+
+    delete_map(table);
+    while (blocks) {
+        struct word_block *next = blocks->next;
+        free(blocks);
+        blocks = next;
+    }
+}
+
+static long peak_kb(struct rusage *usage)
+{
+#ifdef __APPLE__
+    return usage->ru_maxrss / 1024; // macOS reports bytes
+#else
+    return usage->ru_maxrss;
+#endif
+}
+
+#pragma mark main
+
+static void usage(const char *name)
+{
+    fprintf(stderr, "Usage: %s [-h hash] [-w words] file\n", name);
+    exit(EXIT_FAILURE);
+}
+
+int main(int argc, char *argv[])
+{
+    const char *hash_name = 0;
+    int no_top = 0;
+    int opt;
+    while ((opt = getopt(argc, argv, "h:w:")) != -1) {
+        switch (opt) {
+            case 'h': hash_name = optarg; break;
+            case 'w': no_top = atoi(optarg); break;
+            default: usage(argv[0]);
+        }
+    }
+    if (optind != argc - 1) usage(argv[0]);
+
+    int fd = open(argv[optind], O_RDONLY);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) != 0) {
+        perror(argv[optind]);
+        return EXIT_FAILURE;
+    }
+    size_t size = st.st_size;
+    const char *text = "";
+    if (size > 0) {
+        text = (const char *)mmap(0, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (text == MAP_FAILED) {
+            perror(argv[optind]);
+            return EXIT_FAILURE;
+        }
+    }
+    close(fd);
+
+    struct result *result =
+    (struct result *)mmap(0, sizeof(struct result), PROT_READ | PROT_WRITE,
+                          MAP_SHARED | MAP_ANON, -1, 0);
+    bool header = false;
+    for (size_t f = 0; f < NO_HASH_FUNCTIONS; ++f) {
+        if (hash_name && strcmp(hash_name, hash_functions[f].name) != 0)
+            continue;
+        string_hash = hash_functions[f].hash;
+
+        fflush(stdout);
+        pid_t pid = fork();
+        if (pid == 0) {
+            count_words(text, size, result, no_top);
+            _exit(EXIT_SUCCESS);
+        }
+        int status;
+        struct rusage usage;
+        if (pid < 0 || wait4(pid, &status, 0, &usage) < 0 ||
+            !WIFEXITED(status) || WEXITSTATUS(status) != EXIT_SUCCESS) {
+            fprintf(stderr, "Counting with %s failed.\n", hash_functions[f].name);
+            return EXIT_FAILURE;
+        }
+        no_top = 0; // we only list the words once
+
+        if (!header) {
+            printf("%llu words, %llu distinct, %.1f MB\n\n",
+                   (unsigned long long)result->no_words,
+                   (unsigned long long)result->no_distinct, size / 1e6);
+            printf("%-14s %9s %8s %9s %9s %11s %16s %9s\n",
+                   "hash", "Mwords/s", "MB/s", "hashes/w", "cmps/w",
+                   "hash coll", "bin coll (rand)", "peak MB");
+            header = true;
+        }
+        double words = result->no_words ? result->no_words : 1;
+        printf("%-14s %9.2f %8.1f %9.2f %9.2f %11llu %7llu (%7.0f) %9.1f\n",
+               hash_functions[f].name,
+               result->no_words / result->seconds * 1e-6,
+               size / result->seconds * 1e-6,
+               result->no_hash_calls / words,
+               result->no_key_cmps / words,
+               (unsigned long long)result->hash_collisions,
+               (unsigned long long)result->bin_collisions,
+               result->expected_bin_collisions,
+               peak_kb(&usage) / 1024.0);
+    }
+    if (!header) usage(argv[0]);
+
+    munmap(result, sizeof(struct result));
+    if (size > 0) munmap((void *)text, size);
+    return EXIT_SUCCESS;
+}
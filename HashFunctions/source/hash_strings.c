@@ -6,6 +6,7 @@
 //  Copyright © 2018 Thomas Mailund. All rights reserved.
 //
 
+#include <string.h>
 #include "hash_strings.h"
 
 uint32_t additive_hash(uint32_t state, char *input, int len)
@@ -67,9 +68,13 @@ uint32_t jenkins_hash(uint32_t state, char *input, int len)
     /*---------------------------------------- handle most of the key */
     while (len >= 12)
     {
-        a += *((uint32_t*)input);
-        b += *((uint32_t*)input + 4);
-        c += *((uint32_t*)input + 8);
+        // The next twelve bytes as three words. The input need not
+        // be aligned, so we copy them.
+        uint32_t words[3];
+        memcpy(words, input, sizeof(words));
+        a += words[0];
+        b += words[1];
+        c += words[2];
         mix(a,b,c);
         input += 12;
         len -= 12;
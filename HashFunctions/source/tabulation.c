@@ -0,0 +1,215 @@
+//
+//  tabulation.c
+//  HashFunctions
+//
+//  Created by Thomas Mailund on 19/10/2026.
+//  Copyright © 2026 Thomas Mailund. All rights reserved.
+//
+
+#include <stdlib.h>
+#include "tabulation.h"
+#if defined(__AVX2__) || defined(__AVX512F__)
+#include <immintrin.h>
+#endif
+
+#pragma mark random numbers
+
+// splitmix64
+uint64_t tabulation_random(uint64_t *state)
+{
+    uint64_t z = (*state += 0x9e3779b97f4a7c15);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111eb;
+    return z ^ (z >> 31);
+}
+
+void tabulation_sample(uint64_t *state, uint32_t *start, uint32_t *end)
+{
+    // one call to the generator gives us two entries
+    while (end - start >= 2) {
+        uint64_t r = tabulation_random(state);
+        *(start++) = (uint32_t)r;
+        *(start++) = (uint32_t)(r >> 32);
+    }
+    if (start != end)
+        *start = (uint32_t)tabulation_random(state);
+}
+
+#pragma mark tabulation hashing
+
+// tabulation hashing, r=4, q=32
+uint32_t tabhash_32_r4(uint32_t x, const uint32_t *T)
+{
+    const int r = 4;
+    const uint32_t no_cols = 1 << r;
+    const uint32_t mask = (1 << r) - 1;
+
+    uint32_t y = T[0 * no_cols + (x & mask)]; x >>= r;
+    y ^= T[1 * no_cols + (x & mask)]; x >>= r;
+    y ^= T[2 * no_cols + (x & mask)]; x >>= r;
+    y ^= T[3 * no_cols + (x & mask)]; x >>= r;
+    y ^= T[4 * no_cols + (x & mask)]; x >>= r;
+    y ^= T[5 * no_cols + (x & mask)]; x >>= r;
+    y ^= T[6 * no_cols + (x & mask)]; x >>= r;
+    y ^= T[7 * no_cols + (x & mask)];
+
+    return y;
+}
+
+// tabulation hashing, r=8, q=32
+uint32_t tabhash_32_r8(uint32_t x, const uint32_t *T)
+{
+    const int r = 8;
+    const uint32_t no_cols = 1 << r;
+    const uint32_t mask = (1 << r) - 1;
+
+    uint32_t y = T[0 * no_cols + (x & mask)]; x >>= r;
+    y ^= T[1 * no_cols + (x & mask)]; x >>= r;
+    y ^= T[2 * no_cols + (x & mask)]; x >>= r;
+    y ^= T[3 * no_cols + (x & mask)];
+
+    return y;
+}
+
+// Tabulation hashing of n keys at a time. With AVX2 or AVX-512 we
+// hash 8 or 16 keys per iteration, using gathers against T (which
+// is small enough to stay in L1); the rest go through tabhash_32_r8().
+void tabhash_32_r8_n(const uint32_t *x, uint32_t *y, size_t n, const uint32_t *T)
+{
+    size_t i = 0;
+#if defined(__AVX512F__)
+    const __m512i mask = _mm512_set1_epi32(0xff);
+    for (; i + 16 <= n; i += 16) {
+        __m512i k = _mm512_loadu_si512((const void *)(x + i));
+        __m512i c0 = _mm512_and_si512(k, mask);
+        __m512i c1 = _mm512_or_si512(_mm512_and_si512(_mm512_srli_epi32(k, 8), mask),
+                                     _mm512_set1_epi32(1 << 8));
+        __m512i c2 = _mm512_or_si512(_mm512_and_si512(_mm512_srli_epi32(k, 16), mask),
+                                     _mm512_set1_epi32(2 << 8));
+        __m512i c3 = _mm512_or_si512(_mm512_srli_epi32(k, 24),
+                                     _mm512_set1_epi32(3 << 8));
+        __m512i h = _mm512_i32gather_epi32(c0, (const void *)T, 4);
+        h = _mm512_xor_si512(h, _mm512_i32gather_epi32(c1, (const void *)T, 4));
+        h = _mm512_xor_si512(h, _mm512_i32gather_epi32(c2, (const void *)T, 4));
+        h = _mm512_xor_si512(h, _mm512_i32gather_epi32(c3, (const void *)T, 4));
+        _mm512_storeu_si512((void *)(y + i), h);
+    }
+#elif defined(__AVX2__)
+    const __m256i mask = _mm256_set1_epi32(0xff);
+    for (; i + 8 <= n; i += 8) {
+        __m256i k = _mm256_loadu_si256((const __m256i *)(x + i));
+        __m256i c0 = _mm256_and_si256(k, mask);
+        __m256i c1 = _mm256_or_si256(_mm256_and_si256(_mm256_srli_epi32(k, 8), mask),
+                                     _mm256_set1_epi32(1 << 8));
+        __m256i c2 = _mm256_or_si256(_mm256_and_si256(_mm256_srli_epi32(k, 16), mask),
+                                     _mm256_set1_epi32(2 << 8));
+        __m256i c3 = _mm256_or_si256(_mm256_srli_epi32(k, 24),
+                                     _mm256_set1_epi32(3 << 8));
+        __m256i h = _mm256_i32gather_epi32((const int *)T, c0, 4);
+        h = _mm256_xor_si256(h, _mm256_i32gather_epi32((const int *)T, c1, 4));
+        h = _mm256_xor_si256(h, _mm256_i32gather_epi32((const int *)T, c2, 4));
+        h = _mm256_xor_si256(h, _mm256_i32gather_epi32((const int *)T, c3, 4));
+        _mm256_storeu_si256((__m256i *)(y + i), h);
+    }
+#endif
+    for (; i < n; ++i)
+        y[i] = tabhash_32_r8(x[i], T);
+}
+
+// tabulation hashing, r=8, p=64, q=32
+uint32_t tabhash_64_r8(uint64_t x, const uint32_t *T)
+{
+    const int r = 8;
+    const uint32_t no_cols = 1 << r;
+    const uint64_t mask = (1 << r) - 1;
+
+    uint32_t y = T[0 * no_cols + (x & mask)]; x >>= r;
+    y ^= T[1 * no_cols + (x & mask)]; x >>= r;
+    y ^= T[2 * no_cols + (x & mask)]; x >>= r;
+    y ^= T[3 * no_cols + (x & mask)]; x >>= r;
+    y ^= T[4 * no_cols + (x & mask)]; x >>= r;
+    y ^= T[5 * no_cols + (x & mask)]; x >>= r;
+    y ^= T[6 * no_cols + (x & mask)]; x >>= r;
+    y ^= T[7 * no_cols + (x & mask)];
+
+    return y;
+}
+
+// Twisted tabulation (Patrascu and Thorup). The tables hold 64-bit
+// entries; the low bits of the first seven lookups "twist" the last
+// character before we look it up, and the high 32 bits are the hash.
+uint32_t twisted_tabhash_64(uint64_t x, const uint64_t *T)
+{
+    const int r = 8;
+    const uint32_t no_cols = 1 << r;
+    const uint64_t mask = (1 << r) - 1;
+
+    uint64_t h = T[0 * no_cols + (x & mask)]; x >>= r;
+    h ^= T[1 * no_cols + (x & mask)]; x >>= r;
+    h ^= T[2 * no_cols + (x & mask)]; x >>= r;
+    h ^= T[3 * no_cols + (x & mask)]; x >>= r;
+    h ^= T[4 * no_cols + (x & mask)]; x >>= r;
+    h ^= T[5 * no_cols + (x & mask)]; x >>= r;
+    h ^= T[6 * no_cols + (x & mask)]; x >>= r;
+    h ^= T[7 * no_cols + ((x ^ h) & mask)];
+
+    return (uint32_t)(h >> 32);
+}
+
+#pragma mark tables
+
+static int table_bytes(enum tabulation_kind kind)
+{
+    // p bits in keys, r bits per character, q bits in table entries
+    int p, r, q;
+    switch (kind) {
+        case TABULATION_32_R4:         p = 32; r = 4; q = 32; break;
+        case TABULATION_32_R8:         p = 32; r = 8; q = 32; break;
+        case TABULATION_64_R8:         p = 64; r = 8; q = 32; break;
+        case TABULATION_64_R8_TWISTED: p = 64; r = 8; q = 64; break;
+        default: return 0;
+    }
+    int no_cols = (1 << r);
+    int t = p / r;
+    return t * no_cols * q / 8;
+}
+
+struct tabulation *new_tabulation(enum tabulation_kind kind, uint64_t seed)
+{
+    struct tabulation *tab =
+    (struct tabulation *)malloc(sizeof(struct tabulation));
+    int bytes = table_bytes(kind);
+    tab->kind = kind;
+    tab->rng_state = seed;
+    tab->T = malloc(bytes);
+    tab->T_end = tab->T + bytes;
+    tabulation_resample(tab);
+    return tab;
+}
+
+void delete_tabulation(struct tabulation *tab)
+{
+    free(tab->T);
+    free(tab);
+}
+
+void tabulation_resample(struct tabulation *tab)
+{
+    tabulation_sample(&tab->rng_state,
+                      (uint32_t *)tab->T, (uint32_t *)tab->T_end);
+}
+
+uint32_t tabulation_hash(struct tabulation *tab, uint64_t x)
+{
+    switch (tab->kind) {
+        case TABULATION_32_R4:
+            return tabhash_32_r4((uint32_t)x, (uint32_t *)tab->T);
+        case TABULATION_32_R8:
+            return tabhash_32_r8((uint32_t)x, (uint32_t *)tab->T);
+        case TABULATION_64_R8:
+            return tabhash_64_r8(x, (uint32_t *)tab->T);
+        case TABULATION_64_R8_TWISTED:
+            return twisted_tabhash_64(x, (uint64_t *)tab->T);
+    }
+    return 0;
+}
@@ -0,0 +1,55 @@
+//
+//  tabulation.h
+//  HashFunctions
+//
+//  Created by Thomas Mailund on 19/10/2026.
+//  Copyright © 2026 Thomas Mailund. All rights reserved.
+//
+
+#ifndef tabulation_h
+#define tabulation_h
+
+#include <stdint.h>
+#include <stddef.h>
+
+// Each tabulation table carries its own random number generator
+// (splitmix64), so sampling a table never touches global state. The
+// same seed always gives the same table.
+uint64_t tabulation_random(uint64_t *state);
+void     tabulation_sample(uint64_t *state, uint32_t *start, uint32_t *end);
+
+enum tabulation_kind {
+    TABULATION_32_R4,         // 32-bit keys, 4-bit characters, 8 lookups
+    TABULATION_32_R8,         // 32-bit keys, 8-bit characters, 4 lookups
+    TABULATION_64_R8,         // 64-bit keys, 8-bit characters, 8 lookups
+    TABULATION_64_R8_TWISTED  // 64-bit keys, twisted tabulation
+};
+
+struct tabulation {
+    enum tabulation_kind kind;
+    uint64_t rng_state;
+    uint8_t *T, *T_end;
+};
+
+struct tabulation *
+new_tabulation          (enum tabulation_kind kind, uint64_t seed);
+void delete_tabulation  (struct tabulation *tab);
+void tabulation_resample(struct tabulation *tab);
+
+// Hashes with the table's kind; 32-bit kinds only use the low
+// 32 bits of the key.
+uint32_t tabulation_hash(struct tabulation *tab, uint64_t x);
+
+// The individual schemes, for when you want to inline the table
+// in your own structures.
+uint32_t tabhash_32_r4     (uint32_t x, const uint32_t *T);
+uint32_t tabhash_32_r8     (uint32_t x, const uint32_t *T);
+uint32_t tabhash_64_r8     (uint64_t x, const uint32_t *T);
+uint32_t twisted_tabhash_64(uint64_t x, const uint64_t *T);
+
+// Hashes n keys with tabhash_32_r8. Vectorised with gathers when
+// compiled with AVX2 or AVX-512.
+void tabhash_32_r8_n(const uint32_t *x, uint32_t *y, size_t n,
+                     const uint32_t *T);
+
+#endif /* tabulation_h */
@@ -0,0 +1,88 @@
+//
+//  main.c
+//  Benchmark
+//
+//  Created by Thomas Mailund on 19/10/2026.
+//  Copyright © 2026 Thomas Mailund. All rights reserved.
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "aggregation.h"
+
+static double now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static uint64_t next_random(uint64_t *state)
+{
+    uint64_t z = (*state += 0x9e3779b97f4a7c15);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111eb;
+    return z ^ (z >> 31);
+}
+
+// SUM, COUNT, MIN and MAX of the values
+static void stats_init(int64_t *slots)
+{
+    slots[0] = slots[1] = 0;
+    slots[2] = INT64_MAX;
+    slots[3] = INT64_MIN;
+}
+static void stats_update(int64_t *slots, int64_t value)
+{
+    slots[0] += value;
+    slots[1]++;
+    if (value < slots[2]) slots[2] = value;
+    if (value > slots[3]) slots[3] = value;
+}
+static void stats_combine(int64_t *slots, const int64_t *other)
+{
+    slots[0] += other[0];
+    slots[1] += other[1];
+    if (other[2] < slots[2]) slots[2] = other[2];
+    if (other[3] > slots[3]) slots[3] = other[3];
+}
+
+// Groups rows by key with 1 to 64 threads. The keys are uniform over
+// the groups; with few groups everything stays in the threads' local
+// maps, with many they spill and the merge does most of the work.
+int main(int argc, const char *argv[])
+{
+    size_t no_rows = 1 << 24;
+    uint64_t no_groups_ = 1 << 20;
+    if (argc > 1) no_groups_ = strtoull(argv[1], 0, 10);
+    if (argc > 2) no_rows = strtoull(argv[2], 0, 10);
+
+    uint64_t *keys = malloc(no_rows * sizeof(uint64_t));
+    int64_t *vals = malloc(no_rows * sizeof(int64_t));
+    uint64_t state = 1;
+    for (size_t i = 0; i < no_rows; ++i) {
+        uint64_t r = next_random(&state);
+        keys[i] = r % no_groups_;
+        vals[i] = (int64_t)(r >> 40);
+    }
+
+    struct aggregate stats = { 4, stats_init, stats_update, stats_combine };
+    printf("%zu rows, %llu groups, SUM/COUNT/MIN/MAX\n",
+           no_rows, (unsigned long long)no_groups_);
+    for (int no_threads = 1; no_threads <= 64; no_threads *= 2) {
+        double begin = now();
+        struct aggregation *aggregation =
+        group_by(&stats, keys, vals, no_rows, no_threads);
+        double elapsed = now() - begin;
+
+        printf("%2d threads: %7.2f Mrows/s (%llu groups)\n",
+               no_threads, no_rows / elapsed * 1e-6,
+               (unsigned long long)no_groups(aggregation));
+        delete_aggregation(aggregation);
+    }
+
+    free(keys);
+    free(vals);
+    return EXIT_SUCCESS;
+}
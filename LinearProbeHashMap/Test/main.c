@@ -8,8 +8,14 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <assert.h>
+#include <stdatomic.h>
+#include <unistd.h>
+#include <sys/stat.h>
 #include "hash_map.h"
+#include "aggregation.h"
+#include "external_aggregation.h"
 
 
 struct tag_key {
@@ -52,6 +58,163 @@ static void val_destroy(void *void_key)
     key->val_deleted = true;
 }
 
+static char *read_file(const char *path, long *size)
+{
+    FILE *file = fopen(path, "rb");
+    assert(file);
+    fseek(file, 0, SEEK_END);
+    *size = ftell(file);
+    rewind(file);
+    char *bytes = malloc(*size);
+    assert(fread(bytes, 1, *size, file) == *size);
+    fclose(file);
+    return bytes;
+}
+
+static void write_file(const char *path, const char *bytes, long size)
+{
+    FILE *file = fopen(path, "wb");
+    assert(file && fwrite(bytes, 1, size, file) == size);
+    fclose(file);
+}
+
+static void key_bytes(void *key, const void **bytes, uint32_t *len)
+{
+    *bytes = &((struct tag_key*)key)->key;
+    *len = sizeof(uint32_t);
+}
+
+static void count_entry(void *key, void *val, void *data)
+{
+    assert(key == val);
+    atomic_fetch_add((_Atomic int *)data, 1);
+}
+
+// SUM, COUNT, MIN and MAX of the values
+static void stats_init(int64_t *slots)
+{
+    slots[0] = slots[1] = 0;
+    slots[2] = INT64_MAX;
+    slots[3] = INT64_MIN;
+}
+static void stats_update(int64_t *slots, int64_t value)
+{
+    slots[0] += value;
+    slots[1]++;
+    if (value < slots[2]) slots[2] = value;
+    if (value > slots[3]) slots[3] = value;
+}
+static void stats_combine(int64_t *slots, const int64_t *other)
+{
+    slots[0] += other[0];
+    slots[1] += other[1];
+    if (other[2] < slots[2]) slots[2] = other[2];
+    if (other[3] > slots[3]) slots[3] = other[3];
+}
+
+static void count_group(uint64_t key, const int64_t *slots, void *data)
+{
+    *(int64_t *)data += slots[1];
+}
+
+// Saves the count and sum of each group, and checks that we only
+// see each group once.
+struct saved_groups {
+    int64_t *counts;
+    int64_t *sums;
+    int64_t no_groups;
+};
+
+static void save_group(uint64_t key, const int64_t *slots, void *data)
+{
+    struct saved_groups *saved = (struct saved_groups *)data;
+    assert(key < saved->no_groups);
+    assert(saved->counts[key] == 0);
+    saved->counts[key] = slots[1];
+    saved->sums[key] = slots[0];
+}
+
+// The table owns these keys and frees them, so the sanitizers catch
+// bins that still point to a key after we replaced or deleted it.
+static int no_freed;
+
+static void free_key(void *key)
+{
+    no_freed++;
+    free(key);
+}
+
+static void keep_val(void *val)
+{
+}
+
+static struct tag_key *new_tag_key(uint32_t key)
+{
+    struct tag_key *tag_key = (struct tag_key *)malloc(sizeof(struct tag_key));
+    init_tag_key(tag_key, key);
+    return tag_key;
+}
+
+// Sixteen clusters of keys, four keys per hash value, that start 128
+// bins before a multiple of 4096. When threads move the bins, the
+// clusters cross from one thread's range into the next, so some bins
+// are deferred, and the first cluster wraps around the end of the
+// table.
+static uint32_t cluster_hash(void *key)
+{
+    uint32_t k = ((struct tag_key *)key)->key;
+    return ((k & 15) << 12) - 128 + (k >> 6);
+}
+
+static void deferred_bins_test()
+{
+    int no_keys = 1 << 14;
+    struct hash_map *table =
+    new_map(1 << 16, cluster_hash, compare_values, free_key, keep_val);
+    table->resize_threads = 4;
+    for (int i = 0; i < no_keys; ++i) {
+        map(table, new_tag_key(i), (void *)(uintptr_t)(i + 1));
+    }
+    reserve_parallel(table, 1 << 16, 4);
+    assert(table->size == 1 << 17);
+
+    struct tag_key probe;
+    for (int i = 0; i < no_keys; ++i) {
+        init_tag_key(&probe, i);
+        assert(lookup(table, &probe) == (void *)(uintptr_t)(i + 1));
+    }
+
+    // Replacing keys frees the keys we moved
+    for (int i = 0; i < no_keys; i += 2) {
+        map(table, new_tag_key(i), (void *)(uintptr_t)(i + 2));
+    }
+    assert(no_freed == no_keys / 2);
+    assert(table->active == no_keys);
+
+    // Deleting most of the keys frees them and shrinks the table,
+    // and shrinking a large table moves the bins with several threads.
+    for (int i = 0; i < no_keys; ++i) {
+        if (i % 16 == 0) continue;
+        init_tag_key(&probe, i);
+        delete_key(table, &probe);
+    }
+    assert(table->size < 1 << 17);
+    assert(no_freed == no_keys / 2 + no_keys - no_keys / 16);
+    for (int i = 0; i < no_keys; ++i) {
+        init_tag_key(&probe, i);
+        void *val = lookup(table, &probe);
+        assert(val == (i % 16 == 0 ? (void *)(uintptr_t)(i + 2) : 0));
+    }
+    for (int i = 0; i < no_keys; i += 16) {
+        init_tag_key(&probe, i);
+        map(table, new_tag_key(i), (void *)(uintptr_t)(i + 1));
+        assert(lookup(table, &probe) == (void *)(uintptr_t)(i + 1));
+    }
+
+    delete_map(table);
+    assert(no_freed == no_keys + no_keys / 2 + no_keys / 16);
+}
+
 int main(int argc, const char *argv[])
 {
     
@@ -113,6 +276,316 @@ int main(int argc, const char *argv[])
     }
     
     delete_map(table);
+    
+    // Reusing a deleted bin must also update the value
+    table = new_map(4, id_hash, compare_values, key_destroy, val_destroy);
+    init_tag_key(&keys[0], 0);
+    init_tag_key(&keys[1], 4);
+    init_tag_key(&other_keys[0], 0);
+    map(table, &keys[0], &keys[0]);
+    map(table, &keys[1], &keys[1]);
+    delete_key(table, &keys[0]);
+    map(table, &other_keys[0], &other_keys[0]);
+    assert(lookup(table, &keys[0]) == &other_keys[0]);
+    
+    // Clearing destroys the keys but keeps the bins
+    uint32_t cleared_size = table->size;
+    clear_map(table);
+    assert(table->active == 0 && table->size == cleared_size);
+    assert(other_keys[0].key_deleted && keys[1].key_deleted);
+    assert(!contains_key(table, &other_keys[0]));
+    assert(!contains_key(table, &keys[1]));
+    init_tag_key(&keys[0], 0);
+    map(table, &keys[0], &keys[0]);
+    assert(lookup(table, &other_keys[0]) == &keys[0]);
+    delete_map(table);
+    
+    // Moving the bins with several threads. The table is large
+    // enough that resizes go through the parallel path.
+    int no_large = 200000;
+    struct tag_key *large_keys = malloc(no_large * sizeof(struct tag_key));
+    for (int i = 0; i < no_large; ++i) {
+        init_tag_key(&large_keys[i], i);
+    }
+    table = new_map(2, id_hash, compare_values, key_destroy, val_destroy);
+    table->resize_threads = 4;
+    for (int i = 0; i < no_large; ++i) {
+        map(table, &large_keys[i], &large_keys[i]);
+    }
+    for (int i = 0; i < no_large; ++i) {
+        assert(lookup(table, &large_keys[i]) == &large_keys[i]);
+    }
+    reserve_parallel(table, 4 * no_large, 3);
+    assert(table->size >= 8 * no_large);
+    assert(table->active == no_large);
+    for (int i = 0; i < no_large; i += 2) {
+        delete_key(table, &large_keys[i]);
+    }
+    for (int i = 0; i < no_large; ++i) {
+        assert(contains_key(table, &large_keys[i]) == (i % 2 == 1));
+    }
+    delete_map(table);
+    for (int i = 0; i < no_large; ++i) {
+        assert(large_keys[i].key_deleted == true);
+    }
+    free(large_keys);
+    
+    // Building from arrays. Each key appears twice.
+    int no_array = 100000;
+    struct tag_key *array_keys = malloc(2 * no_array * sizeof(struct tag_key));
+    void **array_key_ptrs = malloc(2 * no_array * sizeof(void *));
+    for (enum duplicate_keys duplicates = UNIQUE_KEYS;
+         duplicates <= KEEP_LAST_KEY; ++duplicates) {
+        // With unique keys we only give the table the first half
+        int n = duplicates == UNIQUE_KEYS ? no_array : 2 * no_array;
+        for (int i = 0; i < 2 * no_array; ++i) {
+            init_tag_key(&array_keys[i], i % no_array);
+            array_key_ptrs[i] = &array_keys[i];
+        }
+        table = new_map_from_arrays(n, array_key_ptrs, array_key_ptrs,
+                                    duplicates, 4, id_hash,
+                                    compare_values, key_destroy, val_destroy);
+        assert(table->active == no_array);
+        for (int i = 0; i < no_array; ++i) {
+            int kept = duplicates == KEEP_LAST_KEY ? i + no_array : i;
+            int dropped = duplicates == KEEP_LAST_KEY ? i : i + no_array;
+            assert(lookup(table, &array_keys[i]) == &array_keys[kept]);
+            assert(array_keys[kept].key_deleted == false);
+            assert(array_keys[dropped].key_deleted == (duplicates != UNIQUE_KEYS));
+        }
+        delete_map(table);
+    }
+    free(array_keys);
+    free(array_key_ptrs);
+    
+    // Group-by aggregation. There are more groups than fit in the
+    // threads' local maps, so they spill.
+    struct aggregate stats = { 4, stats_init, stats_update, stats_combine };
+    int no_rows = 1000000, no_row_groups = 50000;
+    uint64_t *row_keys = malloc(no_rows * sizeof(uint64_t));
+    int64_t *row_vals = malloc(no_rows * sizeof(int64_t));
+    for (int i = 0; i < no_rows; ++i) {
+        row_keys[i] = i % no_row_groups;
+        row_vals[i] = i;
+    }
+    for (int no_threads = 1; no_threads <= 4; no_threads *= 2) {
+        struct aggregation *aggregation =
+        group_by(&stats, row_keys, row_vals, no_rows, no_threads);
+        assert(no_groups(aggregation) == no_row_groups);
+        int64_t rows_per_group = no_rows / no_row_groups;
+        for (int k = 0; k < no_row_groups; ++k) {
+            const int64_t *slots = group_slots(aggregation, k);
+            assert(slots);
+            int64_t last = k + (rows_per_group - 1) * no_row_groups;
+            assert(slots[0] == (k + last) * rows_per_group / 2);
+            assert(slots[1] == rows_per_group);
+            assert(slots[2] == k);
+            assert(slots[3] == last);
+        }
+        assert(group_slots(aggregation, no_row_groups) == 0);
+        int64_t no_counted = 0;
+        for_each_group(aggregation, count_group, &no_counted);
+        assert(no_counted == no_rows);
+        delete_aggregation(aggregation);
+    }
+    
+    // Aggregation with a memory limit. With 64 KB, the groups are
+    // partitioned twice.
+    for (size_t limit = 1 << 16; limit <= 1 << 26; limit <<= 10) {
+        struct external_aggregation *aggregation =
+        new_external_aggregation(&stats, limit, 0);
+        int rows_per_call = 1000;
+        for (int i = 0; i < no_rows; i += rows_per_call) {
+            assert(external_aggregate_rows(aggregation, row_keys + i, row_vals + i,
+                                           rows_per_call));
+        }
+        struct saved_groups saved;
+        saved.no_groups = no_row_groups;
+        saved.counts = calloc(no_row_groups, sizeof(int64_t));
+        saved.sums = calloc(no_row_groups, sizeof(int64_t));
+        assert(finish_external_aggregation(aggregation, save_group, &saved));
+        int64_t rows_per_group = no_rows / no_row_groups;
+        for (int k = 0; k < no_row_groups; ++k) {
+            int64_t last = k + (rows_per_group - 1) * no_row_groups;
+            assert(saved.counts[k] == rows_per_group);
+            assert(saved.sums[k] == (k + last) * rows_per_group / 2);
+        }
+        if (limit == 1 << 16) assert(aggregation->max_level == 2);
+        if (limit == 1 << 26) assert(aggregation->spilled_records == 0);
+        free(saved.counts);
+        free(saved.sums);
+        delete_external_aggregation(aggregation);
+    }
+    free(row_keys);
+    free(row_vals);
+    
+    // Iteration
+    int no_iter = 10000;
+    struct tag_key *iter_keys = malloc(no_iter * sizeof(struct tag_key));
+    table = new_map(2, id_hash, compare_values, key_destroy, val_destroy);
+    for (int i = 0; i < no_iter; ++i) {
+        init_tag_key(&iter_keys[i], i);
+        map(table, &iter_keys[i], &iter_keys[i]);
+    }
+    int no_iterated = 0;
+    struct cursor cursor;
+    init_cursor(&cursor);
+    void *key, *val;
+    while (next_entry(table, &cursor, &key, &val)) {
+        assert(key == val);
+        ((struct tag_key *)key)->key_deleted = true;
+        no_iterated++;
+    }
+    assert(no_iterated == no_iter);
+    for (int i = 0; i < no_iter; ++i) {
+        assert(iter_keys[i].key_deleted == true);
+        iter_keys[i].key_deleted = false;
+    }
+    _Atomic int no_visited = 0;
+    for_each(table, count_entry, &no_visited);
+    assert(no_visited == no_iter);
+    for (int no_threads = 1; no_threads <= 8; no_threads *= 2) {
+        no_visited = 0;
+        for_each_parallel(table, count_entry, &no_visited, no_threads);
+        assert(no_visited == no_iter);
+    }
+    delete_map(table);
+    free(iter_keys);
+    
+    // Snapshots. Key i maps to key 3 * i, and we delete every
+    // third key before we write the snapshot.
+    int no_snapshot = 10000;
+    struct tag_key *snapshot_keys = malloc(2 * no_snapshot * sizeof(struct tag_key));
+    table = new_map(2, id_hash, compare_values, key_destroy, val_destroy);
+    for (int i = 0; i < no_snapshot; ++i) {
+        init_tag_key(&snapshot_keys[i], i);
+        init_tag_key(&snapshot_keys[i + no_snapshot], 3 * i);
+        map(table, &snapshot_keys[i], &snapshot_keys[i + no_snapshot]);
+    }
+    for (int i = 0; i < no_snapshot; i += 3) {
+        delete_key(table, &snapshot_keys[i]);
+    }
+    char path[] = "/tmp/snapshotXXXXXX";
+    close(mkstemp(path));
+    assert(!write_snapshot(table, "/nonexistent/snapshot", key_bytes, key_bytes));
+    assert(write_snapshot(table, path, key_bytes, key_bytes));
+    // We wrote the snapshot next to path and renamed it
+    char tmp_path[sizeof(path) + 4];
+    sprintf(tmp_path, "%s.tmp", path);
+    assert(access(tmp_path, F_OK) != 0);
+    
+    struct snapshot *snapshot = open_snapshot(path, id_hash, key_bytes);
+    assert(snapshot);
+    assert(snapshot_size(snapshot) == no_snapshot - (no_snapshot + 2) / 3);
+    const void *snapshot_val; uint32_t val_len;
+    for (int i = 0; i < no_snapshot; ++i) {
+        bool found = snapshot_lookup(snapshot, &snapshot_keys[i],
+                                     &snapshot_val, &val_len);
+        assert(found == (i % 3 != 0));
+        if (!found) continue;
+        assert(val_len == sizeof(uint32_t));
+        assert((uintptr_t)snapshot_val % 8 == 0);
+        assert(*(const uint32_t *)snapshot_val == 3 * i);
+    }
+    struct tag_key missing;
+    init_tag_key(&missing, no_snapshot);
+    assert(!snapshot_lookup(snapshot, &missing, &snapshot_val, &val_len));
+    close_snapshot(snapshot);
+    
+    // Deltas. We put back the deleted keys below 300 and delete
+    // the keys below 300 that are one more than a multiple of three.
+    for (int i = 0; i < 300; ++i) {
+        if (i % 3 == 0) map(table, &snapshot_keys[i], &snapshot_keys[i + no_snapshot]);
+        if (i % 3 == 1) delete_key(table, &snapshot_keys[i]);
+    }
+    char delta_path[] = "/tmp/deltaXXXXXX";
+    close(mkstemp(delta_path));
+    // A delta we cannot write keeps the dirty pages for the next one
+    assert(!write_delta(table, "/nonexistent/delta", key_bytes, key_bytes));
+    assert(write_delta(table, delta_path, key_bytes, key_bytes));
+    char delta_tmp_path[sizeof(delta_path) + 4];
+    sprintf(delta_tmp_path, "%s.tmp", delta_path);
+    assert(access(delta_tmp_path, F_OK) != 0);
+    struct stat snapshot_stat, delta_stat;
+    assert(stat(path, &snapshot_stat) == 0 && stat(delta_path, &delta_stat) == 0);
+    assert(delta_stat.st_size < snapshot_stat.st_size / 10);
+    
+    // A delta whose last page is not in the table is rejected before
+    // we write any of its pages. In the delta header, no_pages is at
+    // byte 28 and pages_offset at byte 48.
+    long delta_size, snapshot_bytes_size, after_size;
+    char *delta = read_file(delta_path, &delta_size);
+    char *snapshot_bytes = read_file(path, &snapshot_bytes_size);
+    uint32_t no_pages; uint64_t pages_offset;
+    memcpy(&no_pages, delta + 28, sizeof(no_pages));
+    memcpy(&pages_offset, delta + 48, sizeof(pages_offset));
+    assert(no_pages > 1);
+    uint32_t bad_page = UINT32_MAX;
+    memcpy(delta + pages_offset + (no_pages - 1) * sizeof(uint32_t),
+           &bad_page, sizeof(bad_page));
+    char bad_delta_path[] = "/tmp/deltaXXXXXX";
+    close(mkstemp(bad_delta_path));
+    write_file(bad_delta_path, delta, delta_size);
+    assert(!apply_delta(path, bad_delta_path));
+    char *after = read_file(path, &after_size);
+    assert(after_size == snapshot_bytes_size &&
+           memcmp(after, snapshot_bytes, after_size) == 0);
+    unlink(bad_delta_path);
+    free(delta); free(snapshot_bytes); free(after);
+    
+    assert(apply_delta(path, delta_path));
+    assert(apply_delta(path, delta_path)); // applying it again does nothing
+    snapshot = open_snapshot(path, id_hash, key_bytes);
+    assert(snapshot);
+    assert(snapshot_size(snapshot) == table->active);
+    for (int i = 0; i < no_snapshot; ++i) {
+        bool found = snapshot_lookup(snapshot, &snapshot_keys[i],
+                                     &snapshot_val, &val_len);
+        assert(found == (i < 300 ? i % 3 != 1 : i % 3 != 0));
+        if (found) assert(*(const uint32_t *)snapshot_val == 3 * i);
+    }
+    close_snapshot(snapshot);
+    
+    // Deltas must come in order
+    char next_delta_path[] = "/tmp/deltaXXXXXX";
+    close(mkstemp(next_delta_path));
+    delete_key(table, &snapshot_keys[2]);
+    assert(write_delta(table, delta_path, key_bytes, key_bytes));
+    delete_key(table, &snapshot_keys[5]);
+    assert(write_delta(table, next_delta_path, key_bytes, key_bytes));
+    assert(!apply_delta(path, next_delta_path));
+    assert(apply_delta(path, delta_path));
+    assert(apply_delta(path, next_delta_path));
+    
+    // After a resize, the delta holds all the table
+    uint32_t old_size = table->size;
+    for (int i = 0; i < no_snapshot; ++i) {
+        if (i < 1000) map(table, &snapshot_keys[i], &snapshot_keys[i + no_snapshot]);
+        else delete_key(table, &snapshot_keys[i]);
+    }
+    assert(table->size < old_size);
+    assert(write_delta(table, delta_path, key_bytes, key_bytes));
+    assert(apply_delta(path, delta_path));
+    snapshot = open_snapshot(path, id_hash, key_bytes);
+    assert(snapshot);
+    assert(snapshot_size(snapshot) == 1000);
+    for (int i = 0; i < no_snapshot; ++i) {
+        assert(snapshot_lookup(snapshot, &snapshot_keys[i],
+                               &snapshot_val, &val_len) == (i < 1000));
+    }
+    close_snapshot(snapshot);
+    unlink(delta_path);
+    unlink(next_delta_path);
+    delete_map(table);
+    
+    // A truncated file is not a snapshot
+    assert(truncate(path, 20) == 0);
+    assert(!open_snapshot(path, id_hash, key_bytes));
+    unlink(path);
+    free(snapshot_keys);
+    
+    deferred_bins_test();
+    
     printf("SUCCESS\n");
     
     return EXIT_SUCCESS;
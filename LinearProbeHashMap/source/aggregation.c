@@ -0,0 +1,334 @@
+//
+//  aggregation.c
+//  LinearProbeHashMap
+//
+//  Created by Thomas Mailund on 19/10/2026.
+//  Copyright © 2026 Thomas Mailund. All rights reserved.
+//
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include "aggregation.h"
+
+// A thread spills its groups when they and the bins of its map would
+// take up more than this.
+#define LOCAL_CACHE_SIZE (1 << 20)
+// About the size of a bin in the linear probe map.
+#define BIN_SIZE 24
+
+#define PARTITION_BITS 6
+#define NO_PARTITIONS (1 << PARTITION_BITS)
+
+// The largest map we make for a partition. It holds 2^30 groups
+// before it resizes, and map sizes must fit in 32 bits.
+#define MAX_PARTITION_MAP_SIZE (1u << 31)
+
+// A group is a record of record_size words: the key followed by the
+// slots. The maps map records to themselves and only look at the
+// key, so a pointer to a key works as a key for lookups.
+
+// murmur3's 64-bit finaliser
+static uint64_t mix(uint64_t x)
+{
+    x ^= x >> 33; x *= 0xff51afd7ed558ccd;
+    x ^= x >> 33; x *= 0xc4ceb9fe1a85ec53;
+    return x ^ (x >> 33);
+}
+
+static uint32_t record_hash(void *record)
+{
+    return (uint32_t)mix(*(uint64_t *)record);
+}
+
+static bool record_cmp(void *a, void *b)
+{
+    return *(uint64_t *)a == *(uint64_t *)b;
+}
+
+static void no_destructor(void *record)
+{
+}
+
+// The maps use the low bits of the hash, so we partition on the high.
+static uint32_t partition_index(uint64_t key)
+{
+    return (uint32_t)(mix(key) >> (64 - PARTITION_BITS));
+}
+
+static struct hash_map *new_record_map(uint32_t size)
+{
+    return new_map(size, record_hash, record_cmp, no_destructor, no_destructor);
+}
+
+#pragma mark buffers
+
+// A growing array of records
+struct records {
+    int64_t *records;
+    size_t used, size;
+};
+
+static void append_record(struct records *records,
+                          const int64_t *record, uint32_t record_size)
+{
+    if (records->used == records->size) {
+        records->size = records->size ? 2 * records->size : 64;
+        records->records =
+        (int64_t *)realloc(records->records,
+                           records->size * record_size * sizeof(int64_t));
+    }
+    memcpy(records->records + records->used++ * record_size,
+           record, record_size * sizeof(int64_t));
+}
+
+// The groups of one thread, and what it has spilled so far.
+struct local_groups {
+    struct hash_map *map;
+    int64_t *groups;
+    uint32_t no_groups, limit;
+    struct records spilled[NO_PARTITIONS];
+} __attribute__((aligned(64)));
+
+// The combined groups of one partition. The groups are records in the
+// threads' spill buffers, so they do not move once we get here.
+struct partition {
+    struct hash_map *map;
+    int64_t **groups;
+    size_t no_groups, size;
+};
+
+#pragma mark aggregation
+
+struct aggregation *new_aggregation(const struct aggregate *aggregate,
+                                    int no_threads)
+{
+    struct aggregation *aggregation =
+    (struct aggregation *)malloc(sizeof(struct aggregation));
+    aggregation->aggregate = *aggregate;
+    aggregation->no_threads = no_threads < 1 ? 1 : no_threads;
+    aggregation->record_size = 1 + aggregate->no_slots;
+
+    // Pick the largest map that, with the groups it can hold before
+    // it is half full, fits in the cache.
+    size_t record_bytes = aggregation->record_size * sizeof(int64_t);
+    uint32_t map_size = 16;
+    while (2 * map_size * BIN_SIZE + map_size * record_bytes <= LOCAL_CACHE_SIZE)
+        map_size *= 2;
+
+    size_t locals_size = aggregation->no_threads * sizeof(struct local_groups);
+    aggregation->locals = (struct local_groups *)aligned_alloc(64, locals_size);
+    memset(aggregation->locals, 0, locals_size);
+    for (int t = 0; t < aggregation->no_threads; ++t) {
+        struct local_groups *local = &aggregation->locals[t];
+        local->map = new_record_map(map_size);
+        local->limit = map_size / 2;
+        local->groups = (int64_t *)malloc(local->limit * record_bytes);
+    }
+
+    aggregation->partitions =
+    (struct partition *)calloc(NO_PARTITIONS, sizeof(struct partition));
+
+    return aggregation;
+}
+
+void delete_aggregation(struct aggregation *aggregation)
+{
+    for (int t = 0; t < aggregation->no_threads; ++t) {
+        struct local_groups *local = &aggregation->locals[t];
+        if (local->map) delete_map(local->map);
+        free(local->groups);
+        for (int p = 0; p < NO_PARTITIONS; ++p)
+            free(local->spilled[p].records);
+    }
+    free(aggregation->locals);
+    for (int p = 0; p < NO_PARTITIONS; ++p) {
+        struct partition *partition = &aggregation->partitions[p];
+        if (partition->map) delete_map(partition->map);
+        free(partition->groups);
+    }
+    free(aggregation->partitions);
+    free(aggregation);
+}
+
+static void spill(struct aggregation *aggregation, struct local_groups *local)
+{
+    uint32_t record_size = aggregation->record_size;
+    for (uint32_t i = 0; i < local->no_groups; ++i) {
+        int64_t *record = local->groups + i * record_size;
+        append_record(&local->spilled[partition_index(record[0])],
+                      record, record_size);
+    }
+    local->no_groups = 0;
+    clear_map(local->map);
+}
+
+void aggregate_rows(struct aggregation *aggregation, int thread,
+                    const uint64_t *keys, const int64_t *vals, size_t n)
+{
+    struct local_groups *local = &aggregation->locals[thread];
+    struct aggregate *aggregate = &aggregation->aggregate;
+    uint32_t record_size = aggregation->record_size;
+
+    for (size_t i = 0; i < n; ++i) {
+        int64_t *record = (int64_t *)lookup(local->map, (void *)&keys[i]);
+        if (!record) {
+            if (local->no_groups == local->limit)
+                spill(aggregation, local);
+            record = local->groups + local->no_groups++ * record_size;
+            record[0] = (int64_t)keys[i];
+            aggregate->init(record + 1);
+            map(local->map, record, record);
+        }
+        aggregate->update(record + 1, vals[i]);
+    }
+}
+
+#pragma mark threads
+
+struct aggregation_thread {
+    struct aggregation *aggregation;
+    int thread;
+    _Atomic int *next_partition;
+    const uint64_t *keys;
+    const int64_t *vals;
+    size_t n;
+};
+
+static void run_aggregation_threads(struct aggregation *aggregation,
+                                    const uint64_t *keys, const int64_t *vals,
+                                    size_t n, void *(*f)(void *))
+{
+    int no_threads = aggregation->no_threads;
+    _Atomic int next_partition = 0;
+    pthread_t threads[no_threads];
+    struct aggregation_thread args[no_threads];
+    for (int i = 0; i < no_threads; ++i) {
+        args[i].aggregation = aggregation;
+        args[i].thread = i;
+        args[i].next_partition = &next_partition;
+        args[i].keys = keys;
+        args[i].vals = vals;
+        args[i].n = n;
+        pthread_create(&threads[i], 0, f, &args[i]);
+    }
+    for (int i = 0; i < no_threads; ++i) {
+        pthread_join(threads[i], 0);
+    }
+}
+
+static void *spill_local_groups(void *arg)
+{
+    struct aggregation_thread *t = (struct aggregation_thread *)arg;
+    struct local_groups *local = &t->aggregation->locals[t->thread];
+    spill(t->aggregation, local);
+    delete_map(local->map);
+    local->map = 0;
+    free(local->groups);
+    local->groups = 0;
+    return 0;
+}
+
+static void merge_partition(struct aggregation *aggregation, int p)
+{
+    struct partition *partition = &aggregation->partitions[p];
+    uint32_t record_size = aggregation->record_size;
+
+    // There are at most as many groups as partial aggregates, so with
+    // room for those the map never resizes, unless there are more
+    // than the largest map holds.
+    size_t no_records = 0;
+    for (int t = 0; t < aggregation->no_threads; ++t)
+        no_records += aggregation->locals[t].spilled[p].used;
+    uint32_t size = 2;
+    while (size / 2 < no_records && size < MAX_PARTITION_MAP_SIZE) size *= 2;
+    partition->map = new_record_map(size);
+    for (int t = 0; t < aggregation->no_threads; ++t) {
+        struct records *spilled = &aggregation->locals[t].spilled[p];
+        for (size_t i = 0; i < spilled->used; ++i) {
+            int64_t *record = spilled->records + i * record_size;
+            int64_t *group = (int64_t *)lookup(partition->map, record);
+            if (group) {
+                aggregation->aggregate.combine(group + 1, record + 1);
+                continue;
+            }
+            map(partition->map, record, record);
+            if (partition->no_groups == partition->size) {
+                partition->size = partition->size ? 2 * partition->size : 64;
+                partition->groups =
+                (int64_t **)realloc(partition->groups,
+                                    partition->size * sizeof(int64_t *));
+            }
+            partition->groups[partition->no_groups++] = record;
+        }
+    }
+}
+
+static void *merge_partitions(void *arg)
+{
+    struct aggregation_thread *t = (struct aggregation_thread *)arg;
+    int p;
+    while ((p = atomic_fetch_add(t->next_partition, 1)) < NO_PARTITIONS) {
+        merge_partition(t->aggregation, p);
+    }
+    return 0;
+}
+
+void finish_aggregation(struct aggregation *aggregation)
+{
+    run_aggregation_threads(aggregation, 0, 0, 0, spill_local_groups);
+    run_aggregation_threads(aggregation, 0, 0, 0, merge_partitions);
+}
+
+static void *aggregate_slice(void *arg)
+{
+    struct aggregation_thread *t = (struct aggregation_thread *)arg;
+    int no_threads = t->aggregation->no_threads;
+    size_t begin = t->n / no_threads * t->thread;
+    size_t end = (t->thread == no_threads - 1) ? t->n : begin + t->n / no_threads;
+    aggregate_rows(t->aggregation, t->thread,
+                   t->keys + begin, t->vals + begin, end - begin);
+    return 0;
+}
+
+struct aggregation *group_by(const struct aggregate *aggregate,
+                             const uint64_t *keys, const int64_t *vals, size_t n,
+                             int no_threads)
+{
+    struct aggregation *aggregation = new_aggregation(aggregate, no_threads);
+    run_aggregation_threads(aggregation, keys, vals, n, aggregate_slice);
+    finish_aggregation(aggregation);
+    return aggregation;
+}
+
+#pragma mark results
+
+uint64_t no_groups(struct aggregation *aggregation)
+{
+    uint64_t n = 0;
+    for (int p = 0; p < NO_PARTITIONS; ++p)
+        n += aggregation->partitions[p].no_groups;
+    return n;
+}
+
+const int64_t *group_slots(struct aggregation *aggregation, uint64_t key)
+{
+    struct partition *partition = &aggregation->partitions[partition_index(key)];
+    if (!partition->map) return 0;
+    int64_t *group = (int64_t *)lookup(partition->map, &key);
+    return group ? group + 1 : 0;
+}
+
+void for_each_group(struct aggregation *aggregation,
+                    void (*f)(uint64_t key, const int64_t *slots, void *data),
+                    void *data)
+{
+    for (int p = 0; p < NO_PARTITIONS; ++p) {
+        struct partition *partition = &aggregation->partitions[p];
+        for (size_t i = 0; i < partition->no_groups; ++i) {
+            int64_t *group = partition->groups[i];
+            f((uint64_t)group[0], group + 1, data);
+        }
+    }
+}
@@ -0,0 +1,73 @@
+//
+//  aggregation.h
+//  LinearProbeHashMap
+//
+//  Created by Thomas Mailund on 19/10/2026.
+//  Copyright © 2026 Thomas Mailund. All rights reserved.
+//
+
+#ifndef aggregation_h
+#define aggregation_h
+
+#include <stdint.h>
+#include <stddef.h>
+#include "hash_map.h"
+
+// Group-by aggregation over rows of a 64-bit key and a 64-bit value,
+// as in GROUP BY key, SUM(value), COUNT(*), ...
+//
+// Each thread aggregates its rows in its own small linear probe map.
+// When that map no longer fits in the cache, the thread spills its
+// partial aggregates to buffers partitioned by the high bits of the
+// key hash and starts over. When all rows are in, one thread per
+// partition combines the partial aggregates.
+
+// An aggregate keeps no_slots 64-bit slots per group. init sets up
+// the slots for a new group, update adds a row to them, and combine
+// adds the slots of another partial aggregate of the same group.
+typedef void (*aggregate_init_func)(int64_t *slots);
+typedef void (*aggregate_update_func)(int64_t *slots, int64_t value);
+typedef void (*aggregate_combine_func)(int64_t *slots, const int64_t *other);
+
+struct aggregate {
+    uint32_t no_slots;
+    aggregate_init_func init;
+    aggregate_update_func update;
+    aggregate_combine_func combine;
+};
+
+struct aggregation {
+    struct aggregate aggregate;
+    int no_threads;
+    uint32_t record_size;     // key plus slots, in 64-bit words
+    struct local_groups *locals;
+    struct partition *partitions;
+};
+
+struct aggregation *
+new_aggregation    (const struct aggregate *aggregate, int no_threads);
+void delete_aggregation(struct aggregation *aggregation);
+
+// Aggregates n rows. Thread number thread (0 <= thread < no_threads)
+// must only be used by one thread at a time, but different threads
+// can aggregate rows at the same time.
+void aggregate_rows(struct aggregation *aggregation, int thread,
+                    const uint64_t *keys, const int64_t *vals, size_t n);
+// Combines the partial aggregates, using no_threads threads. Call it
+// once, after all rows are aggregated.
+void finish_aggregation(struct aggregation *aggregation);
+
+// Aggregates all the rows with no_threads threads and finishes.
+struct aggregation *
+group_by           (const struct aggregate *aggregate,
+                    const uint64_t *keys, const int64_t *vals, size_t n,
+                    int no_threads);
+
+// After finish_aggregation
+uint64_t       no_groups  (struct aggregation *aggregation);
+const int64_t *group_slots(struct aggregation *aggregation, uint64_t key);
+void for_each_group(struct aggregation *aggregation,
+                    void (*f)(uint64_t key, const int64_t *slots, void *data),
+                    void *data);
+
+#endif /* aggregation_h */
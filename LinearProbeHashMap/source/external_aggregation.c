@@ -0,0 +1,380 @@
+//
+//  external_aggregation.c
+//  LinearProbeHashMap
+//
+//  Created by Thomas Mailund on 19/10/2026.
+//  Copyright © 2026 Thomas Mailund. All rights reserved.
+//
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <errno.h>
+#include "external_aggregation.h"
+
+// About the size of a bin in the linear probe map.
+#define BIN_SIZE 24
+
+#define PARTITION_BITS 6
+#define NO_PARTITIONS (1 << PARTITION_BITS)
+// Each level of partitioning uses the next bits of the hash
+#define MAX_LEVEL (64 / PARTITION_BITS)
+
+#define MIN_BUFFER_BYTES (1 << 12)
+#define MAX_BUFFER_BYTES (1 << 20)
+
+// A temporary file of records: keys followed by slots, as in the
+// groups in memory.
+struct spill_file {
+    int fd;          // -1 until we write to it
+    uint8_t *buffer;
+    size_t used;
+};
+
+// murmur3's 64-bit finaliser
+static uint64_t mix(uint64_t x)
+{
+    x ^= x >> 33; x *= 0xff51afd7ed558ccd;
+    x ^= x >> 33; x *= 0xc4ceb9fe1a85ec53;
+    return x ^ (x >> 33);
+}
+
+static uint32_t record_hash(void *record)
+{
+    return (uint32_t)mix(*(uint64_t *)record);
+}
+
+static bool record_cmp(void *a, void *b)
+{
+    return *(uint64_t *)a == *(uint64_t *)b;
+}
+
+static void no_destructor(void *record)
+{
+}
+
+// The map uses the low bits of the hash, so we partition on the high.
+static uint32_t partition_index(uint64_t key, uint32_t level)
+{
+    return (uint32_t)((mix(key) << (level * PARTITION_BITS)) >> (64 - PARTITION_BITS));
+}
+
+static size_t record_bytes(struct external_aggregation *aggregation)
+{
+    return aggregation->record_size * sizeof(int64_t);
+}
+
+#pragma mark groups in memory
+
+static void reset_groups(struct external_aggregation *aggregation)
+{
+    if (aggregation->map) delete_map(aggregation->map);
+    aggregation->map = new_map(aggregation->map_size, record_hash, record_cmp,
+                               no_destructor, no_destructor);
+    aggregation->no_groups = 0;
+}
+
+static int64_t *new_group(struct external_aggregation *aggregation)
+{
+    int64_t *group = aggregation->groups +
+    (size_t)aggregation->no_groups++ * aggregation->record_size;
+    map(aggregation->map, group, group);
+    return group;
+}
+
+// When we cannot split the groups on more bits, we let them take up
+// more memory. With 64-bit keys, that only happens for a handful of
+// groups.
+static void grow_groups(struct external_aggregation *aggregation)
+{
+    aggregation->limit *= 2;
+    aggregation->map_size *= 2;
+    aggregation->groups =
+    (int64_t *)realloc(aggregation->groups, aggregation->limit * record_bytes(aggregation));
+    // The map points into the groups, which may have moved
+    uint32_t no_groups = aggregation->no_groups;
+    reset_groups(aggregation);
+    for (uint32_t i = 0; i < no_groups; ++i) {
+        new_group(aggregation);
+    }
+}
+
+static void emit_groups(struct external_aggregation *aggregation,
+                        void (*f)(uint64_t key, const int64_t *slots, void *data),
+                        void *data)
+{
+    for (uint32_t i = 0; i < aggregation->no_groups; ++i) {
+        int64_t *group = aggregation->groups + (size_t)i * aggregation->record_size;
+        f((uint64_t)group[0], group + 1, data);
+    }
+    reset_groups(aggregation);
+}
+
+#pragma mark files
+
+static bool write_all(int fd, const void *bytes, size_t len)
+{
+    while (len > 0) {
+        ssize_t written = write(fd, bytes, len);
+        if (written < 0 && errno == EINTR) continue;
+        if (written <= 0) return false;
+        bytes = (const uint8_t *)bytes + written;
+        len -= written;
+    }
+    return true;
+}
+
+static int temporary_file(struct external_aggregation *aggregation)
+{
+    size_t len = strlen(aggregation->tmp_dir);
+    char *path = (char *)malloc(len + sizeof("/aggregationXXXXXX"));
+    memcpy(path, aggregation->tmp_dir, len);
+    strcpy(path + len, "/aggregationXXXXXX");
+    int fd = mkstemp(path);
+    if (fd >= 0) unlink(path);
+    free(path);
+    return fd;
+}
+
+static struct spill_file *new_partitions(void)
+{
+    struct spill_file *files =
+    (struct spill_file *)calloc(NO_PARTITIONS, sizeof(struct spill_file));
+    for (int p = 0; p < NO_PARTITIONS; ++p) {
+        files[p].fd = -1;
+    }
+    return files;
+}
+
+static void flush_file(struct external_aggregation *aggregation,
+                       struct spill_file *file)
+{
+    if (!write_all(file->fd, file->buffer, file->used))
+        aggregation->failed = true;
+    file->used = 0;
+}
+
+static void write_record(struct external_aggregation *aggregation,
+                         struct spill_file *file, const int64_t *record)
+{
+    size_t bytes = record_bytes(aggregation);
+    if (file->fd < 0) {
+        file->fd = temporary_file(aggregation);
+        if (file->fd < 0) {
+            aggregation->failed = true;
+            return;
+        }
+        file->buffer = (uint8_t *)malloc(aggregation->buffer_bytes);
+    }
+    if (file->used + bytes > aggregation->buffer_bytes)
+        flush_file(aggregation, file);
+    memcpy(file->buffer + file->used, record, bytes);
+    file->used += bytes;
+}
+
+// We are done writing the partitions, so we can give their buffers
+// back before we read them.
+static void finish_writing(struct external_aggregation *aggregation,
+                           struct spill_file *files)
+{
+    for (int p = 0; p < NO_PARTITIONS; ++p) {
+        if (files[p].fd < 0) continue;
+        flush_file(aggregation, &files[p]);
+        free(files[p].buffer);
+        files[p].buffer = 0;
+        if (lseek(files[p].fd, 0, SEEK_SET) != 0)
+            aggregation->failed = true;
+    }
+}
+
+static void close_partitions(struct spill_file *files)
+{
+    for (int p = 0; p < NO_PARTITIONS; ++p) {
+        if (files[p].fd >= 0) close(files[p].fd);
+        free(files[p].buffer);
+    }
+    free(files);
+}
+
+static void spill_groups(struct external_aggregation *aggregation,
+                         struct spill_file *files, uint32_t level)
+{
+    for (uint32_t i = 0; i < aggregation->no_groups; ++i) {
+        int64_t *group = aggregation->groups + (size_t)i * aggregation->record_size;
+        write_record(aggregation, &files[partition_index(group[0], level)], group);
+    }
+    aggregation->spilled_records += aggregation->no_groups;
+    if (level + 1 > aggregation->max_level)
+        aggregation->max_level = level + 1;
+    reset_groups(aggregation);
+}
+
+// Makes room for a new group, spilling the groups we have on the
+// bits of the hash for level.
+static void make_room(struct external_aggregation *aggregation,
+                      struct spill_file **files, uint32_t level)
+{
+    if (aggregation->no_groups < aggregation->limit) return;
+    if (level >= MAX_LEVEL) {
+        grow_groups(aggregation);
+        return;
+    }
+    if (!*files) *files = new_partitions();
+    spill_groups(aggregation, *files, level);
+}
+
+#pragma mark aggregation
+
+struct external_aggregation *
+new_external_aggregation(const struct aggregate *aggregate,
+                         size_t memory_limit, const char *tmp_dir)
+{
+    struct external_aggregation *aggregation =
+    (struct external_aggregation *)calloc(1, sizeof(struct external_aggregation));
+    aggregation->aggregate = *aggregate;
+    aggregation->record_size = 1 + aggregate->no_slots;
+
+    if (!tmp_dir) tmp_dir = getenv("TMPDIR");
+    if (!tmp_dir) tmp_dir = "/tmp";
+    aggregation->tmp_dir = strdup(tmp_dir);
+
+    // A quarter of the memory goes to buffers for the files we write
+    // and the file we read, and the rest to the groups and the map.
+    size_t buffer_bytes = memory_limit / (4 * (NO_PARTITIONS + 1));
+    if (buffer_bytes < MIN_BUFFER_BYTES) buffer_bytes = MIN_BUFFER_BYTES;
+    if (buffer_bytes > MAX_BUFFER_BYTES) buffer_bytes = MAX_BUFFER_BYTES;
+    if (buffer_bytes < record_bytes(aggregation))
+        buffer_bytes = record_bytes(aggregation);
+    aggregation->buffer_bytes = buffer_bytes;
+
+    // The largest map that, with the groups it can hold before it is
+    // half full, fits in the rest.
+    size_t group_bytes = memory_limit - memory_limit / 4;
+    uint32_t map_size = 16;
+    while (2 * map_size * BIN_SIZE + map_size * record_bytes(aggregation) <= group_bytes)
+        map_size *= 2;
+    aggregation->map_size = map_size;
+    aggregation->limit = map_size / 2;
+    aggregation->groups = (int64_t *)malloc(aggregation->limit * record_bytes(aggregation));
+    reset_groups(aggregation);
+
+    return aggregation;
+}
+
+void delete_external_aggregation(struct external_aggregation *aggregation)
+{
+    if (aggregation->partitions) close_partitions(aggregation->partitions);
+    if (aggregation->map) delete_map(aggregation->map);
+    free(aggregation->groups);
+    free(aggregation->tmp_dir);
+    free(aggregation);
+}
+
+bool external_aggregate_rows(struct external_aggregation *aggregation,
+                             const uint64_t *keys, const int64_t *vals,
+                             size_t n)
+{
+    struct aggregate *aggregate = &aggregation->aggregate;
+    for (size_t i = 0; i < n; ++i) {
+        int64_t *group = (int64_t *)lookup(aggregation->map, (void *)&keys[i]);
+        if (!group) {
+            make_room(aggregation, &aggregation->partitions, 0);
+            group = aggregation->groups +
+            (size_t)aggregation->no_groups * aggregation->record_size;
+            group[0] = (int64_t)keys[i];
+            aggregate->init(group + 1);
+            new_group(aggregation);
+        }
+        aggregate->update(group + 1, vals[i]);
+    }
+    return !aggregation->failed;
+}
+
+// Reads up to size bytes, but only whole records
+static size_t read_records(struct external_aggregation *aggregation,
+                           int fd, uint8_t *buffer, size_t size)
+{
+    size_t got = 0;
+    while (got < size) {
+        ssize_t bytes = read(fd, buffer + got, size - got);
+        if (bytes < 0 && errno == EINTR) continue;
+        if (bytes < 0) aggregation->failed = true;
+        if (bytes <= 0) break;
+        got += bytes;
+    }
+    if (got % record_bytes(aggregation) != 0) aggregation->failed = true;
+    return got / record_bytes(aggregation);
+}
+
+// Combines the partial aggregates in file, which holds the groups
+// with the same first level * PARTITION_BITS bits of their hash.
+static void aggregate_file(struct external_aggregation *aggregation,
+                           struct spill_file *file, uint32_t level,
+                           void (*f)(uint64_t key, const int64_t *slots, void *data),
+                           void *data)
+{
+    struct aggregate *aggregate = &aggregation->aggregate;
+    size_t bytes = record_bytes(aggregation);
+    size_t chunk = aggregation->buffer_bytes / bytes;
+    int64_t *records = (int64_t *)malloc(chunk * bytes);
+    struct spill_file *children = 0;
+
+    size_t n;
+    while (!aggregation->failed &&
+           (n = read_records(aggregation, file->fd, (uint8_t *)records, chunk * bytes)) > 0) {
+        for (size_t i = 0; i < n; ++i) {
+            int64_t *record = records + i * aggregation->record_size;
+            int64_t *group = (int64_t *)lookup(aggregation->map, record);
+            if (group) {
+                aggregate->combine(group + 1, record + 1);
+                continue;
+            }
+            make_room(aggregation, &children, level);
+            group = aggregation->groups +
+            (size_t)aggregation->no_groups * aggregation->record_size;
+            memcpy(group, record, bytes);
+            new_group(aggregation);
+        }
+    }
+    free(records);
+    close(file->fd);
+    file->fd = -1;
+
+    if (!children) {
+        emit_groups(aggregation, f, data);
+        return;
+    }
+
+    // The partition did not fit, so we split it further
+    spill_groups(aggregation, children, level);
+    finish_writing(aggregation, children);
+    for (int p = 0; p < NO_PARTITIONS; ++p) {
+        if (children[p].fd < 0) continue;
+        aggregate_file(aggregation, &children[p], level + 1, f, data);
+    }
+    close_partitions(children);
+}
+
+bool finish_external_aggregation(struct external_aggregation *aggregation,
+                                 void (*f)(uint64_t key, const int64_t *slots,
+                                           void *data),
+                                 void *data)
+{
+    // If we never spilled, all the groups are here
+    if (!aggregation->partitions) {
+        emit_groups(aggregation, f, data);
+        return !aggregation->failed;
+    }
+
+    struct spill_file *partitions = aggregation->partitions;
+    spill_groups(aggregation, partitions, 0);
+    finish_writing(aggregation, partitions);
+    for (int p = 0; p < NO_PARTITIONS; ++p) {
+        if (partitions[p].fd < 0) continue;
+        aggregate_file(aggregation, &partitions[p], 1, f, data);
+    }
+    close_partitions(partitions);
+    aggregation->partitions = 0;
+    return !aggregation->failed;
+}
@@ -0,0 +1,70 @@
+//
+//  external_aggregation.h
+//  LinearProbeHashMap
+//
+//  Created by Thomas Mailund on 19/10/2026.
+//  Copyright © 2026 Thomas Mailund. All rights reserved.
+//
+
+#ifndef external_aggregation_h
+#define external_aggregation_h
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include "aggregation.h"
+
+// Group-by aggregation that stays within a memory limit, for when
+// the groups do not fit in memory.
+//
+// We aggregate rows in a linear probe map until its groups reach the
+// limit. Then we write the partial aggregates to temporary files,
+// partitioned by the high bits of the key hash, and start over. When
+// all rows are in, we aggregate each file the same way, combining the
+// partial aggregates; if a partition has more groups than fit, we
+// spill it on the next bits of the hash and aggregate those files in
+// turn. Files are only written and read from start to end. Partial
+// aggregates are combined with the aggregate's combine function, so
+// the result is exact.
+
+struct spill_file;
+
+struct external_aggregation {
+    struct aggregate aggregate;
+    uint32_t record_size;     // key plus slots, in 64-bit words
+    char *tmp_dir;
+    size_t buffer_bytes;      // for each file we write
+
+    // The groups in memory
+    struct hash_map *map;
+    uint32_t map_size;
+    int64_t *groups;
+    uint32_t no_groups, limit;
+
+    struct spill_file *partitions; // null until we spill
+    bool failed;                   // we could not write or read a file
+
+    uint64_t spilled_records;
+    uint32_t max_level;            // of partitioning
+};
+
+// The groups, bins and file buffers take up about memory_limit bytes.
+// Temporary files go in tmp_dir, or, if it is null, in $TMPDIR or
+// /tmp. They are removed as soon as we have created them.
+struct external_aggregation *
+new_external_aggregation(const struct aggregate *aggregate,
+                         size_t memory_limit, const char *tmp_dir);
+void delete_external_aggregation(struct external_aggregation *aggregation);
+
+// Return false if we could not write or read the temporary files.
+bool external_aggregate_rows(struct external_aggregation *aggregation,
+                             const uint64_t *keys, const int64_t *vals,
+                             size_t n);
+// Calls f once for every group. The groups do not all fit in memory,
+// so this is the only way to get them, and you can only do it once.
+bool finish_external_aggregation(struct external_aggregation *aggregation,
+                                 void (*f)(uint64_t key, const int64_t *slots,
+                                           void *data),
+                                 void *data);
+
+#endif /* external_aggregation_h */
@@ -0,0 +1,393 @@
+//
+//  main.c
+//  Dedup
+//
+//  Created by Thomas Mailund on 19/10/2026.
+//  Copyright © 2026 Thomas Mailund. All rights reserved.
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "hash_set.h"
+#include "hash_strings.h"
+
+// Writes the lines of a file, leaving out lines we have already seen:
+//
+//     dedup [-t threads] [-h hash] [-n] [-s] file
+//
+// The file is mapped into memory, and the set holds offsets into the
+// mapping instead of copies of the lines. With more than one thread,
+// each thread hashes a slice of the file, and the lines go to one set
+// per thread, picked by the high bits of their hash, so the threads
+// never share a set. We still write the first occurrence of each line
+// in the order of the file.
+//
+// -h picks the string hash function (jenkins, one-at-a-time, rotating
+// or additive), -n only counts lines without writing them, and -s
+// reports the time and throughput on stderr, so the tool doubles as a
+// benchmark of the set and the hash functions.
+
+typedef uint32_t (*string_hash_func)(uint32_t state, char *input, int len);
+
+static struct {
+    const char *name;
+    string_hash_func hash;
+} hash_functions[] = {
+    { "jenkins", jenkins_hash },
+    { "one-at-a-time", one_at_a_time_hash },
+    { "rotating", rotating_hash },
+    { "additive", additive_hash },
+};
+#define NO_HASH_FUNCTIONS (sizeof(hash_functions) / sizeof(hash_functions[0]))
+
+// The set's functions only get the key, so the mapping is global
+static const char *input;
+static size_t input_size;
+static string_hash_func string_hash = jenkins_hash;
+
+static double now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static size_t line_end(size_t offset, size_t end)
+{
+    const char *newline = memchr(input + offset, '\n', end - offset);
+    return newline ? (size_t)(newline - input) : end;
+}
+
+// Writes the lines we keep. Lines we keep next to each other are
+// contiguous in the mapping, so we write them with a single fwrite.
+struct output {
+    FILE *file;
+    bool count_only;
+    size_t run_start, run_end;
+};
+
+static void keep_line(struct output *output, size_t start, size_t end)
+{
+    if (start != output->run_end) {
+        if (!output->count_only && output->run_end > output->run_start)
+            fwrite(input + output->run_start, 1,
+                   output->run_end - output->run_start, output->file);
+        output->run_start = start;
+    }
+    output->run_end = end;
+}
+
+static void flush_output(struct output *output)
+{
+    keep_line(output, SIZE_MAX, SIZE_MAX);
+}
+
+// The next line after end, including its newline if it has one
+static size_t next_line(size_t end)
+{
+    return end < input_size ? end + 1 : end;
+}
+
+#pragma mark one thread
+
+// A key is the line's offset in the high bits and its length in the
+// low bits.
+#define LENGTH_BITS 24
+#define MAX_LINE ((1 << LENGTH_BITS) - 1)
+
+static void *offset_key(size_t offset, size_t len)
+{
+    return (void *)(((uintptr_t)offset << LENGTH_BITS) | len);
+}
+
+static const char *key_bytes(void *key, uint32_t *len)
+{
+    uintptr_t k = (uintptr_t)key;
+    *len = (uint32_t)(k & MAX_LINE);
+    return input + (k >> LENGTH_BITS);
+}
+
+static uint32_t offset_hash(void *key)
+{
+    uint32_t len;
+    const char *bytes = key_bytes(key, &len);
+    return string_hash(0, (char *)bytes, (int)len);
+}
+
+static bool offset_cmp(void *a, void *b)
+{
+    uint32_t len_a, len_b;
+    const char *bytes_a = key_bytes(a, &len_a);
+    const char *bytes_b = key_bytes(b, &len_b);
+    return len_a == len_b && memcmp(bytes_a, bytes_b, len_a) == 0;
+}
+
+static void no_destructor(void *key)
+{
+}
+
+static size_t dedup(struct output *output, size_t *no_lines)
+{
+    struct hash_set *set = new_set(1 << 16, offset_hash, offset_cmp, no_destructor);
+    size_t no_kept = 0;
+    *no_lines = 0;
+    for (size_t start = 0; start < input_size; ) {
+        size_t end = line_end(start, input_size);
+        if (end - start > MAX_LINE) {
+            fprintf(stderr, "Line at offset %zu is too long.\n", start);
+            exit(EXIT_FAILURE);
+        }
+        (*no_lines)++;
+        if (insert_new_key(set, offset_key(start, end - start))) {
+            keep_line(output, start, next_line(end));
+            no_kept++;
+        }
+        start = next_line(end);
+    }
+    flush_output(output);
+    delete_set(set);
+    return no_kept;
+}
+
+#pragma mark threads
+
+struct line {
+    size_t offset;
+    uint32_t len;
+    uint32_t hash;
+    uint32_t index; // in the slice
+};
+
+struct lines {
+    struct line *lines;
+    size_t used, size;
+};
+
+// A slice of the file, hashed by one thread. Its lines are sorted by
+// the set they go to, and keep says which of them we write.
+struct slice {
+    size_t begin, end;
+    struct lines *partitions;
+    uint32_t no_lines;
+    bool *keep;
+};
+
+struct dedup_thread {
+    struct slice *slices;
+    int no_threads;
+    int thread;
+    size_t no_kept;
+};
+
+static uint32_t line_hash(void *key)
+{
+    return ((struct line *)key)->hash;
+}
+
+static bool line_cmp(void *a, void *b)
+{
+    struct line *x = (struct line *)a, *y = (struct line *)b;
+    return x->len == y->len && memcmp(input + x->offset, input + y->offset, x->len) == 0;
+}
+
+// The sets use the low bits of the hash, so we partition on the high
+static int partition_index(uint32_t hash, int no_threads)
+{
+    return (int)(((uint64_t)hash * no_threads) >> 32);
+}
+
+static void append_line(struct lines *lines, struct line *line)
+{
+    if (lines->used == lines->size) {
+        lines->size = lines->size ? 2 * lines->size : 1024;
+        lines->lines = (struct line *)realloc(lines->lines, lines->size * sizeof(struct line));
+    }
+    lines->lines[lines->used++] = *line;
+}
+
+static void *hash_slice(void *arg)
+{
+    struct dedup_thread *t = (struct dedup_thread *)arg;
+    struct slice *slice = &t->slices[t->thread];
+    slice->partitions = (struct lines *)calloc(t->no_threads, sizeof(struct lines));
+    struct line line;
+    line.index = 0;
+    for (size_t start = slice->begin; start < slice->end; ) {
+        size_t end = line_end(start, slice->end);
+        if (end - start > UINT32_MAX) {
+            fprintf(stderr, "Line at offset %zu is too long.\n", start);
+            exit(EXIT_FAILURE);
+        }
+        line.offset = start;
+        line.len = (uint32_t)(end - start);
+        line.hash = string_hash(0, (char *)input + start, (int)line.len);
+        append_line(&slice->partitions[partition_index(line.hash, t->no_threads)], &line);
+        line.index++;
+        start = next_line(end);
+    }
+    slice->no_lines = line.index;
+    // Different threads set different entries, so they do not conflict
+    slice->keep = (bool *)calloc(slice->no_lines, sizeof(bool));
+    return 0;
+}
+
+// Goes through the slices in order, so the first line of each key in
+// the file is the one we keep.
+static void *dedup_partition(void *arg)
+{
+    struct dedup_thread *t = (struct dedup_thread *)arg;
+    struct hash_set *set = new_set(1 << 16, line_hash, line_cmp, no_destructor);
+    t->no_kept = 0;
+    for (int s = 0; s < t->no_threads; ++s) {
+        struct slice *slice = &t->slices[s];
+        struct lines *lines = &slice->partitions[t->thread];
+        for (size_t i = 0; i < lines->used; ++i) {
+            struct line *line = &lines->lines[i];
+            if (insert_new_key(set, line)) {
+                slice->keep[line->index] = true;
+                t->no_kept++;
+            }
+        }
+    }
+    delete_set(set);
+    return 0;
+}
+
+static void run_threads(struct dedup_thread *args, int no_threads,
+                        void *(*f)(void *))
+{
+    pthread_t threads[no_threads];
+    for (int i = 0; i < no_threads; ++i) {
+        pthread_create(&threads[i], 0, f, &args[i]);
+    }
+    for (int i = 0; i < no_threads; ++i) {
+        pthread_join(threads[i], 0);
+    }
+}
+
+static size_t dedup_parallel(struct output *output, int no_threads, size_t *no_lines)
+{
+    // Slices end at line ends
+    struct slice *slices = (struct slice *)calloc(no_threads, sizeof(struct slice));
+    size_t begin = 0;
+    for (int i = 0; i < no_threads; ++i) {
+        size_t end = input_size / no_threads * (i + 1);
+        if (i == no_threads - 1 || end < begin) end = input_size;
+        if (end > begin && end < input_size) end = next_line(line_end(end - 1, input_size));
+        slices[i].begin = begin;
+        slices[i].end = end;
+        begin = end;
+    }
+
+    struct dedup_thread args[no_threads];
+    for (int i = 0; i < no_threads; ++i) {
+        args[i].slices = slices;
+        args[i].no_threads = no_threads;
+        args[i].thread = i;
+    }
+    run_threads(args, no_threads, hash_slice);
+    run_threads(args, no_threads, dedup_partition);
+
+    size_t no_kept = 0;
+    *no_lines = 0;
+    for (int i = 0; i < no_threads; ++i) {
+        no_kept += args[i].no_kept;
+        struct slice *slice = &slices[i];
+        *no_lines += slice->no_lines;
+        uint32_t index = 0;
+        for (size_t start = slice->begin; start < slice->end; ++index) {
+            size_t end = next_line(line_end(start, slice->end));
+            if (slice->keep[index]) keep_line(output, start, end);
+            start = end;
+        }
+        for (int p = 0; p < no_threads; ++p) {
+            free(slice->partitions[p].lines);
+        }
+        free(slice->partitions);
+        free(slice->keep);
+    }
+    flush_output(output);
+    free(slices);
+    return no_kept;
+}
+
+#pragma mark main
+
+static void usage(const char *name)
+{
+    fprintf(stderr, "Usage: %s [-t threads] [-h hash] [-n] [-s] file\n", name);
+    fprintf(stderr, "Hash functions:");
+    for (size_t i = 0; i < NO_HASH_FUNCTIONS; ++i) {
+        fprintf(stderr, " %s", hash_functions[i].name);
+    }
+    fprintf(stderr, "\n");
+    exit(EXIT_FAILURE);
+}
+
+int main(int argc, char *argv[])
+{
+    int no_threads = 1;
+    bool count_only = false, statistics = false;
+    const char *hash_name = "jenkins";
+    int opt;
+    while ((opt = getopt(argc, argv, "t:h:ns")) != -1) {
+        switch (opt) {
+            case 't': no_threads = atoi(optarg); break;
+            case 'h': hash_name = optarg; break;
+            case 'n': count_only = true; break;
+            case 's': statistics = true; break;
+            default: usage(argv[0]);
+        }
+    }
+    if (optind != argc - 1 || no_threads < 1) usage(argv[0]);
+    string_hash = 0;
+    for (size_t i = 0; i < NO_HASH_FUNCTIONS; ++i) {
+        if (strcmp(hash_name, hash_functions[i].name) == 0)
+            string_hash = hash_functions[i].hash;
+    }
+    if (!string_hash) usage(argv[0]);
+
+    int fd = open(argv[optind], O_RDONLY);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) != 0) {
+        perror(argv[optind]);
+        return EXIT_FAILURE;
+    }
+    input_size = st.st_size;
+    if (input_size > 0) {
+        input = mmap(0, input_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (input == MAP_FAILED) {
+            perror(argv[optind]);
+            return EXIT_FAILURE;
+        }
+        madvise((void *)input, input_size, MADV_SEQUENTIAL);
+    }
+    close(fd);
+
+    struct output output = { stdout, count_only, 0, 0 };
+    setvbuf(stdout, 0, _IOFBF, 1 << 20);
+    double start = now();
+    size_t no_lines;
+    size_t no_kept = (no_threads == 1) ?
+    dedup(&output, &no_lines) :
+    dedup_parallel(&output, no_threads, &no_lines);
+    fflush(stdout);
+    double seconds = now() - start;
+
+    if (statistics) {
+        fprintf(stderr, "%zu lines, %zu unique, %s hash, %d thread%s\n",
+                no_lines, no_kept, hash_name, no_threads, no_threads == 1 ? "" : "s");
+        fprintf(stderr, "%.3f s, %.1f MB/s, %.2f M lines/s\n", seconds,
+                input_size / seconds / 1e6, no_lines / seconds / 1e6);
+    }
+    if (input_size > 0) munmap((void *)input, input_size);
+    return EXIT_SUCCESS;
+}
@@ -8,8 +8,12 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <assert.h>
+#include <stdatomic.h>
+#include <pthread.h>
 #include "hash_set.h"
+#include "interning.h"
 
 
 struct tag_key {
@@ -46,6 +50,109 @@ static void destroy(void *void_key)
     key->deleted = true;
 }
 
+static void count_key(void *key, void *data)
+{
+    atomic_fetch_add((_Atomic int *)data, 1);
+}
+
+#pragma mark interning
+
+#define NO_STRINGS 5000
+#define NO_INTERN_THREADS 8
+
+// Strings of lengths 0 to 29, with the number in them so they differ
+static uint32_t intern_string(char *buffer, int i)
+{
+    return (uint32_t)sprintf(buffer, "%.*s%d", i % 27, "host.example.org/agent/v1.2", i);
+}
+
+struct intern_thread {
+    struct interner *interner;
+    int thread;
+    uint32_t ids[NO_STRINGS];
+};
+
+// All threads intern all strings, starting at different places
+static void *intern_strings(void *arg)
+{
+    struct intern_thread *data = (struct intern_thread *)arg;
+    char string[64];
+    for (int j = 0; j < NO_STRINGS; ++j) {
+        int i = (j + data->thread * NO_STRINGS / NO_INTERN_THREADS) % NO_STRINGS;
+        data->ids[i] = intern(data->interner, string, intern_string(string, i));
+    }
+    return 0;
+}
+
+static void interning_test(uint32_t no_shards)
+{
+    char string[64];
+    struct interner *interner = new_interner(no_shards);
+    for (int i = 0; i < NO_STRINGS; ++i) {
+        assert(intern(interner, string, intern_string(string, i)) == i);
+    }
+    // Again, and the IDs stay the same
+    for (int i = NO_STRINGS - 1; i >= 0; --i) {
+        uint32_t len = intern_string(string, i), id;
+        assert(intern(interner, string, len) == i);
+        assert(lookup_id(interner, string, len, &id) && id == i);
+    }
+    assert(no_interned(interner) == NO_STRINGS);
+    assert(!lookup_id(interner, "x", 1, &(uint32_t){ 0 }));
+    for (int i = 0; i < NO_STRINGS; ++i) {
+        uint32_t len = intern_string(string, i), interned_len;
+        const char *interned = interned_string(interner, i, &interned_len);
+        assert(interned_len == len && memcmp(interned, string, len) == 0);
+        assert(interned[len] == '\0');
+    }
+    
+    // The empty string, strings with '\0' in them and large strings
+    uint32_t empty = intern(interner, "", 0);
+    uint32_t a_b = intern(interner, "a\0b", 3);
+    assert(intern(interner, "a", 1) != a_b);
+    static char large[3 << 20];
+    memset(large, 'x', sizeof(large));
+    uint32_t large_id = intern(interner, large, sizeof(large));
+    uint32_t len;
+    assert(interned_string(interner, empty, &len)[0] == '\0' && len == 0);
+    assert(memcmp(interned_string(interner, a_b, &len), "a\0b", 3) == 0 && len == 3);
+    assert(interned_string(interner, large_id, &len) && len == sizeof(large));
+    assert(intern(interner, large, sizeof(large)) == large_id);
+    delete_interner(interner);
+    
+    if (no_shards == 0) return;
+    
+    // Threads interning the same strings at the same time agree on
+    // the IDs, and the IDs are dense.
+    interner = new_interner(no_shards);
+    pthread_t threads[NO_INTERN_THREADS];
+    struct intern_thread *data = malloc(NO_INTERN_THREADS * sizeof(struct intern_thread));
+    for (int t = 0; t < NO_INTERN_THREADS; ++t) {
+        data[t].interner = interner;
+        data[t].thread = t;
+        pthread_create(&threads[t], 0, intern_strings, &data[t]);
+    }
+    for (int t = 0; t < NO_INTERN_THREADS; ++t) {
+        pthread_join(threads[t], 0);
+    }
+    assert(no_interned(interner) == NO_STRINGS);
+    bool *seen = calloc(NO_STRINGS, sizeof(bool));
+    for (int i = 0; i < NO_STRINGS; ++i) {
+        uint32_t id = data[0].ids[i];
+        assert(id < NO_STRINGS && !seen[id]);
+        seen[id] = true;
+        for (int t = 1; t < NO_INTERN_THREADS; ++t) {
+            assert(data[t].ids[i] == id);
+        }
+        uint32_t len = intern_string(string, i), interned_len;
+        const char *interned = interned_string(interner, id, &interned_len);
+        assert(interned_len == len && memcmp(interned, string, len) == 0);
+    }
+    free(seen);
+    free(data);
+    delete_interner(interner);
+}
+
 int main(int argc, const char *argv[])
 {
     
@@ -90,6 +197,116 @@ int main(int argc, const char *argv[])
     }
     
     delete_set(table);
+    
+    // Moving the bins with several threads. The table is large
+    // enough that resizes go through the parallel path.
+    int no_large = 200000;
+    struct tag_key *large_keys = malloc(no_large * sizeof(struct tag_key));
+    for (int i = 0; i < no_large; ++i) {
+        init_tag_key(&large_keys[i], i);
+    }
+    table = new_set(2, id_hash, compare_values, destroy);
+    table->resize_threads = 4;
+    for (int i = 0; i < no_large; ++i) {
+        insert_key(table, &large_keys[i]);
+    }
+    for (int i = 0; i < no_large; ++i) {
+        assert(contains_key(table, &large_keys[i]));
+    }
+    reserve_parallel(table, 4 * no_large, 3);
+    assert(table->size >= 8 * no_large);
+    assert(table->active == no_large);
+    for (int i = 0; i < no_large; i += 2) {
+        delete_key(table, &large_keys[i]);
+    }
+    for (int i = 0; i < no_large; ++i) {
+        assert(contains_key(table, &large_keys[i]) == (i % 2 == 1));
+    }
+    delete_set(table);
+    for (int i = 0; i < no_large; ++i) {
+        assert(large_keys[i].deleted == true);
+    }
+    free(large_keys);
+    
+    // Building from arrays. Each key appears twice.
+    int no_array = 100000;
+    struct tag_key *array_keys = malloc(2 * no_array * sizeof(struct tag_key));
+    void **array_key_ptrs = malloc(2 * no_array * sizeof(void *));
+    for (enum duplicate_keys duplicates = UNIQUE_KEYS;
+         duplicates <= KEEP_LAST_KEY; ++duplicates) {
+        // With unique keys we only give the table the first half
+        int n = duplicates == UNIQUE_KEYS ? no_array : 2 * no_array;
+        for (int i = 0; i < 2 * no_array; ++i) {
+            init_tag_key(&array_keys[i], i % no_array);
+            array_key_ptrs[i] = &array_keys[i];
+        }
+        table = new_set_from_array(n, array_key_ptrs, duplicates, 4,
+                                   id_hash, compare_values, destroy);
+        assert(table->active == no_array);
+        for (int i = 0; i < no_array; ++i) {
+            int kept = duplicates == KEEP_LAST_KEY ? i + no_array : i;
+            int dropped = duplicates == KEEP_LAST_KEY ? i : i + no_array;
+            assert(contains_key(table, &array_keys[i]));
+            assert(array_keys[kept].deleted == false);
+            assert(array_keys[dropped].deleted == (duplicates != UNIQUE_KEYS));
+        }
+        delete_set(table);
+    }
+    free(array_keys);
+    free(array_key_ptrs);
+    
+    // Iteration
+    int no_iter = 10000;
+    struct tag_key *iter_keys = malloc(no_iter * sizeof(struct tag_key));
+    table = new_set(2, id_hash, compare_values, destroy);
+    for (int i = 0; i < no_iter; ++i) {
+        init_tag_key(&iter_keys[i], i);
+        insert_key(table, &iter_keys[i]);
+    }
+    int no_iterated = 0;
+    struct cursor cursor;
+    init_cursor(&cursor);
+    void *key;
+    while (next_key(table, &cursor, &key)) {
+        ((struct tag_key *)key)->deleted = true;
+        no_iterated++;
+    }
+    assert(no_iterated == no_iter);
+    for (int i = 0; i < no_iter; ++i) {
+        assert(iter_keys[i].deleted == true);
+        iter_keys[i].deleted = false;
+    }
+    _Atomic int no_visited = 0;
+    for_each(table, count_key, &no_visited);
+    assert(no_visited == no_iter);
+    for (int no_threads = 1; no_threads <= 8; no_threads *= 2) {
+        no_visited = 0;
+        for_each_parallel(table, count_key, &no_visited, no_threads);
+        assert(no_visited == no_iter);
+    }
+    delete_set(table);
+    free(iter_keys);
+    
+    // Inserting only new keys
+    table = new_set(2, id_hash, compare_values, destroy);
+    for (int i = 0; i < no_elms; ++i) {
+        keys[i].deleted = other_keys[i].deleted = false;
+        assert(insert_new_key(table, &keys[i]));
+    }
+    for (int i = 0; i < no_elms; ++i) {
+        assert(!insert_new_key(table, &other_keys[i]));
+        assert(!other_keys[i].deleted && !keys[i].deleted);
+    }
+    assert(table->active == no_elms);
+    delete_key(table, &keys[0]);
+    assert(insert_new_key(table, &other_keys[0]));
+    assert(table->active == no_elms);
+    delete_set(table);
+    
+    interning_test(0);
+    interning_test(1);
+    interning_test(16);
+    
     printf("SUCCESS\n");
     
     return EXIT_SUCCESS;
@@ -7,6 +7,7 @@
 //
 
 #include <stdlib.h>
+#include <pthread.h>
 #include "hash_set.h"
 
 struct bin {
@@ -26,7 +27,253 @@ void insert_key_hashed(struct hash_set *table,
                        uint32_t hash_key, void *key);
 static bool contains_key_hashed(struct hash_set *table, uint32_t hash_key, void *key);
 
-static void resize(struct hash_set *table, uint32_t new_size)
+#pragma mark parallel migration
+
+// Tables smaller than this are always moved on the calling thread.
+#define PARALLEL_MIN_SIZE (1 << 16)
+
+// A bin on its way to the new bins.
+struct moving_bin {
+    uint32_t hash_key;
+    void *key;
+};
+
+// We move bins in parallel in three passes. First, each thread hashes
+// its slice of the sources and counts how many go to each thread's
+// range of the new bins. Then the threads copy their bins to an array
+// ordered by range, and finally each thread inserts the bins for its
+// own range. Threads only write to their own range, so they never
+// conflict. Bins whose probes run past the end of their range are
+// left for the calling thread to insert when the others are done.
+//
+// The sources are either old bins, when we resize or rehash, or
+// an array of keys, when we build a table from an array.
+struct migration {
+    struct hash_set *table;
+    struct bin *old_bins;
+    void **keys;
+    uint32_t n;                       // number of sources
+    enum duplicate_keys duplicates;
+    int no_threads;
+    
+    uint32_t *hash_keys;              // indexed like the sources
+    uint32_t *offsets;                // no_threads x no_threads
+    uint32_t *range_start;            // no_threads + 1
+    struct moving_bin *moving;
+    
+    // per thread
+    struct moving_bin **deferred;
+    uint32_t *no_deferred;
+    uint32_t *no_inserted;
+};
+
+struct migration_thread {
+    struct migration *migration;
+    int thread;
+};
+
+// The first index in range r when we split size indices into
+// no_threads ranges.
+static uint32_t range_begin(uint32_t size, int no_threads, int r)
+{
+    return (uint32_t)(((uint64_t)size * r + no_threads - 1) / no_threads);
+}
+
+static int destination(struct migration *m, uint32_t hash_key)
+{
+    uint32_t size = m->table->size;
+    return (int)((uint64_t)p(hash_key, 0, size) * m->no_threads / size);
+}
+
+static bool is_source(struct migration *m, uint32_t i)
+{
+    return m->keys || !(m->old_bins[i].is_free || m->old_bins[i].is_deleted);
+}
+
+static void *hash_sources(void *arg)
+{
+    struct migration_thread *t = (struct migration_thread *)arg;
+    struct migration *m = t->migration;
+    uint32_t *counts = m->offsets + t->thread * m->no_threads;
+    
+    uint32_t end = range_begin(m->n, m->no_threads, t->thread + 1);
+    for (uint32_t i = range_begin(m->n, m->no_threads, t->thread); i < end; ++i) {
+        if (!is_source(m, i)) continue;
+        uint32_t hash_key = m->keys ?
+            m->table->hash(m->keys[i]) : m->old_bins[i].hash_key;
+        m->hash_keys[i] = hash_key;
+        counts[destination(m, hash_key)]++;
+    }
+    return 0;
+}
+
+static void *partition_sources(void *arg)
+{
+    struct migration_thread *t = (struct migration_thread *)arg;
+    struct migration *m = t->migration;
+    uint32_t *offsets = m->offsets + t->thread * m->no_threads;
+    
+    uint32_t end = range_begin(m->n, m->no_threads, t->thread + 1);
+    for (uint32_t i = range_begin(m->n, m->no_threads, t->thread); i < end; ++i) {
+        if (!is_source(m, i)) continue;
+        struct moving_bin *moving =
+        &m->moving[offsets[destination(m, m->hash_keys[i])]++];
+        moving->hash_key = m->hash_keys[i];
+        moving->key = m->keys ? m->keys[i] : m->old_bins[i].key;
+    }
+    return 0;
+}
+
+// Puts a moving bin in a bin that is either free or holds the same
+// key. Returns true if the table has one more key.
+static bool place_bin(struct migration *m, struct bin *bin,
+                      struct moving_bin *moving)
+{
+    struct hash_set *table = m->table;
+    if (!bin->is_free) {
+        if (m->duplicates == KEEP_FIRST_KEY) {
+            if (table->destructor) table->destructor(moving->key);
+        } else {
+            if (table->destructor) table->destructor(bin->key);
+            bin->key = moving->key;
+        }
+        return false;
+    }
+    bin->hash_key = moving->hash_key;
+    bin->key = moving->key;
+    bin->is_free = bin->is_deleted = false;
+    return true;
+}
+
+// Is this bin where the moving bin should go, if it doesn't go further?
+static bool bin_stops_probe(struct migration *m, struct bin *bin,
+                            struct moving_bin *moving)
+{
+    return bin->is_free ||
+    (m->duplicates != UNIQUE_KEYS && bin->hash_key == moving->hash_key &&
+     m->table->cmp(bin->key, moving->key));
+}
+
+static void *insert_range(void *arg)
+{
+    struct migration_thread *t = (struct migration_thread *)arg;
+    struct migration *m = t->migration;
+    struct hash_set *table = m->table;
+    uint32_t end = range_begin(table->size, m->no_threads, t->thread + 1);
+    
+    uint32_t no_inserted = 0, no_deferred = 0, deferred_size = 0;
+    struct moving_bin *deferred = 0;
+    for (uint32_t j = m->range_start[t->thread]; j < m->range_start[t->thread + 1]; ++j) {
+        struct moving_bin *moving = &m->moving[j];
+        uint32_t index = p(moving->hash_key, 0, table->size);
+        while (index < end && !bin_stops_probe(m, &table->table[index], moving))
+            ++index;
+        if (index == end) {
+            if (no_deferred == deferred_size) {
+                deferred_size = deferred_size ? 2 * deferred_size : 16;
+                deferred = (struct moving_bin *)
+                realloc(deferred, deferred_size * sizeof(struct moving_bin));
+            }
+            deferred[no_deferred++] = *moving;
+            continue;
+        }
+        no_inserted += place_bin(m, &table->table[index], moving);
+    }
+    m->deferred[t->thread] = deferred;
+    m->no_deferred[t->thread] = no_deferred;
+    m->no_inserted[t->thread] = no_inserted;
+    return 0;
+}
+
+static void run_migration_threads(struct migration *m, void *(*f)(void *))
+{
+    pthread_t threads[m->no_threads];
+    struct migration_thread args[m->no_threads];
+    for (int i = 0; i < m->no_threads; ++i) {
+        args[i].migration = m;
+        args[i].thread = i;
+        pthread_create(&threads[i], 0, f, &args[i]);
+    }
+    for (int i = 0; i < m->no_threads; ++i) {
+        pthread_join(threads[i], 0);
+    }
+}
+
+// The new bins must be in the table, all free, before we get here.
+static void migrate(struct migration *m)
+{
+    struct hash_set *table = m->table;
+    int no_threads = m->no_threads;
+    m->hash_keys = (uint32_t *)malloc(m->n * sizeof(uint32_t));
+    m->offsets = (uint32_t *)calloc(no_threads * no_threads, sizeof(uint32_t));
+    m->range_start = (uint32_t *)malloc((no_threads + 1) * sizeof(uint32_t));
+    m->deferred = (struct moving_bin **)malloc(no_threads * sizeof(struct moving_bin *));
+    m->no_deferred = (uint32_t *)malloc(no_threads * sizeof(uint32_t));
+    m->no_inserted = (uint32_t *)malloc(no_threads * sizeof(uint32_t));
+    
+    run_migration_threads(m, hash_sources);
+    
+    // Turn counts into offsets. Range r starts where the bins of the
+    // ranges before it end, and within a range the sources keep
+    // their order.
+    uint32_t offset = 0;
+    for (int r = 0; r < no_threads; ++r) {
+        m->range_start[r] = offset;
+        for (int t = 0; t < no_threads; ++t) {
+            uint32_t count = m->offsets[t * no_threads + r];
+            m->offsets[t * no_threads + r] = offset;
+            offset += count;
+        }
+    }
+    m->range_start[no_threads] = offset;
+    m->moving = (struct moving_bin *)malloc(offset * sizeof(struct moving_bin));
+    
+    run_migration_threads(m, partition_sources);
+    run_migration_threads(m, insert_range);
+    
+    // The bins that ran out of their range. All other bins are in
+    // place now, so an ordinary probe finds the right bin.
+    for (int t = 0; t < no_threads; ++t) {
+        for (uint32_t j = 0; j < m->no_deferred[t]; ++j) {
+            struct moving_bin *moving = &m->deferred[t][j];
+            uint32_t i = 0;
+            while (!bin_stops_probe(m, &table->table[p(moving->hash_key, i, table->size)], moving))
+                ++i;
+            struct bin *bin = &table->table[p(moving->hash_key, i, table->size)];
+            if (place_bin(m, bin, moving)) {
+                table->active++; table->used++;
+            }
+        }
+        free(m->deferred[t]);
+        table->active += m->no_inserted[t];
+        table->used += m->no_inserted[t];
+    }
+    
+    free(m->hash_keys);
+    free(m->offsets);
+    free(m->range_start);
+    free(m->moving);
+    free(m->deferred);
+    free(m->no_deferred);
+    free(m->no_inserted);
+}
+
+static void move_bins_parallel(struct hash_set *table,
+                               struct bin *old_bins, uint32_t old_size,
+                               int no_threads)
+{
+    struct migration m;
+    m.table = table;
+    m.old_bins = old_bins;
+    m.keys = 0;
+    m.n = old_size;
+    m.duplicates = UNIQUE_KEYS;
+    m.no_threads = no_threads;
+    migrate(&m);
+}
+
+static void resize_parallel(struct hash_set *table, uint32_t new_size,
+                            int no_threads)
 {
     if (new_size == 0) return;
 
@@ -45,18 +292,27 @@ static void resize(struct hash_set *table, uint32_t new_size)
     table->size = new_size;
     table->active = table->used = 0;
     
-    // Move the values from the old bins to the new,
-    // using the table's insertion function
-    end = old_bins + old_size;
-    for (struct bin *bin = old_bins; bin != end; ++bin) {
-        if (bin->is_free || bin->is_deleted) continue;
-        insert_key_hashed(table, bin->hash_key, bin->key);
+    if (no_threads > 1 && old_size >= PARALLEL_MIN_SIZE) {
+        move_bins_parallel(table, old_bins, old_size, no_threads);
+    } else {
+        // Move the values from the old bins to the new,
+        // using the table's insertion function
+        end = old_bins + old_size;
+        for (struct bin *bin = old_bins; bin != end; ++bin) {
+            if (bin->is_free || bin->is_deleted) continue;
+            insert_key_hashed(table, bin->hash_key, bin->key);
+        }
     }
     
     // Finally, free memory for old bins
     free(old_bins);
 }
 
+static void resize(struct hash_set *table, uint32_t new_size)
+{
+    resize_parallel(table, new_size, table->resize_threads);
+}
+
 struct hash_set *new_set(uint32_t size,
                                hash_func  hash,
                                compare_func cmp,
@@ -76,9 +332,42 @@ struct hash_set *new_set(uint32_t size,
     table->hash = hash;
     table->cmp = cmp;
     table->destructor = destructor;
+    table->resize_threads = 1;
     return table;
 }
 
+struct hash_set *new_set_from_array(uint32_t n, void **keys,
+                                    enum duplicate_keys duplicates,
+                                    int no_threads,
+                                    hash_func hash,
+                                    compare_func cmp,
+                                    destructor_func destructor)
+{
+    // Make room for all the keys, so we never resize while we fill
+    uint32_t size = 2;
+    while (size / 2 < n) size *= 2;
+    struct hash_set *table = new_set(size, hash, cmp, destructor);
+    
+    struct migration m;
+    m.table = table;
+    m.old_bins = 0;
+    m.keys = keys;
+    m.n = n;
+    m.duplicates = duplicates;
+    m.no_threads = no_threads < 1 ? 1 : no_threads;
+    migrate(&m);
+    
+    return table;
+}
+
+void reserve_parallel(struct hash_set *table, uint32_t n, int no_threads)
+{
+    uint32_t new_size = table->size;
+    while (new_size / 2 < n) new_size *= 2;
+    if (new_size != table->size)
+        resize_parallel(table, new_size, no_threads);
+}
+
 void delete_set(struct hash_set *table)
 {
     if (table->destructor) {
@@ -146,6 +435,28 @@ void insert_key(struct hash_set *table, void *key)
     insert_key_hashed(table, hash_key, key);
 }
 
+bool insert_new_key(struct hash_set *table, void *key)
+{
+    uint32_t hash_key = table->hash(key);
+    if (contains_key_hashed(table, hash_key, key))
+        return false;
+    
+    // The key is not there, so it goes in the first free or deleted bin
+    for (uint32_t i = 0; i < table->size; ++i) {
+        struct bin *bin = &table->table[p(hash_key, i, table->size)];
+        if (!bin->is_free && !bin->is_deleted) continue;
+        if (bin->is_free) table->used++;
+        bin->hash_key = hash_key; bin->key = key;
+        bin->is_free = bin->is_deleted = false;
+        table->active++;
+        break;
+    }
+    
+    if (table->used > table->size / 2)
+        resize(table, table->size * 2);
+    return true;
+}
+
 static bool contains_key_hashed(struct hash_set *table, uint32_t hash_key, void *key)
 {
     for (uint32_t i = 0; i < table->size; ++i) {
@@ -188,3 +499,70 @@ void delete_key(struct hash_set *table, void *key)
     if (table->active < table->size / 8)
         resize(table, table->size / 2);
 }
+
+#pragma mark iteration
+
+void init_cursor(struct cursor *cursor)
+{
+    cursor->index = 0;
+}
+
+bool next_key(struct hash_set *table, struct cursor *cursor, void **key)
+{
+    while (cursor->index < table->size) {
+        struct bin *bin = &table->table[cursor->index++];
+        if (bin->is_free || bin->is_deleted) continue;
+        *key = bin->key;
+        return true;
+    }
+    return false;
+}
+
+static void for_each_in_range(struct hash_set *table,
+                              uint32_t begin, uint32_t end,
+                              for_each_func f, void *data)
+{
+    for (uint32_t i = begin; i < end; ++i) {
+        struct bin *bin = &table->table[i];
+        if (bin->is_free || bin->is_deleted) continue;
+        f(bin->key, data);
+    }
+}
+
+void for_each(struct hash_set *table, for_each_func f, void *data)
+{
+    for_each_in_range(table, 0, table->size, f, data);
+}
+
+struct iteration_thread {
+    struct hash_set *table;
+    uint32_t begin, end;
+    for_each_func f;
+    void *data;
+};
+
+static void *iterate_range(void *arg)
+{
+    struct iteration_thread *t = (struct iteration_thread *)arg;
+    for_each_in_range(t->table, t->begin, t->end, t->f, t->data);
+    return 0;
+}
+
+void for_each_parallel(struct hash_set *table,
+                       for_each_func f, void *data, int no_threads)
+{
+    if (no_threads < 1) no_threads = 1;
+    pthread_t threads[no_threads];
+    struct iteration_thread args[no_threads];
+    for (int i = 0; i < no_threads; ++i) {
+        args[i].table = table;
+        args[i].begin = range_begin(table->size, no_threads, i);
+        args[i].end = range_begin(table->size, no_threads, i + 1);
+        args[i].f = f;
+        args[i].data = data;
+        pthread_create(&threads[i], 0, iterate_range, &args[i]);
+    }
+    for (int i = 0; i < no_threads; ++i) {
+        pthread_join(threads[i], 0);
+    }
+}
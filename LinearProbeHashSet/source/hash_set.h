@@ -15,6 +15,15 @@
 typedef uint32_t (*hash_func)(void *);
 typedef void (*destructor_func)(void *);
 typedef bool (*compare_func)(void *, void *);
+typedef void (*for_each_func)(void *key, void *data);
+
+// How the constructors from arrays handle keys that appear more
+// than once.
+enum duplicate_keys {
+    UNIQUE_KEYS,    // there are none; we do not check
+    KEEP_FIRST_KEY, // later copies are destroyed
+    KEEP_LAST_KEY   // earlier copies are destroyed, as with insert_key()
+};
 
 struct hash_set {
     struct bin *table;
@@ -24,6 +33,9 @@ struct hash_set {
     hash_func hash;
     compare_func cmp;
     destructor_func destructor;
+    
+    // Threads that move the bins when we resize large tables
+    int resize_threads;
 };
 
 struct hash_set *
@@ -31,14 +43,43 @@ new_set         (uint32_t size, // Must be a power of two!
                  hash_func hash,
                  compare_func cmp,
                  destructor_func destructor);
+// Builds a set of the n keys, large enough that it does not resize.
+// no_threads threads fill the bins.
+struct hash_set *
+new_set_from_array (uint32_t n, void **keys,
+                    enum duplicate_keys duplicates,
+                    int no_threads,
+                    hash_func hash,
+                    compare_func cmp,
+                    destructor_func destructor);
 void delete_set  (struct hash_set *table);
+// Grows the table so it holds n keys without resizing, moving the
+// bins with no_threads threads.
+void reserve_parallel(struct hash_set *table, uint32_t n, int no_threads);
 
 void insert_key  (struct hash_set *table,
                   void *key);
+// Inserts the key if it is not in the set, and returns true if it
+// was new. If it was not, the set keeps the key it has.
+bool insert_new_key(struct hash_set *table,
+                    void *key);
 bool contains_key(struct hash_set *table,
                   void *key);
 void delete_key  (struct hash_set *table,
                   void *key);
 
+// Iteration. The table must not change while you iterate over it,
+// and f must not change it either.
+struct cursor {
+    uint32_t index;
+};
+void init_cursor (struct cursor *cursor);
+bool next_key    (struct hash_set *table, struct cursor *cursor,
+                  void **key);
+void for_each    (struct hash_set *table, for_each_func f, void *data);
+// Splits the bins into no_threads ranges and calls f from
+// no_threads threads at the same time.
+void for_each_parallel(struct hash_set *table,
+                       for_each_func f, void *data, int no_threads);
 
 #endif /* hash_set_h */
@@ -0,0 +1,274 @@
+//
+//  interning.c
+//  LinearProbeHashSet
+//
+//  Created by Thomas Mailund on 19/10/2026.
+//  Copyright © 2026 Thomas Mailund. All rights reserved.
+//
+
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <pthread.h>
+#include "interning.h"
+#include "hash_strings.h"
+
+// The ID table has segments of 2^16 pointers
+#define SEGMENT_BITS 16
+#define SEGMENT_SIZE (1u << SEGMENT_BITS)
+#define NO_SEGMENTS (1u << (32 - SEGMENT_BITS))
+
+// Strings go in blocks of this size, unless they are larger
+#define BLOCK_SIZE (1 << 20)
+
+#define INITIAL_SIZE 1024
+
+struct bin {
+    uint32_t hash_key;
+    uint32_t id; // plus one, so free bins are zero
+};
+
+// In the blocks, each string has its length in front of it and a
+// '\0' after it. The ID table points to the string itself.
+struct block {
+    struct block *next;
+    char bytes[];
+};
+
+struct intern_shard {
+    pthread_mutex_t lock;
+    struct bin *bins;
+    uint32_t size, used;
+
+    struct block *blocks;
+    size_t block_used, block_size;
+} __attribute__((aligned(64)));
+
+static uint32_t
+p(uint32_t k, uint32_t i, uint32_t m)
+{
+    return (k + i) & (m - 1);
+}
+
+// jenkins_hash takes an int length, so we hash longer strings in pieces
+#define HASH_PIECE (1 << 30)
+
+static uint32_t hash_string(const char *string, uint32_t len)
+{
+    uint32_t hash_key = 0;
+    for (; len > INT_MAX; string += HASH_PIECE, len -= HASH_PIECE)
+        hash_key = jenkins_hash(hash_key, (char *)string, HASH_PIECE);
+    return jenkins_hash(hash_key, (char *)string, (int)len);
+}
+
+static uint32_t string_len(const char *string)
+{
+    uint32_t len;
+    memcpy(&len, string - sizeof(uint32_t), sizeof(uint32_t));
+    return len;
+}
+
+#pragma mark strings
+
+static const char *store_string(struct intern_shard *shard,
+                                const char *string, uint32_t len)
+{
+    size_t needed = sizeof(uint32_t) + len + 1;
+    if (!shard->blocks || shard->block_used + needed > shard->block_size) {
+        size_t size = needed > BLOCK_SIZE ? needed : BLOCK_SIZE;
+        struct block *block = (struct block *)malloc(sizeof(struct block) + size);
+        block->next = shard->blocks;
+        shard->blocks = block;
+        shard->block_used = 0;
+        shard->block_size = size;
+    }
+    char *bytes = shard->blocks->bytes + shard->block_used;
+    memcpy(bytes, &len, sizeof(uint32_t));
+    bytes += sizeof(uint32_t);
+    memcpy(bytes, string, len);
+    bytes[len] = '\0';
+    shard->block_used += needed;
+    return bytes;
+}
+
+static const char *string_by_id(struct interner *interner, uint32_t id)
+{
+    const char **segment = atomic_load(&interner->segments[id >> SEGMENT_BITS]);
+    return segment[id & (SEGMENT_SIZE - 1)];
+}
+
+static void set_string(struct interner *interner, uint32_t id, const char *string)
+{
+    _Atomic(const char **) *slot = &interner->segments[id >> SEGMENT_BITS];
+    const char **segment = atomic_load(slot);
+    if (!segment) {
+        // Another shard might be adding the segment as well
+        const char **new_segment = (const char **)malloc(SEGMENT_SIZE * sizeof(const char *));
+        if (atomic_compare_exchange_strong(slot, &segment, new_segment)) {
+            segment = new_segment;
+        } else {
+            free(new_segment);
+        }
+    }
+    segment[id & (SEGMENT_SIZE - 1)] = string;
+}
+
+// IDs are handed out in order, across all shards
+static uint32_t next_id(struct interner *interner)
+{
+    uint32_t id = atomic_load(&interner->no_strings);
+    do {
+        if (id == NO_ID) return NO_ID;
+    } while (!atomic_compare_exchange_weak(&interner->no_strings, &id, id + 1));
+    return id;
+}
+
+#pragma mark bins
+
+static struct bin *new_bins(uint32_t size)
+{
+    return (struct bin *)calloc(size, sizeof(struct bin));
+}
+
+static void resize(struct intern_shard *shard, uint32_t new_size)
+{
+    struct bin *old_bins = shard->bins;
+    uint32_t old_size = shard->size;
+    shard->bins = new_bins(new_size);
+    shard->size = new_size;
+    for (uint32_t i = 0; i < old_size; ++i) {
+        struct bin *old_bin = &old_bins[i];
+        if (!old_bin->id) continue;
+        for (uint32_t j = 0; ; ++j) {
+            struct bin *bin = &shard->bins[p(old_bin->hash_key, j, new_size)];
+            if (!bin->id) {
+                *bin = *old_bin;
+                break;
+            }
+        }
+    }
+    free(old_bins);
+}
+
+// Finds the string's bin, or the free bin where it should go.
+static struct bin *find_bin(struct interner *interner, struct intern_shard *shard,
+                            uint32_t hash_key, const char *string, uint32_t len)
+{
+    for (uint32_t i = 0; ; ++i) {
+        struct bin *bin = &shard->bins[p(hash_key, i, shard->size)];
+        if (!bin->id) return bin;
+        if (bin->hash_key != hash_key) continue;
+        const char *bin_string = string_by_id(interner, bin->id - 1);
+        if (string_len(bin_string) == len && memcmp(bin_string, string, len) == 0)
+            return bin;
+    }
+}
+
+static struct intern_shard *get_shard(struct interner *interner, uint32_t hash_key)
+{
+    // The bins use the low bits of the hash, so we pick shards with
+    // the high bits.
+    uint32_t shard = (uint32_t)(((uint64_t)hash_key * interner->no_shards) >> 32);
+    struct intern_shard *s = &interner->shards[shard];
+    if (interner->locking) pthread_mutex_lock(&s->lock);
+    return s;
+}
+
+static void release_shard(struct interner *interner, struct intern_shard *shard)
+{
+    if (interner->locking) pthread_mutex_unlock(&shard->lock);
+}
+
+#pragma mark interning
+
+struct interner *new_interner(uint32_t no_shards)
+{
+    struct interner *interner = (struct interner *)malloc(sizeof(struct interner));
+    interner->locking = no_shards > 0;
+    interner->no_shards = no_shards > 0 ? no_shards : 1;
+    atomic_init(&interner->no_strings, 0);
+    interner->segments = calloc(NO_SEGMENTS, sizeof(*interner->segments));
+
+    uint32_t size = 16;
+    while (size * interner->no_shards < INITIAL_SIZE) size *= 2;
+    size_t bytes = interner->no_shards * sizeof(struct intern_shard);
+    interner->shards =
+    (struct intern_shard *)aligned_alloc(_Alignof(struct intern_shard), bytes);
+    for (uint32_t i = 0; i < interner->no_shards; ++i) {
+        struct intern_shard *shard = &interner->shards[i];
+        pthread_mutex_init(&shard->lock, 0);
+        shard->bins = new_bins(size);
+        shard->size = size;
+        shard->used = 0;
+        shard->blocks = 0;
+        shard->block_used = shard->block_size = 0;
+    }
+    return interner;
+}
+
+void delete_interner(struct interner *interner)
+{
+    for (uint32_t i = 0; i < interner->no_shards; ++i) {
+        struct intern_shard *shard = &interner->shards[i];
+        pthread_mutex_destroy(&shard->lock);
+        free(shard->bins);
+        struct block *block = shard->blocks;
+        while (block) {
+            struct block *next = block->next;
+            free(block);
+            block = next;
+        }
+    }
+    for (uint32_t i = 0; i < NO_SEGMENTS; ++i) {
+        free((void *)atomic_load(&interner->segments[i]));
+    }
+    free(interner->segments);
+    free(interner->shards);
+    free(interner);
+}
+
+uint32_t intern(struct interner *interner, const char *string, uint32_t len)
+{
+    uint32_t hash_key = hash_string(string, len);
+    struct intern_shard *shard = get_shard(interner, hash_key);
+    struct bin *bin = find_bin(interner, shard, hash_key, string, len);
+    uint32_t id;
+    if (bin->id) {
+        id = bin->id - 1;
+    } else {
+        id = next_id(interner);
+        if (id != NO_ID) {
+            set_string(interner, id, store_string(shard, string, len));
+            bin->hash_key = hash_key;
+            bin->id = id + 1;
+            if (++shard->used > shard->size / 2)
+                resize(shard, shard->size * 2);
+        }
+    }
+    release_shard(interner, shard);
+    return id;
+}
+
+bool lookup_id(struct interner *interner, const char *string, uint32_t len,
+               uint32_t *id)
+{
+    uint32_t hash_key = hash_string(string, len);
+    struct intern_shard *shard = get_shard(interner, hash_key);
+    struct bin *bin = find_bin(interner, shard, hash_key, string, len);
+    bool found = bin->id != 0;
+    if (found) *id = bin->id - 1;
+    release_shard(interner, shard);
+    return found;
+}
+
+const char *interned_string(struct interner *interner, uint32_t id, uint32_t *len)
+{
+    const char *string = string_by_id(interner, id);
+    *len = string_len(string);
+    return string;
+}
+
+uint32_t no_interned(struct interner *interner)
+{
+    return atomic_load(&interner->no_strings);
+}
@@ -0,0 +1,71 @@
+//
+//  interning.h
+//  LinearProbeHashSet
+//
+//  Created by Thomas Mailund on 19/10/2026.
+//  Copyright © 2026 Thomas Mailund. All rights reserved.
+//
+
+#ifndef interning_h
+#define interning_h
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+
+// String interning: each distinct byte string gets a 32-bit ID, and
+// IDs are dense, 0, 1, 2, ..., in the order we first see the strings.
+// You can then compare and join on IDs instead of strings.
+//
+// The set of strings is a linear probe table, but the bins only hold
+// the string's hash and its ID, eight bytes, so many bins fit in a
+// cache line and we only look at string bytes when the hashes match.
+// We hash strings with jenkins_hash from HashFunctions. Resizing uses
+// the hashes in the bins and never touches the strings.
+//
+// Each string is stored once, in large blocks of memory where strings
+// follow each other, and an ID leads to its string through a table
+// of pointers. Strings never move, so the pointers interned_string()
+// gives you are valid until you delete the interner.
+//
+// With shards, the strings are split over a number of tables by the
+// high bits of their hash, and each table has its own lock, so threads
+// can intern at the same time. IDs are still dense. An ID is only
+// valid once intern() has returned it, so share IDs between threads
+// the way you would share any other data.
+
+#define NO_ID UINT32_MAX
+
+struct intern_shard;
+
+struct interner {
+    uint32_t no_shards;
+    bool locking;
+    struct intern_shard *shards;
+
+    _Atomic uint32_t no_strings;
+    // The strings by ID, in segments that never move
+    _Atomic(const char **) *segments;
+};
+
+// With zero shards, the interner is for one thread and takes no
+// locks. Otherwise, the strings are split over no_shards tables.
+struct interner *new_interner(uint32_t no_shards);
+void delete_interner(struct interner *interner);
+
+// Returns the string's ID, giving it a new one if we have not seen it
+// before, or NO_ID if we have run out of IDs.
+uint32_t    intern         (struct interner *interner,
+                            const char *string, uint32_t len);
+// Gets the ID without adding the string. Returns false if we have not
+// seen it.
+bool        lookup_id      (struct interner *interner,
+                            const char *string, uint32_t len,
+                            uint32_t *id);
+// The string has a '\0' after it, so it is also a C string, unless
+// it holds a '\0' itself.
+const char *interned_string(struct interner *interner, uint32_t id,
+                            uint32_t *len);
+uint32_t    no_interned    (struct interner *interner);
+
+#endif /* interning_h */
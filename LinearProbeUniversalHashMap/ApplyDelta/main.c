@@ -0,0 +1,33 @@
+//
+//  main.c
+//  ApplyDelta
+//
+//  Created by Thomas Mailund on 19/10/2026.
+//  Copyright © 2026 Thomas Mailund. All rights reserved.
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "hash_map.h"
+
+// Brings a snapshot up to date with the deltas written after it:
+//
+//     apply_delta snapshot delta...
+//
+// The deltas must be given in the order they were written. Deltas
+// the snapshot already has are skipped, so if we stop half way, you
+// can run the same command again.
+int main(int argc, const char *argv[])
+{
+    if (argc < 3) {
+        fprintf(stderr, "Usage: %s snapshot delta...\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+    for (int i = 2; i < argc; ++i) {
+        if (!apply_delta(argv[1], argv[i])) {
+            fprintf(stderr, "Could not apply %s to %s.\n", argv[i], argv[1]);
+            return EXIT_FAILURE;
+        }
+    }
+    return EXIT_SUCCESS;
+}
@@ -9,7 +9,10 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <assert.h>
+#include <stdatomic.h>
+#include <unistd.h>
 #include "hash_map.h"
+#include "sharded_map.h"
 
 
 struct tag_key {
@@ -41,6 +44,12 @@ static uint32_t id_hash(void *key)
     return ((struct tag_key*)key)->key;
 }
 
+static void key_bytes(void *key, const void **bytes, uint32_t *len)
+{
+    *bytes = &((struct tag_key*)key)->key;
+    *len = sizeof(uint32_t);
+}
+
 static void key_destroy(void *void_key)
 {
     struct tag_key *key = (struct tag_key*)void_key;
@@ -52,6 +61,12 @@ static void val_destroy(void *void_key)
     key->val_deleted = true;
 }
 
+static void count_entry(void *key, void *val, void *data)
+{
+    assert(key == val);
+    atomic_fetch_add((_Atomic int *)data, 1);
+}
+
 int main(int argc, const char *argv[])
 {
     
@@ -82,6 +97,14 @@ int main(int argc, const char *argv[])
         assert(lookup(table, &other_keys[i]) == &keys[i]);
         assert(lookup(table, &other_keys[i]) != &other_keys[i]);
     }
+    void *key_ptrs[no_elms], *vals[no_elms];
+    for (int i = 0; i < no_elms; ++i) {
+        key_ptrs[i] = &other_keys[i];
+    }
+    lookup_keys(table, key_ptrs, no_elms, vals);
+    for (int i = 0; i < no_elms; ++i) {
+        assert(vals[i] == &keys[i]);
+    }
     for (int i = 0; i < no_elms; ++i) {
         assert(!contains_key(table, &different_keys[i]));
     }
@@ -113,6 +136,294 @@ int main(int argc, const char *argv[])
     }
 
     delete_map(table);
+    
+    // Multiply-shift hashing
+    table = new_map_family(2, 1.0, UNIVERSAL_MULTIPLY_SHIFT,
+                           id_hash, compare_values, key_destroy, val_destroy);
+    for (int i = 0; i < no_elms; ++i) {
+        init_tag_key(&keys[i], keys[i].key);
+        map(table, &keys[i], &keys[i]);
+    }
+    for (int i = 0; i < no_elms; ++i) {
+        assert(lookup(table, &other_keys[i]) == &keys[i]);
+    }
+    for (int i = 0; i < no_elms; ++i) {
+        assert(!contains_key(table, &different_keys[i]));
+    }
+    for (int i = 0; i < no_elms; ++i) {
+        delete_key(table, &keys[i]);
+        assert(!contains_key(table, &keys[i]));
+        assert(keys[i].key_deleted == true);
+        assert(keys[i].val_deleted == true);
+    }
+    delete_map(table);
+    
+    // Hashing the key bytes, which needs a key_view
+    assert(!new_map_family(2, 1.0, UNIVERSAL_KEY_BYTES, 0,
+                           compare_values, key_destroy, val_destroy));
+    assert(!new_map_keyed(2, 1.0, 0, compare_values, key_destroy, val_destroy));
+    table = new_map_keyed(2, 1.0, key_bytes,
+                          compare_values, key_destroy, val_destroy);
+    for (int i = 0; i < no_elms; ++i) {
+        init_tag_key(&keys[i], keys[i].key);
+        map(table, &keys[i], &keys[i]);
+    }
+    for (int i = 0; i < no_elms; ++i) {
+        assert(lookup(table, &other_keys[i]) == &keys[i]);
+    }
+    for (int i = 0; i < no_elms; ++i) {
+        assert(!contains_key(table, &different_keys[i]));
+    }
+    for (int i = 0; i < no_elms; ++i) {
+        delete_key(table, &keys[i]);
+        assert(!contains_key(table, &keys[i]));
+        assert(keys[i].key_deleted == true);
+        assert(keys[i].val_deleted == true);
+    }
+    delete_map(table);
+    
+    // Moving the bins with several threads. The table is large
+    // enough that resizes and rehashes go through the parallel path.
+    int no_large = 200000;
+    struct tag_key *large_keys = malloc(no_large * sizeof(struct tag_key));
+    for (int i = 0; i < no_large; ++i) {
+        init_tag_key(&large_keys[i], i);
+    }
+    table = new_map(2, 1.0, id_hash, compare_values, key_destroy, val_destroy);
+    table->resize_threads = 4;
+    for (int i = 0; i < no_large; ++i) {
+        map(table, &large_keys[i], &large_keys[i]);
+    }
+    for (int i = 0; i < no_large; ++i) {
+        assert(lookup(table, &large_keys[i]) == &large_keys[i]);
+    }
+    reserve_parallel(table, 4 * no_large, 3);
+    assert(table->size >= 8 * no_large);
+    assert(table->active == no_large);
+    for (int i = 0; i < no_large; i += 2) {
+        delete_key(table, &large_keys[i]);
+    }
+    for (int i = 0; i < no_large; ++i) {
+        assert(contains_key(table, &large_keys[i]) == (i % 2 == 1));
+    }
+    delete_map(table);
+    for (int i = 0; i < no_large; ++i) {
+        assert(large_keys[i].key_deleted == true);
+    }
+    free(large_keys);
+    
+    // Building from arrays. Each key appears twice.
+    int no_array = 100000;
+    struct tag_key *array_keys = malloc(2 * no_array * sizeof(struct tag_key));
+    void **array_key_ptrs = malloc(2 * no_array * sizeof(void *));
+    for (enum duplicate_keys duplicates = UNIQUE_KEYS;
+         duplicates <= KEEP_LAST_KEY; ++duplicates) {
+        // With unique keys we only give the table the first half
+        int n = duplicates == UNIQUE_KEYS ? no_array : 2 * no_array;
+        for (int i = 0; i < 2 * no_array; ++i) {
+            init_tag_key(&array_keys[i], i % no_array);
+            array_key_ptrs[i] = &array_keys[i];
+        }
+        table = new_map_from_arrays(n, array_key_ptrs, array_key_ptrs,
+                                    duplicates, 4, 1.0, id_hash,
+                                    compare_values, key_destroy, val_destroy);
+        assert(table->active == no_array);
+        for (int i = 0; i < no_array; ++i) {
+            int kept = duplicates == KEEP_LAST_KEY ? i + no_array : i;
+            int dropped = duplicates == KEEP_LAST_KEY ? i : i + no_array;
+            assert(lookup(table, &array_keys[i]) == &array_keys[kept]);
+            assert(array_keys[kept].key_deleted == false);
+            assert(array_keys[dropped].key_deleted == (duplicates != UNIQUE_KEYS));
+        }
+        delete_map(table);
+    }
+    free(array_keys);
+    free(array_key_ptrs);
+    
+    // Sharded maps
+    struct sharded_map *sharded =
+    new_sharded_map(8, 2, 1.0, UNIVERSAL_TABULATION,
+                    id_hash, compare_values, key_destroy, val_destroy);
+    for (int i = 0; i < no_elms; ++i) {
+        init_tag_key(&keys[i], keys[i].key);
+        sharded_map_key(sharded, &keys[i], &keys[i]);
+    }
+    for (int i = 0; i < no_elms; ++i) {
+        assert(sharded_contains_key(sharded, &other_keys[i]));
+        assert(sharded_lookup(sharded, &other_keys[i]) == &keys[i]);
+    }
+    for (int i = 0; i < no_elms; ++i) {
+        assert(!sharded_contains_key(sharded, &different_keys[i]));
+    }
+    for (int i = 0; i < no_elms; ++i) {
+        sharded_delete_key(sharded, &keys[i]);
+        assert(!sharded_contains_key(sharded, &keys[i]));
+        assert(keys[i].key_deleted == true);
+        assert(keys[i].val_deleted == true);
+    }
+    delete_sharded_map(sharded);
+    
+    // Bulk insertion; each key appears twice and the last one wins
+    int no_bulk = 10000;
+    struct tag_key *bulk_keys = malloc(2 * no_bulk * sizeof(struct tag_key));
+    void **bulk_key_ptrs = malloc(2 * no_bulk * sizeof(void *));
+    for (int i = 0; i < 2 * no_bulk; ++i) {
+        init_tag_key(&bulk_keys[i], i % no_bulk);
+        bulk_key_ptrs[i] = &bulk_keys[i];
+    }
+    sharded = new_sharded_map(16, 16, 1.0, UNIVERSAL_MULTIPLY_SHIFT,
+                              id_hash, compare_values, key_destroy, val_destroy);
+    sharded_map_keys(sharded, bulk_key_ptrs, bulk_key_ptrs, 2 * no_bulk, 4);
+    for (int i = 0; i < no_bulk; ++i) {
+        assert(sharded_lookup(sharded, &bulk_keys[i]) == &bulk_keys[i + no_bulk]);
+        assert(bulk_keys[i].key_deleted == true);
+        assert(bulk_keys[i + no_bulk].key_deleted == false);
+    }
+    delete_sharded_map(sharded);
+    for (int i = 0; i < 2 * no_bulk; ++i) {
+        assert(bulk_keys[i].key_deleted == true);
+        assert(bulk_keys[i].val_deleted == true);
+    }
+    free(bulk_keys);
+    free(bulk_key_ptrs);
+    
+    // Iteration
+    int no_iter = 10000;
+    struct tag_key *iter_keys = malloc(no_iter * sizeof(struct tag_key));
+    table = new_map(2, 1.0, id_hash, compare_values, key_destroy, val_destroy);
+    for (int i = 0; i < no_iter; ++i) {
+        init_tag_key(&iter_keys[i], i);
+        map(table, &iter_keys[i], &iter_keys[i]);
+    }
+    int no_iterated = 0;
+    struct cursor cursor;
+    init_cursor(&cursor);
+    void *key, *val;
+    while (next_entry(table, &cursor, &key, &val)) {
+        assert(key == val);
+        ((struct tag_key *)key)->key_deleted = true;
+        no_iterated++;
+    }
+    assert(no_iterated == no_iter);
+    for (int i = 0; i < no_iter; ++i) {
+        assert(iter_keys[i].key_deleted == true);
+        iter_keys[i].key_deleted = false;
+    }
+    _Atomic int no_visited = 0;
+    for_each(table, count_entry, &no_visited);
+    assert(no_visited == no_iter);
+    for (int no_threads = 1; no_threads <= 8; no_threads *= 2) {
+        no_visited = 0;
+        for_each_parallel(table, count_entry, &no_visited, no_threads);
+        assert(no_visited == no_iter);
+    }
+    delete_map(table);
+    free(iter_keys);
+    
+    // Snapshots, for both the pre-hash and the key-bytes families.
+    // Key i maps to key 3 * i, and we delete every third key before
+    // we write the snapshot.
+    int no_snapshot = 10000;
+    struct tag_key *snapshot_keys = malloc(2 * no_snapshot * sizeof(struct tag_key));
+    for (int keyed = 0; keyed < 2; ++keyed) {
+        if (keyed)
+            table = new_map_keyed(2, 1.0, key_bytes, compare_values,
+                                  key_destroy, val_destroy);
+        else
+            table = new_map(2, 1.0, id_hash, compare_values,
+                            key_destroy, val_destroy);
+        for (int i = 0; i < no_snapshot; ++i) {
+            init_tag_key(&snapshot_keys[i], i);
+            init_tag_key(&snapshot_keys[i + no_snapshot], 3 * i);
+            map(table, &snapshot_keys[i], &snapshot_keys[i + no_snapshot]);
+        }
+        for (int i = 0; i < no_snapshot; i += 3) {
+            delete_key(table, &snapshot_keys[i]);
+        }
+        char path[] = "/tmp/snapshotXXXXXX";
+        close(mkstemp(path));
+        assert(write_snapshot(table, path, key_bytes, key_bytes));
+        
+        struct snapshot *snapshot = open_snapshot(path, id_hash, key_bytes);
+        assert(snapshot);
+        assert(snapshot_size(snapshot) == no_snapshot - (no_snapshot + 2) / 3);
+        const void *snapshot_val; uint32_t val_len;
+        for (int i = 0; i < no_snapshot; ++i) {
+            bool found = snapshot_lookup(snapshot, &snapshot_keys[i],
+                                         &snapshot_val, &val_len);
+            assert(found == (i % 3 != 0));
+            if (!found) continue;
+            assert(val_len == sizeof(uint32_t));
+            assert(*(const uint32_t *)snapshot_val == 3 * i);
+        }
+        struct tag_key missing;
+        init_tag_key(&missing, no_snapshot);
+        assert(!snapshot_lookup(snapshot, &missing, &snapshot_val, &val_len));
+        close_snapshot(snapshot);
+        
+        // Deltas. We put back the deleted keys below 300 and delete
+        // the keys below 300 that are one more than a multiple of
+        // three. Lookups can rehash the table, and then the delta
+        // holds all of it, but either way the snapshot gets the keys.
+        for (int i = 0; i < 300; ++i) {
+            if (i % 3 == 0) map(table, &snapshot_keys[i], &snapshot_keys[i + no_snapshot]);
+            if (i % 3 == 1) delete_key(table, &snapshot_keys[i]);
+        }
+        char delta_path[] = "/tmp/deltaXXXXXX";
+        close(mkstemp(delta_path));
+        assert(write_delta(table, delta_path, key_bytes, key_bytes));
+        assert(apply_delta(path, delta_path));
+        assert(apply_delta(path, delta_path)); // applying it again does nothing
+        snapshot = open_snapshot(path, id_hash, key_bytes);
+        assert(snapshot);
+        assert(snapshot_size(snapshot) == table->active);
+        for (int i = 0; i < no_snapshot; ++i) {
+            bool found = snapshot_lookup(snapshot, &snapshot_keys[i],
+                                         &snapshot_val, &val_len);
+            assert(found == (i < 300 ? i % 3 != 1 : i % 3 != 0));
+            if (found) assert(*(const uint32_t *)snapshot_val == 3 * i);
+        }
+        close_snapshot(snapshot);
+        
+        // Deltas must come in order
+        char next_delta_path[] = "/tmp/deltaXXXXXX";
+        close(mkstemp(next_delta_path));
+        delete_key(table, &snapshot_keys[2]);
+        assert(write_delta(table, delta_path, key_bytes, key_bytes));
+        delete_key(table, &snapshot_keys[5]);
+        assert(write_delta(table, next_delta_path, key_bytes, key_bytes));
+        assert(!apply_delta(path, next_delta_path));
+        assert(apply_delta(path, delta_path));
+        assert(apply_delta(path, next_delta_path));
+        
+        // After a resize, the delta holds all the table
+        uint32_t old_size = table->size;
+        for (int i = 1000; i < no_snapshot; ++i) {
+            delete_key(table, &snapshot_keys[i]);
+        }
+        assert(table->size < old_size && table->all_dirty);
+        assert(write_delta(table, delta_path, key_bytes, key_bytes));
+        assert(apply_delta(path, delta_path));
+        snapshot = open_snapshot(path, id_hash, key_bytes);
+        assert(snapshot);
+        assert(snapshot_size(snapshot) == table->active);
+        for (int i = 0; i < no_snapshot; ++i) {
+            assert(snapshot_lookup(snapshot, &snapshot_keys[i], &snapshot_val, &val_len) ==
+                   (i < 1000 && i != 2 && i != 5 &&
+                    (i < 300 ? i % 3 != 1 : i % 3 != 0)));
+        }
+        close_snapshot(snapshot);
+        unlink(delta_path);
+        unlink(next_delta_path);
+        delete_map(table);
+        
+        // A truncated file is not a snapshot
+        assert(truncate(path, 20) == 0);
+        assert(!open_snapshot(path, id_hash, key_bytes));
+        unlink(path);
+    }
+    free(snapshot_keys);
+    
     printf("SUCCESS\n");
     
     return EXIT_SUCCESS;
@@ -7,34 +7,113 @@
 //
 
 #include <stdlib.h>
+#include <stdio.h>
+#include <pthread.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include "hash_map.h"
+#include "tabulation.h"
 
 #pragma mark universal hashing
 
-void tabulation_sample(uint32_t *start, uint32_t *end)
+// multiply-add-shift: the high 32 bits of a*x + b, for random 64-bit
+// a (odd) and b. It needs no table and a single multiplication.
+static uint32_t mulshift(uint32_t x, uint64_t a, uint64_t b)
 {
-    while (start != end)
-        *(start++) = rand();
+    return (uint32_t)((a * x + b) >> 32);
 }
 
-// tabulation hashing, r=4, q=32
-static uint32_t tabhash(uint32_t x, uint8_t *T)
+static uint32_t uhash(struct hash_map *table, uint32_t hash_key)
 {
-    const int r = 4;
-    const uint32_t no_cols = 1 << r;
-    const uint32_t mask = (1 << r) - 1;
-    
-    uint32_t *T_ = (uint32_t*)T;
-    uint32_t y = T_[0 * no_cols + (x & mask)]; x >>= r;
-    y ^= T_[1 * no_cols + (x & mask)]; x >>= r;
-    y ^= T_[2 * no_cols + (x & mask)]; x >>= r;
-    y ^= T_[3 * no_cols + (x & mask)]; x >>= r;
-    y ^= T_[4 * no_cols + (x & mask)]; x >>= r;
-    y ^= T_[5 * no_cols + (x & mask)]; x >>= r;
-    y ^= T_[6 * no_cols + (x & mask)]; x >>= r;
-    y ^= T_[7 * no_cols + (x & mask)];
+    if (table->family == UNIVERSAL_MULTIPLY_SHIFT)
+        return mulshift(hash_key, table->a, table->b);
+    if (table->family == UNIVERSAL_KEY_BYTES)
+        return hash_key;
+    return tabhash_32_r8(hash_key, (const uint32_t *)table->T);
+}
+
+static void uhash_n(struct hash_map *table,
+                    const uint32_t *x, uint32_t *y, uint32_t n)
+{
+    if (table->family == UNIVERSAL_MULTIPLY_SHIFT) {
+        for (uint32_t i = 0; i < n; ++i)
+            y[i] = mulshift(x[i], table->a, table->b);
+    } else if (table->family == UNIVERSAL_KEY_BYTES) {
+        memcpy(y, x, n * sizeof(uint32_t));
+    } else {
+        tabhash_32_r8_n(x, y, n, (const uint32_t *)table->T);
+    }
+}
+
+static void mark_all_dirty(struct hash_map *table);
+
+// Multilinear hashing of the raw key bytes, taken as 32-bit words w_i:
+// the high 32 bits of m_0 + len * m_1 + sum_i m_{i+2} w_i (mod 2^64)
+// for random 64-bit coefficients m. We draw coefficients as longer
+// keys need them.
+static void grow_coefficients(struct hash_map *table, uint32_t n)
+{
+    uint32_t no_coefs = table->no_coefs ? table->no_coefs : 16;
+    while (no_coefs < n) no_coefs *= 2;
+    table->coefs = (uint64_t *)realloc(table->coefs, no_coefs * sizeof(uint64_t));
+    for (uint32_t i = table->no_coefs; i < no_coefs; ++i)
+        table->coefs[i] = tabulation_random(&table->rng_state);
+    table->no_coefs = no_coefs;
+    // Snapshots only have the old coefficients
+    mark_all_dirty(table);
+}
+
+static uint32_t multilinear(struct hash_map *table,
+                            const uint8_t *bytes, uint32_t len)
+{
+    uint32_t no_words = (len + 3) / 4;
+    if (no_words + 2 > table->no_coefs)
+        grow_coefficients(table, no_words + 2);
     
-    return y;
+    const uint64_t *m = table->coefs;
+    uint64_t h = m[0] + m[1] * len;
+    uint32_t i = 0, w;
+    for (; i < len / 4; ++i) {
+        memcpy(&w, bytes + 4 * i, 4);
+        h += m[i + 2] * w;
+    }
+    if (len % 4) {
+        w = 0;
+        memcpy(&w, bytes + 4 * i, len % 4);
+        h += m[i + 2] * w;
+    }
+    return (uint32_t)(h >> 32);
+}
+
+// The hash key we store for a key. For the key-bytes family this is
+// already a universal hash, so uhash() leaves it alone.
+static uint32_t key_hash(struct hash_map *table, void *key)
+{
+    if (table->family == UNIVERSAL_KEY_BYTES) {
+        const void *bytes; uint32_t len;
+        table->key_view(key, &bytes, &len);
+        return multilinear(table, (const uint8_t *)bytes, len);
+    }
+    return table->hash(key);
+}
+
+// Samples a new function from the table's family.
+static void sample_hash_function(struct hash_map *table)
+{
+    if (table->family == UNIVERSAL_MULTIPLY_SHIFT) {
+        table->a = tabulation_random(&table->rng_state) | 1;
+        table->b = tabulation_random(&table->rng_state);
+    } else if (table->family == UNIVERSAL_KEY_BYTES) {
+        for (uint32_t i = 0; i < table->no_coefs; ++i)
+            table->coefs[i] = tabulation_random(&table->rng_state);
+    } else {
+        tabulation_sample(&table->rng_state,
+                          (uint32_t*)table->T, (uint32_t*)table->T_end);
+    }
 }
 
 
@@ -54,6 +133,31 @@ p(uint32_t k, unsigned int i, unsigned int m)
     return (k + i) & (m - 1);
 }
 
+// Deltas hold pages of this many bins. 128 snapshot bins are 4 KB.
+#define DIRTY_PAGE_BINS 128
+
+static uint32_t no_dirty_words(uint32_t size)
+{
+    uint32_t no_pages = (size + DIRTY_PAGE_BINS - 1) / DIRTY_PAGE_BINS;
+    return (no_pages + 63) / 64;
+}
+
+static void mark_dirty(struct hash_map *table, uint32_t index)
+{
+    if (!table->dirty) return; // we only track after a snapshot
+    uint32_t page = index / DIRTY_PAGE_BINS;
+    table->dirty[page / 64] |= (uint64_t)1 << (page % 64);
+}
+
+// When all bins move, the next delta must be a full snapshot
+static void mark_all_dirty(struct hash_map *table)
+{
+    if (!table->dirty) return;
+    free(table->dirty);
+    table->dirty = (uint64_t *)calloc(no_dirty_words(table->size), sizeof(uint64_t));
+    table->all_dirty = true;
+}
+
 static void resize(struct hash_map *table, uint32_t new_size);
 static void insert_key_hashed(struct hash_map *table,
                               uint32_t hash_key, uint32_t uhash_key,
@@ -63,8 +167,326 @@ static bool contains_key_hashed(struct hash_map *table,
                                 uint32_t uhash_key,
                                 void *key);
 
+// Number of keys we hash at a time when we work on batches of keys.
+#define HASH_BATCH 256
 
-static void resize(struct hash_map *table, uint32_t new_size)
+#pragma mark parallel migration
+
+// Tables smaller than this are always moved on the calling thread.
+#define PARALLEL_MIN_SIZE (1 << 16)
+
+// A bin on its way to the new bins.
+struct moving_bin {
+    uint32_t hash_key;
+    uint32_t uhash_key;
+    void *key;
+    void *val;
+};
+
+// We move bins in parallel in three passes. First, each thread hashes
+// its slice of the sources and counts how many go to each thread's
+// range of the new bins. Then the threads copy their bins to an array
+// ordered by range, and finally each thread inserts the bins for its
+// own range. Threads only write to their own range, so they never
+// conflict. Bins whose probes run past the end of their range are
+// left for the calling thread to insert when the others are done.
+//
+// The sources are either old bins, when we resize or rehash, or
+// arrays of keys and values, when we build a table from arrays.
+struct migration {
+    struct hash_map *table;
+    struct bin *old_bins;
+    void **keys, **vals;
+    uint32_t n;                       // number of sources
+    enum duplicate_keys duplicates;
+    int no_threads;
+    
+    uint32_t *hash_keys, *uhash_keys; // indexed like the sources
+    uint32_t *offsets;                // no_threads x no_threads
+    uint32_t *range_start;            // no_threads + 1
+    struct moving_bin *moving;
+    
+    // per thread
+    struct moving_bin **deferred;
+    uint32_t *no_deferred;
+    uint32_t *no_inserted;
+};
+
+struct migration_thread {
+    struct migration *migration;
+    int thread;
+};
+
+// The first index in range r when we split size indices into
+// no_threads ranges.
+static uint32_t range_begin(uint32_t size, int no_threads, int r)
+{
+    return (uint32_t)(((uint64_t)size * r + no_threads - 1) / no_threads);
+}
+
+static int destination(struct migration *m, uint32_t uhash_key)
+{
+    uint32_t size = m->table->size;
+    return (int)((uint64_t)p(uhash_key, 0, size) * m->no_threads / size);
+}
+
+static bool is_source(struct migration *m, uint32_t i)
+{
+    return m->keys || !(m->old_bins[i].is_free || m->old_bins[i].is_deleted);
+}
+
+static void *hash_sources(void *arg)
+{
+    struct migration_thread *t = (struct migration_thread *)arg;
+    struct migration *m = t->migration;
+    struct hash_map *table = m->table;
+    uint32_t *counts = m->offsets + t->thread * m->no_threads;
+    
+    uint32_t batch[HASH_BATCH];
+    uint32_t hash_keys[HASH_BATCH];
+    uint32_t uhash_keys[HASH_BATCH];
+    uint32_t i = range_begin(m->n, m->no_threads, t->thread);
+    uint32_t end = range_begin(m->n, m->no_threads, t->thread + 1);
+    while (i < end) {
+        uint32_t n = 0;
+        for (; i < end && n < HASH_BATCH; ++i) {
+            if (!is_source(m, i)) continue;
+            batch[n] = i;
+            if (m->keys) {
+                hash_keys[n++] = key_hash(table, m->keys[i]);
+            } else {
+                struct bin *bin = &m->old_bins[i];
+                hash_keys[n++] = (table->family == UNIVERSAL_KEY_BYTES) ?
+                    key_hash(table, bin->key) : bin->hash_key;
+            }
+        }
+        uhash_n(table, hash_keys, uhash_keys, n);
+        for (uint32_t j = 0; j < n; ++j) {
+            m->hash_keys[batch[j]] = hash_keys[j];
+            m->uhash_keys[batch[j]] = uhash_keys[j];
+            counts[destination(m, uhash_keys[j])]++;
+        }
+    }
+    return 0;
+}
+
+static void *partition_sources(void *arg)
+{
+    struct migration_thread *t = (struct migration_thread *)arg;
+    struct migration *m = t->migration;
+    uint32_t *offsets = m->offsets + t->thread * m->no_threads;
+    
+    uint32_t end = range_begin(m->n, m->no_threads, t->thread + 1);
+    for (uint32_t i = range_begin(m->n, m->no_threads, t->thread); i < end; ++i) {
+        if (!is_source(m, i)) continue;
+        struct moving_bin *moving =
+        &m->moving[offsets[destination(m, m->uhash_keys[i])]++];
+        moving->hash_key = m->hash_keys[i];
+        moving->uhash_key = m->uhash_keys[i];
+        if (m->keys) {
+            moving->key = m->keys[i];
+            moving->val = m->vals[i];
+        } else {
+            moving->key = m->old_bins[i].key;
+            moving->val = m->old_bins[i].val;
+        }
+    }
+    return 0;
+}
+
+// Puts a moving bin in a bin that is either free or holds the same
+// key. Returns true if the table has one more key.
+static bool place_bin(struct migration *m, struct bin *bin,
+                      struct moving_bin *moving)
+{
+    struct hash_map *table = m->table;
+    if (!bin->is_free) {
+        if (m->duplicates == KEEP_FIRST_KEY) {
+            table->key_destructor(moving->key);
+            table->val_destructor(moving->val);
+        } else {
+            table->key_destructor(bin->key);
+            table->val_destructor(bin->val);
+            bin->key = moving->key;
+            bin->val = moving->val;
+        }
+        return false;
+    }
+    bin->hash_key = moving->hash_key;
+    bin->key = moving->key;
+    bin->val = moving->val;
+    bin->is_free = bin->is_deleted = false;
+    return true;
+}
+
+// Is this bin where the moving bin should go, if it doesn't go further?
+static bool bin_stops_probe(struct migration *m, struct bin *bin,
+                            struct moving_bin *moving)
+{
+    return bin->is_free ||
+    (m->duplicates != UNIQUE_KEYS && bin->hash_key == moving->hash_key &&
+     m->table->key_cmp(bin->key, moving->key));
+}
+
+static void *insert_range(void *arg)
+{
+    struct migration_thread *t = (struct migration_thread *)arg;
+    struct migration *m = t->migration;
+    struct hash_map *table = m->table;
+    uint32_t end = range_begin(table->size, m->no_threads, t->thread + 1);
+    
+    uint32_t no_inserted = 0, no_deferred = 0, deferred_size = 0;
+    struct moving_bin *deferred = 0;
+    for (uint32_t j = m->range_start[t->thread]; j < m->range_start[t->thread + 1]; ++j) {
+        struct moving_bin *moving = &m->moving[j];
+        uint32_t index = p(moving->uhash_key, 0, table->size);
+        while (index < end && !bin_stops_probe(m, &table->table[index], moving))
+            ++index;
+        if (index == end) {
+            if (no_deferred == deferred_size) {
+                deferred_size = deferred_size ? 2 * deferred_size : 16;
+                deferred = (struct moving_bin *)
+                realloc(deferred, deferred_size * sizeof(struct moving_bin));
+            }
+            deferred[no_deferred++] = *moving;
+            continue;
+        }
+        no_inserted += place_bin(m, &table->table[index], moving);
+    }
+    m->deferred[t->thread] = deferred;
+    m->no_deferred[t->thread] = no_deferred;
+    m->no_inserted[t->thread] = no_inserted;
+    return 0;
+}
+
+static void run_migration_threads(struct migration *m, void *(*f)(void *))
+{
+    pthread_t threads[m->no_threads];
+    struct migration_thread args[m->no_threads];
+    for (int i = 0; i < m->no_threads; ++i) {
+        args[i].migration = m;
+        args[i].thread = i;
+        pthread_create(&threads[i], 0, f, &args[i]);
+    }
+    for (int i = 0; i < m->no_threads; ++i) {
+        pthread_join(threads[i], 0);
+    }
+}
+
+// The new bins must be in the table, all free, and the hash function
+// sampled, before we get here.
+static void migrate(struct migration *m)
+{
+    struct hash_map *table = m->table;
+    int no_threads = m->no_threads;
+    m->hash_keys = (uint32_t *)malloc(m->n * sizeof(uint32_t));
+    m->uhash_keys = (uint32_t *)malloc(m->n * sizeof(uint32_t));
+    m->offsets = (uint32_t *)calloc(no_threads * no_threads, sizeof(uint32_t));
+    m->range_start = (uint32_t *)malloc((no_threads + 1) * sizeof(uint32_t));
+    m->deferred = (struct moving_bin **)malloc(no_threads * sizeof(struct moving_bin *));
+    m->no_deferred = (uint32_t *)malloc(no_threads * sizeof(uint32_t));
+    m->no_inserted = (uint32_t *)malloc(no_threads * sizeof(uint32_t));
+    
+    run_migration_threads(m, hash_sources);
+    
+    // Turn counts into offsets. Range r starts where the bins of the
+    // ranges before it end, and within a range the sources keep
+    // their order.
+    uint32_t offset = 0;
+    for (int r = 0; r < no_threads; ++r) {
+        m->range_start[r] = offset;
+        for (int t = 0; t < no_threads; ++t) {
+            uint32_t count = m->offsets[t * no_threads + r];
+            m->offsets[t * no_threads + r] = offset;
+            offset += count;
+        }
+    }
+    m->range_start[no_threads] = offset;
+    m->moving = (struct moving_bin *)malloc(offset * sizeof(struct moving_bin));
+    
+    run_migration_threads(m, partition_sources);
+    run_migration_threads(m, insert_range);
+    
+    // The bins that ran out of their range. All other bins are in
+    // place now, so an ordinary probe finds the right bin.
+    for (int t = 0; t < no_threads; ++t) {
+        for (uint32_t j = 0; j < m->no_deferred[t]; ++j) {
+            struct moving_bin *moving = &m->deferred[t][j];
+            uint32_t i = 0;
+            while (!bin_stops_probe(m, &table->table[p(moving->uhash_key, i, table->size)], moving))
+                ++i;
+            struct bin *bin = &table->table[p(moving->uhash_key, i, table->size)];
+            if (place_bin(m, bin, moving)) {
+                table->active++; table->used++;
+            }
+        }
+        free(m->deferred[t]);
+        table->active += m->no_inserted[t];
+        table->used += m->no_inserted[t];
+    }
+    
+    free(m->hash_keys);
+    free(m->uhash_keys);
+    free(m->offsets);
+    free(m->range_start);
+    free(m->moving);
+    free(m->deferred);
+    free(m->no_deferred);
+    free(m->no_inserted);
+}
+
+static void move_bins_parallel(struct hash_map *table,
+                               struct bin *old_bins, uint32_t old_size,
+                               int no_threads)
+{
+    struct migration m;
+    m.table = table;
+    m.old_bins = old_bins;
+    m.keys = m.vals = 0;
+    m.n = old_size;
+    m.duplicates = UNIQUE_KEYS;
+    m.no_threads = no_threads;
+    migrate(&m);
+}
+
+// Move the values from the old bins to the new, using the table's
+// insertion function. We compute the new hash keys a batch at a time
+// so tabulation hashing can vectorise them.
+static void move_bins(struct hash_map *table,
+                      struct bin *old_bins, uint32_t old_size,
+                      int no_threads)
+{
+    if (no_threads > 1 && old_size >= PARALLEL_MIN_SIZE) {
+        move_bins_parallel(table, old_bins, old_size, no_threads);
+        return;
+    }
+    
+    struct bin *batch[HASH_BATCH];
+    uint32_t hash_keys[HASH_BATCH];
+    uint32_t uhash_keys[HASH_BATCH];
+    
+    struct bin *bin = old_bins, *end = old_bins + old_size;
+    while (bin != end) {
+        uint32_t n = 0;
+        for (; bin != end && n < HASH_BATCH; ++bin) {
+            if (bin->is_free || bin->is_deleted) continue;
+            batch[n] = bin;
+            // With the key-bytes family the hash key depends on the
+            // function we just sampled.
+            hash_keys[n++] = (table->family == UNIVERSAL_KEY_BYTES) ?
+                key_hash(table, bin->key) : bin->hash_key;
+        }
+        uhash_n(table, hash_keys, uhash_keys, n);
+        for (uint32_t i = 0; i < n; ++i) {
+            insert_key_hashed(table, hash_keys[i], uhash_keys[i],
+                              batch[i]->key, batch[i]->val);
+        }
+    }
+}
+
+
+static void resize_parallel(struct hash_map *table, uint32_t new_size,
+                            int no_threads)
 {
     if (new_size == 0) return;
     
@@ -82,29 +504,28 @@ static void resize(struct hash_map *table, uint32_t new_size)
     }
     table->size = new_size;
     table->active = table->used = 0;
+    mark_all_dirty(table);
     
     // Update hash function
-    tabulation_sample((uint32_t*)table->T, (uint32_t*)table->T_end);
+    sample_hash_function(table);
     
     // Update rehash limit
     table->probe_limit = table->rehash_factor * new_size;
     table->operations_since_rehash = 0;
     
     
-    // Move the values from the old bins to the new,
-    // using the table's insertion function
-    end = old_bins + old_size;
-    for (struct bin *bin = old_bins; bin != end; ++bin) {
-        if (bin->is_free || bin->is_deleted) continue;
-        uint32_t uhash_key = tabhash(bin->hash_key, table->T);
-        insert_key_hashed(table, bin->hash_key, uhash_key,
-                          bin->key, bin->val);
-    }
+    // Move the values from the old bins to the new
+    move_bins(table, old_bins, old_size, no_threads);
     
     // Finally, free memory for old bins
     free(old_bins);
 }
 
+static void resize(struct hash_map *table, uint32_t new_size)
+{
+    resize_parallel(table, new_size, table->resize_threads);
+}
+
 static void rehash(struct hash_map *table)
 {
     // Remember the old bins until we have moved them.
@@ -119,35 +540,32 @@ static void rehash(struct hash_map *table)
         bin->is_free = true;
         bin->is_deleted = false;
     }
+    table->active = table->used = 0;
+    mark_all_dirty(table);
     
     // Update hash function
-    tabulation_sample((uint32_t*)table->T, (uint32_t*)table->T_end);
+    sample_hash_function(table);
     
     // Update rehash limit
     table->probe_limit = table->rehash_factor * table->size;
     table->operations_since_rehash = 0;
     
     
-    // Move the values from the old bins to the new,
-    // using the table's insertion function
-    end = old_bins + old_size;
-    for (struct bin *bin = old_bins; bin != end; ++bin) {
-        if (bin->is_free || bin->is_deleted) continue;
-        uint32_t uhash_key = tabhash(bin->hash_key, table->T);
-        insert_key_hashed(table, bin->hash_key, uhash_key,
-                          bin->key, bin->val);
-    }
+    // Move the values from the old bins to the new
+    move_bins(table, old_bins, old_size, table->resize_threads);
     
     // Finally, free memory for old bins
     free(old_bins);
 }
 
-struct hash_map *new_map(uint32_t size,
-                         float rehash_factor,
-                         hash_func  hash,
-                         compare_func key_cmp,
-                         destructor_func key_destructor,
-                         destructor_func val_destructor)
+static struct hash_map *new_table(uint32_t size,
+                                  float rehash_factor,
+                                  enum universal_family family,
+                                  hash_func  hash,
+                                  key_view_func key_view,
+                                  compare_func key_cmp,
+                                  destructor_func key_destructor,
+                                  destructor_func val_destructor)
 {
     struct hash_map *table =
     (struct hash_map*)malloc(sizeof(struct hash_map));
@@ -165,25 +583,113 @@ struct hash_map *new_map(uint32_t size,
     table->key_destructor = key_destructor;
     table->val_destructor = val_destructor;
     
-    // setting up tabulation hashing table
-    int p = 32;
-    int r = 4;
-    int q = 32;
-    int no_cols = (1 << r);
-    int t = p / r;
-    int bytes = t * no_cols * q / 8;
-    table->T = malloc(bytes);
-    table->T_end = table->T + bytes;
-    tabulation_sample((uint32_t*)table->T,
-                      (uint32_t*)table->T_end);
+    // setting up the hash function. Only tabulation hashing
+    // needs a table.
+    table->family = family;
+    table->T = table->T_end = 0;
+    table->coefs = 0;
+    table->no_coefs = 0;
+    table->key_view = key_view;
+    table->dirty = 0;
+    table->all_dirty = false;
+    table->snapshot_sequence = 0;
+    if (family == UNIVERSAL_TABULATION) {
+        int p = 32;
+        int r = 8;
+        int q = 32;
+        int no_cols = (1 << r);
+        int t = p / r;
+        int bytes = t * no_cols * q / 8;
+        table->T = malloc(bytes);
+        table->T_end = table->T + bytes;
+    }
+    // We only use rand() to seed the table's own generator, so
+    // srand() still makes the tables reproducible.
+    table->rng_state = ((uint64_t)rand() << 32) ^ (uint64_t)rand();
+    sample_hash_function(table);
     
     table->rehash_factor = rehash_factor;
     table->probe_limit = rehash_factor * size;
     table->operations_since_rehash = 0;
+    table->resize_threads = 1;
+    
+    return table;
+}
+
+// UNIVERSAL_KEY_BYTES tables need a key_view, so they only come
+// from new_map_keyed.
+struct hash_map *new_map_family(uint32_t size,
+                                float rehash_factor,
+                                enum universal_family family,
+                                hash_func  hash,
+                                compare_func key_cmp,
+                                destructor_func key_destructor,
+                                destructor_func val_destructor)
+{
+    if (family == UNIVERSAL_KEY_BYTES) return 0;
+    return new_table(size, rehash_factor, family, hash, 0,
+                     key_cmp, key_destructor, val_destructor);
+}
+
+struct hash_map *new_map(uint32_t size,
+                         float rehash_factor,
+                         hash_func hash,
+                         compare_func key_cmp,
+                         destructor_func key_destructor,
+                         destructor_func val_destructor)
+{
+    return new_map_family(size, rehash_factor, UNIVERSAL_TABULATION,
+                          hash, key_cmp, key_destructor, val_destructor);
+}
+
+struct hash_map *new_map_from_arrays(uint32_t n, void **keys, void **vals,
+                                     enum duplicate_keys duplicates,
+                                     int no_threads,
+                                     float rehash_factor,
+                                     hash_func hash,
+                                     compare_func key_cmp,
+                                     destructor_func key_destructor,
+                                     destructor_func val_destructor)
+{
+    // Make room for all the keys, so we never resize while we fill
+    uint32_t size = 2;
+    while (size / 2 < n) size *= 2;
+    struct hash_map *table =
+    new_map(size, rehash_factor, hash, key_cmp, key_destructor, val_destructor);
+    
+    struct migration m;
+    m.table = table;
+    m.old_bins = 0;
+    m.keys = keys;
+    m.vals = vals;
+    m.n = n;
+    m.duplicates = duplicates;
+    m.no_threads = no_threads < 1 ? 1 : no_threads;
+    migrate(&m);
     
     return table;
 }
 
+struct hash_map *new_map_keyed(uint32_t size,
+                               float rehash_factor,
+                               key_view_func key_view,
+                               compare_func key_cmp,
+                               destructor_func key_destructor,
+                               destructor_func val_destructor)
+{
+    if (!key_view) return 0;
+    return new_table(size, rehash_factor, UNIVERSAL_KEY_BYTES, 0, key_view,
+                     key_cmp, key_destructor, val_destructor);
+}
+
+void reserve_parallel(struct hash_map *table, uint32_t n, int no_threads)
+{
+    uint32_t new_size = table->size;
+    while (new_size / 2 < n) new_size *= 2;
+    if (new_size != table->size)
+        resize_parallel(table, new_size, no_threads);
+}
+
 void delete_map(struct hash_map *table)
 {
     struct bin *end = table->table + table->size;
@@ -194,6 +700,8 @@ void delete_map(struct hash_map *table)
     }
     free(table->table);
     free(table->T);
+    free(table->coefs);
+    free(table->dirty);
     free(table);
 }
 
@@ -215,6 +723,7 @@ static void insert_key_hashed(struct hash_map *table,
             bin->key = key;
             bin->val = val;
             bin->is_free = bin->is_deleted = false;
+            mark_dirty(table, index);
             
             // we have one more active element
             // and one more unused cell changes character
@@ -223,8 +732,9 @@ static void insert_key_hashed(struct hash_map *table,
         }
         
         if (bin->is_deleted && !contains) {
-            bin->hash_key = hash_key; bin->key = key;
+            bin->hash_key = hash_key; bin->key = key; bin->val = val;
             bin->is_free = bin->is_deleted = false;
+            mark_dirty(table, index);
             
             // we have one more active element
             // but we do not use more cells since the
@@ -239,6 +749,7 @@ static void insert_key_hashed(struct hash_map *table,
                 table->val_destructor(bin->val);
                 bin->key = key;
                 bin->val = val;
+                mark_dirty(table, index);
                 return; // Done
             } else {
                 // we have found the key but with as
@@ -256,8 +767,8 @@ void map(struct hash_map *table, void *key, void *val)
         rehash(table);
     }
     
-    uint32_t hash_key = table->hash(key);
-    uint32_t uhash_key = tabhash(hash_key, table->T);
+    uint32_t hash_key = key_hash(table, key);
+    uint32_t uhash_key = uhash(table, hash_key);
     insert_key_hashed(table, hash_key, uhash_key, key, val);
     
     if (table->used > table->size / 2)
@@ -288,20 +799,16 @@ bool contains_key(struct hash_map *table, void *key)
         rehash(table);
     }
     
-    uint32_t hash_key = table->hash(key);
-    uint32_t uhash_key = tabhash(hash_key, table->T);
-    return contains_key_hashed(table, uhash_key, hash_key, key);
+    uint32_t hash_key = key_hash(table, key);
+    uint32_t uhash_key = uhash(table, hash_key);
+    return contains_key_hashed(table, hash_key, uhash_key, key);
 }
 
-void *lookup(struct hash_map *table, void *key)
+static void *lookup_hashed(struct hash_map *table,
+                           uint32_t hash_key,
+                           uint32_t uhash_key,
+                           void *key)
 {
-    table->operations_since_rehash++;
-    if (table->operations_since_rehash > table->probe_limit) {
-        rehash(table);
-    }
-    
-    uint32_t hash_key = table->hash(key);
-    uint32_t uhash_key = tabhash(hash_key, table->T);
     for (uint32_t i = 0; i < table->size; ++i) {
         uint32_t index = p(uhash_key, i, table->size);
         struct bin *bin = & table->table[index];
@@ -314,6 +821,41 @@ void *lookup(struct hash_map *table, void *key)
     return 0;
 }
 
+void *lookup(struct hash_map *table, void *key)
+{
+    table->operations_since_rehash++;
+    if (table->operations_since_rehash > table->probe_limit) {
+        rehash(table);
+    }
+    
+    uint32_t hash_key = key_hash(table, key);
+    uint32_t uhash_key = uhash(table, hash_key);
+    return lookup_hashed(table, hash_key, uhash_key, key);
+}
+
+void lookup_keys(struct hash_map *table,
+                 void **keys, uint32_t n, void **vals)
+{
+    table->operations_since_rehash += n;
+    if (table->operations_since_rehash > table->probe_limit) {
+        rehash(table);
+    }
+    
+    uint32_t hash_keys[HASH_BATCH];
+    uint32_t uhash_keys[HASH_BATCH];
+    for (uint32_t offset = 0; offset < n; offset += HASH_BATCH) {
+        uint32_t m = (n - offset < HASH_BATCH) ? n - offset : HASH_BATCH;
+        for (uint32_t i = 0; i < m; ++i) {
+            hash_keys[i] = key_hash(table, keys[offset + i]);
+        }
+        uhash_n(table, hash_keys, uhash_keys, m);
+        for (uint32_t i = 0; i < m; ++i) {
+            vals[offset + i] = lookup_hashed(table, hash_keys[i], uhash_keys[i],
+                                             keys[offset + i]);
+        }
+    }
+}
+
 
 void delete_key(struct hash_map *table, void *key)
 {
@@ -322,8 +864,8 @@ void delete_key(struct hash_map *table, void *key)
         rehash(table);
     }
     
-    uint32_t hash_key = table->hash(key);
-    uint32_t uhash_key = tabhash(hash_key, table->T);
+    uint32_t hash_key = key_hash(table, key);
+    uint32_t uhash_key = uhash(table, hash_key);
     for (uint32_t i = 0; i < table->size; ++i) {
         uint32_t index = p(uhash_key, i, table->size);
         struct bin * bin = & table->table[index];
@@ -333,6 +875,7 @@ void delete_key(struct hash_map *table, void *key)
         if (!bin->is_deleted && bin->hash_key == hash_key &&
             table->key_cmp(bin->key, key)) {
             bin->is_deleted = true;
+            mark_dirty(table, index);
             table->key_destructor(table->table[index].key);
             table->val_destructor(table->table[index].val);
             table->active--;
@@ -343,3 +886,715 @@ void delete_key(struct hash_map *table, void *key)
     if (table->active < table->size / 8)
         resize(table, table->size / 2);
 }
+
+#pragma mark iteration
+
+void init_cursor(struct cursor *cursor)
+{
+    cursor->index = 0;
+}
+
+bool next_entry(struct hash_map *table, struct cursor *cursor, void **key, void **val)
+{
+    while (cursor->index < table->size) {
+        struct bin *bin = &table->table[cursor->index++];
+        if (bin->is_free || bin->is_deleted) continue;
+        *key = bin->key;
+        *val = bin->val;
+        return true;
+    }
+    return false;
+}
+
+static void for_each_in_range(struct hash_map *table,
+                              uint32_t begin, uint32_t end,
+                              for_each_func f, void *data)
+{
+    for (uint32_t i = begin; i < end; ++i) {
+        struct bin *bin = &table->table[i];
+        if (bin->is_free || bin->is_deleted) continue;
+        f(bin->key, bin->val, data);
+    }
+}
+
+void for_each(struct hash_map *table, for_each_func f, void *data)
+{
+    for_each_in_range(table, 0, table->size, f, data);
+}
+
+struct iteration_thread {
+    struct hash_map *table;
+    uint32_t begin, end;
+    for_each_func f;
+    void *data;
+};
+
+static void *iterate_range(void *arg)
+{
+    struct iteration_thread *t = (struct iteration_thread *)arg;
+    for_each_in_range(t->table, t->begin, t->end, t->f, t->data);
+    return 0;
+}
+
+void for_each_parallel(struct hash_map *table,
+                       for_each_func f, void *data, int no_threads)
+{
+    if (no_threads < 1) no_threads = 1;
+    pthread_t threads[no_threads];
+    struct iteration_thread args[no_threads];
+    for (int i = 0; i < no_threads; ++i) {
+        args[i].table = table;
+        args[i].begin = range_begin(table->size, no_threads, i);
+        args[i].end = range_begin(table->size, no_threads, i + 1);
+        args[i].f = f;
+        args[i].data = data;
+        pthread_create(&threads[i], 0, iterate_range, &args[i]);
+    }
+    for (int i = 0; i < no_threads; ++i) {
+        pthread_join(threads[i], 0);
+    }
+}
+
+#pragma mark snapshots
+
+#define SNAPSHOT_MAGIC "LPUMSNAP"
+#define SNAPSHOT_VERSION 2
+#define SNAPSHOT_BYTE_ORDER 0x01020304
+
+// A snapshot file is this header, then the bins, the tabulation
+// table, the key-bytes coefficients, and the blob of key and value
+// bytes.
+struct snapshot_header {
+    char magic[8];
+    uint32_t version;
+    uint32_t byte_order;
+    uint32_t size;   // number of bins
+    uint32_t active; // number of keys
+    uint32_t family;
+    uint32_t no_coefs;
+    uint64_t a, b;
+    uint64_t bins_offset;
+    uint64_t T_offset, T_bytes;
+    uint64_t coefs_offset;
+    uint64_t blob_offset;
+    uint64_t blob_bytes;
+    uint64_t sequence; // counts snapshots and deltas
+};
+
+enum snapshot_state {
+    SNAPSHOT_FREE,
+    SNAPSHOT_DELETED,
+    SNAPSHOT_ACTIVE
+};
+
+struct snapshot_bin {
+    uint32_t hash_key;
+    uint32_t state;
+    uint32_t key_len;
+    uint32_t val_len;
+    uint64_t key_offset; // from the start of the blob
+    uint64_t val_offset;
+};
+
+struct snapshot {
+    void *data;
+    size_t bytes;
+    const struct snapshot_header *header;
+    const struct snapshot_bin *bins;
+    const uint8_t *blob;
+    hash_func hash;
+    key_view_func key_view;
+    // A table with no bins that holds the hash function, with T
+    // and the coefficients pointing into the mapped file.
+    struct hash_map hashing;
+};
+
+// Keys and values start at multiples of eight in the blob, so
+// values can be read as structs in place.
+static uint64_t align8(uint64_t x)
+{
+    return (x + 7) & ~(uint64_t)7;
+}
+
+static bool write_padded(FILE *file, const void *bytes, uint64_t len)
+{
+    static const uint8_t zeros[8];
+    uint64_t padding = align8(len) - len;
+    return fwrite(bytes, 1, len, file) == len &&
+           fwrite(zeros, 1, padding, file) == padding;
+}
+
+// The snapshot bin for bin. Keys and values go at offset in the blob,
+// and we move offset past them.
+static void snapshot_bin(struct bin *bin, struct snapshot_bin *out,
+                         uint64_t *offset,
+                         key_view_func key_view, key_view_func val_view)
+{
+    const void *bytes;
+    memset(out, 0, sizeof(*out));
+    if (bin->is_free) {
+        out->state = SNAPSHOT_FREE;
+    } else if (bin->is_deleted) {
+        // Lookups must still probe past deleted bins
+        out->state = SNAPSHOT_DELETED;
+    } else {
+        out->state = SNAPSHOT_ACTIVE;
+        out->hash_key = bin->hash_key;
+        key_view(bin->key, &bytes, &out->key_len);
+        val_view(bin->val, &bytes, &out->val_len);
+        out->key_offset = *offset;
+        *offset += align8(out->key_len);
+        out->val_offset = *offset;
+        *offset += align8(out->val_len);
+    }
+}
+
+// Writes a snapshot at the current position in file. The offsets in
+// the header are from the start of the snapshot, so we can also put
+// snapshots inside other files.
+static bool write_snapshot_to(struct hash_map *table, FILE *file,
+                              key_view_func key_view, key_view_func val_view,
+                              uint64_t sequence)
+{
+    long start = ftell(file);
+    if (start < 0) return false;
+
+    struct snapshot_header header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic));
+    header.version = SNAPSHOT_VERSION;
+    header.byte_order = SNAPSHOT_BYTE_ORDER;
+    header.size = table->size;
+    header.active = table->active;
+    header.family = table->family;
+    header.no_coefs = table->no_coefs;
+    header.a = table->a;
+    header.b = table->b;
+    header.bins_offset = sizeof(header);
+    header.T_offset =
+    header.bins_offset + (uint64_t)table->size * sizeof(struct snapshot_bin);
+    header.T_bytes = table->T_end - table->T;
+    header.coefs_offset = header.T_offset + align8(header.T_bytes);
+    header.blob_offset =
+    header.coefs_offset + (uint64_t)table->no_coefs * sizeof(uint64_t);
+    header.sequence = sequence;
+    bool ok = fwrite(&header, sizeof(header), 1, file) == 1;
+
+    // The bins, with the offsets their keys and values will get
+    const void *bytes;
+    uint64_t offset = 0;
+    for (uint32_t i = 0; ok && i < table->size; ++i) {
+        struct snapshot_bin out;
+        snapshot_bin(table->table + i, &out, &offset, key_view, val_view);
+        ok = fwrite(&out, sizeof(out), 1, file) == 1;
+    }
+
+    // The hash function
+    if (table->T)
+        ok = ok && write_padded(file, table->T, header.T_bytes);
+    if (table->coefs)
+        ok = ok && write_padded(file, table->coefs,
+                                table->no_coefs * sizeof(uint64_t));
+
+    // Then the keys and values, in the same order as the bins
+    uint32_t len;
+    for (uint32_t i = 0; ok && i < table->size; ++i) {
+        struct bin *bin = &table->table[i];
+        if (bin->is_free || bin->is_deleted) continue;
+        key_view(bin->key, &bytes, &len);
+        ok = write_padded(file, bytes, len);
+        val_view(bin->val, &bytes, &len);
+        ok = ok && write_padded(file, bytes, len);
+    }
+
+    header.blob_bytes = offset;
+    return ok && fseek(file, start, SEEK_SET) == 0 &&
+           fwrite(&header, sizeof(header), 1, file) == 1 &&
+           fseek(file, 0, SEEK_END) == 0;
+}
+
+// From now on, deltas hold the bins that change after this snapshot
+static void start_tracking(struct hash_map *table, uint64_t sequence)
+{
+    size_t bytes = no_dirty_words(table->size) * sizeof(uint64_t);
+    if (table->dirty)
+        memset(table->dirty, 0, bytes);
+    else
+        table->dirty = (uint64_t *)calloc(1, bytes);
+    table->all_dirty = false;
+    table->snapshot_sequence = sequence;
+}
+
+// We write new snapshots next to the old ones, as path.tmp, and
+// rename them when they are on disk.
+static char *tmp_path_for(const char *path)
+{
+    size_t path_len = strlen(path);
+    char *tmp_path = (char *)malloc(path_len + 5);
+    memcpy(tmp_path, path, path_len);
+    memcpy(tmp_path + path_len, ".tmp", 5);
+    return tmp_path;
+}
+
+// A rename is only durable once the directory it is in is synced
+static bool sync_dir_of(const char *path)
+{
+    const char *slash = strrchr(path, '/');
+    size_t dir_len = !slash ? 0 : slash == path ? 1 : (size_t)(slash - path);
+    char *dir = (char *)malloc(dir_len + 2);
+    if (dir_len) memcpy(dir, path, dir_len);
+    else dir[dir_len++] = '.';
+    dir[dir_len] = '\0';
+    int fd = open(dir, O_RDONLY);
+    free(dir);
+    if (fd < 0) return false;
+    bool ok = fsync(fd) == 0;
+    close(fd);
+    return ok;
+}
+
+// The snapshot at path is always either the old one or the new one,
+// even if we crash while we write.
+bool write_snapshot(struct hash_map *table, const char *path,
+                    key_view_func key_view, key_view_func val_view)
+{
+    char *tmp_path = tmp_path_for(path);
+    FILE *file = fopen(tmp_path, "wb");
+    if (!file) {
+        free(tmp_path);
+        return false;
+    }
+    setvbuf(file, 0, _IOFBF, 1 << 20);
+    uint64_t sequence = table->snapshot_sequence + 1;
+    bool ok = write_snapshot_to(table, file, key_view, val_view, sequence) &&
+              fflush(file) == 0 && fsync(fileno(file)) == 0;
+    if (fclose(file) != 0) ok = false;
+    ok = ok && rename(tmp_path, path) == 0;
+    if (!ok) unlink(tmp_path);
+    free(tmp_path);
+    ok = ok && sync_dir_of(path);
+    if (ok) start_tracking(table, sequence);
+    return ok;
+}
+
+static bool valid_header(const struct snapshot_header *header, uint64_t bytes)
+{
+    uint64_t T_bytes = header->family == UNIVERSAL_TABULATION ? 4 * 256 * 4 : 0;
+    return memcmp(header->magic, SNAPSHOT_MAGIC, sizeof(header->magic)) == 0 &&
+           header->version == SNAPSHOT_VERSION &&
+           header->byte_order == SNAPSHOT_BYTE_ORDER &&
+           header->family <= UNIVERSAL_KEY_BYTES &&
+           header->size && (header->size & (header->size - 1)) == 0 &&
+           header->bins_offset >= sizeof(struct snapshot_header) &&
+           header->bins_offset + (uint64_t)header->size * sizeof(struct snapshot_bin)
+               <= header->T_offset &&
+           header->T_bytes == T_bytes && header->T_offset % 8 == 0 &&
+           header->T_offset + T_bytes <= header->coefs_offset &&
+           header->coefs_offset % 8 == 0 &&
+           header->coefs_offset + (uint64_t)header->no_coefs * sizeof(uint64_t)
+               <= header->blob_offset &&
+           header->blob_offset <= bytes &&
+           header->blob_bytes <= bytes - header->blob_offset;
+}
+
+struct snapshot *open_snapshot(const char *path,
+                               hash_func hash, key_view_func key_view)
+{
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) return 0;
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size < sizeof(struct snapshot_header)) {
+        close(fd);
+        return 0;
+    }
+    void *data = mmap(0, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd); // the mapping keeps the file open
+    if (data == MAP_FAILED) return 0;
+
+    const struct snapshot_header *header = (const struct snapshot_header *)data;
+    if (!valid_header(header, st.st_size)) {
+        munmap(data, st.st_size);
+        return 0;
+    }
+    // Lookups jump around in the bins, so reading ahead does not help
+    madvise(data, st.st_size, MADV_RANDOM);
+
+    struct snapshot *snapshot = (struct snapshot *)malloc(sizeof(struct snapshot));
+    snapshot->data = data;
+    snapshot->bytes = st.st_size;
+    snapshot->header = header;
+    snapshot->bins =
+    (const struct snapshot_bin *)((const uint8_t *)data + header->bins_offset);
+    snapshot->blob = (const uint8_t *)data + header->blob_offset;
+    snapshot->hash = hash;
+    snapshot->key_view = key_view;
+
+    // We never write through these pointers; the mapping is read-only.
+    memset(&snapshot->hashing, 0, sizeof(snapshot->hashing));
+    snapshot->hashing.family = header->family;
+    snapshot->hashing.a = header->a;
+    snapshot->hashing.b = header->b;
+    if (header->T_bytes) {
+        snapshot->hashing.T = (uint8_t *)data + header->T_offset;
+        snapshot->hashing.T_end = snapshot->hashing.T + header->T_bytes;
+    }
+    snapshot->hashing.coefs = (uint64_t *)((uint8_t *)data + header->coefs_offset);
+    snapshot->hashing.no_coefs = header->no_coefs;
+    return snapshot;
+}
+
+void close_snapshot(struct snapshot *snapshot)
+{
+    munmap(snapshot->data, snapshot->bytes);
+    free(snapshot);
+}
+
+uint32_t snapshot_size(struct snapshot *snapshot)
+{
+    return snapshot->header->active;
+}
+
+// We only check the offsets in the bins we look at, so opening a
+// snapshot does not have to read all of it.
+static bool in_blob(struct snapshot *snapshot, uint64_t offset, uint32_t len)
+{
+    uint64_t blob_bytes = snapshot->header->blob_bytes;
+    return offset <= blob_bytes && len <= blob_bytes - offset;
+}
+
+bool snapshot_lookup(struct snapshot *snapshot, void *key,
+                     const void **val, uint32_t *val_len)
+{
+    uint32_t size = snapshot->header->size;
+    const void *bytes; uint32_t len;
+    snapshot->key_view(key, &bytes, &len);
+
+    uint32_t hash_key;
+    if (snapshot->hashing.family == UNIVERSAL_KEY_BYTES) {
+        // The table drew coefficients for the longest key it hashed,
+        // so a key that needs more cannot be in the snapshot (and we
+        // cannot grow the coefficients in the mapped file).
+        if ((len + 3) / 4 + 2 > snapshot->hashing.no_coefs)
+            return false;
+        hash_key = multilinear(&snapshot->hashing, (const uint8_t *)bytes, len);
+    } else {
+        hash_key = snapshot->hash(key);
+    }
+    uint32_t uhash_key = uhash(&snapshot->hashing, hash_key);
+
+    for (uint32_t i = 0; i < size; ++i) {
+        const struct snapshot_bin *bin = &snapshot->bins[p(uhash_key, i, size)];
+        if (bin->state == SNAPSHOT_FREE)
+            return false;
+        if (bin->state == SNAPSHOT_ACTIVE && bin->hash_key == hash_key &&
+            bin->key_len == len && in_blob(snapshot, bin->key_offset, len) &&
+            memcmp(snapshot->blob + bin->key_offset, bytes, len) == 0) {
+            if (!in_blob(snapshot, bin->val_offset, bin->val_len))
+                return false;
+            *val = snapshot->blob + bin->val_offset;
+            *val_len = bin->val_len;
+            return true;
+        }
+    }
+    return false;
+}
+
+#pragma mark deltas
+
+#define DELTA_MAGIC "LPUMDLTA"
+
+// A delta file is this header, then the indices of the pages it
+// holds, then their bins, then a blob with the keys and values in
+// those bins. A full delta is this header followed by a snapshot.
+struct delta_header {
+    char magic[8];
+    uint32_t version;
+    uint32_t byte_order;
+    uint32_t size;   // number of bins in the table
+    uint32_t active; // number of keys in the table
+    uint32_t full;
+    uint32_t no_pages;
+    uint64_t base_sequence; // the snapshot or delta this one follows
+    uint64_t sequence;
+    uint64_t pages_offset;
+    uint64_t bins_offset;
+    uint64_t blob_offset;
+    uint64_t blob_bytes;
+};
+
+static uint32_t page_bins(uint32_t size, uint32_t page)
+{
+    uint32_t first = page * DIRTY_PAGE_BINS;
+    return size - first < DIRTY_PAGE_BINS ? size - first : DIRTY_PAGE_BINS;
+}
+
+static bool write_full_delta(struct hash_map *table, FILE *file,
+                             struct delta_header *header,
+                             key_view_func key_view, key_view_func val_view)
+{
+    header->full = 1;
+    header->blob_offset = sizeof(*header);
+    return fwrite(header, sizeof(*header), 1, file) == 1 &&
+           write_snapshot_to(table, file, key_view, val_view, header->sequence);
+}
+
+static bool write_pages(struct hash_map *table, FILE *file,
+                        struct delta_header *header,
+                        key_view_func key_view, key_view_func val_view)
+{
+    uint32_t no_pages = (table->size + DIRTY_PAGE_BINS - 1) / DIRTY_PAGE_BINS;
+    uint32_t *pages = (uint32_t *)malloc(no_pages * sizeof(uint32_t));
+    for (uint32_t page = 0; page < no_pages; ++page) {
+        if (table->dirty[page / 64] & ((uint64_t)1 << (page % 64)))
+            pages[header->no_pages++] = page;
+    }
+    header->pages_offset = sizeof(*header);
+    header->bins_offset =
+    align8(header->pages_offset + (uint64_t)header->no_pages * sizeof(uint32_t));
+    uint64_t no_bins = 0;
+    for (uint32_t i = 0; i < header->no_pages; ++i) {
+        no_bins += page_bins(table->size, pages[i]);
+    }
+    header->blob_offset = header->bins_offset + no_bins * sizeof(struct snapshot_bin);
+
+    static const uint8_t zeros[8];
+    size_t padding = header->bins_offset - header->pages_offset -
+                     header->no_pages * sizeof(uint32_t);
+    bool ok = fwrite(header, sizeof(*header), 1, file) == 1 &&
+              fwrite(pages, sizeof(uint32_t), header->no_pages, file) == header->no_pages &&
+              fwrite(zeros, 1, padding, file) == padding;
+
+    // The bins, with offsets into the delta's blob
+    uint64_t offset = 0;
+    for (uint32_t i = 0; ok && i < header->no_pages; ++i) {
+        struct bin *bins = table->table + pages[i] * DIRTY_PAGE_BINS;
+        for (uint32_t j = 0; ok && j < page_bins(table->size, pages[i]); ++j) {
+            struct snapshot_bin out;
+            snapshot_bin(bins + j, &out, &offset, key_view, val_view);
+            ok = fwrite(&out, sizeof(out), 1, file) == 1;
+        }
+    }
+
+    const void *bytes; uint32_t len;
+    for (uint32_t i = 0; ok && i < header->no_pages; ++i) {
+        struct bin *bins = table->table + pages[i] * DIRTY_PAGE_BINS;
+        for (uint32_t j = 0; ok && j < page_bins(table->size, pages[i]); ++j) {
+            struct bin *bin = bins + j;
+            if (bin->is_free || bin->is_deleted) continue;
+            key_view(bin->key, &bytes, &len);
+            ok = write_padded(file, bytes, len);
+            val_view(bin->val, &bytes, &len);
+            ok = ok && write_padded(file, bytes, len);
+        }
+    }
+    free(pages);
+
+    header->blob_bytes = offset;
+    return ok && fseek(file, 0, SEEK_SET) == 0 &&
+           fwrite(header, sizeof(*header), 1, file) == 1;
+}
+
+bool write_delta(struct hash_map *table, const char *path,
+                 key_view_func key_view, key_view_func val_view)
+{
+    // A delta must follow a snapshot
+    if (!table->dirty) return false;
+
+    // Like snapshots, deltas are written next to path and renamed, so
+    // a crash never leaves a torn delta, and we only forget the dirty
+    // pages once the delta is on disk.
+    char *tmp_path = tmp_path_for(path);
+    FILE *file = fopen(tmp_path, "wb");
+    if (!file) {
+        free(tmp_path);
+        return false;
+    }
+    setvbuf(file, 0, _IOFBF, 1 << 20);
+
+    struct delta_header header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, DELTA_MAGIC, sizeof(header.magic));
+    header.version = SNAPSHOT_VERSION;
+    header.byte_order = SNAPSHOT_BYTE_ORDER;
+    header.size = table->size;
+    header.active = table->active;
+    header.base_sequence = table->snapshot_sequence;
+    header.sequence = table->snapshot_sequence + 1;
+
+    bool ok = table->all_dirty ?
+    write_full_delta(table, file, &header, key_view, val_view) :
+    write_pages(table, file, &header, key_view, val_view);
+    ok = ok && fflush(file) == 0 && fsync(fileno(file)) == 0;
+    if (fclose(file) != 0) ok = false;
+    ok = ok && rename(tmp_path, path) == 0;
+    if (!ok) unlink(tmp_path);
+    free(tmp_path);
+    ok = ok && sync_dir_of(path);
+    if (ok) start_tracking(table, header.sequence);
+    return ok;
+}
+
+static bool valid_delta(const struct delta_header *header, uint64_t bytes)
+{
+    if (memcmp(header->magic, DELTA_MAGIC, sizeof(header->magic)) != 0 ||
+        header->version != SNAPSHOT_VERSION ||
+        header->byte_order != SNAPSHOT_BYTE_ORDER ||
+        header->sequence != header->base_sequence + 1 ||
+        header->blob_offset < sizeof(struct delta_header) ||
+        header->blob_offset > bytes)
+        return false;
+    if (header->full) return true;
+    uint32_t no_pages = (header->size + DIRTY_PAGE_BINS - 1) / DIRTY_PAGE_BINS;
+    return header->no_pages <= no_pages &&
+           header->pages_offset >= sizeof(struct delta_header) &&
+           header->pages_offset + (uint64_t)header->no_pages * sizeof(uint32_t)
+               <= header->bins_offset &&
+           header->bins_offset <= header->blob_offset &&
+           header->blob_bytes <= bytes - header->blob_offset;
+}
+
+static bool write_all(int fd, const void *bytes, size_t len, uint64_t offset)
+{
+    while (len > 0) {
+        ssize_t written = pwrite(fd, bytes, len, offset);
+        if (written < 0 && errno == EINTR) continue;
+        if (written <= 0) return false;
+        bytes = (const uint8_t *)bytes + written;
+        len -= written;
+        offset += written;
+    }
+    return true;
+}
+
+// The delta replaces the whole snapshot. We write it next to the old
+// one and rename it, so the snapshot is always either old or new.
+static bool apply_full_delta(const char *snapshot_path,
+                             const uint8_t *delta, uint64_t bytes)
+{
+    const struct delta_header *header = (const struct delta_header *)delta;
+    const struct snapshot_header *snapshot =
+    (const struct snapshot_header *)(delta + header->blob_offset);
+    uint64_t snapshot_bytes = bytes - header->blob_offset;
+    if (snapshot_bytes < sizeof(struct snapshot_header) ||
+        !valid_header(snapshot, snapshot_bytes) ||
+        snapshot->sequence != header->sequence)
+        return false;
+
+    char *tmp_path = tmp_path_for(snapshot_path);
+    int fd = open(tmp_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    bool ok = fd >= 0 && write_all(fd, snapshot, snapshot_bytes, 0) &&
+              fsync(fd) == 0;
+    if (fd >= 0 && close(fd) != 0) ok = false;
+    ok = ok && rename(tmp_path, snapshot_path) == 0;
+    if (!ok) unlink(tmp_path);
+    free(tmp_path);
+    return ok && sync_dir_of(snapshot_path);
+}
+
+// Checks that the pages are in the table, and that their bins are in
+// the delta and point into its blob.
+static bool valid_pages(const uint8_t *delta)
+{
+    const struct delta_header *header = (const struct delta_header *)delta;
+    const uint32_t *pages = (const uint32_t *)(delta + header->pages_offset);
+    const struct snapshot_bin *bins =
+    (const struct snapshot_bin *)(delta + header->bins_offset);
+    const struct snapshot_bin *bins_end =
+    (const struct snapshot_bin *)(delta + header->blob_offset);
+    for (uint32_t i = 0; i < header->no_pages; ++i) {
+        if ((uint64_t)pages[i] * DIRTY_PAGE_BINS >= header->size) return false;
+        uint32_t no_bins = page_bins(header->size, pages[i]);
+        if (bins_end - bins < no_bins) return false;
+        for (uint32_t j = 0; j < no_bins; ++j) {
+            if (bins[j].state != SNAPSHOT_ACTIVE) continue;
+            if (bins[j].key_offset > header->blob_bytes ||
+                bins[j].key_len > header->blob_bytes - bins[j].key_offset ||
+                bins[j].val_offset > header->blob_bytes ||
+                bins[j].val_len > header->blob_bytes - bins[j].val_offset)
+                return false;
+        }
+        bins += no_bins;
+    }
+    return true;
+}
+
+// We check the whole delta before we write anything, so a delta we
+// reject leaves the snapshot as it was. Then we append the delta's
+// blob to the snapshot's, write the pages with their offsets moved
+// past the old blob, and the header last. Until the header is
+// written, the snapshot still has the old blob size and sequence, so
+// running this again gives the same result.
+static bool apply_pages(int fd, struct snapshot_header *snapshot,
+                        const uint8_t *delta)
+{
+    const struct delta_header *header = (const struct delta_header *)delta;
+    if (header->size != snapshot->size || !valid_pages(delta)) return false;
+    uint64_t old_blob_bytes = snapshot->blob_bytes;
+    if (!write_all(fd, delta + header->blob_offset, header->blob_bytes,
+                   snapshot->blob_offset + old_blob_bytes) ||
+        fsync(fd) != 0)
+        return false;
+
+    const uint32_t *pages = (const uint32_t *)(delta + header->pages_offset);
+    const struct snapshot_bin *bins =
+    (const struct snapshot_bin *)(delta + header->bins_offset);
+    struct snapshot_bin page[DIRTY_PAGE_BINS];
+    for (uint32_t i = 0; i < header->no_pages; ++i) {
+        uint32_t no_bins = page_bins(header->size, pages[i]);
+        for (uint32_t j = 0; j < no_bins; ++j) {
+            page[j] = bins[j];
+            if (page[j].state != SNAPSHOT_ACTIVE) continue;
+            page[j].key_offset += old_blob_bytes;
+            page[j].val_offset += old_blob_bytes;
+        }
+        uint64_t offset = snapshot->bins_offset +
+        (uint64_t)pages[i] * DIRTY_PAGE_BINS * sizeof(struct snapshot_bin);
+        if (!write_all(fd, page, no_bins * sizeof(struct snapshot_bin), offset))
+            return false;
+        bins += no_bins;
+    }
+    if (fsync(fd) != 0) return false;
+
+    snapshot->active = header->active;
+    snapshot->blob_bytes = old_blob_bytes + header->blob_bytes;
+    snapshot->sequence = header->sequence;
+    return write_all(fd, snapshot, sizeof(*snapshot), 0) && fsync(fd) == 0;
+}
+
+bool apply_delta(const char *snapshot_path, const char *delta_path)
+{
+    int delta_fd = open(delta_path, O_RDONLY);
+    if (delta_fd < 0) return false;
+    struct stat st;
+    if (fstat(delta_fd, &st) != 0 || st.st_size < sizeof(struct delta_header)) {
+        close(delta_fd);
+        return false;
+    }
+    void *delta = mmap(0, st.st_size, PROT_READ, MAP_SHARED, delta_fd, 0);
+    close(delta_fd);
+    if (delta == MAP_FAILED) return false;
+    uint64_t delta_bytes = st.st_size;
+    const struct delta_header *header = (const struct delta_header *)delta;
+
+    bool ok = false;
+    struct snapshot_header snapshot;
+    int fd = open(snapshot_path, O_RDWR);
+    if (fd < 0 || !valid_delta(header, delta_bytes) ||
+        fstat(fd, &st) != 0 ||
+        pread(fd, &snapshot, sizeof(snapshot), 0) != sizeof(snapshot) ||
+        !valid_header(&snapshot, st.st_size)) {
+        // not something we can apply
+    } else if (snapshot.sequence >= header->sequence) {
+        ok = true; // already applied
+    } else if (snapshot.sequence != header->base_sequence) {
+        // the delta does not follow this snapshot
+    } else if (header->full) {
+        ok = apply_full_delta(snapshot_path, (const uint8_t *)delta, delta_bytes);
+    } else {
+        ok = apply_pages(fd, &snapshot, (const uint8_t *)delta);
+    }
+
+    if (fd >= 0) close(fd);
+    munmap(delta, delta_bytes);
+    return ok;
+}
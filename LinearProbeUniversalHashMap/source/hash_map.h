@@ -15,6 +15,24 @@
 typedef uint32_t (*hash_func)(void *);
 typedef void (*destructor_func)(void *);
 typedef bool (*compare_func)(void *, void *);
+typedef void (*for_each_func)(void *key, void *val, void *data);
+// Gives the table the bytes of a key, for hashing the key bytes
+// instead of a 32-bit pre-hash.
+typedef void (*key_view_func)(void *key, const void **bytes, uint32_t *len);
+
+enum universal_family {
+    UNIVERSAL_TABULATION,     // tabulation hashing, 4 KB table per hash table
+    UNIVERSAL_MULTIPLY_SHIFT, // multiply-add-shift, no table
+    UNIVERSAL_KEY_BYTES       // multilinear hashing of the key bytes
+};
+
+// How the constructors from arrays handle keys that appear more
+// than once.
+enum duplicate_keys {
+    UNIQUE_KEYS,    // there are none; we do not check
+    KEEP_FIRST_KEY, // later copies are destroyed
+    KEEP_LAST_KEY   // earlier copies are destroyed, as with map()
+};
 
 struct hash_map {
     struct bin *table;
@@ -27,12 +45,27 @@ struct hash_map {
     destructor_func key_destructor;
     destructor_func val_destructor;
     
-    // For tabulation hashing.
-    uint8_t *T, *T_end;
+    // The universal family and the current function from it.
+    enum universal_family family;
+    uint8_t *T, *T_end;  // tabulation hashing
+    uint64_t a, b;       // multiply-shift hashing
+    uint64_t *coefs;     // key-bytes hashing
+    uint32_t no_coefs;
+    key_view_func key_view;
+    uint64_t rng_state;
     
     float rehash_factor;
     unsigned int probe_limit;
     unsigned int operations_since_rehash;
+    
+    // Threads that move the bins when we resize or rehash large tables
+    int resize_threads;
+    
+    // Pages of bins changed since the last snapshot or delta, once
+    // we have written a snapshot.
+    uint64_t *dirty;
+    bool all_dirty;
+    uint64_t snapshot_sequence;
 };
 
 struct hash_map *
@@ -42,12 +75,105 @@ new_map           (uint32_t size, // Must be a power of two!
                    compare_func key_cmp,
                    destructor_func key_destructor,
                    destructor_func val_destructor);
+// Returns 0 for UNIVERSAL_KEY_BYTES. Use new_map_keyed for that.
+struct hash_map *
+new_map_family    (uint32_t size, // Must be a power of two!
+                   float rehash_factor,
+                   enum universal_family family,
+                   hash_func hash,
+                   compare_func key_cmp,
+                   destructor_func key_destructor,
+                   destructor_func val_destructor);
+// Hashes the bytes of keys with multilinear hashing, so rehashing
+// also breaks up keys that would collide in a 32-bit pre-hash.
+// Returns 0 if key_view is 0.
+struct hash_map *
+new_map_keyed     (uint32_t size, // Must be a power of two!
+                   float rehash_factor,
+                   key_view_func key_view,
+                   compare_func key_cmp,
+                   destructor_func key_destructor,
+                   destructor_func val_destructor);
+// Builds a map of keys[i] to vals[i] for i < n, large enough that it
+// does not resize. no_threads threads fill the bins.
+struct hash_map *
+new_map_from_arrays(uint32_t n, void **keys, void **vals,
+                    enum duplicate_keys duplicates,
+                    int no_threads,
+                    float rehash_factor,
+                    hash_func hash,
+                    compare_func key_cmp,
+                    destructor_func key_destructor,
+                    destructor_func val_destructor);
 void  delete_map  (struct hash_map *table);
+// Grows the table so it holds n keys without resizing, moving the
+// bins with no_threads threads.
+void  reserve_parallel(struct hash_map *table, uint32_t n, int no_threads);
 
 void  map          (struct hash_map *table,
                     void *key, void *val);
 void *lookup       (struct hash_map *table, void *key);
+// Looks up n keys at a time and puts the values in vals.
+void  lookup_keys  (struct hash_map *table,
+                    void **keys, uint32_t n, void **vals);
 bool  contains_key (struct hash_map *table, void *key);
 void  delete_key   (struct hash_map *table, void *key);
 
+// Iteration. The table must not change while you iterate over it,
+// and since lookups can rehash, you cannot look up keys either.
+struct cursor {
+    uint32_t index;
+};
+void  init_cursor  (struct cursor *cursor);
+bool  next_entry   (struct hash_map *table, struct cursor *cursor,
+                    void **key, void **val);
+void  for_each     (struct hash_map *table, for_each_func f, void *data);
+// Splits the bins into no_threads ranges and calls f from
+// no_threads threads at the same time.
+void  for_each_parallel(struct hash_map *table,
+                        for_each_func f, void *data, int no_threads);
+
+// Snapshots. write_snapshot() writes the bins, with their hash keys,
+// and the table's current hash function (including the tabulation
+// table) to a file. The bytes of keys and values go to a region after
+// the bins, and the bins refer to them by offsets. open_snapshot()
+// maps such a file read-only, so we can look keys up without loading
+// the table; the pages are only read as lookups touch them. Snapshots
+// use the byte order of the machine that wrote them. Lookups hash keys
+// with hash (or, for UNIVERSAL_KEY_BYTES tables, the bytes key_view
+// gives them), so hash must be the table's pre-hash function.
+// write_snapshot() writes to path.tmp and renames it over path once
+// it is synced, so a crash leaves the old snapshot in place.
+bool  write_snapshot(struct hash_map *table, const char *path,
+                     key_view_func key_view, key_view_func val_view);
+
+struct snapshot;
+// Returns null if the file is not a snapshot we can read.
+struct snapshot *
+open_snapshot      (const char *path,
+                    hash_func hash, key_view_func key_view);
+void  close_snapshot(struct snapshot *snapshot);
+uint32_t snapshot_size(struct snapshot *snapshot); // number of keys
+// Points val at the bytes of the key's value in the mapped file.
+bool  snapshot_lookup(struct snapshot *snapshot, void *key,
+                      const void **val, uint32_t *val_len);
+
+// Deltas. Once a table has written a snapshot, it keeps track of the
+// pages of bins that change. write_delta() writes only those pages,
+// with their keys and values, and apply_delta() updates a snapshot
+// file with them, in place. Deltas must be applied in the order they
+// were written, to the snapshot they follow. Resizing and rehashing
+// move all the bins, and longer keys can add coefficients to the
+// hash function, so after those the delta holds a full snapshot.
+// Like snapshots, deltas are written to path.tmp and renamed once
+// they are synced.
+//
+// apply_delta() only appends to the snapshot's blob, so the blob
+// keeps the bytes of old keys and values until you write a new full
+// snapshot. If it is interrupted, you can run it again. Do not apply
+// deltas to a snapshot that is open.
+bool  write_delta  (struct hash_map *table, const char *path,
+                    key_view_func key_view, key_view_func val_view);
+bool  apply_delta  (const char *snapshot_path, const char *delta_path);
+
 #endif /* hash_map_h */
@@ -0,0 +1,233 @@
+//
+//  sharded_map.c
+//  LinearProbeUniversalHashMap
+//
+//  Created by Thomas Mailund on 19/10/2026.
+//  Copyright © 2026 Thomas Mailund. All rights reserved.
+//
+
+#include <stdlib.h>
+#include <stdatomic.h>
+#include "sharded_map.h"
+
+// The shards use the low bits of their own universal hash functions,
+// so we scramble the user's hash with a fixed multiplier before we
+// take the high bits. Otherwise, a poor hash function would put
+// everything in a few shards.
+static uint32_t get_shard(struct sharded_map *table, void *key)
+{
+    if (table->shard_bits == 0) return 0;
+    uint64_t h = (uint64_t)table->hash(key) * 0x9e3779b97f4a7c15;
+    return (uint32_t)(h >> (64 - table->shard_bits));
+}
+
+struct sharded_map *new_sharded_map(uint32_t no_shards,
+                                    uint32_t size,
+                                    float rehash_factor,
+                                    enum universal_family family,
+                                    hash_func hash,
+                                    compare_func key_cmp,
+                                    destructor_func key_destructor,
+                                    destructor_func val_destructor)
+{
+    // The shards are picked by hash, so we need a hash function.
+    if (family == UNIVERSAL_KEY_BYTES) return 0;
+
+    struct sharded_map *table =
+    (struct sharded_map *)malloc(sizeof(struct sharded_map));
+    table->shards =
+    (struct shard *)aligned_alloc(_Alignof(struct shard),
+                                  no_shards * sizeof(struct shard));
+    table->no_shards = no_shards;
+    table->shard_bits = 0;
+    while ((1u << table->shard_bits) < no_shards) table->shard_bits++;
+    table->hash = hash;
+
+    uint32_t shard_size = size / no_shards;
+    if (shard_size == 0) shard_size = 1;
+    for (uint32_t i = 0; i < no_shards; ++i) {
+        pthread_mutex_init(&table->shards[i].lock, 0);
+        table->shards[i].map =
+        new_map_family(shard_size, rehash_factor, family,
+                       hash, key_cmp, key_destructor, val_destructor);
+    }
+
+    return table;
+}
+
+void delete_sharded_map(struct sharded_map *table)
+{
+    for (uint32_t i = 0; i < table->no_shards; ++i) {
+        pthread_mutex_destroy(&table->shards[i].lock);
+        delete_map(table->shards[i].map);
+    }
+    free(table->shards);
+    free(table);
+}
+
+void sharded_map_key(struct sharded_map *table, void *key, void *val)
+{
+    struct shard *shard = &table->shards[get_shard(table, key)];
+    pthread_mutex_lock(&shard->lock);
+    map(shard->map, key, val);
+    pthread_mutex_unlock(&shard->lock);
+}
+
+// Lookups take the lock as well, since a lookup can trigger a rehash.
+void *sharded_lookup(struct sharded_map *table, void *key)
+{
+    struct shard *shard = &table->shards[get_shard(table, key)];
+    pthread_mutex_lock(&shard->lock);
+    void *val = lookup(shard->map, key);
+    pthread_mutex_unlock(&shard->lock);
+    return val;
+}
+
+bool sharded_contains_key(struct sharded_map *table, void *key)
+{
+    struct shard *shard = &table->shards[get_shard(table, key)];
+    pthread_mutex_lock(&shard->lock);
+    bool res = contains_key(shard->map, key);
+    pthread_mutex_unlock(&shard->lock);
+    return res;
+}
+
+void sharded_delete_key(struct sharded_map *table, void *key)
+{
+    struct shard *shard = &table->shards[get_shard(table, key)];
+    pthread_mutex_lock(&shard->lock);
+    delete_key(shard->map, key);
+    pthread_mutex_unlock(&shard->lock);
+}
+
+#pragma mark bulk insertion
+
+// We insert in three passes: count the keys for each shard in each
+// thread's slice of the input, move the keys to their shard's part of
+// a partitioned array, and then insert each part in its shard.
+struct bulk_job {
+    struct sharded_map *table;
+    void **keys, **vals;
+    uint32_t n;
+    int no_threads;
+
+    // no_threads x no_shards; first counts and then offsets
+    uint32_t *offsets;
+    void **part_keys, **part_vals;
+    uint32_t *part_start; // no_shards + 1
+
+    _Atomic uint32_t next_shard;
+};
+
+struct bulk_thread {
+    struct bulk_job *job;
+    int thread;
+};
+
+static void slice(struct bulk_job *job, int thread,
+                  uint32_t *begin, uint32_t *end)
+{
+    *begin = (uint32_t)((uint64_t)job->n * thread / job->no_threads);
+    *end = (uint32_t)((uint64_t)job->n * (thread + 1) / job->no_threads);
+}
+
+static void *count_slice(void *arg)
+{
+    struct bulk_thread *t = (struct bulk_thread *)arg;
+    struct bulk_job *job = t->job;
+    uint32_t *counts = job->offsets + t->thread * job->table->no_shards;
+    uint32_t begin, end;
+    slice(job, t->thread, &begin, &end);
+    for (uint32_t i = begin; i < end; ++i) {
+        counts[get_shard(job->table, job->keys[i])]++;
+    }
+    return 0;
+}
+
+static void *partition_slice(void *arg)
+{
+    struct bulk_thread *t = (struct bulk_thread *)arg;
+    struct bulk_job *job = t->job;
+    uint32_t *offsets = job->offsets + t->thread * job->table->no_shards;
+    uint32_t begin, end;
+    slice(job, t->thread, &begin, &end);
+    for (uint32_t i = begin; i < end; ++i) {
+        uint32_t j = offsets[get_shard(job->table, job->keys[i])]++;
+        job->part_keys[j] = job->keys[i];
+        job->part_vals[j] = job->vals[i];
+    }
+    return 0;
+}
+
+static void *fill_shards(void *arg)
+{
+    struct bulk_thread *t = (struct bulk_thread *)arg;
+    struct bulk_job *job = t->job;
+    uint32_t s;
+    while ((s = atomic_fetch_add(&job->next_shard, 1)) < job->table->no_shards) {
+        struct shard *shard = &job->table->shards[s];
+        pthread_mutex_lock(&shard->lock);
+        for (uint32_t i = job->part_start[s]; i < job->part_start[s + 1]; ++i) {
+            map(shard->map, job->part_keys[i], job->part_vals[i]);
+        }
+        pthread_mutex_unlock(&shard->lock);
+    }
+    return 0;
+}
+
+static void run_threads(struct bulk_job *job, void *(*f)(void *))
+{
+    pthread_t threads[job->no_threads];
+    struct bulk_thread args[job->no_threads];
+    for (int i = 0; i < job->no_threads; ++i) {
+        args[i].job = job;
+        args[i].thread = i;
+        pthread_create(&threads[i], 0, f, &args[i]);
+    }
+    for (int i = 0; i < job->no_threads; ++i) {
+        pthread_join(threads[i], 0);
+    }
+}
+
+void sharded_map_keys(struct sharded_map *table,
+                      void **keys, void **vals, uint32_t n,
+                      int no_threads)
+{
+    if (no_threads < 1) no_threads = 1;
+    uint32_t no_shards = table->no_shards;
+
+    struct bulk_job job;
+    job.table = table;
+    job.keys = keys;
+    job.vals = vals;
+    job.n = n;
+    job.no_threads = no_threads;
+    job.offsets = (uint32_t *)calloc((size_t)no_threads * no_shards, sizeof(uint32_t));
+    job.part_keys = (void **)malloc(n * sizeof(void *));
+    job.part_vals = (void **)malloc(n * sizeof(void *));
+    job.part_start = (uint32_t *)malloc((no_shards + 1) * sizeof(uint32_t));
+    atomic_init(&job.next_shard, 0);
+
+    run_threads(&job, count_slice);
+
+    // Turn the counts into offsets. Within a shard, earlier threads
+    // go first, so the input order is kept.
+    uint32_t offset = 0;
+    for (uint32_t s = 0; s < no_shards; ++s) {
+        job.part_start[s] = offset;
+        for (int t = 0; t < no_threads; ++t) {
+            uint32_t count = job.offsets[t * no_shards + s];
+            job.offsets[t * no_shards + s] = offset;
+            offset += count;
+        }
+    }
+    job.part_start[no_shards] = offset;
+
+    run_threads(&job, partition_slice);
+    run_threads(&job, fill_shards);
+
+    free(job.offsets);
+    free(job.part_keys);
+    free(job.part_vals);
+    free(job.part_start);
+}
@@ -0,0 +1,59 @@
+//
+//  sharded_map.h
+//  LinearProbeUniversalHashMap
+//
+//  Created by Thomas Mailund on 19/10/2026.
+//  Copyright © 2026 Thomas Mailund. All rights reserved.
+//
+
+#ifndef sharded_map_h
+#define sharded_map_h
+
+#include <pthread.h>
+#include "hash_map.h"
+
+// A map split into independent linear probe maps with universal
+// hashing. The high bits of the hash pick the shard, and each shard
+// resizes and rehashes on its own, so a large map never stops
+// everything to rebuild. Each shard has its own lock, so threads can
+// use different shards at the same time.
+
+struct shard {
+    pthread_mutex_t lock;
+    struct hash_map *map;
+} __attribute__((aligned(64)));
+
+struct sharded_map {
+    struct shard *shards;
+    uint32_t no_shards;
+    uint32_t shard_bits;
+    hash_func hash;
+};
+
+// Returns 0 for UNIVERSAL_KEY_BYTES, since shards are picked by hash.
+struct sharded_map *
+new_sharded_map     (uint32_t no_shards, // Must be a power of two!
+                     uint32_t size,      // Must be a power of two!
+                     float rehash_factor,
+                     enum universal_family family,
+                     hash_func hash,
+                     compare_func key_cmp,
+                     destructor_func key_destructor,
+                     destructor_func val_destructor);
+void  delete_sharded_map  (struct sharded_map *table);
+
+void  sharded_map_key     (struct sharded_map *table,
+                           void *key, void *val);
+void *sharded_lookup      (struct sharded_map *table, void *key);
+bool  sharded_contains_key(struct sharded_map *table, void *key);
+void  sharded_delete_key  (struct sharded_map *table, void *key);
+
+// Maps keys[i] to vals[i] for all i < n. The keys are partitioned by
+// shard, and no_threads threads fill the shards. If a key appears
+// more than once, the last one wins, as if you had inserted them one
+// at a time.
+void  sharded_map_keys    (struct sharded_map *table,
+                           void **keys, void **vals, uint32_t n,
+                           int no_threads);
+
+#endif /* sharded_map_h */
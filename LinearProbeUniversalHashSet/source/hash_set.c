@@ -7,34 +7,103 @@
 //
 
 #include <stdlib.h>
+#include <pthread.h>
+#include <string.h>
 #include "hash_set.h"
+#include "tabulation.h"
 
 #pragma mark universal hashing
 
-void tabulation_sample(uint32_t *start, uint32_t *end)
+// multiply-add-shift: the high 32 bits of a*x + b, for random 64-bit
+// a (odd) and b. It needs no table and a single multiplication.
+static uint32_t mulshift(uint32_t x, uint64_t a, uint64_t b)
 {
-    while (start != end)
-        *(start++) = rand();
+    return (uint32_t)((a * x + b) >> 32);
 }
 
-// tabulation hashing, r=4, q=32
-static uint32_t tabhash(uint32_t x, uint8_t *T)
+static uint32_t uhash(struct hash_set *table, uint32_t hash_key)
 {
-    const int r = 4;
-    const uint32_t no_cols = 1 << r;
-    const uint32_t mask = (1 << r) - 1;
-    
-    uint32_t *T_ = (uint32_t*)T;
-    uint32_t y = T_[0 * no_cols + (x & mask)]; x >>= r;
-    y ^= T_[1 * no_cols + (x & mask)]; x >>= r;
-    y ^= T_[2 * no_cols + (x & mask)]; x >>= r;
-    y ^= T_[3 * no_cols + (x & mask)]; x >>= r;
-    y ^= T_[4 * no_cols + (x & mask)]; x >>= r;
-    y ^= T_[5 * no_cols + (x & mask)]; x >>= r;
-    y ^= T_[6 * no_cols + (x & mask)]; x >>= r;
-    y ^= T_[7 * no_cols + (x & mask)];
+    if (table->family == UNIVERSAL_MULTIPLY_SHIFT)
+        return mulshift(hash_key, table->a, table->b);
+    if (table->family == UNIVERSAL_KEY_BYTES)
+        return hash_key;
+    return tabhash_32_r8(hash_key, (const uint32_t *)table->T);
+}
+
+static void uhash_n(struct hash_set *table,
+                    const uint32_t *x, uint32_t *y, uint32_t n)
+{
+    if (table->family == UNIVERSAL_MULTIPLY_SHIFT) {
+        for (uint32_t i = 0; i < n; ++i)
+            y[i] = mulshift(x[i], table->a, table->b);
+    } else if (table->family == UNIVERSAL_KEY_BYTES) {
+        memcpy(y, x, n * sizeof(uint32_t));
+    } else {
+        tabhash_32_r8_n(x, y, n, (const uint32_t *)table->T);
+    }
+}
+
+// Multilinear hashing of the raw key bytes, taken as 32-bit words w_i:
+// the high 32 bits of m_0 + len * m_1 + sum_i m_{i+2} w_i (mod 2^64)
+// for random 64-bit coefficients m. We draw coefficients as longer
+// keys need them.
+static void grow_coefficients(struct hash_set *table, uint32_t n)
+{
+    uint32_t no_coefs = table->no_coefs ? table->no_coefs : 16;
+    while (no_coefs < n) no_coefs *= 2;
+    table->coefs = (uint64_t *)realloc(table->coefs, no_coefs * sizeof(uint64_t));
+    for (uint32_t i = table->no_coefs; i < no_coefs; ++i)
+        table->coefs[i] = tabulation_random(&table->rng_state);
+    table->no_coefs = no_coefs;
+}
+
+static uint32_t multilinear(struct hash_set *table,
+                            const uint8_t *bytes, uint32_t len)
+{
+    uint32_t no_words = (len + 3) / 4;
+    if (no_words + 2 > table->no_coefs)
+        grow_coefficients(table, no_words + 2);
     
-    return y;
+    const uint64_t *m = table->coefs;
+    uint64_t h = m[0] + m[1] * len;
+    uint32_t i = 0, w;
+    for (; i < len / 4; ++i) {
+        memcpy(&w, bytes + 4 * i, 4);
+        h += m[i + 2] * w;
+    }
+    if (len % 4) {
+        w = 0;
+        memcpy(&w, bytes + 4 * i, len % 4);
+        h += m[i + 2] * w;
+    }
+    return (uint32_t)(h >> 32);
+}
+
+// The hash key we store for a key. For the key-bytes family this is
+// already a universal hash, so uhash() leaves it alone.
+static uint32_t key_hash(struct hash_set *table, void *key)
+{
+    if (table->family == UNIVERSAL_KEY_BYTES) {
+        const void *bytes; uint32_t len;
+        table->key_view(key, &bytes, &len);
+        return multilinear(table, (const uint8_t *)bytes, len);
+    }
+    return table->hash(key);
+}
+
+// Samples a new function from the table's family.
+static void sample_hash_function(struct hash_set *table)
+{
+    if (table->family == UNIVERSAL_MULTIPLY_SHIFT) {
+        table->a = tabulation_random(&table->rng_state) | 1;
+        table->b = tabulation_random(&table->rng_state);
+    } else if (table->family == UNIVERSAL_KEY_BYTES) {
+        for (uint32_t i = 0; i < table->no_coefs; ++i)
+            table->coefs[i] = tabulation_random(&table->rng_state);
+    } else {
+        tabulation_sample(&table->rng_state,
+                          (uint32_t*)table->T, (uint32_t*)table->T_end);
+    }
 }
 
 
@@ -61,7 +130,314 @@ static bool contains_key_hashed(struct hash_set *table,
                                 uint32_t hash_key, uint32_t uhash_key,
                                 void *key);
 
-static void resize(struct hash_set *table, uint32_t new_size)
+// Number of keys we hash at a time when we work on batches of keys.
+#define HASH_BATCH 256
+
+#pragma mark parallel migration
+
+// Tables smaller than this are always moved on the calling thread.
+#define PARALLEL_MIN_SIZE (1 << 16)
+
+// A bin on its way to the new bins.
+struct moving_bin {
+    uint32_t hash_key;
+    uint32_t uhash_key;
+    void *key;
+};
+
+// We move bins in parallel in three passes. First, each thread hashes
+// its slice of the sources and counts how many go to each thread's
+// range of the new bins. Then the threads copy their bins to an array
+// ordered by range, and finally each thread inserts the bins for its
+// own range. Threads only write to their own range, so they never
+// conflict. Bins whose probes run past the end of their range are
+// left for the calling thread to insert when the others are done.
+//
+// The sources are either old bins, when we resize or rehash, or
+// an array of keys, when we build a table from an array.
+struct migration {
+    struct hash_set *table;
+    struct bin *old_bins;
+    void **keys;
+    uint32_t n;                       // number of sources
+    enum duplicate_keys duplicates;
+    int no_threads;
+    
+    uint32_t *hash_keys, *uhash_keys; // indexed like the sources
+    uint32_t *offsets;                // no_threads x no_threads
+    uint32_t *range_start;            // no_threads + 1
+    struct moving_bin *moving;
+    
+    // per thread
+    struct moving_bin **deferred;
+    uint32_t *no_deferred;
+    uint32_t *no_inserted;
+};
+
+struct migration_thread {
+    struct migration *migration;
+    int thread;
+};
+
+// The first index in range r when we split size indices into
+// no_threads ranges.
+static uint32_t range_begin(uint32_t size, int no_threads, int r)
+{
+    return (uint32_t)(((uint64_t)size * r + no_threads - 1) / no_threads);
+}
+
+static int destination(struct migration *m, uint32_t uhash_key)
+{
+    uint32_t size = m->table->size;
+    return (int)((uint64_t)p(uhash_key, 0, size) * m->no_threads / size);
+}
+
+static bool is_source(struct migration *m, uint32_t i)
+{
+    return m->keys || !(m->old_bins[i].is_free || m->old_bins[i].is_deleted);
+}
+
+static void *hash_sources(void *arg)
+{
+    struct migration_thread *t = (struct migration_thread *)arg;
+    struct migration *m = t->migration;
+    struct hash_set *table = m->table;
+    uint32_t *counts = m->offsets + t->thread * m->no_threads;
+    
+    uint32_t batch[HASH_BATCH];
+    uint32_t hash_keys[HASH_BATCH];
+    uint32_t uhash_keys[HASH_BATCH];
+    uint32_t i = range_begin(m->n, m->no_threads, t->thread);
+    uint32_t end = range_begin(m->n, m->no_threads, t->thread + 1);
+    while (i < end) {
+        uint32_t n = 0;
+        for (; i < end && n < HASH_BATCH; ++i) {
+            if (!is_source(m, i)) continue;
+            batch[n] = i;
+            if (m->keys) {
+                hash_keys[n++] = key_hash(table, m->keys[i]);
+            } else {
+                struct bin *bin = &m->old_bins[i];
+                hash_keys[n++] = (table->family == UNIVERSAL_KEY_BYTES) ?
+                    key_hash(table, bin->key) : bin->hash_key;
+            }
+        }
+        uhash_n(table, hash_keys, uhash_keys, n);
+        for (uint32_t j = 0; j < n; ++j) {
+            m->hash_keys[batch[j]] = hash_keys[j];
+            m->uhash_keys[batch[j]] = uhash_keys[j];
+            counts[destination(m, uhash_keys[j])]++;
+        }
+    }
+    return 0;
+}
+
+static void *partition_sources(void *arg)
+{
+    struct migration_thread *t = (struct migration_thread *)arg;
+    struct migration *m = t->migration;
+    uint32_t *offsets = m->offsets + t->thread * m->no_threads;
+    
+    uint32_t end = range_begin(m->n, m->no_threads, t->thread + 1);
+    for (uint32_t i = range_begin(m->n, m->no_threads, t->thread); i < end; ++i) {
+        if (!is_source(m, i)) continue;
+        struct moving_bin *moving =
+        &m->moving[offsets[destination(m, m->uhash_keys[i])]++];
+        moving->hash_key = m->hash_keys[i];
+        moving->uhash_key = m->uhash_keys[i];
+        moving->key = m->keys ? m->keys[i] : m->old_bins[i].key;
+    }
+    return 0;
+}
+
+// Puts a moving bin in a bin that is either free or holds the same
+// key. Returns true if the table has one more key.
+static bool place_bin(struct migration *m, struct bin *bin,
+                      struct moving_bin *moving)
+{
+    struct hash_set *table = m->table;
+    if (!bin->is_free) {
+        if (m->duplicates == KEEP_FIRST_KEY) {
+            if (table->destructor) table->destructor(moving->key);
+        } else {
+            if (table->destructor) table->destructor(bin->key);
+            bin->key = moving->key;
+        }
+        return false;
+    }
+    bin->hash_key = moving->hash_key;
+    bin->key = moving->key;
+    bin->is_free = bin->is_deleted = false;
+    return true;
+}
+
+// Is this bin where the moving bin should go, if it doesn't go further?
+static bool bin_stops_probe(struct migration *m, struct bin *bin,
+                            struct moving_bin *moving)
+{
+    return bin->is_free ||
+    (m->duplicates != UNIQUE_KEYS && bin->hash_key == moving->hash_key &&
+     m->table->cmp(bin->key, moving->key));
+}
+
+static void *insert_range(void *arg)
+{
+    struct migration_thread *t = (struct migration_thread *)arg;
+    struct migration *m = t->migration;
+    struct hash_set *table = m->table;
+    uint32_t end = range_begin(table->size, m->no_threads, t->thread + 1);
+    
+    uint32_t no_inserted = 0, no_deferred = 0, deferred_size = 0;
+    struct moving_bin *deferred = 0;
+    for (uint32_t j = m->range_start[t->thread]; j < m->range_start[t->thread + 1]; ++j) {
+        struct moving_bin *moving = &m->moving[j];
+        uint32_t index = p(moving->uhash_key, 0, table->size);
+        while (index < end && !bin_stops_probe(m, &table->table[index], moving))
+            ++index;
+        if (index == end) {
+            if (no_deferred == deferred_size) {
+                deferred_size = deferred_size ? 2 * deferred_size : 16;
+                deferred = (struct moving_bin *)
+                realloc(deferred, deferred_size * sizeof(struct moving_bin));
+            }
+            deferred[no_deferred++] = *moving;
+            continue;
+        }
+        no_inserted += place_bin(m, &table->table[index], moving);
+    }
+    m->deferred[t->thread] = deferred;
+    m->no_deferred[t->thread] = no_deferred;
+    m->no_inserted[t->thread] = no_inserted;
+    return 0;
+}
+
+static void run_migration_threads(struct migration *m, void *(*f)(void *))
+{
+    pthread_t threads[m->no_threads];
+    struct migration_thread args[m->no_threads];
+    for (int i = 0; i < m->no_threads; ++i) {
+        args[i].migration = m;
+        args[i].thread = i;
+        pthread_create(&threads[i], 0, f, &args[i]);
+    }
+    for (int i = 0; i < m->no_threads; ++i) {
+        pthread_join(threads[i], 0);
+    }
+}
+
+// The new bins must be in the table, all free, and the hash function
+// sampled, before we get here.
+static void migrate(struct migration *m)
+{
+    struct hash_set *table = m->table;
+    int no_threads = m->no_threads;
+    m->hash_keys = (uint32_t *)malloc(m->n * sizeof(uint32_t));
+    m->uhash_keys = (uint32_t *)malloc(m->n * sizeof(uint32_t));
+    m->offsets = (uint32_t *)calloc(no_threads * no_threads, sizeof(uint32_t));
+    m->range_start = (uint32_t *)malloc((no_threads + 1) * sizeof(uint32_t));
+    m->deferred = (struct moving_bin **)malloc(no_threads * sizeof(struct moving_bin *));
+    m->no_deferred = (uint32_t *)malloc(no_threads * sizeof(uint32_t));
+    m->no_inserted = (uint32_t *)malloc(no_threads * sizeof(uint32_t));
+    
+    run_migration_threads(m, hash_sources);
+    
+    // Turn counts into offsets. Range r starts where the bins of the
+    // ranges before it end, and within a range the sources keep
+    // their order.
+    uint32_t offset = 0;
+    for (int r = 0; r < no_threads; ++r) {
+        m->range_start[r] = offset;
+        for (int t = 0; t < no_threads; ++t) {
+            uint32_t count = m->offsets[t * no_threads + r];
+            m->offsets[t * no_threads + r] = offset;
+            offset += count;
+        }
+    }
+    m->range_start[no_threads] = offset;
+    m->moving = (struct moving_bin *)malloc(offset * sizeof(struct moving_bin));
+    
+    run_migration_threads(m, partition_sources);
+    run_migration_threads(m, insert_range);
+    
+    // The bins that ran out of their range. All other bins are in
+    // place now, so an ordinary probe finds the right bin.
+    for (int t = 0; t < no_threads; ++t) {
+        for (uint32_t j = 0; j < m->no_deferred[t]; ++j) {
+            struct moving_bin *moving = &m->deferred[t][j];
+            uint32_t i = 0;
+            while (!bin_stops_probe(m, &table->table[p(moving->uhash_key, i, table->size)], moving))
+                ++i;
+            struct bin *bin = &table->table[p(moving->uhash_key, i, table->size)];
+            if (place_bin(m, bin, moving)) {
+                table->active++; table->used++;
+            }
+        }
+        free(m->deferred[t]);
+        table->active += m->no_inserted[t];
+        table->used += m->no_inserted[t];
+    }
+    
+    free(m->hash_keys);
+    free(m->uhash_keys);
+    free(m->offsets);
+    free(m->range_start);
+    free(m->moving);
+    free(m->deferred);
+    free(m->no_deferred);
+    free(m->no_inserted);
+}
+
+static void move_bins_parallel(struct hash_set *table,
+                               struct bin *old_bins, uint32_t old_size,
+                               int no_threads)
+{
+    struct migration m;
+    m.table = table;
+    m.old_bins = old_bins;
+    m.keys = 0;
+    m.n = old_size;
+    m.duplicates = UNIQUE_KEYS;
+    m.no_threads = no_threads;
+    migrate(&m);
+}
+
+// Move the values from the old bins to the new, using the table's
+// insertion function. We compute the new hash keys a batch at a time
+// so tabulation hashing can vectorise them.
+static void move_bins(struct hash_set *table,
+                      struct bin *old_bins, uint32_t old_size,
+                      int no_threads)
+{
+    if (no_threads > 1 && old_size >= PARALLEL_MIN_SIZE) {
+        move_bins_parallel(table, old_bins, old_size, no_threads);
+        return;
+    }
+    
+    struct bin *batch[HASH_BATCH];
+    uint32_t hash_keys[HASH_BATCH];
+    uint32_t uhash_keys[HASH_BATCH];
+    
+    struct bin *bin = old_bins, *end = old_bins + old_size;
+    while (bin != end) {
+        uint32_t n = 0;
+        for (; bin != end && n < HASH_BATCH; ++bin) {
+            if (bin->is_free || bin->is_deleted) continue;
+            batch[n] = bin;
+            // With the key-bytes family the hash key depends on the
+            // function we just sampled.
+            hash_keys[n++] = (table->family == UNIVERSAL_KEY_BYTES) ?
+                key_hash(table, bin->key) : bin->hash_key;
+        }
+        uhash_n(table, hash_keys, uhash_keys, n);
+        for (uint32_t i = 0; i < n; ++i) {
+            insert_key_hashed(table, hash_keys[i], uhash_keys[i],
+                              batch[i]->key);
+        }
+    }
+}
+
+static void resize_parallel(struct hash_set *table, uint32_t new_size,
+                            int no_threads)
 {
     if (new_size == 0) return;
     
@@ -81,26 +457,25 @@ static void resize(struct hash_set *table, uint32_t new_size)
     table->active = table->used = 0;
     
     // Update hash function
-    tabulation_sample((uint32_t*)table->T, (uint32_t*)table->T_end);
+    sample_hash_function(table);
     
     // Update rehash limit
     table->probe_limit = table->rehash_factor * new_size;
     table->operations_since_rehash = 0;
 
     
-    // Move the values from the old bins to the new,
-    // using the table's insertion function
-    end = old_bins + old_size;
-    for (struct bin *bin = old_bins; bin != end; ++bin) {
-        if (bin->is_free || bin->is_deleted) continue;
-        uint32_t uhash_key = tabhash(bin->hash_key, table->T);
-        insert_key_hashed(table, bin->hash_key, uhash_key, bin->key);
-    }
+    // Move the values from the old bins to the new
+    move_bins(table, old_bins, old_size, no_threads);
     
     // Finally, free memory for old bins
     free(old_bins);
 }
 
+static void resize(struct hash_set *table, uint32_t new_size)
+{
+    resize_parallel(table, new_size, table->resize_threads);
+}
+
 static void rehash(struct hash_set *table)
 {
     // Remember the old bins until we have moved them.
@@ -115,33 +490,30 @@ static void rehash(struct hash_set *table)
         bin->is_free = true;
         bin->is_deleted = false;
     }
+    table->active = table->used = 0;
     
     // Update hash function
-    tabulation_sample((uint32_t*)table->T, (uint32_t*)table->T_end);
+    sample_hash_function(table);
     
     // Update rehash limit
     table->probe_limit = table->rehash_factor * table->size;
     table->operations_since_rehash = 0;
     
     
-    // Move the values from the old bins to the new,
-    // using the table's insertion function
-    end = old_bins + old_size;
-    for (struct bin *bin = old_bins; bin != end; ++bin) {
-        if (bin->is_free || bin->is_deleted) continue;
-        uint32_t uhash_key = tabhash(bin->hash_key, table->T);
-        insert_key_hashed(table, bin->hash_key, uhash_key, bin->key);
-    }
+    // Move the values from the old bins to the new
+    move_bins(table, old_bins, old_size, table->resize_threads);
     
     // Finally, free memory for old bins
     free(old_bins);
 }
 
-struct hash_set *new_set(uint32_t size,
-                               float rehash_factor,
-                               hash_func  hash,
-                               compare_func cmp,
-                               destructor_func destructor)
+static struct hash_set *new_table(uint32_t size,
+                                  float rehash_factor,
+                                  enum universal_family family,
+                                  hash_func  hash,
+                                  key_view_func key_view,
+                                  compare_func cmp,
+                                  destructor_func destructor)
 {
     struct hash_set *table =
     (struct hash_set*)malloc(sizeof(struct hash_set));
@@ -158,25 +530,104 @@ struct hash_set *new_set(uint32_t size,
     table->cmp = cmp;
     table->destructor = destructor;
     
-    // setting up tabulation hashing table
-    int p = 32;
-    int r = 4;
-    int q = 32;
-    int no_cols = (1 << r);
-    int t = p / r;
-    int bytes = t * no_cols * q / 8;
-    table->T = malloc(bytes);
-    table->T_end = table->T + bytes;
-    tabulation_sample((uint32_t*)table->T,
-                      (uint32_t*)table->T_end);
+    // setting up the hash function. Only tabulation hashing
+    // needs a table.
+    table->family = family;
+    table->T = table->T_end = 0;
+    table->coefs = 0;
+    table->no_coefs = 0;
+    table->key_view = key_view;
+    if (family == UNIVERSAL_TABULATION) {
+        int p = 32;
+        int r = 8;
+        int q = 32;
+        int no_cols = (1 << r);
+        int t = p / r;
+        int bytes = t * no_cols * q / 8;
+        table->T = malloc(bytes);
+        table->T_end = table->T + bytes;
+    }
+    // We only use rand() to seed the table's own generator, so
+    // srand() still makes the tables reproducible.
+    table->rng_state = ((uint64_t)rand() << 32) ^ (uint64_t)rand();
+    sample_hash_function(table);
     
     table->rehash_factor = rehash_factor;
     table->probe_limit = rehash_factor * size;
     table->operations_since_rehash = 0;
+    table->resize_threads = 1;
 
     return table;
 }
 
+// UNIVERSAL_KEY_BYTES tables need a key_view, so they only come
+// from new_set_keyed.
+struct hash_set *new_set_family(uint32_t size,
+                               float rehash_factor,
+                               enum universal_family family,
+                               hash_func  hash,
+                               compare_func cmp,
+                               destructor_func destructor)
+{
+    if (family == UNIVERSAL_KEY_BYTES) return 0;
+    return new_table(size, rehash_factor, family, hash, 0,
+                     cmp, destructor);
+}
+
+struct hash_set *new_set(uint32_t size,
+                         float rehash_factor,
+                         hash_func hash,
+                         compare_func cmp,
+                         destructor_func destructor)
+{
+    return new_set_family(size, rehash_factor, UNIVERSAL_TABULATION,
+                          hash, cmp, destructor);
+}
+
+struct hash_set *new_set_from_array(uint32_t n, void **keys,
+                                    enum duplicate_keys duplicates,
+                                    int no_threads,
+                                    float rehash_factor,
+                                    hash_func hash,
+                                    compare_func cmp,
+                                    destructor_func destructor)
+{
+    // Make room for all the keys, so we never resize while we fill
+    uint32_t size = 2;
+    while (size / 2 < n) size *= 2;
+    struct hash_set *table = new_set(size, rehash_factor, hash, cmp, destructor);
+    
+    struct migration m;
+    m.table = table;
+    m.old_bins = 0;
+    m.keys = keys;
+    m.n = n;
+    m.duplicates = duplicates;
+    m.no_threads = no_threads < 1 ? 1 : no_threads;
+    migrate(&m);
+    
+    return table;
+}
+
+struct hash_set *new_set_keyed(uint32_t size,
+                               float rehash_factor,
+                               key_view_func key_view,
+                               compare_func cmp,
+                               destructor_func destructor)
+{
+    if (!key_view) return 0;
+    return new_table(size, rehash_factor, UNIVERSAL_KEY_BYTES, 0, key_view,
+                     cmp, destructor);
+}
+
+void reserve_parallel(struct hash_set *table, uint32_t n, int no_threads)
+{
+    uint32_t new_size = table->size;
+    while (new_size / 2 < n) new_size *= 2;
+    if (new_size != table->size)
+        resize_parallel(table, new_size, no_threads);
+}
+
 void delete_set(struct hash_set *table)
 {
     if (table->destructor) {
@@ -188,6 +639,7 @@ void delete_set(struct hash_set *table)
     }
     free(table->table);
     free(table->T);
+    free(table->coefs);
     free(table);
 }
 
@@ -247,8 +699,8 @@ void insert_key(struct hash_set *table, void *key)
         rehash(table);
     }
 
-    uint32_t hash_key = table->hash(key);
-    uint32_t uhash_key = tabhash(hash_key, table->T);
+    uint32_t hash_key = key_hash(table, key);
+    uint32_t uhash_key = uhash(table, hash_key);
     insert_key_hashed(table, hash_key, uhash_key, key);
     if (table->used > table->size / 2)
         resize(table, table->size * 2);
@@ -275,11 +727,34 @@ bool contains_key(struct hash_set *table, void *key)
         rehash(table);
     }
     
-    uint32_t hash_key = table->hash(key);
-    uint32_t uhash_key = tabhash(hash_key, table->T);
+    uint32_t hash_key = key_hash(table, key);
+    uint32_t uhash_key = uhash(table, hash_key);
     return contains_key_hashed(table, hash_key, uhash_key, key);
 }
 
+void contains_keys(struct hash_set *table,
+                   void **keys, uint32_t n, bool *results)
+{
+    table->operations_since_rehash += n;
+    if (table->operations_since_rehash > table->probe_limit) {
+        rehash(table);
+    }
+    
+    uint32_t hash_keys[HASH_BATCH];
+    uint32_t uhash_keys[HASH_BATCH];
+    for (uint32_t offset = 0; offset < n; offset += HASH_BATCH) {
+        uint32_t m = (n - offset < HASH_BATCH) ? n - offset : HASH_BATCH;
+        for (uint32_t i = 0; i < m; ++i) {
+            hash_keys[i] = key_hash(table, keys[offset + i]);
+        }
+        uhash_n(table, hash_keys, uhash_keys, m);
+        for (uint32_t i = 0; i < m; ++i) {
+            results[offset + i] = contains_key_hashed(table, hash_keys[i], uhash_keys[i],
+                                                      keys[offset + i]);
+        }
+    }
+}
+
 void delete_key(struct hash_set *table, void *key)
 {
     table->operations_since_rehash++;
@@ -287,8 +762,8 @@ void delete_key(struct hash_set *table, void *key)
         rehash(table);
     }
 
-    uint32_t hash_key = table->hash(key);
-    uint32_t uhash_key = tabhash(hash_key, table->T);
+    uint32_t hash_key = key_hash(table, key);
+    uint32_t uhash_key = uhash(table, hash_key);
     for (uint32_t i = 0; i < table->size; ++i) {
         uint32_t index = p(uhash_key, i, table->size);
         struct bin * bin = & table->table[index];
@@ -308,3 +783,70 @@ void delete_key(struct hash_set *table, void *key)
     if (table->active < table->size / 8)
         resize(table, table->size / 2);
 }
+
+#pragma mark iteration
+
+void init_cursor(struct cursor *cursor)
+{
+    cursor->index = 0;
+}
+
+bool next_key(struct hash_set *table, struct cursor *cursor, void **key)
+{
+    while (cursor->index < table->size) {
+        struct bin *bin = &table->table[cursor->index++];
+        if (bin->is_free || bin->is_deleted) continue;
+        *key = bin->key;
+        return true;
+    }
+    return false;
+}
+
+static void for_each_in_range(struct hash_set *table,
+                              uint32_t begin, uint32_t end,
+                              for_each_func f, void *data)
+{
+    for (uint32_t i = begin; i < end; ++i) {
+        struct bin *bin = &table->table[i];
+        if (bin->is_free || bin->is_deleted) continue;
+        f(bin->key, data);
+    }
+}
+
+void for_each(struct hash_set *table, for_each_func f, void *data)
+{
+    for_each_in_range(table, 0, table->size, f, data);
+}
+
+struct iteration_thread {
+    struct hash_set *table;
+    uint32_t begin, end;
+    for_each_func f;
+    void *data;
+};
+
+static void *iterate_range(void *arg)
+{
+    struct iteration_thread *t = (struct iteration_thread *)arg;
+    for_each_in_range(t->table, t->begin, t->end, t->f, t->data);
+    return 0;
+}
+
+void for_each_parallel(struct hash_set *table,
+                       for_each_func f, void *data, int no_threads)
+{
+    if (no_threads < 1) no_threads = 1;
+    pthread_t threads[no_threads];
+    struct iteration_thread args[no_threads];
+    for (int i = 0; i < no_threads; ++i) {
+        args[i].table = table;
+        args[i].begin = range_begin(table->size, no_threads, i);
+        args[i].end = range_begin(table->size, no_threads, i + 1);
+        args[i].f = f;
+        args[i].data = data;
+        pthread_create(&threads[i], 0, iterate_range, &args[i]);
+    }
+    for (int i = 0; i < no_threads; ++i) {
+        pthread_join(threads[i], 0);
+    }
+}
@@ -15,6 +15,24 @@
 typedef uint32_t (*hash_func)(void *);
 typedef void (*destructor_func)(void *);
 typedef bool (*compare_func)(void *, void *);
+typedef void (*for_each_func)(void *key, void *data);
+// Gives the table the bytes of a key, for hashing the key bytes
+// instead of a 32-bit pre-hash.
+typedef void (*key_view_func)(void *key, const void **bytes, uint32_t *len);
+
+enum universal_family {
+    UNIVERSAL_TABULATION,     // tabulation hashing, 4 KB table per hash table
+    UNIVERSAL_MULTIPLY_SHIFT, // multiply-add-shift, no table
+    UNIVERSAL_KEY_BYTES       // multilinear hashing of the key bytes
+};
+
+// How the constructors from arrays handle keys that appear more
+// than once.
+enum duplicate_keys {
+    UNIQUE_KEYS,    // there are none; we do not check
+    KEEP_FIRST_KEY, // later copies are destroyed
+    KEEP_LAST_KEY   // earlier copies are destroyed, as with insert_key()
+};
 
 struct hash_set {
     struct bin *table;
@@ -26,12 +44,21 @@ struct hash_set {
     compare_func cmp;
     destructor_func destructor;
     
-    // For tabulation hashing.
-    uint8_t *T, *T_end;
+    // The universal family and the current function from it.
+    enum universal_family family;
+    uint8_t *T, *T_end;  // tabulation hashing
+    uint64_t a, b;       // multiply-shift hashing
+    uint64_t *coefs;     // key-bytes hashing
+    uint32_t no_coefs;
+    key_view_func key_view;
+    uint64_t rng_state;
     
     float rehash_factor;
     unsigned int probe_limit;
     unsigned int operations_since_rehash;
+    
+    // Threads that move the bins when we resize or rehash large tables
+    int resize_threads;
 };
 
 struct hash_set *
@@ -40,14 +67,60 @@ new_set            (uint32_t size, // Must be a power of two!
                     hash_func hash,
                     compare_func cmp,
                     destructor_func destructor);
+// Returns 0 for UNIVERSAL_KEY_BYTES. Use new_set_keyed for that.
+struct hash_set *
+new_set_family     (uint32_t size, // Must be a power of two!
+                    float rehash_factor,
+                    enum universal_family family,
+                    hash_func hash,
+                    compare_func cmp,
+                    destructor_func destructor);
+// Hashes the bytes of keys with multilinear hashing, so rehashing
+// also breaks up keys that would collide in a 32-bit pre-hash.
+// Returns 0 if key_view is 0.
+struct hash_set *
+new_set_keyed      (uint32_t size, // Must be a power of two!
+                    float rehash_factor,
+                    key_view_func key_view,
+                    compare_func cmp,
+                    destructor_func destructor);
+// Builds a set of the n keys, large enough that it does not resize.
+// no_threads threads fill the bins.
+struct hash_set *
+new_set_from_array (uint32_t n, void **keys,
+                    enum duplicate_keys duplicates,
+                    int no_threads,
+                    float rehash_factor,
+                    hash_func hash,
+                    compare_func cmp,
+                    destructor_func destructor);
 void delete_set  (struct hash_set *table);
+// Grows the table so it holds n keys without resizing, moving the
+// bins with no_threads threads.
+void reserve_parallel(struct hash_set *table, uint32_t n, int no_threads);
 
 void insert_key  (struct hash_set *table,
                   void *key);
 bool contains_key(struct hash_set *table,
                   void *key);
+// Checks n keys at a time and puts the results in results.
+void contains_keys(struct hash_set *table,
+                   void **keys, uint32_t n, bool *results);
 void delete_key  (struct hash_set *table,
                   void *key);
 
+// Iteration. The table must not change while you iterate over it,
+// and since lookups can rehash, you cannot look up keys either.
+struct cursor {
+    uint32_t index;
+};
+void init_cursor (struct cursor *cursor);
+bool next_key    (struct hash_set *table, struct cursor *cursor,
+                  void **key);
+void for_each    (struct hash_set *table, for_each_func f, void *data);
+// Splits the bins into no_threads ranges and calls f from
+// no_threads threads at the same time.
+void for_each_parallel(struct hash_set *table,
+                       for_each_func f, void *data, int no_threads);
 
 #endif /* hash_h */
@@ -0,0 +1,78 @@
+//
+//  main.c
+//  Benchmark
+//
+//  Created by Thomas Mailund on 19/10/2026.
+//  Copyright © 2026 Thomas Mailund. All rights reserved.
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <pthread.h>
+#include "hash_set.h"
+
+static double now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static uint64_t next_random(uint64_t *state)
+{
+    uint64_t z = (*state += 0x9e3779b97f4a7c15);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111eb;
+    return z ^ (z >> 31);
+}
+
+struct thread_data {
+    struct hash_set *table;
+    uint64_t rng_state;
+    int no_ops;
+    uint64_t key_range;
+};
+
+static void *inserter(void *arg)
+{
+    struct thread_data *data = (struct thread_data *)arg;
+    for (int i = 0; i < data->no_ops; ++i) {
+        insert_key(data->table, next_random(&data->rng_state) % data->key_range);
+    }
+    return 0;
+}
+
+// Inserts the same number of keys with 1 to 64 threads, starting
+// from a small table so we also measure resizing. About half the
+// inserts find the key already there, as in deduplication.
+int main(int argc, const char *argv[])
+{
+    int total_ops = 1 << 24;
+    if (argc > 1) total_ops = atoi(argv[1]);
+
+    for (int no_threads = 1; no_threads <= 64; no_threads *= 2) {
+        struct hash_set *table = new_set(1024);
+
+        pthread_t threads[no_threads];
+        struct thread_data data[no_threads];
+        double begin = now();
+        for (int i = 0; i < no_threads; ++i) {
+            data[i].table = table;
+            data[i].rng_state = i + 1;
+            data[i].no_ops = total_ops / no_threads;
+            data[i].key_range = total_ops;
+            pthread_create(&threads[i], 0, inserter, &data[i]);
+        }
+        for (int i = 0; i < no_threads; ++i) {
+            pthread_join(threads[i], 0);
+        }
+        double elapsed = now() - begin;
+
+        printf("%2d threads: %7.2f Minserts/s\n",
+               no_threads, total_ops / elapsed * 1e-6);
+        delete_set(table);
+    }
+
+    return EXIT_SUCCESS;
+}
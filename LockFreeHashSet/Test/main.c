@@ -0,0 +1,113 @@
+//
+//  main.c
+//  Test
+//
+//  Created by Thomas Mailund on 19/10/2026.
+//  Copyright © 2026 Thomas Mailund. All rights reserved.
+//
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <pthread.h>
+#include "hash_set.h"
+
+static uint64_t random_key()
+{
+    return ((uint64_t)random() << 32) ^ (uint64_t)random();
+}
+
+#define NO_THREADS 8
+#define KEYS_PER_THREAD 20000
+
+struct thread_data {
+    struct hash_set *table;
+    int thread;
+    int no_new;
+};
+
+// Thread i inserts the keys i * KEYS_PER_THREAD / 2 up to
+// (i + 2) * KEYS_PER_THREAD / 2, so each key is inserted by two threads.
+static void *inserter(void *arg)
+{
+    struct thread_data *data = (struct thread_data *)arg;
+    uint64_t begin = (uint64_t)data->thread * KEYS_PER_THREAD / 2;
+    data->no_new = 0;
+    for (uint64_t key = begin; key < begin + KEYS_PER_THREAD; ++key) {
+        if (insert_key(data->table, key)) data->no_new++;
+        assert(contains_key(data->table, key));
+    }
+    return 0;
+}
+
+static void concurrent_test()
+{
+    struct hash_set *table = new_set(2);
+
+    pthread_t threads[NO_THREADS];
+    struct thread_data data[NO_THREADS];
+    for (int i = 0; i < NO_THREADS; ++i) {
+        data[i].table = table;
+        data[i].thread = i;
+        pthread_create(&threads[i], 0, inserter, &data[i]);
+    }
+    int no_new = 0;
+    for (int i = 0; i < NO_THREADS; ++i) {
+        pthread_join(threads[i], 0);
+        no_new += data[i].no_new;
+    }
+
+    // Only one of the threads should see a key as new
+    uint64_t no_keys = (uint64_t)(NO_THREADS + 1) * KEYS_PER_THREAD / 2;
+    assert(no_new == no_keys);
+    for (uint64_t key = 0; key < no_keys; ++key) {
+        assert(contains_key(table, key));
+    }
+    assert(!contains_key(table, no_keys));
+
+    delete_set(table);
+}
+
+int main(int argc, const char *argv[])
+{
+    int no_elms = 1000;
+    uint64_t keys[no_elms];
+    for (int i = 0; i < no_elms; ++i) {
+        keys[i] = random_key();
+    }
+    uint64_t different_keys[no_elms];
+    for (int i = 0; i < no_elms; ++i) {
+        different_keys[i] = random_key();
+    }
+
+    struct hash_set *table = new_set(2);
+    for (int i = 0; i < no_elms; ++i) {
+        assert(insert_key(table, keys[i]));
+    }
+    for (int i = 0; i < no_elms; ++i) {
+        assert(contains_key(table, keys[i]));
+        assert(!insert_key(table, keys[i]));
+    }
+    for (int i = 0; i < no_elms; ++i) {
+        assert(!contains_key(table, different_keys[i]));
+    }
+
+    // The keys we use as markers in the bins
+    assert(!contains_key(table, 0));
+    assert(!contains_key(table, UINT64_MAX));
+    assert(insert_key(table, 0));
+    assert(insert_key(table, UINT64_MAX));
+    assert(!insert_key(table, 0));
+    assert(!insert_key(table, UINT64_MAX));
+    assert(contains_key(table, 0));
+    assert(contains_key(table, UINT64_MAX));
+
+    delete_set(table);
+
+    concurrent_test();
+
+    printf("SUCCESS\n");
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,294 @@
+//
+//  hash_set.c
+//  LockFreeHashSet
+//
+//  Created by Thomas Mailund on 19/10/2026.
+//  Copyright © 2026 Thomas Mailund. All rights reserved.
+//
+
+#include <stdlib.h>
+#include <string.h>
+#include "hash_set.h"
+
+// Markers in the bins. Users can still insert these two keys; we
+// keep track of them in flags in the set.
+#define EMPTY 0
+#define MOVED UINT64_MAX
+
+// Number of bins a thread moves at a time when we resize
+#define CHUNK_SIZE 1024
+
+// Each thread counts keys in one of these counters, so the threads
+// do not all fight over the same cache line. Must be a power of two.
+#define NO_COUNTERS 64
+
+struct counter {
+    _Atomic uint32_t value;
+} __attribute__((aligned(64)));
+
+struct bins {
+    uint32_t size;
+    struct counter used[NO_COUNTERS];
+
+    // For resizing
+    _Atomic(struct bins *) next;
+    _Atomic uint32_t next_chunk;
+    _Atomic uint32_t chunks_done;
+    _Atomic bool *chunk_done;
+    // The bins we moved away from. Threads might still look at them,
+    // so we only free them with the set.
+    struct bins *older;
+
+    _Atomic uint64_t keys[];
+};
+
+// The finaliser from MurmurHash3
+static uint64_t mix(uint64_t x)
+{
+    x ^= x >> 33;
+    x *= 0xff51afd7ed558ccd;
+    x ^= x >> 33;
+    x *= 0xc4ceb9fe1a85ec53;
+    x ^= x >> 33;
+    return x;
+}
+
+static uint32_t
+p(uint32_t k, uint32_t i, uint32_t m)
+{
+    return (k + i) & (m - 1);
+}
+
+static struct bins *new_bins(uint32_t size)
+{
+    size_t bytes = sizeof(struct bins) + size * sizeof(uint64_t);
+    bytes = (bytes + _Alignof(struct bins) - 1) & ~(_Alignof(struct bins) - 1);
+    struct bins *bins =
+    (struct bins *)aligned_alloc(_Alignof(struct bins), bytes);
+    // All bins EMPTY and all counters zero
+    memset(bins, 0, bytes);
+    bins->size = size;
+    bins->chunk_done =
+    (_Atomic bool *)calloc((size + CHUNK_SIZE - 1) / CHUNK_SIZE, sizeof(_Atomic bool));
+    return bins;
+}
+
+#pragma mark counting
+
+static _Atomic uint32_t next_counter;
+static _Thread_local int32_t thread_counter = -1;
+
+static struct counter *get_counter(struct bins *bins)
+{
+    if (thread_counter < 0) {
+        thread_counter = atomic_fetch_add(&next_counter, 1) & (NO_COUNTERS - 1);
+    }
+    return &bins->used[thread_counter];
+}
+
+static uint32_t count_keys(struct bins *bins)
+{
+    uint32_t used = 0;
+    for (int i = 0; i < NO_COUNTERS; ++i) {
+        used += atomic_load_explicit(&bins->used[i].value, memory_order_relaxed);
+    }
+    return used;
+}
+
+// Counts a new key and tells us if it is time to resize.
+static bool add_key(struct bins *bins)
+{
+    uint32_t used =
+    atomic_fetch_add_explicit(&get_counter(bins)->value, 1,
+                              memory_order_relaxed) + 1;
+    // For large tables we only look at the other counters now and then.
+    // We might overfill the table a little, but not by much.
+    if (bins->size > NO_COUNTERS * CHUNK_SIZE && used % 16 != 0)
+        return false;
+    if ((uint64_t)used * NO_COUNTERS <= bins->size / 2)
+        return false;
+    return count_keys(bins) > bins->size / 2;
+}
+
+#pragma mark resizing
+
+// Only called when we move keys into bins nobody else inserts into.
+// Several threads can move the same key, so we check if it is there.
+static void move_key(struct bins *bins, uint64_t key)
+{
+    uint32_t hash_key = (uint32_t)mix(key);
+    for (uint32_t i = 0; ; ++i) {
+        uint64_t expected = EMPTY;
+        uint32_t index = p(hash_key, i, bins->size);
+        if (atomic_compare_exchange_strong(&bins->keys[index], &expected, key)) {
+            atomic_fetch_add_explicit(&get_counter(bins)->value, 1,
+                                      memory_order_relaxed);
+            return;
+        }
+        // If the new bins are resizing as well, all keys from these
+        // bins are already in them.
+        if (expected == key || expected == MOVED) return;
+    }
+}
+
+// We copy a key to the new bins before we mark its bin MOVED, so
+// anyone who sees MOVED will find the key in the new bins. That also
+// means that moving a bin twice is harmless.
+static void move_bin(struct bins *bins, struct bins *next, uint32_t i)
+{
+    uint64_t key = atomic_load(&bins->keys[i]);
+    if (key == EMPTY) {
+        // Once a bin is MOVED, inserts cannot claim it
+        if (atomic_compare_exchange_strong(&bins->keys[i], &key, MOVED))
+            return;
+        // An insert got the bin first, and key now holds its key
+    }
+    if (key == MOVED) return;
+    move_key(next, key);
+    atomic_store(&bins->keys[i], MOVED);
+}
+
+static void move_chunk(struct bins *bins, struct bins *next, uint32_t chunk)
+{
+    uint32_t begin = chunk * CHUNK_SIZE;
+    uint32_t end = begin + CHUNK_SIZE;
+    if (end > bins->size) end = bins->size;
+    for (uint32_t i = begin; i < end; ++i) {
+        move_bin(bins, next, i);
+    }
+    if (!atomic_exchange(&bins->chunk_done[chunk], true))
+        atomic_fetch_add(&bins->chunks_done, 1);
+}
+
+// Moves chunks until there are no more. If other threads are still
+// moving theirs, we move those chunks as well rather than wait for
+// them, so a thread that stops in the middle of a resize does not
+// hold up the rest. Returns the new bins.
+static struct bins *help_resize(struct hash_set *table, struct bins *bins)
+{
+    struct bins *next = atomic_load(&bins->next);
+    uint32_t no_chunks = (bins->size + CHUNK_SIZE - 1) / CHUNK_SIZE;
+    uint32_t chunk;
+    while ((chunk = atomic_fetch_add(&bins->next_chunk, 1)) < no_chunks) {
+        move_chunk(bins, next, chunk);
+    }
+    if (atomic_load(&bins->chunks_done) < no_chunks) {
+        for (chunk = 0; chunk < no_chunks; ++chunk) {
+            if (!atomic_load(&bins->chunk_done[chunk]))
+                move_chunk(bins, next, chunk);
+        }
+    }
+
+    struct bins *expected = bins;
+    atomic_compare_exchange_strong(&table->table, &expected, next);
+    return next;
+}
+
+static struct bins *resize(struct hash_set *table, struct bins *bins)
+{
+    struct bins *next = atomic_load(&bins->next);
+    if (!next) {
+        struct bins *new_next = new_bins(2 * bins->size);
+        new_next->older = bins;
+        if (!atomic_compare_exchange_strong(&bins->next, &next, new_next)) {
+            // someone beat us to it
+            free(new_next->chunk_done);
+            free(new_next);
+        }
+    }
+    return help_resize(table, bins);
+}
+
+#pragma mark set
+
+struct hash_set *new_set(uint32_t size)
+{
+    struct hash_set *table =
+    (struct hash_set *)malloc(sizeof(struct hash_set));
+    atomic_init(&table->table, new_bins(size));
+    atomic_init(&table->has_empty_key, false);
+    atomic_init(&table->has_moved_key, false);
+    return table;
+}
+
+void delete_set(struct hash_set *table)
+{
+    struct bins *bins = atomic_load(&table->table);
+    while (bins) {
+        struct bins *older = bins->older;
+        free(bins->chunk_done);
+        free(bins);
+        bins = older;
+    }
+    free(table);
+}
+
+enum insert_result {
+    INSERTED,
+    FOUND,
+    MUST_RESIZE
+};
+
+static enum insert_result
+insert_key_bins(struct bins *bins, uint64_t key)
+{
+    uint32_t hash_key = (uint32_t)mix(key);
+    for (uint32_t i = 0; i < bins->size; ++i) {
+        _Atomic uint64_t *bin = &bins->keys[p(hash_key, i, bins->size)];
+        uint64_t bin_key = atomic_load(bin);
+        if (bin_key == EMPTY) {
+            if (atomic_compare_exchange_strong(bin, &bin_key, key))
+                return INSERTED;
+            // someone else got the bin first; bin_key now holds
+            // what they put there
+        }
+        if (bin_key == key) return FOUND;
+        if (bin_key == MOVED) return MUST_RESIZE;
+    }
+    return MUST_RESIZE; // the table is full
+}
+
+bool insert_key(struct hash_set *table, uint64_t key)
+{
+    if (key == EMPTY)
+        return !atomic_exchange(&table->has_empty_key, true);
+    if (key == MOVED)
+        return !atomic_exchange(&table->has_moved_key, true);
+
+    struct bins *bins = atomic_load(&table->table);
+    for (;;) {
+        switch (insert_key_bins(bins, key)) {
+            case INSERTED:
+                if (add_key(bins)) resize(table, bins);
+                return true;
+            case FOUND:
+                return false;
+            case MUST_RESIZE:
+                bins = resize(table, bins);
+                break;
+        }
+    }
+}
+
+bool contains_key(struct hash_set *table, uint64_t key)
+{
+    if (key == EMPTY)
+        return atomic_load(&table->has_empty_key);
+    if (key == MOVED)
+        return atomic_load(&table->has_moved_key);
+
+    struct bins *bins = atomic_load(&table->table);
+    uint32_t hash_key = (uint32_t)mix(key);
+    for (uint32_t i = 0; i < bins->size; ++i) {
+        uint64_t bin_key = atomic_load(&bins->keys[p(hash_key, i, bins->size)]);
+        if (bin_key == key) return true;
+        if (bin_key == EMPTY) return false;
+        if (bin_key == MOVED) {
+            // The key might be in the new bins, but only once all
+            // keys are moved.
+            bins = help_resize(table, bins);
+            i = -1;
+        }
+    }
+    return false;
+}
@@ -0,0 +1,44 @@
+//
+//  hash_set.h
+//  LockFreeHashSet
+//
+//  Created by Thomas Mailund on 19/10/2026.
+//  Copyright © 2026 Thomas Mailund. All rights reserved.
+//
+
+#ifndef hash_set_h
+#define hash_set_h
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+
+// Linear probing set of 64-bit keys that any number of threads can
+// insert into and query at the same time. Keys live directly in the
+// bins, and threads claim bins with compare-and-swap. Since the keys
+// are words, the set hashes them itself.
+//
+// When the table gets full, the threads that notice move the keys to
+// a larger table together, a chunk of bins at a time. A thread that
+// runs into a resize helps with it, and when there are no chunks
+// left to claim, it also moves the chunks other threads have claimed
+// but not finished, instead of waiting for them. So a thread that is
+// descheduled in the middle of a resize does not block the others.
+// There is no delete_key.
+
+struct hash_set {
+    _Atomic(struct bins *) table;
+    // The two keys we use as markers in the bins
+    atomic_bool has_empty_key;
+    atomic_bool has_moved_key;
+};
+
+struct hash_set *
+new_set         (uint32_t size); // Must be a power of two!
+void delete_set  (struct hash_set *table);
+
+// Returns true if the key was not already in the set.
+bool insert_key  (struct hash_set *table, uint64_t key);
+bool contains_key(struct hash_set *table, uint64_t key);
+
+#endif /* hash_set_h */
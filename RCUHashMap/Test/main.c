@@ -0,0 +1,203 @@
+//
+//  main.c
+//  Test
+//
+//  Created by Thomas Mailund on 19/10/2026.
+//  Copyright © 2026 Thomas Mailund. All rights reserved.
+//
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include "hash_map.h"
+
+
+struct tag_key {
+    bool key_deleted;
+    bool val_deleted;
+    uint32_t key;
+};
+
+static void init_tag_key(struct tag_key *tag_key, uint32_t key)
+{
+    tag_key->key = key;
+    tag_key->val_deleted = tag_key->key_deleted = false;
+}
+
+static uint32_t random_key()
+{
+    return (uint32_t)random();
+}
+
+static bool compare_values(void *a, void *b)
+{
+    uint32_t key_a = ((struct tag_key*)a)->key;
+    uint32_t key_b = ((struct tag_key*)b)->key;
+    return key_a == key_b;
+}
+
+static uint32_t id_hash(void *key)
+{
+    return ((struct tag_key*)key)->key;
+}
+
+static void key_destroy(void *void_key)
+{
+    struct tag_key *key = (struct tag_key*)void_key;
+    key->key_deleted = true;
+}
+static void val_destroy(void *void_key)
+{
+    struct tag_key *key = (struct tag_key*)void_key;
+    key->val_deleted = true;
+}
+
+
+#define NO_READERS 4
+#define NO_KEYS 5000
+
+struct reader_data {
+    struct hash_map *table;
+    struct tag_key *keys;
+    atomic_bool *done;
+};
+
+// Readers look keys up while the writer maps, replaces and deletes
+// them. A key must map to itself or its replacement, or be missing.
+static void *reader(void *arg)
+{
+    struct reader_data *data = (struct reader_data *)arg;
+    struct tag_key *keys = data->keys;
+    while (!atomic_load(data->done)) {
+        for (int i = 0; i < NO_KEYS; ++i) {
+            void *val = lookup(data->table, &keys[i]);
+            assert(val == 0 || val == &keys[i] || val == &keys[i + NO_KEYS]);
+        }
+    }
+    return 0;
+}
+
+static void concurrent_test()
+{
+    // the first half are the keys, the second half replace them
+    struct tag_key *keys = malloc(2 * NO_KEYS * sizeof(struct tag_key));
+    for (int i = 0; i < NO_KEYS; ++i) {
+        init_tag_key(&keys[i], i);
+        init_tag_key(&keys[i + NO_KEYS], i);
+    }
+
+    struct hash_map *table = new_map(2, id_hash, compare_values, key_destroy, val_destroy);
+    atomic_bool done = false;
+
+    pthread_t threads[NO_READERS];
+    struct reader_data data = { table, keys, &done };
+    for (int i = 0; i < NO_READERS; ++i) {
+        pthread_create(&threads[i], 0, reader, &data);
+    }
+
+    for (int i = 0; i < NO_KEYS; ++i) {
+        map(table, &keys[i], &keys[i]);
+    }
+    for (int i = 0; i < NO_KEYS; ++i) {
+        if (i % 2 == 0) {
+            map(table, &keys[i + NO_KEYS], &keys[i + NO_KEYS]);
+        } else {
+            delete_key(table, &keys[i]);
+        }
+    }
+
+    atomic_store(&done, true);
+    for (int i = 0; i < NO_READERS; ++i) {
+        pthread_join(threads[i], 0);
+    }
+
+    for (int i = 0; i < NO_KEYS; ++i) {
+        if (i % 2 == 0) {
+            assert(lookup(table, &keys[i]) == &keys[i + NO_KEYS]);
+        } else {
+            assert(!contains_key(table, &keys[i]));
+        }
+    }
+
+    delete_map(table);
+    for (int i = 0; i < NO_KEYS; ++i) {
+        assert(keys[i].key_deleted == true);
+        assert(keys[i].val_deleted == true);
+        bool replaced = i % 2 == 0;
+        assert(keys[i + NO_KEYS].key_deleted == replaced);
+        assert(keys[i + NO_KEYS].val_deleted == replaced);
+    }
+    free(keys);
+}
+
+int main(int argc, const char *argv[])
+{
+    
+    int no_elms = 100;
+    struct tag_key keys[no_elms];
+    for (int i = 0; i < no_elms; ++i) {
+        init_tag_key(&keys[i], random_key());
+    }
+    struct tag_key other_keys[no_elms];
+    for (int i = 0; i < no_elms; ++i) {
+        init_tag_key(&other_keys[i], keys[i].key);
+    }
+    struct tag_key different_keys[no_elms];
+    for (int i = 0; i < no_elms; ++i) {
+        init_tag_key(&different_keys[i], random_key());
+    }
+    
+    struct hash_map *table = new_map(2, id_hash, compare_values, key_destroy, val_destroy);
+    
+    for (int i = 0; i < no_elms; ++i) {
+        map(table, &keys[i], &keys[i]);
+        assert(keys[i].key_deleted == false);
+    }
+    for (int i = 0; i < no_elms; ++i) {
+        assert(contains_key(table, &keys[i]));
+        assert(lookup(table, &keys[i]) == &keys[i]);
+        assert(keys[i].key_deleted == false);
+        assert(keys[i].val_deleted == false);
+    }
+    for (int i = 0; i < no_elms; ++i) {
+        assert(contains_key(table, &other_keys[i]));
+        assert(lookup(table, &other_keys[i]) == &keys[i]);
+    }
+    for (int i = 0; i < no_elms; ++i) {
+        assert(!contains_key(table, &different_keys[i]));
+    }
+    for (int i = 0; i < no_elms; ++i) {
+        map(table, &other_keys[i], &other_keys[i]);
+    }
+    // The replaced keys are destroyed once no reader can see them,
+    // which might not be yet, but the new ones must still be alive.
+    for (int i = 0; i < no_elms; ++i) {
+        assert(lookup(table, &other_keys[i]) == &other_keys[i]);
+        assert(other_keys[i].key_deleted == false);
+        assert(other_keys[i].val_deleted == false);
+    }
+    for (int i = 0; i < no_elms; ++i) {
+        delete_key(table, &other_keys[i]);
+    }
+    for (int i = 0; i < no_elms; ++i) {
+        assert(!contains_key(table, &keys[i]));
+        assert(!contains_key(table, &other_keys[i]));
+    }
+    
+    delete_map(table);
+    for (int i = 0; i < no_elms; ++i) {
+        assert(keys[i].key_deleted == true);
+        assert(keys[i].val_deleted == true);
+        assert(other_keys[i].key_deleted == true);
+        assert(other_keys[i].val_deleted == true);
+    }
+    
+    concurrent_test();
+    
+    printf("SUCCESS\n");
+    
+    return EXIT_SUCCESS;
+}
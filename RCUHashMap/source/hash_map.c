@@ -0,0 +1,337 @@
+//
+//  hash_map.c
+//  RCUHashMap
+//
+//  Created by Thomas Mailund on 19/10/2026.
+//  Copyright © 2026 Thomas Mailund. All rights reserved.
+//
+
+#include <stdlib.h>
+#include <sched.h>
+#include "hash_map.h"
+
+#pragma mark grace periods
+
+// Readers announce the grace period they started in. A writer ends a
+// grace period by moving the global counter forward and waiting until
+// no reader is still in an older period. After that, nothing a writer
+// removed before the wait can be seen by anyone.
+
+struct reader_record {
+    // (period << 1) | 1 while the thread reads the table, 0 otherwise
+    _Atomic uint64_t state;
+    atomic_bool in_use;
+    struct reader_record *next;
+};
+
+static _Atomic uint64_t global_period = 1;
+static _Atomic(struct reader_record *) records;
+static pthread_key_t record_key;
+static pthread_once_t record_key_once = PTHREAD_ONCE_INIT;
+static _Thread_local struct reader_record *thread_record;
+
+// Called when a thread exits, so another thread can take the record.
+static void release_record(void *record)
+{
+    atomic_store(&((struct reader_record *)record)->in_use, false);
+}
+
+static void make_record_key(void)
+{
+    pthread_key_create(&record_key, release_record);
+}
+
+static struct reader_record *get_record(void)
+{
+    if (thread_record) return thread_record;
+
+    struct reader_record *record = atomic_load(&records);
+    for (; record; record = record->next) {
+        bool free_record = false;
+        if (atomic_compare_exchange_strong(&record->in_use, &free_record, true))
+            break;
+    }
+    if (!record) {
+        record = (struct reader_record *)malloc(sizeof(struct reader_record));
+        atomic_init(&record->state, 0);
+        atomic_init(&record->in_use, true);
+        record->next = atomic_load(&records);
+        while (!atomic_compare_exchange_weak(&records, &record->next, record))
+            ;
+    }
+
+    pthread_once(&record_key_once, make_record_key);
+    pthread_setspecific(record_key, record);
+    thread_record = record;
+    return record;
+}
+
+static struct reader_record *read_lock(void)
+{
+    struct reader_record *record = get_record();
+    uint64_t period = atomic_load(&global_period);
+    atomic_store(&record->state, (period << 1) | 1);
+    atomic_thread_fence(memory_order_seq_cst);
+    return record;
+}
+
+static void read_unlock(struct reader_record *record)
+{
+    atomic_store_explicit(&record->state, 0, memory_order_release);
+}
+
+static void wait_for_readers(void)
+{
+    uint64_t period = atomic_fetch_add(&global_period, 1) + 1;
+    for (struct reader_record *record = atomic_load(&records);
+         record; record = record->next) {
+        for (;;) {
+            uint64_t state = atomic_load(&record->state);
+            if (!(state & 1) || (state >> 1) >= period) break;
+            sched_yield();
+        }
+    }
+}
+
+
+#pragma mark bins
+
+struct entry {
+    uint32_t hash_key;
+    void *key;
+    void *val;
+    struct entry *retired_next;
+};
+
+// Marks deleted bins. Never freed and never compared.
+static struct entry deleted_entry;
+#define DELETED (&deleted_entry)
+
+struct bins {
+    uint32_t size;
+    _Atomic(struct entry *) entries[];
+};
+
+static uint32_t
+p(uint32_t k, unsigned int i, unsigned int m)
+{
+    return (k + i) & (m - 1);
+}
+
+static struct bins *new_bins(uint32_t size)
+{
+    // Using `calloc` makes all bins empty
+    struct bins *bins =
+    (struct bins *)calloc(1, sizeof(struct bins) +
+                          size * sizeof(struct entry *));
+    bins->size = size;
+    return bins;
+}
+
+static struct entry *new_entry(uint32_t hash_key, void *key, void *val)
+{
+    struct entry *entry = (struct entry *)malloc(sizeof(struct entry));
+    entry->hash_key = hash_key;
+    entry->key = key;
+    entry->val = val;
+    return entry;
+}
+
+// Readers use this, so it must work while a writer changes the bins.
+static struct entry *find_entry(struct hash_map *table, struct bins *bins,
+                                uint32_t hash_key, void *key)
+{
+    for (uint32_t i = 0; i < bins->size; ++i) {
+        uint32_t index = p(hash_key, i, bins->size);
+        struct entry *entry =
+        atomic_load_explicit(&bins->entries[index], memory_order_acquire);
+        if (!entry)
+            return 0;
+        if (entry != DELETED && entry->hash_key == hash_key &&
+            table->key_cmp(entry->key, key))
+            return entry;
+    }
+    return 0;
+}
+
+
+#pragma mark writing
+
+// How many entries we let the writers collect before they wait for
+// the readers and free them.
+#define RETIRE_LIMIT 64
+
+static void free_retired(struct hash_map *table)
+{
+    while (table->retired) {
+        struct entry *entry = table->retired;
+        table->retired = entry->retired_next;
+        table->key_destructor(entry->key);
+        table->val_destructor(entry->val);
+        free(entry);
+    }
+    table->no_retired = 0;
+}
+
+static void retire_entry(struct hash_map *table, struct entry *entry)
+{
+    entry->retired_next = table->retired;
+    table->retired = entry;
+    if (++table->no_retired >= RETIRE_LIMIT) {
+        wait_for_readers();
+        free_retired(table);
+    }
+}
+
+// Build the new bins where readers cannot see them, then swap them in.
+static void resize(struct hash_map *table, uint32_t new_size)
+{
+    if (new_size == 0) return;
+
+    struct bins *old_bins = atomic_load(&table->table);
+    struct bins *bins = new_bins(new_size);
+    for (uint32_t i = 0; i < old_bins->size; ++i) {
+        struct entry *entry = atomic_load_explicit(&old_bins->entries[i],
+                                                   memory_order_relaxed);
+        if (!entry || entry == DELETED) continue;
+        uint32_t j = 0;
+        while (atomic_load_explicit(&bins->entries[p(entry->hash_key, j, new_size)],
+                                    memory_order_relaxed))
+            ++j;
+        atomic_store_explicit(&bins->entries[p(entry->hash_key, j, new_size)],
+                              entry, memory_order_relaxed);
+    }
+    table->used = table->active;
+
+    atomic_store_explicit(&table->table, bins, memory_order_release);
+    wait_for_readers();
+    free(old_bins);
+}
+
+struct hash_map *new_map(uint32_t size,
+                         hash_func hash,
+                         compare_func key_cmp,
+                         destructor_func key_destructor,
+                         destructor_func val_destructor)
+{
+    struct hash_map *table =
+    (struct hash_map*)malloc(sizeof(struct hash_map));
+    atomic_init(&table->table, new_bins(size));
+    pthread_mutex_init(&table->write_lock, 0);
+    table->active = table->used = 0;
+    table->retired = 0;
+    table->no_retired = 0;
+    table->hash = hash;
+    table->key_cmp = key_cmp;
+    table->key_destructor = key_destructor;
+    table->val_destructor = val_destructor;
+
+    return table;
+}
+
+void delete_map(struct hash_map *table)
+{
+    struct bins *bins = atomic_load(&table->table);
+    for (uint32_t i = 0; i < bins->size; ++i) {
+        struct entry *entry = atomic_load(&bins->entries[i]);
+        if (!entry || entry == DELETED) continue;
+        table->key_destructor(entry->key);
+        table->val_destructor(entry->val);
+        free(entry);
+    }
+    free(bins);
+    free_retired(table);
+    pthread_mutex_destroy(&table->write_lock);
+    free(table);
+}
+
+void map(struct hash_map *table, void *key, void *val)
+{
+    uint32_t hash_key = table->hash(key);
+    pthread_mutex_lock(&table->write_lock);
+
+    struct bins *bins = atomic_load_explicit(&table->table, memory_order_relaxed);
+    _Atomic(struct entry *) *first_deleted = 0;
+    for (uint32_t i = 0; i < bins->size; ++i) {
+        _Atomic(struct entry *) *bin = &bins->entries[p(hash_key, i, bins->size)];
+        struct entry *entry = atomic_load_explicit(bin, memory_order_relaxed);
+
+        if (!entry) {
+            struct entry *new = new_entry(hash_key, key, val);
+            if (first_deleted) {
+                // the deleted bin was already used
+                atomic_store_explicit(first_deleted, new, memory_order_release);
+            } else {
+                atomic_store_explicit(bin, new, memory_order_release);
+                table->used++;
+            }
+            table->active++;
+            break;
+        }
+
+        if (entry == DELETED) {
+            if (!first_deleted) first_deleted = bin;
+            continue;
+        }
+
+        if (entry->hash_key == hash_key && table->key_cmp(entry->key, key)) {
+            // Readers might have the old entry, so we replace it.
+            atomic_store_explicit(bin, new_entry(hash_key, key, val),
+                                  memory_order_release);
+            retire_entry(table, entry);
+            break;
+        }
+    }
+
+    if (table->used > bins->size / 2)
+        resize(table, bins->size * 2);
+
+    pthread_mutex_unlock(&table->write_lock);
+}
+
+bool contains_key(struct hash_map *table, void *key)
+{
+    uint32_t hash_key = table->hash(key);
+    struct reader_record *record = read_lock();
+    struct bins *bins = atomic_load_explicit(&table->table, memory_order_acquire);
+    bool res = find_entry(table, bins, hash_key, key) != 0;
+    read_unlock(record);
+    return res;
+}
+
+void *lookup(struct hash_map *table, void *key)
+{
+    uint32_t hash_key = table->hash(key);
+    struct reader_record *record = read_lock();
+    struct bins *bins = atomic_load_explicit(&table->table, memory_order_acquire);
+    struct entry *entry = find_entry(table, bins, hash_key, key);
+    void *val = entry ? entry->val : 0;
+    read_unlock(record);
+    return val;
+}
+
+void delete_key(struct hash_map *table, void *key)
+{
+    uint32_t hash_key = table->hash(key);
+    pthread_mutex_lock(&table->write_lock);
+
+    struct bins *bins = atomic_load_explicit(&table->table, memory_order_relaxed);
+    for (uint32_t i = 0; i < bins->size; ++i) {
+        _Atomic(struct entry *) *bin = &bins->entries[p(hash_key, i, bins->size)];
+        struct entry *entry = atomic_load_explicit(bin, memory_order_relaxed);
+        if (!entry)
+            break;
+        if (entry != DELETED && entry->hash_key == hash_key &&
+            table->key_cmp(entry->key, key)) {
+            atomic_store_explicit(bin, DELETED, memory_order_release);
+            retire_entry(table, entry);
+            table->active--;
+            break;
+        }
+    }
+
+    if (table->active < bins->size / 8)
+        resize(table, bins->size / 2);
+
+    pthread_mutex_unlock(&table->write_lock);
+}
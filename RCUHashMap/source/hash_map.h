@@ -0,0 +1,64 @@
+//
+//  hash_map.h
+//  RCUHashMap
+//
+//  Created by Thomas Mailund on 19/10/2026.
+//  Copyright © 2026 Thomas Mailund. All rights reserved.
+//
+
+#ifndef hash_map_h
+#define hash_map_h
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <pthread.h>
+
+typedef uint32_t (*hash_func)(void *);
+typedef void (*destructor_func)(void *);
+typedef bool (*compare_func)(void *, void *);
+
+// Linear probe map for tables that are read much more often than
+// they are updated. Lookups never lock or wait, and any number of
+// threads can do them while a writer updates the table. Writers take
+// a lock, so only one updates the table at a time.
+//
+// Bins point to entries that never change once a reader can see
+// them. An update installs a new entry, and a resize builds a new
+// bin array and swaps it in. Old entries and arrays are freed after a
+// grace period, when no reader can still see them. This also means
+// replaced or deleted keys and values are destroyed some time after
+// the update, and a value you got from lookup can be destroyed if
+// another thread replaces or deletes its key.
+
+struct hash_map {
+    _Atomic(struct bins *) table;
+
+    // Only writers use these, holding the lock
+    pthread_mutex_t write_lock;
+    uint32_t used;
+    uint32_t active;
+    struct entry *retired;
+    uint32_t no_retired;
+
+    hash_func hash;
+    compare_func key_cmp;
+    destructor_func key_destructor;
+    destructor_func val_destructor;
+};
+
+struct hash_map *
+new_map           (uint32_t size, // Must be a power of two!
+                   hash_func hash,
+                   compare_func key_cmp,
+                   destructor_func key_destructor,
+                   destructor_func val_destructor);
+void  delete_map  (struct hash_map *table);
+
+void  map          (struct hash_map *table,
+                    void *key, void *val);
+void *lookup       (struct hash_map *table, void *key);
+bool  contains_key (struct hash_map *table, void *key);
+void  delete_key   (struct hash_map *table, void *key);
+
+#endif /* hash_map_h */
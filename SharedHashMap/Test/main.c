@@ -0,0 +1,156 @@
+//
+//  main.c
+//  Test
+//
+//  Created by Thomas Mailund on 19/10/2026.
+//  Copyright © 2026 Thomas Mailund. All rights reserved.
+//
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include "hash_map.h"
+
+#define NO_KEYS 10000
+
+// Keys and values are the decimal strings of i and 3 * i
+static uint32_t key_string(char *buffer, int i)
+{
+    return (uint32_t)sprintf(buffer, "%d", i);
+}
+
+static void map_key(struct hash_map *table, int i)
+{
+    char key[16], val[16];
+    uint32_t key_len = key_string(key, i);
+    uint32_t val_len = key_string(val, 3 * i);
+    assert(map(table, key, key_len, val, val_len));
+}
+
+static bool has_key(struct hash_map *table, int i)
+{
+    char key[16], val[16];
+    uint32_t key_len = key_string(key, i);
+    uint32_t val_len = key_string(val, 3 * i);
+    uint32_t found_len;
+    const void *found = lookup(table, key, key_len, &found_len);
+    if (!found) return false;
+    assert(found_len == val_len);
+    assert(memcmp(found, val, val_len) == 0);
+    return true;
+}
+
+static void wait_for_child(pid_t pid)
+{
+    int status;
+    assert(waitpid(pid, &status, 0) == pid);
+    assert(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+}
+
+int main(int argc, const char *argv[])
+{
+    struct hash_map *table = new_map(1 << 15, 1 << 20);
+    assert(table);
+    for (int i = 0; i < NO_KEYS; ++i) {
+        map_key(table, i);
+    }
+    assert(no_keys(table) == NO_KEYS);
+    for (int i = 0; i < NO_KEYS; ++i) {
+        assert(has_key(table, i));
+    }
+    assert(!has_key(table, NO_KEYS));
+    delete_key(table, "", 0); // not there
+    for (int i = 0; i < NO_KEYS; i += 2) {
+        char key[16];
+        delete_key(table, key, key_string(key, i));
+    }
+    assert(no_keys(table) == NO_KEYS / 2);
+    for (int i = 0; i < NO_KEYS; ++i) {
+        assert(has_key(table, i) == (i % 2 == 1));
+    }
+
+    // Replacing a value
+    const void *val; uint32_t val_len;
+    assert(map(table, "1", 1, "one", 3));
+    val = lookup(table, "1", 1, &val_len);
+    assert(val_len == 3 && memcmp(val, "one", 3) == 0);
+    assert(no_keys(table) == NO_KEYS / 2);
+
+    // Another process attaches and adds the even keys back, while we
+    // look for them.
+    pid_t pid = fork();
+    if (pid == 0) {
+        struct hash_map *child_table = attach_map(map_fd(table));
+        assert(child_table);
+        for (int i = 0; i < NO_KEYS; i += 2) {
+            map_key(child_table, i);
+        }
+        detach_map(child_table);
+        _exit(EXIT_SUCCESS);
+    }
+    for (int i = 0; i < NO_KEYS; i += 2) {
+        while (!has_key(table, i))
+            ;
+    }
+    wait_for_child(pid);
+    assert(no_keys(table) == NO_KEYS);
+
+    // A process that only has the descriptor
+    struct hash_map *other = attach_map(map_fd(table));
+    assert(other);
+    assert(other->header != table->header);
+    for (int i = 2; i < NO_KEYS; ++i) {
+        assert(has_key(other, i));
+    }
+    detach_map(other);
+    detach_map(table);
+
+    // The map is full when half the bins are used, or when the heap is
+    table = new_map(16, 1 << 20);
+    for (int i = 0; i < 8; ++i) {
+        map_key(table, i);
+    }
+    char key[16];
+    uint32_t key_len = key_string(key, 8);
+    assert(!map(table, key, key_len, "", 0));
+    detach_map(table);
+    table = new_map(16, 64);
+    assert(map(table, "a", 1, "b", 1));
+    assert(!map(table, "0123456789012345678901234567890123456789", 40, "", 0));
+    detach_map(table);
+
+    // Named maps
+    char name[64];
+    sprintf(name, "/hash_map_test.%d", (int)getpid());
+    // A map we cannot make does not leave its name behind
+    assert(!new_named_map(name, 1024, (uint64_t)1 << 63));
+    table = new_named_map(name, 1024, 1 << 16);
+    assert(table);
+    assert(!new_named_map(name, 1024, 1 << 16));
+    map_key(table, 42);
+    other = attach_named_map(name);
+    assert(other && has_key(other, 42));
+    detach_map(other);
+    detach_map(table);
+    shm_unlink(name);
+
+    // A file with the magic but no bins is not a map
+    char path[] = "/tmp/shared_mapXXXXXX";
+    int fd = mkstemp(path);
+    char bytes[4096];
+    memset(bytes, 0, sizeof(bytes));
+    memcpy(bytes, "SHMAP001", 8);
+    assert(write(fd, bytes, sizeof(bytes)) == sizeof(bytes));
+    assert(!attach_map(fd));
+    close(fd);
+    unlink(path);
+
+    printf("SUCCESS\n");
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,398 @@
+//
+//  hash_map.c
+//  SharedHashMap
+//
+//  Created by Thomas Mailund on 19/10/2026.
+//  Copyright © 2026 Thomas Mailund. All rights reserved.
+//
+
+#ifdef __linux__
+#define _GNU_SOURCE // for memfd_create
+#endif
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "hash_map.h"
+
+#define MAGIC "SHMAP001"
+
+enum bin_state {
+    FREE = 0, // the file starts out zero, so all bins are free
+    DELETED,
+    ACTIVE
+};
+
+struct shared_bin {
+    _Atomic uint32_t state;
+    _Atomic uint32_t hash_key;
+    _Atomic uint64_t entry; // offset into the heap
+};
+
+// An entry in the heap: the lengths, then the key bytes, then the
+// value bytes. Entries and values start at multiples of eight.
+struct entry {
+    uint32_t key_len;
+    uint32_t val_len;
+    uint8_t bytes[];
+};
+
+struct shared_header {
+    char magic[8];
+    uint32_t size;
+    uint64_t bins_offset;
+    uint64_t heap_offset;
+    uint64_t heap_bytes;
+
+    // Only writers change these, holding the lock
+    pthread_mutex_t lock;
+    _Atomic uint32_t used;
+    _Atomic uint32_t active;
+    _Atomic uint64_t heap_used;
+};
+
+static uint64_t align8(uint64_t x)
+{
+    return (x + 7) & ~(uint64_t)7;
+}
+
+static uint64_t align64(uint64_t x)
+{
+    return (x + 63) & ~(uint64_t)63;
+}
+
+// The finaliser from MurmurHash3
+static uint64_t mix(uint64_t x)
+{
+    x ^= x >> 33;
+    x *= 0xff51afd7ed558ccd;
+    x ^= x >> 33;
+    x *= 0xc4ceb9fe1a85ec53;
+    x ^= x >> 33;
+    return x;
+}
+
+// The processes cannot share hash functions, so the map hashes the
+// key bytes itself.
+static uint32_t hash_bytes(const void *key, uint32_t len)
+{
+    const uint8_t *bytes = (const uint8_t *)key;
+    uint64_t h = len, w;
+    uint32_t i = 0;
+    for (; i + 8 <= len; i += 8) {
+        memcpy(&w, bytes + i, 8);
+        h = mix(h ^ w);
+    }
+    w = 0;
+    memcpy(&w, bytes + i, len - i);
+    return (uint32_t)mix(h ^ w);
+}
+
+static uint32_t
+p(uint32_t k, uint32_t i, uint32_t m)
+{
+    return (k + i) & (m - 1);
+}
+
+static struct entry *get_entry(struct hash_map *table, uint64_t offset)
+{
+    return (struct entry *)(table->heap + offset);
+}
+
+static const uint8_t *entry_val(struct entry *entry)
+{
+    return entry->bytes + align8(entry->key_len);
+}
+
+#pragma mark shared memory
+
+// The file comes from another process, so we check that the bins and
+// the heap are inside it before we use them.
+static bool valid_header(const struct shared_header *header, uint64_t bytes)
+{
+    return memcmp(header->magic, MAGIC, sizeof(header->magic)) == 0 &&
+           header->size && (header->size & (header->size - 1)) == 0 &&
+           header->bins_offset >= sizeof(struct shared_header) &&
+           header->bins_offset + (uint64_t)header->size * sizeof(struct shared_bin)
+               <= header->heap_offset &&
+           header->heap_offset <= bytes &&
+           header->heap_bytes <= bytes - header->heap_offset &&
+           atomic_load(&header->heap_used) <= header->heap_bytes;
+}
+
+static struct hash_map *map_file(int fd)
+{
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size < sizeof(struct shared_header))
+        return 0;
+    void *data = mmap(0, st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (data == MAP_FAILED) return 0;
+
+    struct shared_header *header = (struct shared_header *)data;
+    if (!valid_header(header, st.st_size)) {
+        munmap(data, st.st_size);
+        return 0;
+    }
+
+    struct hash_map *table = (struct hash_map *)malloc(sizeof(struct hash_map));
+    table->header = header;
+    table->bins = (struct shared_bin *)((uint8_t *)data + header->bins_offset);
+    table->heap = (uint8_t *)data + header->heap_offset;
+    table->fd = fd;
+    table->bytes = st.st_size;
+    return table;
+}
+
+static struct hash_map *init_map(int fd, uint32_t size, uint64_t heap_bytes)
+{
+    uint64_t bins_offset = align64(sizeof(struct shared_header));
+    uint64_t heap_offset = align64(bins_offset + (uint64_t)size * sizeof(struct shared_bin));
+    uint64_t bytes = heap_offset + heap_bytes;
+    // The new file is all zeros, so all bins are free
+    if (ftruncate(fd, bytes) != 0) return 0;
+    void *data = mmap(0, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (data == MAP_FAILED) return 0;
+
+    struct shared_header *header = (struct shared_header *)data;
+    header->size = size;
+    header->bins_offset = bins_offset;
+    header->heap_offset = heap_offset;
+    header->heap_bytes = heap_bytes;
+    atomic_init(&header->used, 0);
+    atomic_init(&header->active, 0);
+    atomic_init(&header->heap_used, 0);
+
+    pthread_mutexattr_t attr;
+    pthread_mutexattr_init(&attr);
+    pthread_mutexattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
+#ifdef __linux__
+    // If a writer dies holding the lock, the next writer gets it
+    pthread_mutexattr_setrobust(&attr, PTHREAD_MUTEX_ROBUST);
+#endif
+    pthread_mutex_init(&header->lock, &attr);
+    pthread_mutexattr_destroy(&attr);
+
+    // Last, so nobody attaches to a half-initialised map
+    memcpy(header->magic, MAGIC, sizeof(header->magic));
+    munmap(data, bytes);
+
+    return map_file(fd);
+}
+
+struct hash_map *new_map(uint32_t size, uint64_t heap_bytes)
+{
+#ifdef __linux__
+    int fd = memfd_create("hash_map", 0);
+#else
+    // Without memfd we make a named object and remove the name at once
+    static _Atomic uint32_t counter;
+    char name[64];
+    snprintf(name, sizeof(name), "/hash_map.%d.%u",
+             (int)getpid(), atomic_fetch_add(&counter, 1));
+    int fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600);
+    if (fd >= 0) shm_unlink(name);
+#endif
+    if (fd < 0) return 0;
+    struct hash_map *table = init_map(fd, size, heap_bytes);
+    if (!table) close(fd);
+    return table;
+}
+
+struct hash_map *new_named_map(const char *name,
+                               uint32_t size, uint64_t heap_bytes)
+{
+    int fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600);
+    if (fd < 0) return 0;
+    struct hash_map *table = init_map(fd, size, heap_bytes);
+    if (!table) {
+        // Remove the half-made object, so the name can be used again
+        close(fd);
+        shm_unlink(name);
+    }
+    return table;
+}
+
+struct hash_map *attach_map(int fd)
+{
+    // The map gets its own descriptor, so detaching does not close yours
+    int own_fd = dup(fd);
+    if (own_fd < 0) return 0;
+    struct hash_map *table = map_file(own_fd);
+    if (!table) close(own_fd);
+    return table;
+}
+
+struct hash_map *attach_named_map(const char *name)
+{
+    int fd = shm_open(name, O_RDWR, 0);
+    if (fd < 0) return 0;
+    struct hash_map *table = map_file(fd);
+    if (!table) close(fd);
+    return table;
+}
+
+void detach_map(struct hash_map *table)
+{
+    munmap(table->header, table->bytes);
+    close(table->fd);
+    free(table);
+}
+
+int map_fd(struct hash_map *table)
+{
+    return table->fd;
+}
+
+#pragma mark map
+
+static void lock_writer(struct shared_header *header)
+{
+    // A writer that dies leaves the map consistent, since every
+    // change is published with a single store, so we can carry on.
+    if (pthread_mutex_lock(&header->lock) == EOWNERDEAD) {
+#ifdef __linux__
+        pthread_mutex_consistent(&header->lock);
+#endif
+    }
+}
+
+static void unlock_writer(struct shared_header *header)
+{
+    pthread_mutex_unlock(&header->lock);
+}
+
+// Returns the index of the key's bin, or size if the key is not
+// there. The bin can change under readers, so we also give them the
+// entry we found.
+static uint32_t find_bin(struct hash_map *table, uint32_t hash_key,
+                         const void *key, uint32_t key_len,
+                         struct entry **found)
+{
+    uint32_t size = table->header->size;
+    for (uint32_t i = 0; i < size; ++i) {
+        uint32_t index = p(hash_key, i, size);
+        struct shared_bin *bin = &table->bins[index];
+        uint32_t state = atomic_load_explicit(&bin->state, memory_order_acquire);
+        if (state == FREE)
+            return size;
+        if (state != ACTIVE ||
+            atomic_load_explicit(&bin->hash_key, memory_order_relaxed) != hash_key)
+            continue;
+        struct entry *entry =
+        get_entry(table, atomic_load_explicit(&bin->entry, memory_order_acquire));
+        if (entry->key_len == key_len && memcmp(entry->bytes, key, key_len) == 0) {
+            if (found) *found = entry;
+            return index;
+        }
+    }
+    return size;
+}
+
+bool map(struct hash_map *table,
+         const void *key, uint32_t key_len,
+         const void *val, uint32_t val_len)
+{
+    struct shared_header *header = table->header;
+    uint32_t size = header->size;
+    uint32_t hash_key = hash_bytes(key, key_len);
+    uint64_t entry_bytes =
+    sizeof(struct entry) + align8(key_len) + align8(val_len);
+
+    lock_writer(header);
+    uint64_t offset = atomic_load_explicit(&header->heap_used, memory_order_relaxed);
+    if (offset + entry_bytes > header->heap_bytes) {
+        unlock_writer(header);
+        return false;
+    }
+
+    uint32_t index = find_bin(table, hash_key, key, key_len, 0);
+    bool new_key = index == size;
+    if (new_key) {
+        // The first free or deleted bin on the probe
+        for (uint32_t i = 0; i < size; ++i) {
+            uint32_t j = p(hash_key, i, size);
+            uint32_t state = atomic_load_explicit(&table->bins[j].state,
+                                                  memory_order_relaxed);
+            if (state == ACTIVE) continue;
+            if (state == FREE && atomic_load(&header->used) + 1 > size / 2)
+                break; // the map is full
+            index = j;
+            break;
+        }
+        if (index == size) {
+            unlock_writer(header);
+            return false;
+        }
+    }
+
+    // Readers cannot see the entry until a bin points to it
+    struct entry *entry = get_entry(table, offset);
+    entry->key_len = key_len;
+    entry->val_len = val_len;
+    memcpy(entry->bytes, key, key_len);
+    memcpy((uint8_t *)entry_val(entry), val, val_len);
+    atomic_store_explicit(&header->heap_used, offset + entry_bytes,
+                          memory_order_relaxed);
+
+    struct shared_bin *bin = &table->bins[index];
+    if (new_key) {
+        if (atomic_load_explicit(&bin->state, memory_order_relaxed) == FREE)
+            atomic_fetch_add(&header->used, 1);
+        atomic_fetch_add(&header->active, 1);
+        atomic_store_explicit(&bin->hash_key, hash_key, memory_order_relaxed);
+        // A reader that saw the bin active before it was deleted can
+        // still load the entry, so it must see the entry's bytes.
+        atomic_store_explicit(&bin->entry, offset, memory_order_release);
+        atomic_store_explicit(&bin->state, ACTIVE, memory_order_release);
+    } else {
+        atomic_store_explicit(&bin->entry, offset, memory_order_release);
+    }
+
+    unlock_writer(header);
+    return true;
+}
+
+const void *lookup(struct hash_map *table,
+                   const void *key, uint32_t key_len,
+                   uint32_t *val_len)
+{
+    uint32_t hash_key = hash_bytes(key, key_len);
+    struct entry *entry;
+    if (find_bin(table, hash_key, key, key_len, &entry) == table->header->size)
+        return 0;
+    if (val_len) *val_len = entry->val_len;
+    return entry_val(entry);
+}
+
+bool contains_key(struct hash_map *table,
+                  const void *key, uint32_t key_len)
+{
+    return lookup(table, key, key_len, 0) != 0;
+}
+
+void delete_key(struct hash_map *table,
+                const void *key, uint32_t key_len)
+{
+    struct shared_header *header = table->header;
+    uint32_t hash_key = hash_bytes(key, key_len);
+
+    lock_writer(header);
+    uint32_t index = find_bin(table, hash_key, key, key_len, 0);
+    if (index != header->size) {
+        atomic_store_explicit(&table->bins[index].state, DELETED,
+                              memory_order_release);
+        atomic_fetch_sub(&header->active, 1);
+    }
+    unlock_writer(header);
+}
+
+uint32_t no_keys(struct hash_map *table)
+{
+    return atomic_load(&table->header->active);
+}
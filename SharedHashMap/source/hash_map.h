@@ -0,0 +1,72 @@
+//
+//  hash_map.h
+//  SharedHashMap
+//
+//  Created by Thomas Mailund on 19/10/2026.
+//  Copyright © 2026 Thomas Mailund. All rights reserved.
+//
+
+#ifndef hash_map_h
+#define hash_map_h
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// Linear probe map that lives in a shared memory file, so several
+// processes can map the same copy. Pointers mean nothing in another
+// process, so the map stores copies of the bytes of keys and values
+// in a heap in the same file, and the bins refer to them by offsets.
+//
+// One process at a time updates the map; writers take a lock that
+// lives in the shared memory. Lookups do not lock. Writers change a
+// bin with a single atomic store once the entry it points to is
+// written, so a lookup sees either the old or the new entry.
+//
+// The map cannot grow, since other processes have it mapped, so you
+// choose the number of bins and the heap size when you create it.
+// Entries are never changed or freed once written, so when you
+// replace or delete a key, its old bytes stay in the heap, and values
+// you get from lookup stay valid for as long as you have the map.
+
+struct hash_map {
+    struct shared_header *header;
+    struct shared_bin *bins;
+    uint8_t *heap;
+    int fd;
+    uint64_t bytes;
+};
+
+// Creates a map in an anonymous shared memory file. Other processes
+// attach to it through the file descriptor, which they inherit with
+// fork() or get over a Unix socket.
+struct hash_map *
+new_map           (uint32_t size, // Must be a power of two!
+                   uint64_t heap_bytes);
+// Creates a map in a named shared memory object (see shm_open).
+struct hash_map *
+new_named_map     (const char *name,
+                   uint32_t size, // Must be a power of two!
+                   uint64_t heap_bytes);
+// Return null if the file is not a shared map.
+struct hash_map *attach_map      (int fd);
+struct hash_map *attach_named_map(const char *name);
+// Unmaps the map. The memory is freed when no process has it mapped
+// (and, for named maps, when the name is removed with shm_unlink).
+void  detach_map   (struct hash_map *table);
+int   map_fd       (struct hash_map *table);
+
+// Returns false if the map has no room for the key and value.
+bool  map          (struct hash_map *table,
+                    const void *key, uint32_t key_len,
+                    const void *val, uint32_t val_len);
+// Returns a pointer to the value bytes in the shared memory, or null.
+const void *lookup (struct hash_map *table,
+                    const void *key, uint32_t key_len,
+                    uint32_t *val_len);
+bool  contains_key (struct hash_map *table,
+                    const void *key, uint32_t key_len);
+void  delete_key   (struct hash_map *table,
+                    const void *key, uint32_t key_len);
+uint32_t no_keys   (struct hash_map *table);
+
+#endif /* hash_map_h */
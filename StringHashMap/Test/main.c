@@ -0,0 +1,146 @@
+//
+//  main.c
+//  Test
+//
+//  Created by Thomas Mailund on 19/10/2026.
+//  Copyright © 2026 Thomas Mailund. All rights reserved.
+//
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include "hash_map.h"
+
+#define NO_KEYS 20000
+
+// Keys of length 0 to 39, so some are inline and some in the arena,
+// with the number spelled out at the end so they all differ.
+static uint32_t key_string(char *buffer, int i)
+{
+    char number[16];
+    int n = sprintf(number, "%d", i);
+    int len = i % 40 < n ? n : i % 40;
+    memset(buffer, 'k', len - n);
+    memcpy(buffer + len - n, number, n + 1);
+    return (uint32_t)len;
+}
+
+static int no_destroyed;
+
+static void count_destroyed(void *val)
+{
+    no_destroyed++;
+}
+
+struct sum {
+    uint32_t no_keys;
+    uint64_t total;
+};
+
+static void sum_vals(const char *key, uint32_t len, void *val, void *data)
+{
+    struct sum *sum = (struct sum *)data;
+    assert(strlen(key) == len);
+    sum->no_keys++;
+    sum->total += (uint64_t)(uintptr_t)val;
+}
+
+int main(int argc, const char *argv[])
+{
+    char key[64];
+    struct hash_map *table = new_map(2, count_destroyed);
+
+    for (int i = 0; i < NO_KEYS; ++i) {
+        map(table, key, key_string(key, i), (void *)(uintptr_t)(i + 1));
+    }
+    assert(table->active == NO_KEYS);
+    assert(table->arena_used > 0);
+    for (int i = 0; i < NO_KEYS; ++i) {
+        uint32_t len = key_string(key, i);
+        assert(contains_key(table, key, len));
+        assert(lookup(table, key, len) == (void *)(uintptr_t)(i + 1));
+    }
+    // A prefix of a key is a different key
+    uint32_t len = key_string(key, 39);
+    assert(!contains_key(table, key, len - 1));
+    assert(!contains_key(table, "", 0));
+
+    // Lengths past MAX_KEY_LEN would look like free or deleted bins.
+    // We never read the bytes of such keys, so any pointer will do.
+    assert(!map(table, key, UINT32_MAX, 0));
+    assert(!map(table, key, MAX_KEY_LEN + 1, 0));
+    assert(!contains_key(table, key, UINT32_MAX));
+    assert(lookup(table, key, MAX_KEY_LEN + 1) == 0);
+    delete_key(table, key, UINT32_MAX);
+    assert(table->active == NO_KEYS);
+
+    // Replacing a value destroys the old one but keeps the key
+    uint64_t arena_used = table->arena_used;
+    map(table, key, len, (void *)(uintptr_t)40);
+    assert(no_destroyed == 1);
+    assert(table->active == NO_KEYS);
+    assert(table->arena_used == arena_used);
+    assert(lookup(table, key, len) == (void *)(uintptr_t)40);
+
+    // The empty key and keys with '\0' in them
+    map(table, "", 0, (void *)(uintptr_t)1);
+    map(table, "a\0b", 3, (void *)(uintptr_t)2);
+    map(table, "a\0c", 3, (void *)(uintptr_t)3);
+    assert(lookup(table, "", 0) == (void *)(uintptr_t)1);
+    assert(lookup(table, "a\0b", 3) == (void *)(uintptr_t)2);
+    assert(lookup(table, "a\0c", 3) == (void *)(uintptr_t)3);
+    assert(!contains_key(table, "a", 1));
+    delete_key(table, "", 0);
+    delete_key(table, "a\0b", 3);
+    delete_key(table, "a\0c", 3);
+    assert(!contains_key(table, "", 0));
+    no_destroyed = 0;
+
+    struct sum sum = { 0, 0 };
+    for_each(table, sum_vals, &sum);
+    assert(sum.no_keys == NO_KEYS);
+    assert(sum.total == (uint64_t)NO_KEYS * (NO_KEYS + 1) / 2);
+
+    // Deleting most of the keys shrinks the table, and the arena gets
+    // rid of the deleted keys.
+    for (int i = 0; i < NO_KEYS; ++i) {
+        if (i % 10 == 0) continue;
+        delete_key(table, key, key_string(key, i));
+    }
+    assert(no_destroyed == NO_KEYS - NO_KEYS / 10);
+    assert(table->active == NO_KEYS / 10);
+    assert(table->arena_used < arena_used / 2);
+    for (int i = 0; i < NO_KEYS; ++i) {
+        uint32_t len = key_string(key, i);
+        assert(contains_key(table, key, len) == (i % 10 == 0));
+        if (i % 10 == 0)
+            assert(lookup(table, key, len) == (void *)(uintptr_t)(i + 1));
+    }
+
+    // Deleting and adding long keys in a table that does not resize
+    // does not grow the arena for ever.
+    struct hash_map *churn = new_map(1024, count_destroyed);
+    char long_key[64];
+    memset(long_key, 'x', sizeof(long_key));
+    for (int i = 0; i < 100000; ++i) {
+        sprintf(long_key + 40, "%08d", i % 300);
+        map(churn, long_key, 48, 0);
+        if (i >= 100) {
+            sprintf(long_key + 40, "%08d", (i - 100) % 300);
+            delete_key(churn, long_key, 48);
+        }
+    }
+    assert(churn->active == 100);
+    assert(churn->arena_size < 100 * 49 * 16);
+    delete_map(churn);
+
+    no_destroyed = 0;
+    delete_map(table);
+    assert(no_destroyed == NO_KEYS / 10);
+
+    printf("SUCCESS\n");
+
+    return EXIT_SUCCESS;
+}
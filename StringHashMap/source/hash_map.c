@@ -0,0 +1,254 @@
+//
+//  hash_map.c
+//  StringHashMap
+//
+//  Created by Thomas Mailund on 19/10/2026.
+//  Copyright © 2026 Thomas Mailund. All rights reserved.
+//
+
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include "hash_map.h"
+#include "hash_strings.h"
+
+// Markers in the length field
+#define FREE UINT32_MAX
+#define DELETED (UINT32_MAX - 1)
+
+// 32 bytes, so two bins share a cache line
+struct bin {
+    uint32_t hash_key;
+    uint32_t len; // of the key, or FREE or DELETED
+    union {
+        char bytes[INLINE_KEY_BYTES + 1];
+        uint64_t offset; // in the arena
+    } key;
+    void *val;
+};
+
+static uint32_t
+p(uint32_t k, uint32_t i, uint32_t m)
+{
+    return (k + i) & (m - 1);
+}
+
+// jenkins_hash takes an int length, so we hash longer keys in pieces
+#define HASH_PIECE (1 << 30)
+
+static uint32_t hash_string(const char *key, uint32_t len)
+{
+    uint32_t hash_key = 0;
+    for (; len > INT_MAX; key += HASH_PIECE, len -= HASH_PIECE)
+        hash_key = jenkins_hash(hash_key, (char *)key, HASH_PIECE);
+    return jenkins_hash(hash_key, (char *)key, (int)len);
+}
+
+static bool is_live(struct bin *bin)
+{
+    return bin->len != FREE && bin->len != DELETED;
+}
+
+static struct bin *new_bins(uint32_t size)
+{
+    struct bin *bins = (struct bin *)malloc(size * sizeof(struct bin));
+    // All lengths FREE
+    memset(bins, 0xff, size * sizeof(struct bin));
+    return bins;
+}
+
+#pragma mark keys
+
+static const char *key_bytes(struct hash_map *table, struct bin *bin)
+{
+    return bin->len <= INLINE_KEY_BYTES ? bin->key.bytes : table->arena + bin->key.offset;
+}
+
+static bool bin_has_key(struct hash_map *table, struct bin *bin,
+                        uint32_t hash_key, const char *key, uint32_t len)
+{
+    return bin->hash_key == hash_key && bin->len == len &&
+    memcmp(key_bytes(table, bin), key, len) == 0;
+}
+
+static uint64_t add_to_arena(struct hash_map *table, const char *key, uint32_t len)
+{
+    uint64_t needed = table->arena_used + len + 1;
+    if (needed > table->arena_size) {
+        uint64_t size = table->arena_size ? 2 * table->arena_size : 4096;
+        while (size < needed) size *= 2;
+        table->arena = (char *)realloc(table->arena, size);
+        table->arena_size = size;
+    }
+    uint64_t offset = table->arena_used;
+    memcpy(table->arena + offset, key, len);
+    table->arena[offset + len] = '\0';
+    table->arena_used = needed;
+    return offset;
+}
+
+static void set_key(struct hash_map *table, struct bin *bin,
+                    uint32_t hash_key, const char *key, uint32_t len)
+{
+    bin->hash_key = hash_key;
+    bin->len = len;
+    if (len <= INLINE_KEY_BYTES) {
+        memcpy(bin->key.bytes, key, len);
+        bin->key.bytes[len] = '\0';
+    } else {
+        bin->key.offset = add_to_arena(table, key, len);
+    }
+}
+
+#pragma mark resizing
+
+// Moves the bins without hashing the keys again. If most of the arena
+// is deleted keys, we copy the live keys to a new arena as we go.
+static void resize(struct hash_map *table, uint32_t new_size)
+{
+    struct bin *old_bins = table->table;
+    uint32_t old_size = table->size;
+    char *old_arena = table->arena;
+    bool compact = table->arena_garbage > table->arena_used / 2;
+    if (compact) {
+        table->arena = 0;
+        table->arena_used = table->arena_size = table->arena_garbage = 0;
+    }
+
+    table->table = new_bins(new_size);
+    table->size = new_size;
+    table->used = table->active;
+
+    for (uint32_t i = 0; i < old_size; ++i) {
+        struct bin *old_bin = &old_bins[i];
+        if (!is_live(old_bin)) continue;
+        struct bin *bin;
+        for (uint32_t j = 0; ; ++j) {
+            bin = &table->table[p(old_bin->hash_key, j, new_size)];
+            if (bin->len == FREE) break;
+        }
+        *bin = *old_bin;
+        if (compact && bin->len > INLINE_KEY_BYTES)
+            bin->key.offset = add_to_arena(table, old_arena + old_bin->key.offset, bin->len);
+    }
+
+    free(old_bins);
+    if (compact) free(old_arena);
+}
+
+#pragma mark map
+
+struct hash_map *new_map(uint32_t size, destructor_func val_destructor)
+{
+    struct hash_map *table =
+    (struct hash_map *)malloc(sizeof(struct hash_map));
+    table->table = new_bins(size);
+    table->size = size;
+    table->active = table->used = 0;
+    table->arena = 0;
+    table->arena_used = table->arena_size = table->arena_garbage = 0;
+    table->val_destructor = val_destructor;
+    return table;
+}
+
+void delete_map(struct hash_map *table)
+{
+    for (uint32_t i = 0; i < table->size; ++i) {
+        if (is_live(&table->table[i]))
+            table->val_destructor(table->table[i].val);
+    }
+    free(table->table);
+    free(table->arena);
+    free(table);
+}
+
+bool map(struct hash_map *table, const char *key, uint32_t len, void *val)
+{
+    if (len > MAX_KEY_LEN) return false;
+    uint32_t hash_key = hash_string(key, len);
+    struct bin *deleted = 0;
+    for (uint32_t i = 0; i < table->size; ++i) {
+        struct bin *bin = &table->table[p(hash_key, i, table->size)];
+        if (bin->len == FREE) {
+            // The key is not here. We reuse the first deleted bin we
+            // saw, if there was one.
+            if (deleted) {
+                bin = deleted;
+            } else {
+                table->used++;
+            }
+            set_key(table, bin, hash_key, key, len);
+            bin->val = val;
+            table->active++;
+            break;
+        }
+        if (bin->len == DELETED) {
+            if (!deleted) deleted = bin;
+            continue;
+        }
+        if (bin_has_key(table, bin, hash_key, key, len)) {
+            table->val_destructor(bin->val);
+            bin->val = val;
+            return true;
+        }
+    }
+
+    if (table->used > table->size / 2)
+        resize(table, table->size * 2);
+    return true;
+}
+
+static struct bin *find_bin(struct hash_map *table, const char *key, uint32_t len)
+{
+    if (len > MAX_KEY_LEN) return 0;
+    uint32_t hash_key = hash_string(key, len);
+    for (uint32_t i = 0; i < table->size; ++i) {
+        struct bin *bin = &table->table[p(hash_key, i, table->size)];
+        if (bin->len == FREE)
+            return 0;
+        if (bin_has_key(table, bin, hash_key, key, len))
+            return bin;
+    }
+    return 0;
+}
+
+void *lookup(struct hash_map *table, const char *key, uint32_t len)
+{
+    struct bin *bin = find_bin(table, key, len);
+    return bin ? bin->val : 0;
+}
+
+bool contains_key(struct hash_map *table, const char *key, uint32_t len)
+{
+    return find_bin(table, key, len) != 0;
+}
+
+void delete_key(struct hash_map *table, const char *key, uint32_t len)
+{
+    struct bin *bin = find_bin(table, key, len);
+    if (!bin) return;
+
+    table->val_destructor(bin->val);
+    if (bin->len > INLINE_KEY_BYTES)
+        table->arena_garbage += bin->len + 1;
+    bin->len = DELETED;
+    table->active--;
+
+    if (table->active < table->size / 8) {
+        resize(table, table->size / 2);
+    } else if (table->arena_garbage > table->arena_used / 2 &&
+               table->arena_garbage > (uint64_t)table->size * sizeof(struct bin)) {
+        // Enough deleted keys that it pays to move the bins just to
+        // get rid of them.
+        resize(table, table->size);
+    }
+}
+
+void for_each(struct hash_map *table, for_each_func f, void *data)
+{
+    for (uint32_t i = 0; i < table->size; ++i) {
+        struct bin *bin = &table->table[i];
+        if (is_live(bin))
+            f(key_bytes(table, bin), bin->len, bin->val, data);
+    }
+}
@@ -0,0 +1,72 @@
+//
+//  hash_map.h
+//  StringHashMap
+//
+//  Created by Thomas Mailund on 19/10/2026.
+//  Copyright © 2026 Thomas Mailund. All rights reserved.
+//
+
+#ifndef hash_map_h
+#define hash_map_h
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// Linear probe map from byte-string keys to void pointers. The map
+// copies the keys, so you do not allocate one string per key and you
+// do not need hash or compare functions. We hash a key once, with
+// jenkins_hash from HashFunctions, and keep the hash and the length
+// in its bin, so we only compare the bytes of keys that have both
+// the same hash and the same length.
+//
+// Keys of up to INLINE_KEY_BYTES bytes live in the bin itself. Longer
+// keys go in an arena the map owns, where we only ever add to the
+// end. Deleted keys stay in the arena until they take up more than
+// half of it. Then the next resize copies the live keys to a new
+// arena, and if there are enough of them, we resize just for that.
+//
+// Keys are stored with a '\0' after them, so the keys for_each()
+// gives you are also C strings, unless they hold a '\0' themselves.
+
+#define INLINE_KEY_BYTES 15
+// The two largest lengths mark free and deleted bins, so keys must be
+// shorter than that.
+#define MAX_KEY_LEN (UINT32_MAX - 2)
+
+typedef void (*destructor_func)(void *);
+typedef void (*for_each_func)(const char *key, uint32_t len,
+                              void *val, void *data);
+
+struct bin;
+
+struct hash_map {
+    struct bin *table;
+    uint32_t size;
+    uint32_t used;
+    uint32_t active;
+
+    char *arena;
+    uint64_t arena_used, arena_size;
+    uint64_t arena_garbage; // bytes of deleted keys
+
+    destructor_func val_destructor;
+};
+
+struct hash_map *
+new_map           (uint32_t size, // Must be a power of two!
+                   destructor_func val_destructor);
+void  delete_map  (struct hash_map *table);
+
+// Returns false, and leaves the table alone, if len > MAX_KEY_LEN.
+// The other functions treat such keys as keys that are not there.
+bool  map          (struct hash_map *table,
+                    const char *key, uint32_t len, void *val);
+void *lookup       (struct hash_map *table, const char *key, uint32_t len);
+bool  contains_key (struct hash_map *table, const char *key, uint32_t len);
+void  delete_key   (struct hash_map *table, const char *key, uint32_t len);
+
+// The table must not change while you iterate over it, and the keys
+// f gets are only valid until it does.
+void  for_each     (struct hash_map *table, for_each_func f, void *data);
+
+#endif /* hash_map_h */